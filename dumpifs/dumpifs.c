@@ -17,6 +17,7 @@
 
 
 
+#define _GNU_SOURCE		// memmem()
 #include <lib/compat.h>
 
 #ifdef _NTO_HDR_DIR_
@@ -28,13 +29,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdarg.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
 #include <utime.h>
+#include <pthread.h>
+#include <getopt.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include _NTO_HDR_(sys/elf.h)
 #include _NTO_HDR_(sys/startup.h)
@@ -42,10 +50,16 @@
 
 #include <zlib.h>
 #include <lzo/lzo1x.h>
-#include <ucl/ucl.h>
 
 #include "xplatform.h"
 #include "md5.h"
+#include "sha2.h"
+#include "libifs/ifs_trace.h"
+#include "libifs/ifs_cksum.h"
+#include "libifs/ifs_copy.h"
+#include "libifs/ifs_image.h"
+#include "libifs/ifs_reader.h"
+#include "libifs/ifs_hash.h"
 
 
 #if defined(__MINGW32__)
@@ -59,10 +73,12 @@ unsigned flags;
 char **check_files;
 char *ucompress_file;
 int zero_check_enabled = 1;
+int errors;
 FILE *fp_bld;
 FILE *fp_bootstrap;
 
 int files_to_extract;
+int extract_jobs = 1;
 int files_left_to_extract;
 int processing_done;
 struct extract_file {
@@ -78,6 +94,10 @@ struct extract_file {
 #define FLAG_FIXUP_HEADER	0x00000020
 #define FLAG_EXTRACT_RAW	0x00000040
 #define FLAG_INO_NAME		0x00000080
+#define FLAG_VERIFY			0x00000100
+#define FLAG_DIFF			0x00000200
+#define FLAG_ARCHIVE		0x00000400
+#define FLAG_SCAN			0x00000800
 
 #define ENDIAN_RET32(x)		((((x) >> 24) & 0xff) | \
 							(((x) >> 8) & 0xff00) | \
@@ -99,12 +119,23 @@ void usage() {
 	printf(("\
 %s - dump an image file system\n\
 \n\
-%s	[-mvxbzc -u file] [-f file] image_file_system_file [files]\n\
+%s	[-mvxbzc -u file] [-f file] [-j n] [--hash=name] [--trace=file] [--verify]\n\
+	[--to-tar=file | --to-cpio=file] image_file_system_file [files]\n\
+%s	--diff [-j n] [--hash=name] old_image_file_system new_image_file_system [files]\n\
+%s	--scan image_file\n\
  -b       Extract to basenames of files\n\
+ -j n     Extract files with n parallel jobs. An LZO or UCL compressed\n\
+          image is uncompressed, -m hashes are computed and large files\n\
+          are searched with n threads (default one per CPU).\n\
  -u file  Put a copy of the uncompressed image file here\n\
  -v       Verbose\n\
- -x       Extract files\n\
+ -x       Extract files. With - as the image file system file, the image\n\
+          is read from stdin in one pass, compressed or not, so it can\n\
+          come straight from a pipe.\n\
  -m       Display MD5 Checksum\n\
+ --hash=md5|sha256|xxh3|blake3\n\
+          Display this hash of each file instead of MD5 (implies -m).\n\
+          xxh3 is not cryptographic, use it for change detection only.\n\
  -f file  Extract named file\n\
  -z       Disable the zero check while searching for the startup header.\n\
           This option should be avoided as it makes the search for the\n\
@@ -112,22 +143,88 @@ void usage() {
           Note: this may not be supported in the future.\n\
  -с       Perform checksum checking\n\
  -e       Fixup header of uncompressed file\n\
- -r       Extract raw content\n"), progname, progname);
+ -r       Extract raw content\n\
+ --verify Only check the startup and image checksums. The exit status\n\
+          is non-zero if either of them is bad.\n\
+ --diff   Compare two images without extracting them. Each difference is\n\
+          a line starting with A (added), D (deleted), M (contents\n\
+          changed), R (moved, the contents are the same) or T (attributes\n\
+          changed). Files are compared by size and hash, xxh3 unless\n\
+          --hash is given. The exit status is 1 if the images differ.\n\
+ --scan   List every image in the file (a flash dump, say): where its\n\
+          startup and image headers are, its size, compression, byte\n\
+          order, whether its checksums are good and which image it\n\
+          chains to.\n\
+ --image=n\n\
+          Use image n from the --scan list instead of the first one.\n\
+ --to-tar=file, --to-cpio=file\n\
+          Write the contents of the image to a tar (pax) or cpio (newc)\n\
+          archive instead of extracting them, - for stdout. Ownership,\n\
+          permissions, times, symlinks and devices are kept.\n\
+ --trace=file\n\
+          Write a Chrome trace (chrome://tracing, Perfetto) to file\n"), progname, progname, progname, progname);
 }
 
 void process(const char *file, FILE *fp);
+void process_stream(const char *file, FILE *fp);
 
 void display_shdr(FILE *fp, int spos, struct startup_header *hdr);
-void display_ihdr(FILE *fp, int ipos, struct image_header *hdr);
-void process_file(FILE *fp, int ipos, struct image_file *ent);
-void process_dir(FILE *fp, int ipos, struct image_dir *ent);
-void process_symlink(FILE *fp, int ipos, struct image_symlink *ent);
-void process_device(FILE *fp, int ipos, struct image_device *ent);
-void display_file(FILE *fp, int ipos, struct image_file *ent);
-void extract_file(FILE *fp, int ipos, const struct image_file *ent, int is_script);
+void display_ihdr(int ipos, struct image_header *hdr);
+void process_file(int ipos, struct image_file *ent);
+void process_dir(int ipos, struct image_dir *ent);
+void process_symlink(int ipos, struct image_symlink *ent);
+void process_device(int ipos, struct image_device *ent);
+void display_file(int ipos, struct image_file *ent);
+void extract_file(int ipos, const struct image_file *ent, int is_script);
+void extract_flush(void);
 
 #define MD5_LENGTH            16
-void compute_md5(FILE *fp, int ipos, struct image_file *ent, unsigned char md5_result[16]);
+#define HASH_MAX_LENGTH       32
+
+enum {
+	HASH_MD5,
+	HASH_SHA256,
+	HASH_XXH3,
+	HASH_BLAKE3
+};
+
+struct hash_method {
+	const char	*name;
+	unsigned	length;
+} hash_methods[] = {
+	{ "md5",	MD5_LENGTH },
+	{ "sha256",	SHA256_DIGEST_LENGTH },
+	{ "xxh3",	IFS_XXH3_SIZE },
+	{ "blake3",	IFS_BLAKE3_SIZE },
+};
+
+int hash_type = HASH_MD5;
+
+void hash_prepare(int ipos, int dpos, int cross);
+void hash_free(void);
+const unsigned char *file_hash(int ipos, struct image_file *ent, unsigned char *digest);
+
+void diff_add(const struct image_attr *attr, const char *path, uint32_t size,
+			uint32_t rdev, const char *target, const unsigned char *digest);
+int diff_report(void);
+int diff_side;
+
+enum {
+	ARCHIVE_TAR,
+	ARCHIVE_CPIO
+};
+
+const char *archive_name;
+int archive_format;
+void archive_open(void);
+void archive_add(const struct image_attr *attr, const char *path, uint32_t size,
+			uint32_t rdev, const char *target, long pos);
+void archive_close(void);
+
+void scan_images(const char *file, FILE *fp);
+long select_image(const char *file, FILE *fp, int index);
+int image_index = -1;
+long image_start = -1;
 
 int zero_ok (struct startup_header *shdr);
 
@@ -153,11 +250,36 @@ void error(int level, char *p, ...) {
 	if(level == 0) {
 		exit(EXIT_FAILURE);
 	}
+	errors++;
 }
 
+enum {
+	OPT_TRACE = 0x100,
+	OPT_VERIFY,
+	OPT_HASH,
+	OPT_DIFF,
+	OPT_TO_TAR,
+	OPT_TO_CPIO,
+	OPT_SCAN,
+	OPT_IMAGE
+};
+
+static const struct option long_opts[] = {
+	{ "trace",	required_argument,	NULL,	OPT_TRACE },
+	{ "verify",	no_argument,		NULL,	OPT_VERIFY },
+	{ "hash",	required_argument,	NULL,	OPT_HASH },
+	{ "diff",	no_argument,		NULL,	OPT_DIFF },
+	{ "to-tar",	required_argument,	NULL,	OPT_TO_TAR },
+	{ "to-cpio",	required_argument,	NULL,	OPT_TO_CPIO },
+	{ "scan",	no_argument,		NULL,	OPT_SCAN },
+	{ "image",	required_argument,	NULL,	OPT_IMAGE },
+	{ NULL }
+};
+
 int main(int argc, char *argv[]) {
 	int					c;
 	char				*image;
+	char				*image2 = NULL;
 	FILE				*fp = NULL;
 	char				*dest_dir_path = NULL;
 	int 				tfd = -1;
@@ -166,9 +288,49 @@ int main(int argc, char *argv[]) {
 
 	progname = basename(argv[0]);
 
-	while((c = getopt(argc, argv, "f:d:mvxbu:zcher")) != -1) {
+	while((c = getopt_long(argc, argv, "f:d:j:mvxbu:zcher", long_opts, NULL)) != -1) {
 		switch(c) {
 
+		case OPT_TRACE:
+			if(ifs_trace_open(optarg, "dumpifs") != 0) {
+				error(0, "Unable to open %s: %s", optarg, strerror(errno));
+			}
+			break;
+
+		case OPT_VERIFY:
+			flags |= (FLAG_VERIFY | FLAG_CHECK_CRC);
+			break;
+
+		case OPT_HASH:
+			for(hash_type = 0; strcmp(optarg, hash_methods[hash_type].name) != 0; ++hash_type) {
+				if(hash_type + 1 >= sizeof hash_methods / sizeof *hash_methods) {
+					error(0, "Unknown hash %s", optarg);
+				}
+			}
+			flags |= FLAG_MD5;
+			break;
+
+		case OPT_DIFF:
+			flags |= FLAG_DIFF;
+			break;
+
+		case OPT_TO_TAR:
+		case OPT_TO_CPIO:
+			archive_name = optarg;
+			archive_format = (c == OPT_TO_TAR) ? ARCHIVE_TAR : ARCHIVE_CPIO;
+			flags |= FLAG_ARCHIVE;
+			break;
+
+		case OPT_SCAN:
+			flags |= FLAG_SCAN;
+			break;
+
+		case OPT_IMAGE:
+			if((image_index = atoi(optarg)) < 0) {
+				error(0, "Invalid image number %s", optarg);
+			}
+			break;
+
 		case 'f':
 			ef = malloc( sizeof(*ef) );
 			if ( ef == NULL ) {
@@ -192,6 +354,12 @@ int main(int argc, char *argv[]) {
 			flags |= FLAG_EXTRACT;
 			break;
 
+		case 'j':
+			if((extract_jobs = atoi(optarg)) < 1) {
+				error(0, "Invalid number of jobs %s", optarg);
+			}
+			break;
+
 		case 'm':
 			flags |= FLAG_MD5;
 			break;
@@ -237,7 +405,18 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	if(flags & (FLAG_EXTRACT|FLAG_MD5)) {
+	if(flags & (FLAG_SCAN)) {
+		flags = FLAG_SCAN;
+	} else if(flags & (FLAG_DIFF)) {
+		if(!(flags & FLAG_MD5)) {
+			hash_type = HASH_XXH3;
+		}
+		flags = FLAG_DIFF;
+	} else if(flags & (FLAG_ARCHIVE)) {
+		flags = FLAG_ARCHIVE;
+	} else if(flags & (FLAG_VERIFY)) {
+		flags &= ~(FLAG_EXTRACT | FLAG_MD5 | FLAG_FIXUP_HEADER | FLAG_EXTRACT_RAW);
+	} else if(flags & (FLAG_EXTRACT|FLAG_MD5)) {
 		if(verbose > 1) {
 			flags |= FLAG_DISPLAY;
 		}
@@ -249,6 +428,12 @@ int main(int argc, char *argv[]) {
 		error(0, "Missing image file system name\n");
 	}
 	image = argv[optind++];
+	if(flags & (FLAG_DIFF)) {
+		if(optind >= argc) {
+			error(0, "Missing second image file system name\n");
+		}
+		image2 = argv[optind++];
+	}
 
 	if(optind < argc) {
 		check_files = &argv[optind];
@@ -265,6 +450,18 @@ int main(int argc, char *argv[]) {
 		image = "-- stdin --";
 	}
 
+	if(flags & (FLAG_SCAN)) {
+		scan_images(image, fp);
+		return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	if(image_index != -1) {
+		image_start = select_image(image, fp, image_index);
+	}
+
+	if(flags & (FLAG_ARCHIVE)) {
+		archive_open();
+	}
+
 	if ( dest_dir_path != NULL ) {
 		/* This temp file is created to address the problems of creating a file in /dev/shmem */
 		sprintf( tpath, "%s/.dumpifs.%d", dest_dir_path, getpid() );
@@ -280,37 +477,878 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	process(image, fp);
+	// Plain extraction from stdin is done in one pass, so a pipe will do.
+	if(fp == stdin && (flags & ~FLAG_BASENAME) == FLAG_EXTRACT && ucompress_file == NULL && image_start == -1) {
+		process_stream(image, fp);
+	} else {
+		process(image, fp);
+	}
+
+	if(image2 != NULL) {
+		if(!(fp = fopen(image2, "rb"))) {
+			error(0, "Unable to open file %s - %s", image2, strerror(errno));
+		}
+		diff_side = 1;
+		process(image2, fp);
+		if(errors == 0 && diff_report() != 0) {
+			return 1;
+		}
+	}
+
+	if(flags & (FLAG_ARCHIVE)) {
+		archive_close();
+	}
 
 	if ( tfd != -1 ) {
 		close(tfd);
 		unlink( tpath );
 	}
 
+	if((flags & FLAG_VERIFY) && errors != 0) {
+		return EXIT_FAILURE;
+	}
 	return EXIT_SUCCESS;
 }
 
-int find(FILE *fp, const unsigned char *p, int len, int count) {
-	int					c;
-	int					i;
+//
+// Signature scanning. The image is searched a cache sized chunk at a
+// time for every wanted signature before moving on, so a large flash
+// dump is read once no matter how many signatures are looked for.
+// Every match is recorded, in file order.
+//
+#define SCAN_CHUNK		0x40000
+#define SCAN_OVERLAP	(sizeof(IMAGE_SIGNATURE) - 2)
+
+enum {
+	SIG_IMAGE,
+	SIG_STARTUP,
+	SIG_STARTUP_SWAP,
+	SIG_NUM
+};
+
+struct sig_scan {
+	long		*pos[SIG_NUM];
+	unsigned	num[SIG_NUM];
+	unsigned	max[SIG_NUM];
+};
+
+static void scan_add(struct sig_scan *sc, int sig, long pos) {
+	if(sc->num[sig] >= sc->max[sig]) {
+		sc->max[sig] = sc->max[sig] ? sc->max[sig] * 2 : 16;
+		sc->pos[sig] = realloc(sc->pos[sig], sc->max[sig] * sizeof(*sc->pos[sig]));
+		if(sc->pos[sig] == NULL) {
+			error(0, "No memory for signature scan");
+		}
+	}
+	sc->pos[sig][sc->num[sig]++] = pos;
+}
+
+static void scan_free(struct sig_scan *sc) {
+	int		i;
+
+	for(i = 0; i < SIG_NUM; ++i) {
+		free(sc->pos[i]);
+	}
+	memset(sc, 0, sizeof(*sc));
+}
+
+static const uint32_t	startup_sig = STARTUP_HDR_SIGNATURE;
+static const uint32_t	startup_swap = ENDIAN_RET32(STARTUP_HDR_SIGNATURE);
+static const struct {
+	const void		*sig;
+	size_t			len;
+	unsigned		anchor;		// offset of two distinctive bytes
+}						sigs[SIG_NUM] = {
+	{ IMAGE_SIGNATURE, sizeof(IMAGE_SIGNATURE) - 1, 0 },
+	{ &startup_sig, sizeof(startup_sig), 0 },
+	{ &startup_swap, sizeof(startup_swap), 1 },
+};
+
+static int scan_match(struct sig_scan *sc, int sig, const unsigned char *buf,
+					size_t len, size_t pos, long base) {
+	if(pos + sigs[sig].len > len || memcmp(buf + pos, sigs[sig].sig, sigs[sig].len) != 0) {
+		return 0;
+	}
+	scan_add(sc, sig, base + pos);
+	return 1;
+}
+
+//
+// Look for the signatures in 'mask' in the bytes at 'buf', recording
+// matches that start before 'limit'. Returns non-zero when 'first' is
+// set and every wanted signature has been found.
+//
+static int scan_chunk(struct sig_scan *sc, unsigned mask, int first,
+					const unsigned char *buf, size_t len, size_t limit, long base) {
+	size_t			pos;
+	unsigned		want = mask;
+	int				i, done;
+
+	if(first) {
+		for(i = 0; i < SIG_NUM; ++i) {
+			if(sc->num[i] != 0) mask &= ~(1 << i);
+		}
+	}
+	limit = min(limit, len);
+	pos = 0;
+#if defined(__SSE2__)
+	{
+		// Compare 16 starting positions at a time against the anchor
+		// bytes of every signature, then check the rare hits in full.
+		__m128i			a0[SIG_NUM], a1[SIG_NUM], l[3], e[SIG_NUM];
+		unsigned		bits;
+
+		for(i = 0; i < SIG_NUM; ++i) {
+			const unsigned char	*p = (const unsigned char *)sigs[i].sig + sigs[i].anchor;
+
+			a0[i] = _mm_set1_epi8(p[0]);
+			a1[i] = _mm_set1_epi8(p[1]);
+		}
+		for( ; pos + 16 + 2 <= len && pos < limit && mask != 0; pos += 16) {
+			l[0] = _mm_loadu_si128((const __m128i *)(buf + pos));
+			l[1] = _mm_loadu_si128((const __m128i *)(buf + pos + 1));
+			l[2] = _mm_loadu_si128((const __m128i *)(buf + pos + 2));
+			for(i = 0; i < SIG_NUM; ++i) {
+				e[i] = _mm_and_si128(_mm_cmpeq_epi8(l[sigs[i].anchor], a0[i]),
+									_mm_cmpeq_epi8(l[sigs[i].anchor + 1], a1[i]));
+			}
+			if(_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(e[0], e[1]), e[2])) == 0) {
+				continue;
+			}
+			for(i = 0; i < SIG_NUM; ++i) {
+				if(!(mask & (1 << i))) continue;
+				for(bits = _mm_movemask_epi8(e[i]); bits != 0; bits &= bits - 1) {
+					size_t	at = pos + __builtin_ctz(bits);
+
+					if(at < limit && scan_match(sc, i, buf, len, at, base) && first) {
+						mask &= ~(1 << i);
+						break;
+					}
+				}
+			}
+		}
+	}
+#endif
+	for(i = 0; i < SIG_NUM; ++i) {
+		const unsigned char	*p, *q;
+
+		if(!(mask & (1 << i))) continue;
+		for(p = buf + pos; (q = memmem(p, buf + len - p, sigs[i].sig, sigs[i].len)) != NULL; p = q + 1) {
+			if(q - buf >= limit) break;
+			scan_add(sc, i, base + (q - buf));
+			if(first) break;
+		}
+	}
+
+	done = 1;
+	for(i = 0; i < SIG_NUM; ++i) {
+		if((want & (1 << i)) && sc->num[i] == 0) done = 0;
+	}
+	return first && done;
+}
+
+//
+// A full scan of a large mapped file is split into parts of whole
+// chunks, each scanned by its own thread, so the matches are exactly
+// those of a scan from start to end. Each part keeps its own list and
+// they are joined up in order.
+//
+#define SCAN_PART		(16 * SCAN_CHUNK)
+
+struct scan_part {
+	const unsigned char	*map;
+	long				from;
+	long				to;
+	long				size;
+	unsigned			mask;
+	struct sig_scan		sc;
+};
+
+static int thread_jobs(void);
+
+static void *scan_worker(void *arg) {
+	struct scan_part	*sp = arg;
+	long				off;
+
+	for(off = sp->from; off < sp->to; off += SCAN_CHUNK) {
+		scan_chunk(&sp->sc, sp->mask, 0, sp->map + off, min(SCAN_CHUNK + SCAN_OVERLAP, sp->size - off), SCAN_CHUNK, off);
+	}
+	return NULL;
+}
+
+static void scan_parallel(const unsigned char *map, long from, long size, unsigned mask,
+						int nparts, struct sig_scan *sc) {
+	struct scan_part	*parts;
+	pthread_t			*tids;
+	long				per;
+	int					i, j, nthreads;
+	unsigned			n;
+
+	if((parts = calloc(nparts, sizeof *parts)) == NULL || (tids = malloc(nparts * sizeof *tids)) == NULL) {
+		error(0, "No memory for signature scan");
+	}
+	per = ((size - from + SCAN_CHUNK - 1) / SCAN_CHUNK + nparts - 1) / nparts * SCAN_CHUNK;
+	for(i = 0; i < nparts; ++i) {
+		parts[i].map = map;
+		parts[i].from = min(from + i * per, size);
+		parts[i].to = min(from + (i + 1) * per, size);
+		parts[i].size = size;
+		parts[i].mask = mask;
+	}
+	for(nthreads = 0; nthreads < nparts; ++nthreads) {
+		if(pthread_create(&tids[nthreads], NULL, scan_worker, &parts[nthreads]) != 0) {
+			break;
+		}
+	}
+	for(i = nthreads; i < nparts; ++i) {
+		scan_worker(&parts[i]);
+	}
+	for(i = 0; i < nthreads; ++i) {
+		pthread_join(tids[i], NULL);
+	}
+	for(i = 0; i < nparts; ++i) {
+		for(j = 0; j < SIG_NUM; ++j) {
+			for(n = 0; n < parts[i].sc.num[j]; ++n) {
+				scan_add(sc, j, parts[i].sc.pos[j][n]);
+			}
+		}
+		scan_free(&parts[i].sc);
+	}
+	free(tids);
+	free(parts);
+}
+
+//
+// Scan 'fp' from offset 'from' to the end for the signatures in 'mask'.
+// With 'first' set the scan stops once each signature has been seen.
+// The file is memory mapped when possible and read in chunks if not.
+//
+static int scan_file(FILE *fp, long from, unsigned mask, int first, struct sig_scan *sc) {
+	struct stat		st;
+	unsigned char	*map, *buf;
+	long			off, size;
+	size_t			len;
+	int				nparts;
+
+	fflush(fp);
+	if(fstat(fileno(fp), &st) == -1 || !S_ISREG(st.st_mode)) {
+		return -1;
+	}
+	size = st.st_size;
+	if(from >= size) {
+		return 0;
+	}
+
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	if(map != MAP_FAILED) {
+		madvise(map, size, MADV_SEQUENTIAL);
+		nparts = first ? 1 : min(thread_jobs(), (size - from) / SCAN_PART);
+		if(nparts > 1) {
+			scan_parallel(map, from, size, mask, nparts, sc);
+		} else {
+			for(off = from; off < size; off += SCAN_CHUNK) {
+				len = min(SCAN_CHUNK + SCAN_OVERLAP, size - off);
+				if(scan_chunk(sc, mask, first, map + off, len, SCAN_CHUNK, off)) break;
+			}
+		}
+		munmap(map, size);
+		return 0;
+	}
+
+	if((buf = malloc(SCAN_CHUNK + SCAN_OVERLAP)) == NULL) {
+		error(0, "No memory for signature scan");
+	}
+	for(off = from; off < size; off += SCAN_CHUNK) {
+		if(fseek(fp, off, SEEK_SET) == -1) break;
+		len = fread(buf, 1, SCAN_CHUNK + SCAN_OVERLAP, fp);
+		if(len == 0) break;
+		if(scan_chunk(sc, mask, first, buf, len, SCAN_CHUNK, off)) break;
+	}
+	free(buf);
+	return 0;
+}
+
+//
+// Finding every image in a flash dump (--scan, --image). The header at
+// each startup and image header signature is checked the way libifs
+// checks any image, and its checksum is worked out. The image header
+// following a startup belongs to it, the others are images on their
+// own. Chain addresses are turned into dump offsets using the physical
+// address of the first bootable image, or taken as offsets if there
+// isn't one.
+//
+struct found_image {
+	long		pos;		// startup header, or image header
+	long		ipos;		// image header, -1 if compressed or missing
+	uint32_t	size;		// stored size, image size if no startup
+	int			startup;
+	int			method;
+	int			big;
+	int			zero_ok;
+	int			startup_ok;	// checksums, -1 if not checked
+	int			image_ok;
+	uint32_t	image_paddr;
+	uint32_t	chain;
+};
+
+static int found_by_pos(const void *a, const void *b) {
+	const struct found_image	*fa = a, *fb = b;
+
+	return (fa->pos > fb->pos) - (fa->pos < fb->pos);
+}
+
+static unsigned find_images(FILE *fp, struct found_image **foundp) {
+	struct sig_scan		sc = { { NULL } };
+	struct found_image	*found, *fi;
+	struct ifs_image	simg = { NULL };
+	struct ifs_location	loc;
+	struct stat			st;
+	char				*claimed;
+	unsigned			num = 0, i, j;
+	unsigned			lflags;
+	int					sig;
+
+	fflush(fp);
+	if(fstat(fileno(fp), &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0
+	 || scan_file(fp, 0, (1 << SIG_IMAGE) | (1 << SIG_STARTUP) | (1 << SIG_STARTUP_SWAP), 0, &sc) == -1) {
+		error(0, "Unable to search for images, it must be a regular file");
+	}
+	if(ifs_image_map(&simg, fileno(fp)) == -1) {
+		error(0, "Unable to map the image file: %s", strerror(errno));
+	}
+	found = calloc(sc.num[SIG_IMAGE] + sc.num[SIG_STARTUP] + sc.num[SIG_STARTUP_SWAP] + 1, sizeof *found);
+	claimed = calloc(sc.num[SIG_IMAGE] + 1, 1);
+	if(found == NULL || claimed == NULL) {
+		error(0, "No memory for the image list");
+	}
+
+	// Each header is checked by libifs right where its signature is.
+	lflags = IFS_LOCATE_AT | IFS_LOCATE_NOINDEX | (zero_check_enabled ? 0 : IFS_OPEN_NOZERO);
+	for(sig = SIG_STARTUP; sig <= SIG_STARTUP_SWAP; ++sig) {
+		for(i = 0; i < sc.num[sig]; ++i) {
+			if(ifs_locate(&simg, sc.pos[sig][i], lflags, &loc) != IFS_OK && loc.spos == -1) {
+				continue;
+			}
+			fi = &found[num++];
+			fi->pos = loc.spos;
+			fi->ipos = -1;
+			fi->size = loc.shdr.stored_size;
+			fi->startup = 1;
+			fi->method = loc.shdr.flags1 & STARTUP_HDR_FLAGS1_COMPRESS_MASK;
+			fi->big = loc.shdr.flags1 & STARTUP_HDR_FLAGS1_BIGENDIAN;
+			fi->zero_ok = loc.zero_ok;
+			fi->startup_ok = ifs_cksum_ok(simg.base + loc.spos, loc.shdr.startup_size, fi->big);
+			fi->image_ok = -1;
+			fi->image_paddr = loc.shdr.image_paddr;
+
+			// The image is the first good one after the startup, and it
+			// has to be within what the startup says it stores.
+			if(loc.ipos == -1 || loc.ipos >= loc.spos + (long)max(loc.shdr.stored_size, loc.shdr.startup_size)) {
+				continue;
+			}
+			fi->ipos = loc.ipos;
+			fi->big = loc.big;
+			fi->image_ok = ifs_cksum_ok(simg.base + loc.ipos, loc.ihdr.image_size, loc.big);
+			fi->chain = loc.ihdr.chain_paddr;
+			for(j = 0; j < sc.num[SIG_IMAGE]; ++j) {
+				if(sc.pos[SIG_IMAGE][j] == loc.ipos) {
+					claimed[j] = 1;
+				}
+			}
+		}
+	}
+	// A signature in compressed data is only a coincidence.
+	for(j = 0; j < sc.num[SIG_IMAGE]; ++j) {
+		for(i = 0; i < num; ++i) {
+			if(found[i].method != 0 && sc.pos[SIG_IMAGE][j] >= found[i].pos
+			 && sc.pos[SIG_IMAGE][j] < found[i].pos + (long)found[i].size) {
+				claimed[j] = 1;
+			}
+		}
+	}
+	for(j = 0; j < sc.num[SIG_IMAGE]; ++j) {
+		if(claimed[j] || ifs_locate(&simg, sc.pos[SIG_IMAGE][j], IFS_LOCATE_AT, &loc) != IFS_OK) {
+			continue;
+		}
+		fi = &found[num++];
+		fi->pos = loc.ipos;
+		fi->ipos = loc.ipos;
+		fi->size = loc.ihdr.image_size;
+		fi->big = loc.big;
+		fi->startup_ok = -1;
+		fi->image_ok = ifs_cksum_ok(simg.base + loc.ipos, loc.ihdr.image_size, loc.big);
+		fi->chain = loc.ihdr.chain_paddr;
+	}
+	qsort(found, num, sizeof *found, found_by_pos);
+
+	ifs_image_unmap(&simg);
+	free(claimed);
+	scan_free(&sc);
+	*foundp = found;
+	return num;
+}
+
+static const char *method_name(int method) {
+	switch(method) {
+	case 0:									return "none";
+	case STARTUP_HDR_FLAGS1_COMPRESS_ZLIB:	return "zlib";
+	case STARTUP_HDR_FLAGS1_COMPRESS_LZO:	return "lzo";
+	case STARTUP_HDR_FLAGS1_COMPRESS_UCL:	return "ucl";
+	default:								return "?";
+	}
+}
+
+static const char *cksum_state(int ok) {
+	return (ok == -1) ? "-" : ok ? "ok" : "bad";
+}
+
+void scan_images(const char *file, FILE *fp) {
+	struct found_image	*found, *fi;
+	unsigned			num, i, j;
+	long				base = 0, target;
+	char				notes[128];
 	int					n;
 
-	i = n = 0;
-	while(i < len && (c = fgetc(fp)) != EOF) {
-		n++;
-		if(c == p[i]) {
-			i++;
+	num = find_images(fp, &found);
+	for(i = 0; i < num; ++i) {
+		if(found[i].startup) {
+			base = (long)found[i].image_paddr - found[i].pos;
+			break;
+		}
+	}
+
+	printf("   #    Offset      Size  Image-at  Comp  Order  Startup  Image  Notes\n");
+	for(i = 0; i < num; ++i) {
+		fi = &found[i];
+		printf(" %3u %9lx %9x ", i, fi->pos, fi->size);
+		if(fi->ipos != -1) {
+			printf("%9lx ", fi->ipos);
 		} else {
-			if(count != -1 && n >= count) {
+			printf("%9s ", "-");
+		}
+		n = 0;
+		for(j = i; j-- > 0; ) {
+			if(fi->pos < found[j].pos + (long)found[j].size) {
+				n += snprintf(notes + n, sizeof notes - n, "inside #%u ", j);
 				break;
 			}
-			i = c == p[0] ? 1 : 0;
 		}
+		if(fi->chain != 0) {
+			target = (long)fi->chain - base;
+			for(j = 0; j < num && found[j].pos != target && found[j].ipos != target; ++j) {
+			}
+			if(j < num) {
+				n += snprintf(notes + n, sizeof notes - n, "chain -> #%u ", j);
+			} else {
+				n += snprintf(notes + n, sizeof notes - n, "chain=%#x not in the file ", fi->chain);
+			}
+		}
+		if(fi->startup && !fi->zero_ok) {
+			n += snprintf(notes + n, sizeof notes - n, "zero fields not zero ");
+		}
+		printf(" %-5s %-6s %-8s ", fi->startup ? method_name(fi->method) : "-", fi->big ? "BE" : "LE",
+				cksum_state(fi->startup_ok));
+		if(n != 0) {
+			notes[n - 1] = '\0';
+			printf("%-5s  %s\n", cksum_state(fi->image_ok), notes);
+		} else {
+			printf("%s\n", cksum_state(fi->image_ok));
+		}
+	}
+	if(num == 0) {
+		error(1, "No images found in %s", file);
+	}
+	free(found);
+}
+
+//
+// The offset of image 'index' from the --scan list.
+//
+long select_image(const char *file, FILE *fp, int index) {
+	struct found_image	*found;
+	unsigned			num;
+	long				pos;
+
+	num = find_images(fp, &found);
+	if(index >= num) {
+		error(0, "There is no image %d in %s, --scan lists them", index, file);
+	}
+	pos = found[index].pos;
+	free(found);
+	return pos;
+}
+
+//
+// The image being examined. Once the image header has been found the
+// file holding it (the uncompressed copy of a compressed image) is
+// mapped read-only and the directory, scripts, ELF headers and file
+// data are all used where they lie. A file that can't be mapped (a
+// pipe) is read into memory instead.
+//
+// A compressed image is only uncompressed start to finish when all of
+// it is going to be needed. Otherwise it's read through libifs, which
+// uncompresses the blocks something is read from and keeps the most
+// recently used ones.
+//
+struct ifs_image	img;
+
+
+//
+// Whether a compressed image should be read on demand rather than
+// uncompressed up front.
+//
+static int img_on_demand(void) {
+	if(ucompress_file != NULL || (flags & (FLAG_FIXUP_HEADER | FLAG_EXTRACT_RAW))) {
+		return 0;
+	}
+	if((flags & FLAG_EXTRACT) && extract_files == NULL && check_files == NULL) {
+		return 0;
 	}
-	if(i < len) {
+	if((flags & (FLAG_MD5 | FLAG_ARCHIVE)) && check_files == NULL) {
+		return 0;
+	}
+	return 1;
+}
+
+static void img_unmap(void) {
+	ifs_image_unmap(&img);
+}
+
+static int img_map(FILE *fp) {
+	unsigned char	*base, *p;
+	size_t			n, max, size = 0;
+
+	img_unmap();
+	fflush(fp);
+	if(ifs_image_map(&img, fileno(fp)) == 0) {
+		return 0;
+	}
+
+	// A stream that can't be mapped is read in from where it is.
+	max = 0x10000;
+	if((base = malloc(max)) == NULL) {
 		return -1;
 	}
-	return ftell(fp) - i;
+	while((n = fread(base + size, 1, max - size, fp)) != 0) {
+		size += n;
+		if(size == max) {
+			if((p = realloc(base, max * 2)) == NULL) {
+				free(base);
+				return -1;
+			}
+			base = p;
+			max *= 2;
+		}
+	}
+	ifs_image_mem(&img, base, size, 0);
+	return ferror(fp) ? -1 : 0;
+}
+
+//
+// Report why the image couldn't be read, unless it was only for
+// running off the end.
+//
+static void img_failed(void) {
+	if(img.error != NULL) {
+		error(img.nomem ? 0 : 1, "%s", img.error);
+		img.error = NULL;
+	}
+}
+
+//
+// Copy 'len' bytes of the image at 'off' to 'out'. A mapped file is left
+// to the kernel to copy.
+//
+static int img_copy(FILE *out, FILE *fp, long off, unsigned long len) {
+	fflush(out);
+	if(img.mapped) {
+		return ifs_copy_range(fileno(out), fileno(fp), off, len);
+	}
+	return (len == 0 || fwrite(img.base + off, len, 1, out) == 1) ? 0 : -1;
+}
+
+static int img_index(int method, long zstart) {
+	if(ifs_image_index(&img, method, zstart) == -1) {
+		img_failed();
+		return -1;
+	}
+	return 0;
+}
+
+//
+// Threads to uncompress or hash with: the -j count if given, else one
+// per CPU.
+//
+static int thread_jobs(void) {
+	long	n;
+
+	if(extract_jobs > 1) {
+		return extract_jobs;
+	}
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? n : 1;
+}
+
+static int img_uncompress(FILE *fp, int nthreads) {
+	fflush(fp);
+	if(ifs_image_uncompress(&img, fileno(fp), nthreads) == -1) {
+		// The caller reports anything but running out of memory.
+		if(img.nomem) img_failed();
+		return -1;
+	}
+	return 0;
+}
+
+static const unsigned char *img_piece(long off, unsigned long len, unsigned long *lenp) {
+	const unsigned char	*p;
+
+	if((p = ifs_image_piece(&img, off, len, lenp)) == NULL) {
+		img_failed();
+	}
+	return p;
+}
+
+static const void *img_span(long off, unsigned long len) {
+	const void	*p;
+
+	if((p = ifs_image_span(&img, off, len)) == NULL) {
+		img_failed();
+	}
+	return p;
+}
+
+static int img_read(long off, void *buf, unsigned long len) {
+	if(ifs_image_read(&img, off, buf, len) == -1) {
+		img_failed();
+		return -1;
+	}
+	return 0;
+}
+
+//
+// Reading an image from a stream in one forward pass (-x with the image
+// on stdin). The bytes not used yet are kept in 'buf', refilled from the
+// input, or from its decompressor once the compressed part of the image
+// is reached. Nothing is ever sought, so the input can be a pipe.
+//
+#define STREAM_BUF		(2 * IFS_BLOCK_SIZE)
+
+struct img_stream {
+	FILE				*fp;
+	int					method;		// compression of the rest of the input
+	int					done;		// the input is used up, or bad
+	z_stream			zs;
+	int					zdone;		// the end of the zlib stream was seen
+	unsigned char		*raw;		// input read ahead of the decompressor
+	unsigned			raw_pos;
+	unsigned			raw_len;
+	unsigned char		*cblock;	// an LZO/UCL block
+	unsigned char		buf[STREAM_BUF];
+	unsigned			head;		// buf[head .. len) not used yet
+	unsigned			len;
+	long				pos;		// image offset of buf[head]
+} strm;
+
+int streaming;
+
+static size_t stream_raw(void *dst, size_t n) {
+	size_t		done = 0;
+
+	if(strm.raw_pos < strm.raw_len) {
+		done = min(n, strm.raw_len - strm.raw_pos);
+		memcpy(dst, strm.raw + strm.raw_pos, done);
+		strm.raw_pos += done;
+	}
+	if(done < n) {
+		done += fread((char *)dst + done, 1, n - done, strm.fp);
+	}
+	return done;
+}
+
+//
+// Add what comes next in the image to the end of 'buf', which has room
+// for at least a block. Returns how much was added, 0 at the end.
+//
+static unsigned stream_fill(void) {
+	unsigned char	*out = strm.buf + strm.len;
+	unsigned		room = STREAM_BUF - strm.len;
+	unsigned char	hdr[2];
+	unsigned		clen, ulen;
+	int				status;
+
+	switch(strm.method) {
+	case 0:
+		return stream_raw(out, room);
+	case STARTUP_HDR_FLAGS1_COMPRESS_ZLIB:
+		strm.zs.next_out = out;
+		strm.zs.avail_out = room;
+		while(strm.zs.avail_out != 0 && !strm.zdone) {
+			if(strm.zs.avail_in == 0) {
+				if(strm.raw_pos >= strm.raw_len) {
+					strm.raw_pos = 0;
+					strm.raw_len = fread(strm.raw, 1, STREAM_BUF, strm.fp);
+				}
+				if(strm.raw_pos >= strm.raw_len) {
+					error(1, "Early end of compressed image");
+					break;
+				}
+				strm.zs.next_in = strm.raw + strm.raw_pos;
+				strm.zs.avail_in = strm.raw_len - strm.raw_pos;
+				strm.raw_pos = strm.raw_len;
+			}
+			status = inflate(&strm.zs, Z_NO_FLUSH);
+			if(status == Z_STREAM_END) {
+				strm.zdone = 1;
+				break;
+			}
+			if(status != Z_OK) {
+				error(1, "decompression failure");
+				break;
+			}
+		}
+		return room - strm.zs.avail_out;
+	default:
+		if(stream_raw(hdr, sizeof hdr) != sizeof hdr) {
+			error(1, "Early end of compressed image");
+			return 0;
+		}
+		clen = (hdr[0] << 8) | hdr[1];
+		if(clen == 0) {
+			return 0;
+		}
+		if(stream_raw(strm.cblock, clen) != clen) {
+			error(1, "Early end of compressed image");
+			return 0;
+		}
+		if(ifs_block_decode(strm.method, strm.cblock, clen, out, &ulen) == -1) {
+			error(1, "decompression failure");
+			return 0;
+		}
+		return ulen;
+	}
+}
+
+//
+// Return the next bytes of the image, at least 'n' of them unless it
+// ends first, and set '*availp' to how many there are.
+//
+static const unsigned char *stream_peek(unsigned long n, unsigned long *availp) {
+	unsigned	added;
+
+	while(strm.len - strm.head < n && !strm.done) {
+		memmove(strm.buf, strm.buf + strm.head, strm.len - strm.head);
+		strm.len -= strm.head;
+		strm.head = 0;
+		if((added = stream_fill()) == 0) {
+			strm.done = 1;
+		}
+		strm.len += added;
+	}
+	*availp = strm.len - strm.head;
+	return strm.buf + strm.head;
+}
+
+static void stream_consume(unsigned long n) {
+	strm.head += n;
+	strm.pos += n;
+}
+
+static int stream_read(void *dst, unsigned long len) {
+	const unsigned char	*p;
+	unsigned long		n;
+
+	for( ; len != 0; len -= n) {
+		p = stream_peek(1, &n);
+		if(n == 0) {
+			return -1;
+		}
+		n = min(n, len);
+		memcpy(dst, p, n);
+		dst = (char *)dst + n;
+		stream_consume(n);
+	}
+	return 0;
+}
+
+//
+// Move on to image offset 'off'.
+//
+static int stream_skip(long off) {
+	unsigned long		n;
+
+	if(off < strm.pos) {
+		return -1;
+	}
+	while(strm.pos < off) {
+		stream_peek(1, &n);
+		if(n == 0) {
+			return -1;
+		}
+		stream_consume(min(n, (unsigned long)(off - strm.pos)));
+	}
+	return 0;
+}
+
+//
+// Move on to the first of the signatures in 'mask', returning which
+// one it is, -1 if none turns up.
+//
+static int stream_scan(unsigned mask) {
+	const unsigned char	*p, *q, *hit;
+	unsigned long		n;
+	int					i, sig;
+
+	for( ;; ) {
+		p = stream_peek(IFS_BLOCK_SIZE, &n);
+		hit = NULL;
+		sig = -1;
+		for(i = 0; i < SIG_NUM; ++i) {
+			if((mask & (1 << i)) && (q = memmem(p, n, sigs[i].sig, sigs[i].len)) != NULL
+			 && (hit == NULL || q < hit)) {
+				hit = q;
+				sig = i;
+			}
+		}
+		if(hit != NULL) {
+			stream_consume(hit - p);
+			return sig;
+		}
+		if(strm.done) {
+			return -1;
+		}
+		// Keep enough for a signature that straddles the next fill.
+		stream_consume(n - min(n, SCAN_OVERLAP));
+	}
+}
+
+//
+// The rest of the input is compressed with 'method'. Whatever was read
+// past this point already is handed to the decompressor.
+//
+static int stream_compressed(int method) {
+	memcpy(strm.raw, strm.buf + strm.head, strm.len - strm.head);
+	strm.raw_pos = 0;
+	strm.raw_len = strm.len - strm.head;
+	strm.head = strm.len = 0;
+	strm.done = 0;
+	switch(method) {
+	case STARTUP_HDR_FLAGS1_COMPRESS_ZLIB:
+		if(inflateInit2(&strm.zs, MAX_WBITS + 16) != Z_OK) {
+			return -1;
+		}
+		break;
+	case STARTUP_HDR_FLAGS1_COMPRESS_LZO:
+		if(lzo_init() != LZO_E_OK) {
+			return -1;
+		}
+		break;
+	case STARTUP_HDR_FLAGS1_COMPRESS_UCL:
+		break;
+	default:
+		return -1;
+	}
+	strm.method = method;
+	return 0;
 }
 
 int check(const char *name) {
@@ -350,7 +1388,7 @@ char		**ptr;
 	return(value);
 }
 
-void display_script(FILE *fp, int pos, int len, FILE *dst) {
+void display_script(int pos, int len, FILE *dst) {
 	int								off;
 	char							buff[1024];
 	union script_cmd				*hdr = (union script_cmd *)buff;
@@ -359,8 +1397,7 @@ void display_script(FILE *fp, int pos, int len, FILE *dst) {
 	FILE 							*fout = (dst) ? dst : stdout;
 
 	for(off = 0; off < len; off += size) {
-		fseek(fp, pos + off, SEEK_SET);
-		if(fread(hdr, sizeof *hdr, 1, fp) != 1) {
+		if(img_read(pos + off, hdr, sizeof *hdr) == -1) {
 			break;
 		}
 		if((size = hdr->hdr.size_lo | (hdr->hdr.size_hi << 8)) == 0) {
@@ -368,9 +1405,9 @@ void display_script(FILE *fp, int pos, int len, FILE *dst) {
 		}
 
 		if(size > sizeof *hdr) {
-			int	n = min(sizeof buff, size - sizeof *hdr);
+			int	n = min(sizeof buff - sizeof *hdr, size - sizeof *hdr);
 
-			if(fread(hdr + 1, n, 1, fp) != 1) {
+			if(img_read(pos + off + sizeof *hdr, hdr + 1, n) == -1) {
 				break;
 			}
 		}
@@ -487,33 +1524,84 @@ wait:
 	}
 }
 
-uint32_t calc_cksum(FILE *fp, long off, uint32_t len) {
-	uint32_t	sum = 0;
-	long		pos = ftell(fp);
+//
+// Checksum of the 'len' bytes at offset 'off' of the image, summed as
+// words of the given byte order. -1 if the image ends early.
+//
+static int img_cksum(long off, unsigned long len, int big, uint32_t *sump) {
+	if(ifs_image_cksum(&img, off, len, big, sump) == -1) {
+		img_failed();
+		return -1;
+	}
+	return 0;
+}
 
-	fseek(fp, off, SEEK_SET);
+//
+// Walk the directory entries from 'dpos' up to the empty one ending
+// them, handing each to its process_*() function.
+//
+static void process_dirents(int ipos, int dpos, const struct image_header *ihdr) {
+	static union image_dirent	*dir;
+	int							n;
 
-	while (len >= 4)
-	{
-		int	data;
-		fread(&data, 4, 1, fp);
-		sum += data;
-		len -= 4;
+	// Each dirent is copied out, in host byte order, by libifs.
+	if(dir == NULL && (dir = malloc(IFS_DIRENT_MAX)) == NULL) {
+		error(0, "No memory for directory entries");
 	}
+	while(!processing_done) {
+		if((n = ifs_dirent_get(&img, dpos, CROSSENDIAN(ihdr->flags & IMAGE_FLAGS_BIGENDIAN), dir)) <= 0) {
+			if(n < 0) {
+				img_failed();
+				error(1, (n == -IFS_EDIRENT) ? "Invalid dir entry" : "Early end reading directory");
+			}
+			break;
+		}
+		dpos += n;
 
-	fseek(fp, pos, SEEK_SET);
+		switch(dir->attr.mode & S_IFMT) {
+		case S_IFREG:
+			if(dir->attr.ino == ihdr->script_ino) {
+				if(flags & (FLAG_EXTRACT_RAW))
+					extract_file(ipos, &dir->file, 1);
+				else
+					process_file(ipos, &dir->file);
 
-	return -sum;
+				if (verbose > 1)
+					display_script(ipos + dir->file.offset, dir->file.size, NULL);
+			} else {
+				process_file(ipos, &dir->file);
+			}
+			break;
+		case S_IFDIR:
+			process_dir(ipos, &dir->dir);
+			break;
+		case S_IFLNK:
+			process_symlink(ipos, &dir->symlink);
+			break;
+		case S_IFCHR:
+		case S_IFBLK:
+		case S_IFIFO:
+		case S_IFNAM:
+			process_device(ipos, &dir->device);
+			// dir->device;
+			break;
+		default:
+			error(1, "Unknown type\n");
+			break;
+		}
+	}
 }
 
 void process(const char *file, FILE *fp) {
-	struct startup_header		shdr = { STARTUP_HDR_SIGNATURE };
+	struct startup_header		shdr;
 	int							spos;
-	struct image_header			ihdr = { IMAGE_SIGNATURE };
+	struct image_header			ihdr;
 	int							ipos;
 	int							dpos;
+	struct ifs_location			loc;
+	unsigned					lflags;
+	int							err;
 	static char					buf[0x10000];
-	static char 				out_buf[0x10000];
 
 	if(flags & (FLAG_EXTRACT_RAW)) {
 		// Create buildfile
@@ -522,52 +1610,60 @@ void process(const char *file, FILE *fp) {
 		}
 	}
 
-	spos = -1;
-	if((ipos = find(fp, ihdr.signature, sizeof ihdr.signature, 0)) == -1) {
-		rewind(fp);
-		//find startup signature and verify its validity
-		while(1){
-			if((spos = find(fp, (char *)&shdr.signature, sizeof shdr.signature, -1)) == -1) {
-				shdr.signature = ENDIAN_RET32(shdr.signature);
-				rewind(fp);
-				if((spos = find(fp, (char *)&shdr.signature, sizeof shdr.signature, -1)) == -1) {
-					error(1, "Unable to find startup header in %s", file);
-					return;
-				}
-			}
-			if(fread((char *)&shdr + sizeof shdr.signature, sizeof shdr - sizeof shdr.signature, 1, fp) != 1) {
-				error(1, "Unable to read image %s", file);
-				return;
-			}
-			// if we are cross endian, flip the shdr members
-			{
-				// flip shdr members
-			}
+	// The headers are found and checked by libifs, as for any other
+	// reader of the image. -z lets a startup header with non-zero zero
+	// fields through and --image says where the headers have to be.
+	lflags = zero_check_enabled ? 0 : IFS_OPEN_NOZERO;
+	if(image_start != -1) {
+		lflags |= IFS_LOCATE_AT;
+	}
+	if(!img_on_demand()) {
+		lflags |= IFS_LOCATE_NOINDEX;
+	}
+	if(img_map(fp) == -1) {
+		error(1, "Unable to read image %s", file);
+		return;
+	}
+	if((err = ifs_locate(&img, max(image_start, 0), lflags, &loc)) != IFS_OK) {
+		img_failed();
+		if(err == IFS_ENOIMAGE) {
+			error(1, "Unable to find an image in %s", file);
+		} else {
+			error(1, "Unable to read image %s: %s", file, ifs_strerror(err));
+		}
+		img_unmap();
+		return;
+	}
+	spos = loc.spos;
+	ipos = loc.ipos;
+	shdr = loc.shdr;
+	ihdr = loc.ihdr;
+	if(verbose > 2) {
+		if(spos != -1) {
+			printf("Found startup header at %#x\n", spos);
+		}
+		if(ipos != -1) {
+			printf("Found image header at %#x\n", ipos);
+		}
+	}
 
-			//check the zero member of startup, one more check to confirm
-			//we found the correct signature
-			if (!zero_ok(&shdr)) {
-				if (zero_check_enabled)
-					continue;
-				if (verbose)
-					printf("Warning: Non zero data in zero fields ignored\n");
-				break;
-			} else {
-				break;
-			}
+	if(spos != -1) {
+		if(!loc.zero_ok && verbose) {
+			printf("Warning: Non zero data in zero fields ignored\n");
 		}
 
+		// The startup region, trailer included, sums to zero.
 		if(flags & (FLAG_CHECK_CRC)) {
-			struct startup_trailer	stlr;
-			uint32_t cksum = calc_cksum(fp, spos, (shdr.startup_size-sizeof(stlr)));
+			uint32_t	sum;
 
-			fseek(fp, spos + shdr.startup_size-sizeof(stlr), SEEK_SET);
-			if(fread(&stlr, sizeof(stlr), 1, fp) != 1) {
+			if(img_cksum(spos, shdr.startup_size, shdr.flags1 & STARTUP_HDR_FLAGS1_BIGENDIAN, &sum) == -1) {
 				error(1, "Early end reading startup trailer");
+				img_unmap();
 				return;
 			}
-			if(cksum != stlr.cksum) {
+			if(sum != 0) {
 				error(1, "Startup header checksum mismatch");
+				img_unmap();
 				return;
 			}
 		}
@@ -576,21 +1672,14 @@ void process(const char *file, FILE *fp) {
 			char boot_name[] = "binary.boot";
 			char startup_name[] = "startup";
 			FILE *fp_ext;
-			int n;
 
 			// Extract boot prefix
 			if(!(fp_ext = fopen(boot_name, "wb"))) {
 				error(0, "Unable to open %s: %s\n", boot_name, strerror(errno));
 			}
-
-			putc('b', fp_ext);
-			putc('o', fp_ext);
-			putc('o', fp_ext);
-			putc('t', fp_ext);
-
-			rewind(fp);
-			for(n = 0 ; n < spos; ++n) {
-				putc(getc(fp), fp_ext);
+			fputs("boot", fp_ext);
+			if(img_copy(fp_ext, fp, 0, spos) == -1) {
+				error(0, "Unable to write %s: %s\n", boot_name, strerror(errno));
 			}
 			fclose(fp_ext);
 
@@ -598,9 +1687,9 @@ void process(const char *file, FILE *fp) {
 			if(!(fp_ext = fopen(startup_name, "wb"))) {
 				error(0, "Unable to open %s: %s\n", startup_name, strerror(errno));
 			}
-			fseek(fp, spos + sizeof shdr, SEEK_SET);
-			for(n = 0 ; n < shdr.startup_size - sizeof shdr - sizeof(struct startup_trailer); ++n) {
-				putc(getc(fp), fp_ext);
+			if(img_copy(fp_ext, fp, spos + sizeof shdr,
+					shdr.startup_size - sizeof shdr - sizeof(struct startup_trailer)) == -1) {
+				error(0, "Unable to write %s: %s\n", startup_name, strerror(errno));
 			}
 			fclose(fp_ext);
 
@@ -617,11 +1706,13 @@ void process(const char *file, FILE *fp) {
 					(shdr.flags1 & STARTUP_HDR_FLAGS1_COMPRESS_MASK) ? " +compress" : "");
 		}
 
-		// If the image is compressed we need to uncompress it into a
-		// tempfile and restart.
-		if((shdr.flags1 & STARTUP_HDR_FLAGS1_COMPRESS_MASK) != 0) {
+		// A compressed image that isn't read on demand is uncompressed
+		// into a tempfile, where its header is then looked for.
+		if(ipos == -1) {
 			FILE	*fp2;
 			int		n;
+			long	zstart = spos + shdr.startup_size;
+			double	start;
 
 			// Create a file to hold uncompressed image.
 			if(ucompress_file) {
@@ -632,22 +1723,20 @@ void process(const char *file, FILE *fp) {
 		
 			if(fp2 == NULL) {
 				error(1, "Unable to create a file to uncompress image.");
+				img_unmap();
 				return;
 			}
 
 			// Copy non-compressed part.
-			rewind(fp);
-			if(CROSSENDIAN(shdr.flags1 & STARTUP_HDR_FLAGS1_BIGENDIAN))
-				for(n = 0 ; n < spos + ENDIAN_RET32(shdr.startup_size); ++n) {
-					putc(getc(fp), fp2);
-				}
-			else
-				for(n = 0 ; n < spos + shdr.startup_size; ++n) {
-					putc(getc(fp), fp2);
-				}
+			if(img_copy(fp2, fp, 0, zstart) == -1) {
+				error(1, "Unable to copy the uncompressed part of the image.");
+				img_unmap();
+				return;
+			}
 			fflush(fp2);
 
 			// Uncompress compressed part
+			start = ifs_trace_now();
 			switch(shdr.flags1 & STARTUP_HDR_FLAGS1_COMPRESS_MASK) {
 			case STARTUP_HDR_FLAGS1_COMPRESS_ZLIB:
 				{
@@ -658,9 +1747,10 @@ void process(const char *file, FILE *fp) {
 					// position being the same as the FILE *'s, so fileno() 
 					// and lseek.
 					fd = fileno(fp);
-					lseek(fd, ftell(fp), SEEK_SET);
+					lseek(fd, zstart, SEEK_SET);
 					if((zin = gzdopen(fd, "rb")) == NULL) {
 						error(1, "Unable to open decompression stream.");
+						img_unmap();
 						return;
 					}
 					while((n = gzread(zin, buf, sizeof(buf))) > 0) {
@@ -669,53 +1759,24 @@ void process(const char *file, FILE *fp) {
 				}
 				break;
 			case STARTUP_HDR_FLAGS1_COMPRESS_LZO:
-				{
-					unsigned	len;
-					lzo_uint	out_len;
-					int			status;
-				
-					if(lzo_init() != LZO_E_OK) {
-						error(1,"decompression init failure");
-						return;
-					}
-					for(;;) {
-						len = getc(fp) << 8;
-						len += getc(fp);
-						if(len == 0) break;
-						fread(buf, len, 1, fp);
-						status = lzo1x_decompress(buf, len, out_buf, &out_len, NULL);
-						if(status != LZO_E_OK) {
-							error(1, "decompression failure");
-							return;
-						}
-						fwrite(out_buf, out_len, 1, fp2);
-					}
-				}
-				break;
 			case STARTUP_HDR_FLAGS1_COMPRESS_UCL:
-				{
-					unsigned	len;
-					ucl_uint	out_len;
-					int			status;
-
-					for(;;) {
-						len = getc(fp) << 8;
-						len += getc(fp);
-						if(len == 0) break;
-						fread(buf, len, 1, fp);
-						status = ucl_nrv2b_decompress_8(buf, len, out_buf, &out_len, NULL);
-						if(status != 0) {
-							error(1, "decompression failure");
-							return;
-						}
-						fwrite(out_buf, out_len, 1, fp2);
-					}
+				// The blocks are found from their lengths and uncompressed
+				// in parallel.
+				if(img_index(shdr.flags1 & STARTUP_HDR_FLAGS1_COMPRESS_MASK, zstart) == -1
+				 || img_uncompress(fp2, thread_jobs()) == -1) {
+					error(1, "decompression failure");
+					img_unmap();
+					return;
 				}
 				break;
 			default:
 				error(1, "Unsupported compression type.");
+				img_unmap();
 				return;
 			}
+			img_unmap();
+			fseek(fp2, 0L, SEEK_END);
+			ifs_trace_span("decompress", file, start, NULL, -1, ftell(fp2));
 
 			fclose(fp);
 			fp = fp2;
@@ -723,26 +1784,37 @@ void process(const char *file, FILE *fp) {
 
 			if(flags & (FLAG_FIXUP_HEADER)) {
 				struct startup_trailer	stlr;
-
-				shdr.flags1 &= ~STARTUP_HDR_FLAGS1_COMPRESS_MASK;
+				struct startup_header	old, new;
+				int						big = shdr.flags1 & STARTUP_HDR_FLAGS1_BIGENDIAN;
 
 				fseek(fp, 0L, SEEK_END);
+				shdr.flags1 &= ~STARTUP_HDR_FLAGS1_COMPRESS_MASK;
 				shdr.stored_size = ftell(fp) - spos;
+
 				fseek(fp, spos, SEEK_SET);
-				if(fwrite((void *)&shdr, sizeof shdr, 1, fp) != 1) {
+				if(fread(&old, sizeof old, 1, fp) != 1) {
+					error(1, "Early end reading startup header");
+					return;
+				}
+				new = old;
+				new.flags1 = shdr.flags1;
+				new.stored_size = CROSSENDIAN(big) ? ENDIAN_RET32(shdr.stored_size) : shdr.stored_size;
+				fseek(fp, spos, SEEK_SET);
+				if(fwrite((void *)&new, sizeof new, 1, fp) != 1) {
 					error(1, "Fixup startup header error");
 					return;
 				}
 
-				fseek(fp, spos + shdr.startup_size-sizeof(stlr), SEEK_SET);
+				// Only the header changed, so the checksum is adjusted by
+				// the difference.
+				fseek(fp, zstart - sizeof(stlr), SEEK_SET);
 				if(fread(&stlr, sizeof(stlr), 1, fp) != 1) {
 					error(1, "Early end reading startup trailer");
 					return;
 				}
+				stlr.cksum = ifs_cksum_patch(stlr.cksum, ifs_cksum_delta(&old, 0, &new, sizeof new, big), big);
 
-				stlr.cksum = calc_cksum(fp, spos, (shdr.startup_size-sizeof(stlr)));
-
-				fseek(fp, spos + shdr.startup_size-sizeof(stlr), SEEK_SET);
+				fseek(fp, zstart - sizeof(stlr), SEEK_SET);
 				if(fwrite((void *)&stlr, sizeof stlr, 1, fp) != 1) {
 					error(1, "Fixup startup trailer error");
 					return;
@@ -750,66 +1822,62 @@ void process(const char *file, FILE *fp) {
 
 				rewind(fp);
 			}
-		}
-
-		if(CROSSENDIAN(shdr.flags1 & STARTUP_HDR_FLAGS1_BIGENDIAN)) {
-			uint32_t	*p;
 
-			shdr.version = ENDIAN_RET16(shdr.version);
-			shdr.machine = ENDIAN_RET16(shdr.machine);
-			shdr.header_size = ENDIAN_RET16(shdr.header_size);
-			shdr.preboot_size = ENDIAN_RET16(shdr.preboot_size);
-			for(p = (uint32_t *)&shdr.startup_vaddr; (unsigned char *)p < (unsigned char *)&shdr + sizeof shdr; p++) {
-				if(p != (uint32_t *)&shdr.preboot_size) {
-					*p = ENDIAN_RET32(*p);
-				}
+			if(img_map(fp) == -1 || ifs_locate(&img, zstart, IFS_LOCATE_AT, &loc) != IFS_OK) {
+				error(1, "Unable to find image header in %s", file);
+				img_unmap();
+				return;
 			}
-		}
-		fseek(fp, spos + shdr.startup_size, SEEK_SET);
-		if((ipos = find(fp, ihdr.signature, sizeof ihdr.signature, -1)) == -1) {
-			error(1, "Unable to find image header in %s", file);
-			return;
-		}
-	}
-	if(fread((char *)&ihdr + sizeof ihdr.signature, sizeof ihdr - sizeof ihdr.signature, 1, fp) != 1) {
-		error(1, "Unable to read image %s", file);
-		return;
-	}
-	if(CROSSENDIAN(ihdr.flags & IMAGE_FLAGS_BIGENDIAN)) {
-		uint32_t	*p;
-
-		for(p = (uint32_t *)&ihdr.image_size; (unsigned char *)p < (unsigned char *)&ihdr + offsetof(struct image_header, mountpoint); p++) {
-			*p = ENDIAN_RET32(*p);
+			ipos = loc.ipos;
+			ihdr = loc.ihdr;
 		}
 	}
 
+	// Likewise the image from its header to the end of its trailer.
 	if(flags & (FLAG_CHECK_CRC)) {
-		struct image_trailer	itlr;
-		uint32_t cksum = calc_cksum(fp, ipos, (ihdr.image_size-sizeof(itlr)));
+		uint32_t	sum;
 
-		fseek(fp, ipos + ihdr.image_size-sizeof(itlr), SEEK_SET);
-		if(fread(&itlr, sizeof(itlr), 1, fp) != 1) {
+		if(img_cksum(ipos, ihdr.image_size, ihdr.flags & IMAGE_FLAGS_BIGENDIAN, &sum) == -1) {
 			error(1, "Early end reading image trailer");
+			img_unmap();
 			return;
 		}
-		if(cksum != itlr.cksum) {
+		if(sum != 0) {
 			error(1, "Image header checksum mismatch");
+			img_unmap();
 			return;
 		}
 	}
 
+	if(flags & (FLAG_VERIFY)) {
+		if(verbose) {
+			printf("%s: checksums OK\n", file);
+		}
+		img_unmap();
+		return;
+	}
+
 	if(flags & (FLAG_EXTRACT_RAW)) {
 		char imagefs_name[] = "imagefs";
 		FILE *fp_ext;
-		int n;
+		const void *p;
 
 		// Extract ImageFS
 		if(!(fp_ext = fopen(imagefs_name, "wb"))) {
 			error(0, "Unable to open %s: %s\n", imagefs_name, strerror(errno));
 		}
-		fseek(fp, ipos, SEEK_SET);
-		for(n = 0 ; n < ihdr.image_size; ++n) {
-			putc(getc(fp), fp_ext);
+		if(img.mapped && img.method == 0) {
+			// The image is all there in the file, so leave it to the
+			// kernel.
+			if(ihdr.image_size > img.size - ipos) {
+				error(1, "Early end reading image");
+			} else if(ifs_copy_range(fileno(fp_ext), fileno(fp), ipos, ihdr.image_size) == -1) {
+				error(0, "Unable to write %s: %s\n", imagefs_name, strerror(errno));
+			}
+		} else if((p = img_span(ipos, ihdr.image_size)) == NULL) {
+			error(1, "Early end reading image");
+		} else if(fwrite(p, ihdr.image_size, 1, fp_ext) != 1) {
+			error(0, "Unable to write %s: %s\n", imagefs_name, strerror(errno));
 		}
 		fclose(fp_ext);
 
@@ -834,94 +1902,24 @@ void process(const char *file, FILE *fp) {
 				printf(" %8lx %8lx  %s\n", spos + sizeof shdr, shdr.startup_size - sizeof shdr, "startup.*");
 			}
 		}
-		display_ihdr(fp, ipos, &ihdr);
+		display_ihdr(ipos, &ihdr);
 		if(check("Image-directory") == 0) {
 			printf(" %8x %8x  %s\n", dpos, ihdr.hdr_dir_size - ihdr.dir_offset, "Image-directory");
 		}
 	}
 
-	while(!processing_done) {
-		char						buff[1024];
-		union image_dirent			*dir = (union image_dirent *)buff;
-
-		fseek(fp, dpos, SEEK_SET);
-		if(fread(&dir->attr, sizeof dir->attr, 1, fp) != 1) {
-			error(1, "Early end reading directory");
-			break;
-		}
-		if(CROSSENDIAN(ihdr.flags & IMAGE_FLAGS_BIGENDIAN)) {
-			uint32_t	*p;
-
-			dir->attr.size = ENDIAN_RET16(dir->attr.size);
-			dir->attr.extattr_offset = ENDIAN_RET16(dir->attr.extattr_offset);
-			for(p = (uint32_t *)&dir->attr.ino; (unsigned char *)p < (unsigned char *)dir + sizeof dir->attr; p++) {
-				*p = ENDIAN_RET32(*p);
-			}
-		}
-		if(dir->attr.size < sizeof dir->attr) {
-			if(dir->attr.size != 0) {
-				error(1, "Invalid dir entry");
-			}
-			break;
-		}
-		if(dir->attr.size > sizeof dir->attr) {
-			if(fread((char *)dir + sizeof dir->attr, min(sizeof buff, dir->attr.size) - sizeof dir->attr, 1, fp) != 1) {
-				error(1, "Error reading directory");
-				break;
-			}
-		}
-		dpos += dir->attr.size;
-
-		switch(dir->attr.mode & S_IFMT) {
-		case S_IFREG:
-			if(CROSSENDIAN(ihdr.flags & IMAGE_FLAGS_BIGENDIAN)) {
-				dir->file.offset = ENDIAN_RET32(dir->file.offset);
-				dir->file.size = ENDIAN_RET32(dir->file.size);
-			}
-			if(dir->attr.ino == ihdr.script_ino) {
-				if(flags & (FLAG_EXTRACT_RAW))
-					extract_file(fp, ipos, &dir->file, 1);
-				else
-					process_file(fp, ipos, &dir->file);
-
-				if (verbose > 1)
-					display_script(fp, ipos + dir->file.offset, dir->file.size, NULL);
-			} else {
-				process_file(fp, ipos, &dir->file);
-			}
-			break;
-		case S_IFDIR:
-			process_dir(fp, ipos, &dir->dir);
-			break;
-		case S_IFLNK:
-			if(CROSSENDIAN(ihdr.flags & IMAGE_FLAGS_BIGENDIAN)) {
-				dir->symlink.sym_offset = ENDIAN_RET16(dir->symlink.sym_offset);
-				dir->symlink.sym_size = ENDIAN_RET16(dir->symlink.sym_size);
-			}
-			process_symlink(fp, ipos, &dir->symlink);
-			break;
-		case S_IFCHR:
-		case S_IFBLK:
-		case S_IFIFO:
-		case S_IFNAM:
-			if(CROSSENDIAN(ihdr.flags & IMAGE_FLAGS_BIGENDIAN)) {
-				dir->device.dev = ENDIAN_RET32(dir->device.dev);
-				dir->device.rdev = ENDIAN_RET32(dir->device.rdev);
-			}
-			process_device(fp, ipos, &dir->device);
-			// dir->device;
-			break;
-		default:
-			error(1, "Unknown type\n");
-			break;
-		}
+	if((flags & (FLAG_MD5|FLAG_DIFF)) && img.method == 0) {
+		hash_prepare(ipos, dpos, CROSSENDIAN(ihdr.flags & IMAGE_FLAGS_BIGENDIAN));
 	}
+
+	process_dirents(ipos, dpos, &ihdr);
+	extract_flush();
+	hash_free();
 	if(flags & FLAG_DISPLAY) {
 		struct image_trailer	itlr;
 		struct startup_trailer	stlr;
 
-		fseek(fp, ipos + ihdr.image_size-sizeof(itlr), SEEK_SET);
-		if(fread(&itlr, sizeof(itlr), 1, fp) != 1) {
+		if(img_read(ipos + ihdr.image_size-sizeof(itlr), &itlr, sizeof(itlr)) == -1) {
 			error(1, "Early end reading image trailer");
 			return;
 		}
@@ -930,8 +1928,7 @@ void process(const char *file, FILE *fp) {
 		else
 			printf("Checksums: image=%#x", itlr.cksum);
 		if(spos != -1) {
-			fseek(fp, spos + shdr.startup_size-sizeof(stlr), SEEK_SET);
-			if(fread(&stlr, sizeof(stlr), 1, fp) != 1) {
+			if(img_read(spos + shdr.startup_size-sizeof(stlr), &stlr, sizeof(stlr)) == -1) {
 				printf("\n");
 				error(1, "Early end reading startup trailer");
 				return;
@@ -949,23 +1946,103 @@ void process(const char *file, FILE *fp) {
 		if(fp_bootstrap)
 			fclose(fp_bootstrap);
 	}
+	img_unmap();
 }
 
-int copy(FILE *from, FILE *to, int nbytes) {
-	char			buff[4096];
-	int				n;
-
-	while(nbytes > 0) {
-		n = min(sizeof buff, nbytes);
-		if(fread(buff, n, 1, from) != 1) {
-			return -1;
+//
+// Extract an image read from a stream in a single pass. The directory
+// comes before the file data, so it's read into memory first, where it
+// stands in for the image while it's walked (the offsets are from the
+// image header from then on). That only queues the files, which
+// extract_flush() then writes in the order their data comes.
+//
+void process_stream(const char *file, FILE *fp) {
+	struct startup_header	shdr;
+	struct image_header		ihdr;
+	const unsigned char		*p;
+	unsigned char			*dir;
+	unsigned long			n;
+	unsigned				ssize;
+	int						method;
+
+	strm.fp = fp;
+	if((strm.raw = malloc(STREAM_BUF)) == NULL || (strm.cblock = malloc(IFS_BLOCK_SIZE)) == NULL) {
+		error(0, "No memory to read %s", file);
+	}
+	streaming = 1;
+
+	p = stream_peek(sizeof ihdr.signature, &n);
+	if(n < sizeof ihdr.signature || memcmp(p, IMAGE_SIGNATURE, sizeof ihdr.signature) != 0) {
+		// Find the startup header, and the image after it.
+		for( ;; ) {
+			if(stream_scan((1 << SIG_STARTUP) | (1 << SIG_STARTUP_SWAP)) == -1) {
+				error(1, "Unable to find startup header in %s", file);
+				return;
+			}
+			p = stream_peek(sizeof shdr, &n);
+			if(n < sizeof shdr) {
+				error(1, "Unable to read image %s", file);
+				return;
+			}
+			memcpy(&shdr, p, sizeof shdr);
+			if(zero_ok(&shdr)) {
+				break;
+			}
+			if(!zero_check_enabled) {
+				if(verbose)
+					printf("Warning: Non zero data in zero fields ignored\n");
+				break;
+			}
+			stream_consume(1);
 		}
-		if(fwrite(buff, n, 1, to) != 1) {
-			return -1;
+		ssize = CROSSENDIAN(shdr.flags1 & STARTUP_HDR_FLAGS1_BIGENDIAN)
+					? ENDIAN_RET32(shdr.startup_size) : shdr.startup_size;
+		if(stream_skip(strm.pos + ssize) == -1) {
+			error(1, "Early end reading startup");
+			return;
+		}
+		if((method = shdr.flags1 & STARTUP_HDR_FLAGS1_COMPRESS_MASK) != 0 && stream_compressed(method) == -1) {
+			error(1, "Unsupported compression type.");
+			return;
+		}
+		if(stream_scan(1 << SIG_IMAGE) == -1) {
+			error(1, "Unable to find image header in %s", file);
+			return;
 		}
-		nbytes -= n;
 	}
-	return 0;
+	strm.pos = 0;
+
+	if(stream_read(&ihdr, sizeof ihdr) == -1) {
+		error(1, "Unable to read image %s", file);
+		return;
+	}
+	if(CROSSENDIAN(ihdr.flags & IMAGE_FLAGS_BIGENDIAN)) {
+		ihdr.dir_offset = ENDIAN_RET32(ihdr.dir_offset);
+		ihdr.hdr_dir_size = ENDIAN_RET32(ihdr.hdr_dir_size);
+		ihdr.script_ino = ENDIAN_RET32(ihdr.script_ino);
+	}
+	if(ihdr.dir_offset < sizeof ihdr || ihdr.dir_offset > ihdr.hdr_dir_size
+	 || (dir = calloc(1, ihdr.hdr_dir_size + sizeof(struct image_attr))) == NULL) {
+		error(1, "Invalid image header in %s", file);
+		return;
+	}
+	if(stream_read(dir + sizeof ihdr, ihdr.hdr_dir_size - sizeof ihdr) == -1) {
+		free(dir);
+		error(1, "Early end reading directory");
+		return;
+	}
+	// An empty entry after the last one ends the walk.
+	ifs_image_mem(&img, dir, ihdr.hdr_dir_size + sizeof(struct image_attr), 0);
+
+	process_dirents(0, ihdr.dir_offset, &ihdr);
+	extract_flush();
+
+	img_unmap();
+	if(strm.method == STARTUP_HDR_FLAGS1_COMPRESS_ZLIB) {
+		inflateEnd(&strm.zs);
+	}
+	free(strm.raw);
+	free(strm.cblock);
 }
 
 void display_shdr(FILE *fp, int spos, struct startup_header *hdr) {
@@ -985,7 +2062,7 @@ void display_shdr(FILE *fp, int spos, struct startup_header *hdr) {
 	}
 }
 
-void display_ihdr(FILE *fp, int ipos, struct image_header *hdr) {
+void display_ihdr(int ipos, struct image_header *hdr) {
 	if(check("Image-header") != 0) {
 		return;
 	}
@@ -993,8 +2070,7 @@ void display_ihdr(FILE *fp, int ipos, struct image_header *hdr) {
 	if(hdr->mountpoint[0]) {
 		char				buff[512];
 
-		fseek(fp, ipos + offsetof(struct image_header, mountpoint), SEEK_SET);
-		if(fread(buff, min(sizeof buff, hdr->dir_offset - offsetof(struct image_header, mountpoint)), 1, fp) != 1) {
+		if(img_read(ipos + offsetof(struct image_header, mountpoint), buff, min(sizeof buff, hdr->dir_offset - offsetof(struct image_header, mountpoint))) == -1) {
 			error(1, "Unable to read image mountpoint");
 		} else {
 			printf(" mountpoint=%s", buff);
@@ -1069,7 +2145,7 @@ void display_attr(struct image_attr *attr) {
 	display_inode_flags(attr->ino);
 }
 
-void display_dir(FILE *fp, int ipos, struct image_dir *ent) {
+void display_dir(int ipos, struct image_dir *ent) {
 	if(check(ent->path[0] ? ent->path : "Root-dirent") != 0) {
 		return;
 	}
@@ -1079,9 +2155,15 @@ void display_dir(FILE *fp, int ipos, struct image_dir *ent) {
 	}
 }
 
-void process_dir(FILE *fp, int ipos, struct image_dir *ent) {
+void process_dir(int ipos, struct image_dir *ent) {
+	if((flags & FLAG_DIFF) && ent->path[0] && check(ent->path) == 0) {
+		diff_add(&ent->attr, ent->path, 0, 0, NULL, NULL);
+	}
+	if((flags & FLAG_ARCHIVE) && ent->path[0] && check(ent->path) == 0) {
+		archive_add(&ent->attr, ent->path, 0, 0, NULL, -1);
+	}
 	if(flags & FLAG_DISPLAY) {
-		display_dir(fp, ipos, ent);
+		display_dir(ipos, ent);
 	}
 	if((flags & (FLAG_EXTRACT_RAW)) && ent->path[0]) {
 		struct image_attr *attr = &ent->attr;
@@ -1090,7 +2172,7 @@ void process_dir(FILE *fp, int ipos, struct image_dir *ent) {
 	}
 }
 
-void display_symlink(FILE *fp, int ipos, struct image_symlink *ent) {
+void display_symlink(int ipos, struct image_symlink *ent) {
 	if(check(ent->path) != 0) {
 		return;
 	}
@@ -1100,9 +2182,15 @@ void display_symlink(FILE *fp, int ipos, struct image_symlink *ent) {
 	}
 }
 
-void process_symlink(FILE *fp, int ipos, struct image_symlink *ent) {
+void process_symlink(int ipos, struct image_symlink *ent) {
+	if((flags & FLAG_DIFF) && check(ent->path) == 0) {
+		diff_add(&ent->attr, ent->path, ent->sym_size, 0, &ent->path[ent->sym_offset], NULL);
+	}
+	if((flags & FLAG_ARCHIVE) && check(ent->path) == 0) {
+		archive_add(&ent->attr, ent->path, 0, 0, &ent->path[ent->sym_offset], -1);
+	}
 	if(flags & FLAG_DISPLAY) {
-		display_symlink(fp, ipos, ent);
+		display_symlink(ipos, ent);
 	}
 	if(flags & (FLAG_EXTRACT_RAW)) {
 		struct image_attr *attr = &ent->attr;
@@ -1113,7 +2201,7 @@ void process_symlink(FILE *fp, int ipos, struct image_symlink *ent) {
 	}
 }
 
-void display_device(FILE *fp, int ipos, struct image_device *ent) {
+void display_device(int ipos, struct image_device *ent) {
 	if(check(ent->path) != 0) {
 		return;
 	}
@@ -1124,9 +2212,15 @@ void display_device(FILE *fp, int ipos, struct image_device *ent) {
 	}
 }
 
-void process_device(FILE *fp, int ipos, struct image_device *ent) {
+void process_device(int ipos, struct image_device *ent) {
+	if((flags & FLAG_DIFF) && check(ent->path) == 0) {
+		diff_add(&ent->attr, ent->path, ent->dev, ent->rdev, NULL, NULL);
+	}
+	if((flags & FLAG_ARCHIVE) && check(ent->path) == 0) {
+		archive_add(&ent->attr, ent->path, 0, ent->rdev, NULL, -1);
+	}
 	if(flags & FLAG_DISPLAY) {
-		display_device(fp, ipos, ent);
+		display_device(ipos, ent);
 	}
 }
 
@@ -1161,11 +2255,292 @@ const char* get_phys_align(uint32_t offset) {
 	return str_4K;
 }
 
-void extract_file(FILE *fp, int ipos, const struct image_file *ent, int is_script) {
+//
+// Create the directory 'name' goes in. Dirents come sorted by path, so
+// this only has to be done when the directory changes.
+//
+void make_parent(const char *name) {
+	static char	*last_dir;
+	struct stat	sb;
+	char		*dir, *s = strdup(name);
+
+	dir = dirname(s);
+	if (last_dir == NULL || strcmp(last_dir, dir) != 0) {
+		if (!(stat(dir, &sb) == 0 && S_ISDIR(sb.st_mode))) {
+			mkdir_p(dir);
+		}
+		free(last_dir);
+		last_dir = strdup(dir);
+	}
+	free(s);
+}
+
+//
+// Parallel extraction (-j). The directory walk only creates the
+// directories and queues the files; once it is done a pool of workers
+// writes the file data straight from the image mapping with pwrite()
+// and sets the ownership, permissions and times of each file.
+//
+struct extract_job {
+	char				*name;
+	char				*path;
+	uint32_t			pos;
+	uint32_t			size;
+	struct image_attr	attr;
+	int					err;
+	const char			*failed;
+	unsigned			seq;		// order in the directory
+	int					fd;
+	int					skip;
+};
+
+struct extract_job	*jobs;
+unsigned			num_jobs;
+unsigned			max_jobs;
+unsigned			next_job;
+pthread_mutex_t		job_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void extract_queue(int ipos, const struct image_file *ent, const char *name) {
+	struct extract_job	*jp;
+
+	if(num_jobs >= max_jobs) {
+		max_jobs = max_jobs ? max_jobs * 2 : 256;
+		if((jobs = realloc(jobs, max_jobs * sizeof *jobs)) == NULL) {
+			error(0, "No memory for extraction list");
+		}
+	}
+	jp = &jobs[num_jobs++];
+	jp->name = strdup(name);
+	jp->path = strdup(ent->path);
+	if(jp->name == NULL || jp->path == NULL) {
+		error(0, "No memory for extraction list");
+	}
+	jp->pos = ipos + ent->offset;
+	jp->size = ent->size;
+	jp->attr = ent->attr;
+	jp->err = 0;
+	jp->failed = NULL;
+	jp->seq = num_jobs - 1;
+	jp->fd = -1;
+	jp->skip = 0;
+}
+
+//
+// Set the ownership, permissions and times of a file whose data has
+// been written, or remove it if that failed.
+//
+static void extract_done(struct extract_job *jp, int fd, double start) {
+	struct utimbuf		buff;
+
+	if(jp->err != 0) {
+		if(jp->failed == NULL) {
+			jp->failed = "Unable to create file";
+		}
+		close(fd);
+		unlink(jp->name);
+		return;
+	}
+	fchmod(fd, jp->attr.mode & 07777);
+	fchown(fd, jp->attr.uid, jp->attr.gid);
+	close(fd);
+	buff.actime = buff.modtime = jp->attr.mtime;
+	utime(jp->name, &buff);
+	ifs_trace_span("extract", jp->path, start, jp->name, -1, jp->size);
+}
+
+static void extract_run(struct extract_job *jp) {
+	const unsigned char	*data = img_span(jp->pos, jp->size);
+	double				start = ifs_trace_now();
+	uint32_t			off;
+	ssize_t				n;
+	int					fd;
+
+	if((fd = open(jp->name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+		jp->err = errno;
+		jp->failed = "Unable to open";
+		return;
+	}
+	ftruncate(fd, jp->size); /* pregrow the dst file */
+	if(data == NULL) {
+		jp->err = EIO;
+		jp->failed = "Early end reading";
+	}
+	for(off = 0; jp->err == 0 && off < jp->size; off += n) {
+		if((n = pwrite(fd, data + off, jp->size - off, off)) <= 0) {
+			jp->err = (n == 0) ? EIO : errno;
+		}
+	}
+	extract_done(jp, fd, start);
+}
+
+static void *extract_worker(void *arg) {
+	char		tname[32];
+	unsigned	i;
+
+	snprintf(tname, sizeof tname, "extract %d", (int)(intptr_t)arg);
+	ifs_trace_thread_name(tname);
+	for( ;; ) {
+		pthread_mutex_lock(&job_mutex);
+		i = next_job++;
+		pthread_mutex_unlock(&job_mutex);
+		if(i >= num_jobs) break;
+		extract_run(&jobs[i]);
+	}
+	return NULL;
+}
+
+static int job_by_name(const void *a, const void *b) {
+	const struct extract_job	*ja = a, *jb = b;
+	int							r = strcmp(ja->name, jb->name);
+
+	return r ? r : (ja->seq > jb->seq) - (ja->seq < jb->seq);
+}
+
+static int job_by_pos(const void *a, const void *b) {
+	const struct extract_job	*ja = a, *jb = b;
+
+	if(ja->pos != jb->pos) {
+		return (ja->pos > jb->pos) - (ja->pos < jb->pos);
+	}
+	return (ja->seq > jb->seq) - (ja->seq < jb->seq);
+}
+
+//
+// Write the queued files from the stream, in the order their data comes.
+// Files whose data starts at the same place are written together. Data
+// that has gone by already can't be gone back to.
+//
+static void stream_extract(void) {
+	struct extract_job	*jp, *grp, *end;
+	const unsigned char	*p;
+	unsigned long		n;
+	uint32_t			off, size;
+	double				start;
+	ssize_t				w;
+
+	// Basenames can collide, and then the last file has to win.
+	if(flags & FLAG_BASENAME) {
+		qsort(jobs, num_jobs, sizeof *jobs, job_by_name);
+		for(jp = jobs; jp + 1 < jobs + num_jobs; ++jp) {
+			jp->skip = strcmp(jp->name, jp[1].name) == 0;
+		}
+	}
+	qsort(jobs, num_jobs, sizeof *jobs, job_by_pos);
+
+	for(grp = jobs; grp < jobs + num_jobs; grp = end) {
+		start = ifs_trace_now();
+		size = 0;
+		for(end = grp; end < jobs + num_jobs && end->pos == grp->pos; ++end) {
+			if(end->skip) continue;
+			if((end->fd = open(end->name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+				end->err = errno;
+				end->failed = "Unable to open";
+				continue;
+			}
+			if(grp->pos < strm.pos) {
+				end->err = ESPIPE;
+			}
+			size = max(size, end->size);
+		}
+		if(size != 0 && stream_skip(grp->pos) == -1) {
+			for(jp = grp; jp < end; ++jp) {
+				if(jp->err == 0) jp->err = (grp->pos < strm.pos) ? ESPIPE : EIO;
+			}
+			size = 0;
+		}
+		for(off = 0; off < size; off += n) {
+			p = stream_peek(1, &n);
+			if(n == 0) {
+				for(jp = grp; jp < end; ++jp) {
+					if(jp->err == 0 && jp->size > off) {
+						jp->err = EIO;
+						jp->failed = "Early end reading";
+					}
+				}
+				break;
+			}
+			n = min(n, size - off);
+			for(jp = grp; jp < end; ++jp) {
+				unsigned long	k, done;
+
+				if(jp->fd == -1 || jp->err != 0 || off >= jp->size) continue;
+				k = min(n, jp->size - off);
+				for(done = 0; done < k; done += w) {
+					if((w = write(jp->fd, p + done, k - done)) <= 0) {
+						jp->err = (w == 0) ? EIO : errno;
+						break;
+					}
+				}
+			}
+			stream_consume(n);
+		}
+		for(jp = grp; jp < end; ++jp) {
+			if(jp->fd != -1) {
+				extract_done(jp, jp->fd, start);
+			}
+		}
+	}
+}
+
+static void extract_threads(void) {
+	pthread_t	*tids;
+	int			i, nthreads;
+
+	nthreads = min(extract_jobs, num_jobs);
+	if((tids = malloc(nthreads * sizeof *tids)) == NULL) {
+		error(0, "No memory for extraction threads");
+	}
+	for(i = 0; i < nthreads; ++i) {
+		if(pthread_create(&tids[i], NULL, extract_worker, (void *)(intptr_t)(i + 1)) != 0) {
+			break;
+		}
+	}
+	nthreads = i;
+	if(nthreads == 0) {
+		extract_worker(NULL);
+	}
+	for(i = 0; i < nthreads; ++i) {
+		pthread_join(tids[i], NULL);
+	}
+	free(tids);
+}
+
+//
+// Write out everything queued by extract_queue().
+//
+void extract_flush(void) {
+	int			i;
+
+	if(num_jobs == 0) {
+		return;
+	}
+	if(streaming) {
+		stream_extract();
+	} else {
+		extract_threads();
+	}
+
+	for(i = 0; i < num_jobs; ++i) {
+		if(jobs[i].err != 0) {
+			error(0, "%s %s: %s\n", jobs[i].failed, jobs[i].name, strerror(jobs[i].err));
+		}
+		if(verbose) {
+			printf("Extracted %s\n", jobs[i].name);
+		}
+		free(jobs[i].name);
+		free(jobs[i].path);
+	}
+	free(jobs);
+	jobs = NULL;
+	num_jobs = max_jobs = next_job = 0;
+}
+
+void extract_file(int ipos, const struct image_file *ent, int is_script) {
 	char			*name, nbuff[_POSIX_PATH_MAX];
 	FILE			*dst;
 	struct utimbuf	buff;
 	struct extract_file *ef;
+	double			start;
 
 	if(check(ent->path) != 0) {
 		return;
@@ -1193,18 +2568,18 @@ void extract_file(FILE *fp, int ipos, const struct image_file *ent, int is_scrip
 	}
 
 	if (!(flags & FLAG_BASENAME)) {
-		struct stat sb;
-		char		*dir, *s = strdup(name);
-
-		dir = dirname(s);
-
-		if (!(stat(dir, &sb) == 0 && S_ISDIR(sb.st_mode))) {
-			mkdir_p(dir);
-		}
+		make_parent(name);
+	}
 
-		free(s);
+	// Basenames can collide, and then the last file has to win. An
+	// image read on demand can only be read by one thread. A stream has
+	// to be read in order, so everything waits for the directory walk.
+	if(streaming || (extract_jobs > 1 && !is_script && !(flags & FLAG_BASENAME) && img.method == 0)) {
+		extract_queue(ipos, ent, name);
+		return;
 	}
 
+	start = ifs_trace_now();
 	if(!(dst = fopen(name, "wb"))) {
 		error(0, "Unable to open %s: %s\n", name, strerror(errno));
 	}
@@ -1212,18 +2587,26 @@ void extract_file(FILE *fp, int ipos, const struct image_file *ent, int is_scrip
 	if (is_script) {
 		struct image_attr *attr = &ent->attr;
 
-		display_script(fp, ipos + ent->offset, ent->size, dst);
+		display_script(ipos + ent->offset, ent->size, dst);
 
 		fprintf(fp_bld, "[type=file gid=%d uid=%d perms=%#o mtime=%u phys_align=%s +script] %s=%s\n",
 				attr->gid, attr->uid, attr->mode & ~S_IFMT, attr->mtime,
 				get_phys_align(ipos + ent->offset), ent->path, name);
 
 	} else {
-		fseek(fp, ipos + ent->offset, SEEK_SET);
+		const unsigned char	*data;
+		unsigned long		off, n;
+
 		ftruncate(fileno(dst), ent->size); /* pregrow the dst file */
-		if(copy(fp, dst, ent->size) == -1) {
-			unlink(name);
-			error(0, "Unable to create file %s: %s\n", name, strerror(errno));
+		for(off = 0; off < ent->size; off += n) {
+			if((data = img_piece(ipos + ent->offset + off, ent->size - off, &n)) == NULL) {
+				unlink(name);
+				error(0, "Early end reading %s\n", name);
+			}
+			if(fwrite(data, n, 1, dst) != 1) {
+				unlink(name);
+				error(0, "Unable to create file %s: %s\n", name, strerror(errno));
+			}
 		}
 	}
 
@@ -1232,17 +2615,28 @@ void extract_file(FILE *fp, int ipos, const struct image_file *ent, int is_scrip
 	fclose(dst);
 	buff.actime = buff.modtime = ent->attr.mtime;
 	utime(name, &buff);
+	ifs_trace_span("extract", ent->path, start, name, -1, ent->size);
 	if(verbose) {
 		printf("Extracted %s\n", name);
 	}
 }
 
-void process_file(FILE *fp, int ipos, struct image_file *ent) {
+void process_file(int ipos, struct image_file *ent) {
+	if(flags & FLAG_DIFF) {
+		unsigned char	digest[HASH_MAX_LENGTH];
+
+		if(check(ent->path) == 0) {
+			diff_add(&ent->attr, ent->path, ent->size, 0, NULL, file_hash(ipos, ent, digest));
+		}
+	}
 	if(flags & FLAG_EXTRACT) {
-		extract_file(fp, ipos, ent, 0);
+		extract_file(ipos, ent, 0);
+	}
+	if((flags & FLAG_ARCHIVE) && check(ent->path) == 0) {
+		archive_add(&ent->attr, ent->path, ent->size, 0, NULL, ipos + ent->offset);
 	}
 	if(flags & (FLAG_MD5|FLAG_DISPLAY)) {
-		display_file(fp, ipos, ent);
+		display_file(ipos, ent);
 	}
 	if(flags & (FLAG_EXTRACT_RAW)) {
 		struct image_attr *attr = &ent->attr;
@@ -1346,11 +2740,10 @@ void dsp_index(const char *strv[], unsigned max, int index) {
 	}
 }
 
-void display_elf(FILE *fp, int pos, int size, char *name) {
+void display_elf(int pos, int size, char *name) {
 	Elf32_Ehdr			ehdr;
 
-	fseek(fp, pos, SEEK_SET);
-	if(fread(&ehdr, sizeof ehdr, 1, fp) != 1) {
+	if(img_read(pos, &ehdr, sizeof ehdr) == -1) {
 		return;
 	}
 	if(memcmp(ehdr.e_ident, ELFMAG, SELFMAG)) {
@@ -1446,8 +2839,7 @@ void display_elf(FILE *fp, int pos, int size, char *name) {
 		for(n = 0; n < ehdr.e_phnum; n++) {
 			Elf32_Phdr			phdr;
 
-			fseek(fp, pos + ehdr.e_phoff + n * ehdr.e_phentsize, SEEK_SET);
-			if(fread(&phdr, sizeof phdr, 1, fp) != 1) {
+			if(img_read(pos + ehdr.e_phoff + n * ehdr.e_phentsize, &phdr, sizeof phdr) == -1) {
 				error(1, "Unable to read phdr %d\n", n);
 				break;
 			}
@@ -1502,19 +2894,20 @@ int zero_ok (struct startup_header *shdr) {
            shdr->zero[2] == 0 );
 }
 
-void display_file(FILE *fp, int ipos, struct image_file *ent) {
+void display_file(int ipos, struct image_file *ent) {
 	if(check(ent->path) != 0) {
 		return;
 	}
 	printf(" %8x %8x  %s [file]", ipos + ent->offset, ent->size, ent->path);
 	if (flags & FLAG_MD5) {
-		unsigned char	md5_result[MD5_LENGTH];
-		int				i;
+		unsigned char		digest[HASH_MAX_LENGTH];
+		const unsigned char	*dp;
+		unsigned			i;
 
-		compute_md5(fp, ipos, ent, md5_result);
+		dp = file_hash(ipos, ent, digest);
 		printf(" ");
-		for ( i = 0; i < MD5_LENGTH; i++ ) {
-			printf("%02x", md5_result[i] );
+		for ( i = 0; i < hash_methods[hash_type].length; i++ ) {
+			printf("%02x", dp[i] );
 		}
 	}
 	printf("\n");
@@ -1522,40 +2915,604 @@ void display_file(FILE *fp, int ipos, struct image_file *ent) {
 		display_attr(&ent->attr);
 	}
 	if(verbose > 1) {
-		display_elf(fp, ipos + ent->offset, ent->size, basename(ent->path));
+		display_elf(ipos + ent->offset, ent->size, basename(ent->path));
 	}
 }
 
-void compute_md5(
-	FILE *fp,
-	int ipos,
-	struct image_file *ent,
-	unsigned char *md5_result)
-{
-	unsigned char buff[4096];
-	int nbytes, n;
-	MD5_CTX md5_ctx;
+//
+// Hash the 'size' bytes at 'pos' of the image into 'digest', -1 if the
+// image ends early. Safe to call from several threads at once when
+// the image isn't compressed.
+//
+int compute_hash(long pos, unsigned long size, unsigned char *digest) {
+	const unsigned char	*data;
+	unsigned long		off, n;
+	MD5_CTX				md5_ctx;
+	SHA2_CTX			sha2_ctx;
+
+	switch(hash_type) {
+	case HASH_MD5:
+		memset(&md5_ctx, 0, sizeof(md5_ctx));
+		MD5Init(&md5_ctx);
+		for (off = 0; off < size; off += n) {
+			if ((data = img_piece(pos + off, size - off, &n)) == NULL) {
+				return -1;
+			}
+			MD5Update(&md5_ctx, data, n);
+		}
+		MD5Final(digest, &md5_ctx);
+		break;
+	case HASH_SHA256:
+		SHA256Init(&sha2_ctx);
+		for (off = 0; off < size; off += n) {
+			if ((data = img_piece(pos + off, size - off, &n)) == NULL) {
+				return -1;
+			}
+			SHA256Update(&sha2_ctx, data, n);
+		}
+		SHA256Final(digest, &sha2_ctx);
+		break;
+	default:
+		// These want the whole file in one piece. Only a compressed
+		// image, which is hashed serially, needs it put together.
+		if (size == 0) {
+			data = (const unsigned char *)"";
+		} else if ((data = img_piece(pos, size, &n)) == NULL) {
+			return -1;
+		} else if (n != size) {
+			if (img.method == 0 || (data = img_span(pos, size)) == NULL) {
+				return -1;
+			}
+		}
+		if (hash_type == HASH_XXH3) {
+			ifs_xxh3(data, size, digest);
+		} else {
+			ifs_blake3(data, size, digest);
+		}
+		break;
+	}
+	return 0;
+}
+
+//
+// Parallel hashing (-m with more than one thread). Before the directory
+// walk, the files it is going to display are found and hashed by a pool
+// of workers straight from the image mapping. display_file() then picks
+// up the digests in directory order.
+//
+struct hash_job {
+	const char		*path;
+	uint32_t		pos;
+	uint32_t		size;
+	int				err;
+	unsigned char	digest[HASH_MAX_LENGTH];
+};
+
+struct hash_job		*hashes;
+unsigned			num_hashes;
+unsigned			max_hashes;
+unsigned			next_hash;
+unsigned			shown_hash;
+pthread_mutex_t		hash_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *hash_worker(void *arg) {
+	char			tname[32];
+	struct hash_job	*hp;
+	unsigned		i;
+	double			start;
+
+	snprintf(tname, sizeof tname, "hash %d", (int)(intptr_t)arg);
+	ifs_trace_thread_name(tname);
+	for( ;; ) {
+		pthread_mutex_lock(&hash_mutex);
+		i = next_hash++;
+		pthread_mutex_unlock(&hash_mutex);
+		if(i >= num_hashes) break;
+		hp = &hashes[i];
+		start = ifs_trace_now();
+		hp->err = compute_hash(hp->pos, hp->size, hp->digest);
+		ifs_trace_span("hash", hp->path, start, NULL, hp->size, hash_methods[hash_type].length);
+	}
+	return NULL;
+}
+
+void hash_prepare(int ipos, int dpos, int cross) {
+	struct image_file	file;
+	const void			*p;
+	uint32_t			mode;
+	pthread_t			*tids;
+	int					i, nthreads;
+
+	if((nthreads = thread_jobs()) < 2) {
+		return;
+	}
+	for( ;; ) {
+		if((p = img_span(dpos, sizeof file.attr)) == NULL) {
+			break;
+		}
+		memcpy(&file.attr, p, sizeof file.attr);
+		if(cross) {
+			file.attr.size = ENDIAN_RET16(file.attr.size);
+		}
+		if(file.attr.size < sizeof file.attr) {
+			break;
+		}
+		mode = cross ? ENDIAN_RET32(file.attr.mode) : file.attr.mode;
+		if(S_ISREG(mode)) {
+			if(file.attr.size <= offsetof(struct image_file, path)
+			 || (p = img_span(dpos, file.attr.size)) == NULL) {
+				break;
+			}
+			memcpy(&file, p, offsetof(struct image_file, path));
+			if(check((const char *)p + offsetof(struct image_file, path)) == 0) {
+				if(num_hashes >= max_hashes) {
+					max_hashes = max_hashes ? max_hashes * 2 : 256;
+					if((hashes = realloc(hashes, max_hashes * sizeof *hashes)) == NULL) {
+						error(0, "No memory for hash list");
+					}
+				}
+				hashes[num_hashes].path = (const char *)p + offsetof(struct image_file, path);
+				hashes[num_hashes].pos = ipos + (cross ? ENDIAN_RET32(file.offset) : file.offset);
+				hashes[num_hashes].size = cross ? ENDIAN_RET32(file.size) : file.size;
+				num_hashes++;
+			}
+		}
+		dpos += file.attr.size;
+	}
+
+	nthreads = min(nthreads, num_hashes);
+	if(nthreads < 2 || (tids = malloc(nthreads * sizeof *tids)) == NULL) {
+		// Too little to share out, display_file() hashes as it goes.
+		hash_free();
+		return;
+	}
+	for(i = 0; i < nthreads; ++i) {
+		if(pthread_create(&tids[i], NULL, hash_worker, (void *)(intptr_t)(i + 1)) != 0) {
+			break;
+		}
+	}
+	nthreads = i;
+	if(nthreads == 0) {
+		hash_worker(NULL);
+	}
+	for(i = 0; i < nthreads; ++i) {
+		pthread_join(tids[i], NULL);
+	}
+	free(tids);
+}
+
+void hash_free(void) {
+	free(hashes);
+	hashes = NULL;
+	num_hashes = max_hashes = next_hash = shown_hash = 0;
+}
+
+//
+// The digest of a file, from hash_prepare() if it was done there.
+//
+const unsigned char *file_hash(int ipos, struct image_file *ent, unsigned char *digest) {
+	uint32_t	pos = ipos + ent->offset;
+	int			err;
+
+	// Files that weren't displayed after all are skipped over.
+	while(shown_hash < num_hashes
+	 && (hashes[shown_hash].pos != pos || hashes[shown_hash].size != ent->size)) {
+		shown_hash++;
+	}
+	if(shown_hash < num_hashes) {
+		err = hashes[shown_hash].err;
+		digest = hashes[shown_hash++].digest;
+	} else {
+		err = compute_hash(pos, ent->size, digest);
+	}
+	if(err != 0) {
+		error(0, "Error reading %d bytes for %s calculation: past the end of the image\n",
+				ent->size, hash_methods[hash_type].name);
+	}
+	return digest;
+}
+
+//
+// Image comparison (--diff). Each image is walked in turn, reading a
+// compressed one on demand, and its entries are recorded with a hash
+// of each file's contents. The two lists are then matched up by path.
+// Deleted files whose contents turn up again under a new path are
+// reported as moved.
+//
+struct diff_entry {
+	char				*path;
+	struct image_attr	attr;
+	uint32_t			size;		// file size, device number
+	uint32_t			rdev;
+	char				*target;	// symlink contents
+	int					paired;		// the path is in both images
+	int					moved;
+	unsigned char		digest[HASH_MAX_LENGTH];
+};
+
+struct diff_list {
+	struct diff_entry	*ents;
+	unsigned			num;
+	unsigned			max;
+} diff_lists[2];
+
+void diff_add(const struct image_attr *attr, const char *path, uint32_t size,
+			uint32_t rdev, const char *target, const unsigned char *digest) {
+	struct diff_list	*dl = &diff_lists[diff_side];
+	struct diff_entry	*dp;
+
+	if(dl->num >= dl->max) {
+		dl->max = dl->max ? dl->max * 2 : 256;
+		if((dl->ents = realloc(dl->ents, dl->max * sizeof *dl->ents)) == NULL) {
+			error(0, "No memory for directory list");
+		}
+	}
+	dp = &dl->ents[dl->num++];
+	memset(dp, 0, sizeof *dp);
+	dp->path = strdup(path);
+	dp->target = target ? strdup(target) : NULL;
+	if(dp->path == NULL || (target != NULL && dp->target == NULL)) {
+		error(0, "No memory for directory list");
+	}
+	dp->attr = *attr;
+	dp->size = size;
+	dp->rdev = rdev;
+	if(digest != NULL) {
+		memcpy(dp->digest, digest, hash_methods[hash_type].length);
+	}
+}
+
+static int diff_by_path(const void *a, const void *b) {
+	return strcmp(((const struct diff_entry *)a)->path, ((const struct diff_entry *)b)->path);
+}
+
+// Whether the contents of two entries of the same type differ.
+static int diff_contents(const struct diff_entry *a, const struct diff_entry *b) {
+	switch(a->attr.mode & S_IFMT) {
+	case S_IFREG:
+		return a->size != b->size || memcmp(a->digest, b->digest, hash_methods[hash_type].length) != 0;
+	case S_IFLNK:
+		return strcmp(a->target, b->target) != 0;
+	case S_IFDIR:
+		return 0;
+	default:
+		return a->size != b->size || a->rdev != b->rdev;
+	}
+}
+
+// Report the attributes that differ, return 1 if any do.
+static int diff_attrs(const struct diff_entry *a, const struct diff_entry *b) {
+	const uint32_t		ino_flags = IFS_INO_PROCESSED_ELF | IFS_INO_RUNONCE_ELF | IFS_INO_BOOTSTRAP_EXE;
+
+	if(((a->attr.mode ^ b->attr.mode) & ~S_IFMT) == 0 && (a->attr.uid == b->attr.uid)
+	 && (a->attr.gid == b->attr.gid) && (a->attr.mtime == b->attr.mtime)
+	 && ((a->attr.ino ^ b->attr.ino) & ino_flags) == 0) {
+		return 0;
+	}
+	printf("T %s", b->path);
+	if((a->attr.mode ^ b->attr.mode) & ~S_IFMT) {
+		printf(" mode=%#o->%#o", a->attr.mode & ~S_IFMT, b->attr.mode & ~S_IFMT);
+	}
+	if(a->attr.uid != b->attr.uid) {
+		printf(" uid=%d->%d", a->attr.uid, b->attr.uid);
+	}
+	if(a->attr.gid != b->attr.gid) {
+		printf(" gid=%d->%d", a->attr.gid, b->attr.gid);
+	}
+	if(a->attr.mtime != b->attr.mtime) {
+		printf(" mtime=%08x->%08x", a->attr.mtime, b->attr.mtime);
+	}
+	if((a->attr.ino ^ b->attr.ino) & ino_flags) {
+		printf(" flags=%u->%u", get_inode_flags(a->attr.ino), get_inode_flags(b->attr.ino));
+	}
+	printf("\n");
+	return 1;
+}
+
+//
+// Print the differences between the two images, return the number of
+// them.
+//
+int diff_report(void) {
+	struct diff_list	*old = &diff_lists[0];
+	struct diff_list	*new = &diff_lists[1];
+	struct diff_entry	*a, *b;
+	unsigned			i, j;
+	int					count = 0;
+	int					cmp;
+
+	qsort(old->ents, old->num, sizeof *old->ents, diff_by_path);
+	qsort(new->ents, new->num, sizeof *new->ents, diff_by_path);
+
+	for(i = j = 0; i < old->num && j < new->num; ) {
+		cmp = strcmp(old->ents[i].path, new->ents[j].path);
+		if(cmp == 0) {
+			old->ents[i++].paired = 1;
+			new->ents[j++].paired = 1;
+		} else if(cmp < 0) {
+			i++;
+		} else {
+			j++;
+		}
+	}
+
+	// A deleted file whose contents were added under another path moved.
+	for(i = 0; i < old->num; ++i) {
+		a = &old->ents[i];
+		if(a->paired || !S_ISREG(a->attr.mode)) {
+			continue;
+		}
+		for(j = 0; j < new->num; ++j) {
+			b = &new->ents[j];
+			if(!b->paired && !b->moved && S_ISREG(b->attr.mode) && !diff_contents(a, b)) {
+				a->moved = b->moved = 1;
+				printf("R %s -> %s\n", a->path, b->path);
+				count++;
+				break;
+			}
+		}
+	}
+
+	for(i = j = 0; i < old->num || j < new->num; ) {
+		a = (i < old->num) ? &old->ents[i] : NULL;
+		b = (j < new->num) ? &new->ents[j] : NULL;
+		cmp = (a == NULL) ? 1 : (b == NULL) ? -1 : strcmp(a->path, b->path);
+		if(cmp < 0) {
+			if(!a->moved) {
+				printf("D %s\n", a->path);
+				count++;
+			}
+			i++;
+		} else if(cmp > 0) {
+			if(!b->moved) {
+				printf("A %s\n", b->path);
+				count++;
+			}
+			j++;
+		} else {
+			if((a->attr.mode & S_IFMT) != (b->attr.mode & S_IFMT)) {
+				printf("M %s (type)\n", b->path);
+				count++;
+			} else if(diff_contents(a, b)) {
+				if(S_ISREG(a->attr.mode) && a->size != b->size) {
+					printf("M %s (size %u->%u)\n", b->path, a->size, b->size);
+				} else if(S_ISLNK(a->attr.mode)) {
+					printf("M %s (%s->%s)\n", b->path, a->target, b->target);
+				} else {
+					printf("M %s\n", b->path);
+				}
+				count++;
+			}
+			count += diff_attrs(a, b);
+			i++;
+			j++;
+		}
+	}
+	if(verbose) {
+		printf("%u entries in the old image, %u in the new, %d differences\n", old->num, new->num, count);
+	}
+	return count;
+}
+
+//
+// Archive output (--to-tar, --to-cpio). Each dirent becomes a member
+// carrying its ownership, permissions and time, with file data copied
+// straight from the image. Tar members are ustar, with a pax header in
+// front when a name or id doesn't fit; cpio members are in the newc
+// format. Named special files have no equivalent and are left out.
+//
+#define TAR_BLOCK		512
+#define QNX_MAJOR(d)	(((d) >> 10) & 0x3f)
+#define QNX_MINOR(d)	((d) & 0x3ff)
+
+FILE				*archive_fp;
+unsigned long long	archive_off;
+unsigned			archive_ino;
+
+static const char	archive_zeros[2 * TAR_BLOCK];
+
+static void archive_write(const void *buf, size_t len) {
+	if(len != 0 && fwrite(buf, len, 1, archive_fp) != 1) {
+		error(0, "Unable to write %s: %s", archive_name, strerror(errno));
+	}
+	archive_off += len;
+}
+
+// Zeros up to the next multiple of 'align'.
+static void archive_pad(unsigned align) {
+	archive_write(archive_zeros, (align - archive_off % align) % align);
+}
+
+static void tar_octal(char *field, size_t len, unsigned long long v) {
+	snprintf(field, len, "%0*llo", (int)len - 1, v);
+}
+
+static void tar_block(char *hdr, const char *name, int type, const struct image_attr *attr,
+					uint32_t size, const char *link, uint32_t rdev) {
+	unsigned	sum, i;
+
+	strncpy(hdr, name, 100);
+	tar_octal(hdr + 100, 8, attr->mode & 07777);
+	tar_octal(hdr + 108, 8, min(attr->uid, 07777777));
+	tar_octal(hdr + 116, 8, min(attr->gid, 07777777));
+	tar_octal(hdr + 124, 12, size);
+	tar_octal(hdr + 136, 12, attr->mtime);
+	hdr[156] = type;
+	if(link != NULL) {
+		strncpy(hdr + 157, link, 100);
+	}
+	memcpy(hdr + 257, "ustar", 6);
+	memcpy(hdr + 263, "00", 2);
+	if(type == '3' || type == '4') {
+		tar_octal(hdr + 329, 8, QNX_MAJOR(rdev));
+		tar_octal(hdr + 337, 8, QNX_MINOR(rdev));
+	}
+	memset(hdr + 148, ' ', 8);
+	for(sum = 0, i = 0; i < TAR_BLOCK; ++i) {
+		sum += (unsigned char)hdr[i];
+	}
+	snprintf(hdr + 148, 8, "%06o", sum);
+	archive_write(hdr, TAR_BLOCK);
+}
+
+// Add a "length key=value\n" pax record, the length counting itself.
+static size_t pax_record(char *buf, const char *key, const char *val) {
+	size_t	len = strlen(key) + strlen(val) + 3;
+	size_t	n;
+	char	digits[24];
+
+	n = len + snprintf(digits, sizeof digits, "%zu", len);
+	if(snprintf(digits, sizeof digits, "%zu", n) + len > n) {
+		n++;
+	}
+	return sprintf(buf, "%zu %s=%s\n", n, key, val);
+}
+
+static void tar_member(const char *path, int type, const struct image_attr *attr,
+					uint32_t size, const char *link, uint32_t rdev) {
+	char		hdr[TAR_BLOCK];
+	char		*name, *pax;
+	size_t		len, split, plen = 0;
+
+	len = strlen(path) + (type == '5');
+	if((name = malloc(len + 1)) == NULL) {
+		error(0, "No memory for archive header");
+	}
+	sprintf(name, "%s%s", path, (type == '5') ? "/" : "");
+	memset(hdr, 0, sizeof hdr);
 
-	if (fseek(fp, ipos + ent->offset, SEEK_SET) != 0) {
-		error(0, "fseek on source file for MD5 calculation failed: %s\n", strerror(errno));
+	// A name that's too long goes in the prefix field up to a '/'.
+	split = 0;
+	if(len > 100) {
+		for(split = min(len - 2, 155); split > 0; --split) {
+			if(name[split] == '/' && len - split - 1 <= 100) break;
+		}
+	}
+	if((len > 100 && split == 0) || (link != NULL && strlen(link) > 100)
+	 || attr->uid > 07777777 || attr->gid > 07777777) {
+		char	id[16];
+
+		if((pax = malloc(len + (link ? strlen(link) : 0) + 128)) == NULL) {
+			error(0, "No memory for archive header");
+		}
+		if(len > 100 && split == 0) {
+			plen += pax_record(pax + plen, "path", name);
+		}
+		if(link != NULL && strlen(link) > 100) {
+			plen += pax_record(pax + plen, "linkpath", link);
+		}
+		if(attr->uid > 07777777) {
+			snprintf(id, sizeof id, "%u", attr->uid);
+			plen += pax_record(pax + plen, "uid", id);
+		}
+		if(attr->gid > 07777777) {
+			snprintf(id, sizeof id, "%u", attr->gid);
+			plen += pax_record(pax + plen, "gid", id);
+		}
+		tar_block(hdr, "PaxHeaders/entry", 'x', attr, plen, NULL, 0);
+		archive_write(pax, plen);
+		archive_pad(TAR_BLOCK);
+		free(pax);
+		memset(hdr, 0, sizeof hdr);
+	}
+	if(split != 0) {
+		memcpy(hdr + 345, name, split);
+		tar_block(hdr, name + split + 1, type, attr, size, link, rdev);
+	} else {
+		tar_block(hdr, name, type, attr, size, link, rdev);
 	}
+	free(name);
+}
+
+static void cpio_member(const char *path, const struct image_attr *attr, uint32_t size, uint32_t rdev) {
+	char	hdr[111];
+	size_t	namesize = strlen(path) + 1;
+
+	snprintf(hdr, sizeof hdr, "070701%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X",
+			++archive_ino, attr->mode, attr->uid, attr->gid, S_ISDIR(attr->mode) ? 2 : 1,
+			attr->mtime, size, 0, 0, QNX_MAJOR(rdev), QNX_MINOR(rdev), (unsigned)namesize, 0);
+	archive_write(hdr, 110);
+	archive_write(path, namesize);
+	archive_pad(4);
+}
 
-	memset((unsigned char*)&md5_ctx, 0, sizeof(md5_ctx));
-	MD5Init(&md5_ctx);
+//
+// Add a dirent to the archive. A file's data comes from image offset
+// 'pos', a symlink's from 'target'.
+//
+void archive_add(const struct image_attr *attr, const char *path, uint32_t size,
+			uint32_t rdev, const char *target, long pos) {
+	const unsigned char	*p;
+	unsigned long		n;
+	uint32_t			off;
+	int					type;
+
+	switch(attr->mode & S_IFMT) {
+	case S_IFREG:	type = '0'; break;
+	case S_IFDIR:	type = '5'; size = 0; break;
+	case S_IFLNK:	type = '2'; break;
+	case S_IFCHR:	type = '3'; size = 0; break;
+	case S_IFBLK:	type = '4'; size = 0; break;
+	case S_IFIFO:	type = '6'; size = 0; break;
+	default:
+		if(verbose) {
+			fprintf(stderr, "%s: %s has no archive equivalent, left out\n", progname, path);
+		}
+		return;
+	}
 
-	nbytes = ent->size;
+	if(archive_format == ARCHIVE_TAR) {
+		tar_member(path, type, attr, (type == '0') ? size : 0, target, rdev);
+		if(type != '0') {
+			return;
+		}
+	} else {
+		if(target != NULL) {
+			size = strlen(target);
+		}
+		cpio_member(path, attr, size, rdev);
+		if(target != NULL) {
+			archive_write(target, size);
+		}
+	}
 
-	while (nbytes > 0) {
-		n = min(sizeof buff, nbytes);
-		if(fread(buff, n, 1, fp) != 1) {
-			error(0, "Error reading %d bytes for MD5 calculation: %s\n", n, strerror(errno));
+	for(off = 0; pos != -1 && off < size; off += n) {
+		if((p = img_piece(pos + off, size - off, &n)) == NULL) {
+			break;
 		}
+		archive_write(p, n);
+	}
+	if(pos != -1 && off < size) {
+		// Fill the member out so the rest of the archive can be read.
+		error(1, "Early end reading %s", path);
+		for( ; off < size; off += n) {
+			n = min(size - off, sizeof archive_zeros);
+			archive_write(archive_zeros, n);
+		}
+	}
+	archive_pad((archive_format == ARCHIVE_TAR) ? TAR_BLOCK : 4);
+}
 
-		MD5Update(&md5_ctx, buff, n);
-		nbytes -= n;
+void archive_open(void) {
+	if(strcmp(archive_name, "-") == 0) {
+		archive_fp = stdout;
+	} else if((archive_fp = fopen(archive_name, "wb")) == NULL) {
+		error(0, "Unable to open %s: %s", archive_name, strerror(errno));
 	}
+}
 
-	MD5Final(md5_result, &md5_ctx);
+void archive_close(void) {
+	static const struct image_attr	none;
+
+	if(archive_format == ARCHIVE_TAR) {
+		archive_write(archive_zeros, sizeof archive_zeros);
+	} else {
+		cpio_member("TRAILER!!!", &none, 0, 0);
+		archive_pad(TAR_BLOCK);
+	}
+	if(fflush(archive_fp) != 0 || ferror(archive_fp) || (archive_fp != stdout && fclose(archive_fp) != 0)) {
+		error(0, "Unable to write %s: %s", archive_name, strerror(errno));
+	}
 }
 
 #ifdef __QNXNTO__
@@ -0,0 +1,387 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ * 
+ * You must obtain a written license from and pay applicable license fees to QNX 
+ * Software Systems before you may reproduce, modify or distribute this software, 
+ * or any work that includes all or part of this software.   Free development 
+ * licenses are available for evaluation and non-commercial purposes.  For more 
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *  
+ * This file may contain contributions from others.  Please review this entire 
+ * file for other proprietary rights or license notices, as well as the QNX 
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/ 
+ * for other information.
+ * $
+ */
+
+//
+// ifs-replace - replace the contents of one file in an image.
+//
+// The new data is written over the file's old extent when it fits in
+// that extent plus the padding before the next file. Then only the
+// extent and the dirent change, and the image checksum is adjusted by
+// the difference between the old and new words. A file that doesn't
+// fit makes room for itself by moving the files after it along by a
+// multiple of a page, which keeps their alignment; the image sizes and
+// both checksums are then recomputed.
+// The image and the file in it are found through the libifs reader.
+// Compressed images have to be uncompressed with dumpifs -u first.
+//
+
+#include <lib/compat.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include _NTO_HDR_(sys/startup.h)
+#include _NTO_HDR_(sys/image.h)
+
+#include "xplatform.h"
+#include "libifs/ifs_cksum.h"
+#include "libifs/ifs_reader.h"
+
+#define RELOC_ALIGN		0x1000
+#define RUP(n, align)	(((n) + ((align)-1)) & ~((align)-1))
+
+#define XIP_FLAGS		(IFS_INO_PROCESSED_ELF | IFS_INO_BOOTSTRAP_EXE)
+
+char			*progname;
+int				verbose;
+
+unsigned char	*base;		// the image file, mapped read/write
+size_t			base_size;
+int				big;		// the image is big endian
+
+
+void usage(void) {
+	printf(("\
+%s - replace a file in an image file system\n\
+\n\
+%s	[-v] image_file_system_file path new_file\n\
+ -v       Verbose\n\
+\n\
+path is the name of the file in the image, with or without the\n\
+mountpoint. The image must not be compressed.\n"), progname, progname);
+}
+
+void error(char *p, ...) {
+	va_list				ap;
+
+	fprintf(stderr, "%s: ", progname);
+
+	va_start(ap, p);
+	vfprintf(stderr, p, ap);
+	va_end(ap);
+
+	fputc('\n', stderr);
+	exit(EXIT_FAILURE);
+}
+
+static uint32_t get32(size_t off, int b) {
+	const unsigned char	*p = base + off;
+
+	return b ? ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]
+			 : ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+static void put32(size_t off, uint32_t v, int b) {
+	unsigned char	*p = base + off;
+	int				i;
+
+	for(i = 0; i < 4; ++i, v >>= 8) {
+		p[b ? 3 - i : i] = v & 0xff;
+	}
+}
+
+static unsigned get16(size_t off, int b) {
+	const unsigned char	*p = base + off;
+
+	return b ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static void map_image(int fd, size_t size) {
+	if(base != NULL) {
+		munmap(base, base_size);
+	}
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(base == MAP_FAILED) {
+		error("Unable to map image: %s", strerror(errno));
+	}
+	base_size = size;
+}
+
+//
+// Patch 'len' bytes at 'off' from the image header, adding what that
+// does to the image sum to 'delta'.
+//
+static void patch_image(size_t ipos, size_t off, const void *src, size_t len, uint32_t *delta) {
+	*delta += ifs_cksum_delta(base + ipos, off, src, len, big);
+	memcpy(base + ipos + off, src, len);
+}
+
+static void patch32(size_t ipos, size_t off, uint32_t v, uint32_t *delta) {
+	unsigned char	b[4];
+	int				i;
+
+	for(i = 0; i < 4; ++i, v >>= 8) {
+		b[big ? 3 - i : i] = v & 0xff;
+	}
+	patch_image(ipos, off, b, sizeof b, delta);
+}
+
+static unsigned char *read_file(const char *path, struct stat *st) {
+	unsigned char	*data;
+	FILE			*fp;
+
+	if((fp = fopen(path, "rb")) == NULL || fstat(fileno(fp), st) == -1) {
+		error("Unable to open %s: %s", path, strerror(errno));
+	}
+	if(!S_ISREG(st->st_mode) || st->st_size > UINT32_MAX) {
+		error("%s is not a regular file that fits in an image", path);
+	}
+	if((data = malloc(st->st_size + 1)) == NULL) {
+		error("No memory for %s", path);
+	}
+	if(st->st_size != 0 && fread(data, st->st_size, 1, fp) != 1) {
+		error("Unable to read %s: %s", path, strerror(errno));
+	}
+	fclose(fp);
+	return data;
+}
+
+int main(int argc, char *argv[]) {
+	struct stat		st, nst;
+	unsigned char	*data;
+	const char		*image, *path;
+	struct ifs_reader	*r;
+	struct ifs_entry	ent;
+	long			spos;
+	size_t			ipos, dpos, dend, tpos;
+	size_t			trailer, next, size;
+	uint32_t		isize, foff, fsize, nsize, ino;
+	uint32_t		delta = 0;
+	int				c, fd, err;
+
+	progname = basename(argv[0]);
+
+	while((c = getopt(argc, argv, "vh")) != -1) {
+		switch(c) {
+		case 'v':
+			verbose++;
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if(argc - optind != 3) {
+		usage();
+		return EXIT_FAILURE;
+	}
+	image = argv[optind];
+	path = argv[optind + 1];
+	data = read_file(argv[optind + 2], &nst);
+	nsize = nst.st_size;
+
+	if((fd = open(image, O_RDWR)) == -1 || fstat(fd, &st) == -1) {
+		error("Unable to open %s: %s", image, strerror(errno));
+	}
+	size = st.st_size;
+	if(size < sizeof(struct image_header)) {
+		error("%s is too short to be an image", image);
+	}
+	if((err = ifs_open(image, 0, &r)) != IFS_OK) {
+		error("Unable to read %s: %s", image, ifs_strerror(err));
+	}
+	if(ifs_startup(r) != NULL && (ifs_startup(r)->flags1 & STARTUP_HDR_FLAGS1_COMPRESS_MASK)) {
+		error("The image is compressed, uncompress it with dumpifs -u first");
+	}
+	spos = ifs_startup_pos(r);
+	ipos = ifs_image_pos(r);
+	big = ifs_big_endian(r);
+	isize = ifs_header(r)->image_size;
+	trailer = isize - sizeof(struct image_trailer);
+	dend = ipos + ifs_header(r)->hdr_dir_size;
+	next = trailer;
+
+	// The path may have the mountpoint in front.
+	if((err = ifs_lookup(r, path, &ent)) != IFS_OK && err != IFS_ENOENT) {
+		error("Unable to read the directory of %s: %s", image, ifs_strerror(err));
+	}
+	if(err == IFS_ENOENT || !S_ISREG(ent.dirent->attr.mode)) {
+		error("No file %s in %s", path, image);
+	}
+	tpos = ent.pos;
+	foff = ent.dirent->file.offset;
+	fsize = ent.dirent->file.size;
+	ino = ent.dirent->attr.ino;
+	if((path = strdup(ent.path)) == NULL) {
+		error("No memory for %s", ent.path);
+	}
+
+	// Leave the image alone if the file already holds the new data.
+	if(fsize == nsize) {
+		unsigned char	*old;
+		int				same;
+
+		if((old = malloc(fsize + 1)) == NULL) {
+			error("No memory for %s", path);
+		}
+		if(ifs_read(r, &ent, 0, old, fsize, &err) != (long)fsize) {
+			error("Unable to read %s from %s: %s", path, image, ifs_strerror(err));
+		}
+		same = memcmp(old, data, nsize) == 0;
+		free(old);
+		if(same) {
+			if(verbose) {
+				printf("%s is unchanged\n", path);
+			}
+			ifs_close(r);
+			close(fd);
+			free(data);
+			return EXIT_SUCCESS;
+		}
+	}
+	ifs_close(r);
+	map_image(fd, size);
+
+	if(ino & IFS_INO_BOOTSTRAP_EXE) {
+		error("%s is a bootstrap executable, rebuild the image with mkifs to replace it", path);
+	}
+	if(foff > trailer || fsize > trailer - foff) {
+		error("%s runs past the end of the image", path);
+	}
+
+	// The file can grow into the padding up to the next file.
+	for(dpos = ipos + get32(ipos + offsetof(struct image_header, dir_offset), big); dpos < dend; dpos += get16(dpos, big)) {
+		uint32_t	off, len;
+
+		if(get16(dpos, big) < sizeof(struct image_attr)) {
+			break;
+		}
+		if(dpos == tpos || !S_ISREG(get32(dpos + offsetof(struct image_attr, mode), big))) {
+			continue;
+		}
+		off = get32(dpos + offsetof(struct image_file, offset), big);
+		len = get32(dpos + offsetof(struct image_file, size), big);
+		if(len != 0 && off < foff + fsize && off + len > foff) {
+			error("%s shares its data with %s, it can't be replaced",
+					path, (const char *)base + dpos + offsetof(struct image_file, path));
+		}
+		if(len != 0 && off >= foff + fsize && off < next) {
+			next = off;
+		}
+	}
+
+	if(nsize <= next - foff) {
+		// Rewrite the extent and the dirent, and adjust the checksum by
+		// the change in the words they cover.
+		if(fsize > nsize) {
+			if((data = realloc(data, fsize)) == NULL) {
+				error("No memory for %s", path);
+			}
+			memset(data + nsize, 0, fsize - nsize);
+		}
+		patch_image(ipos, foff, data, max(fsize, nsize), &delta);
+		patch32(ipos, tpos - ipos + offsetof(struct image_file, size), nsize, &delta);
+		patch32(ipos, tpos - ipos + offsetof(struct image_attr, mtime), nst.st_mtime, &delta);
+		patch32(ipos, tpos - ipos + offsetof(struct image_attr, ino), ino & ~IFS_INO_PROCESSED_ELF, &delta);
+		put32(ipos + trailer, get32(ipos + trailer, big) - delta, big);
+		if(verbose) {
+			printf("Replaced %s in place at %#x, %u bytes (was %u)\n", path, foff, nsize, fsize);
+		}
+	} else {
+		uint32_t	move = RUP(nsize - (next - foff), RELOC_ALIGN);
+		uint32_t	off;
+		size_t		spad;
+
+		for(dpos = ipos + get32(ipos + offsetof(struct image_header, dir_offset), big); dpos < dend; dpos += get16(dpos, big)) {
+			if(get16(dpos, big) < sizeof(struct image_attr)) {
+				break;
+			}
+			if(S_ISREG(get32(dpos + offsetof(struct image_attr, mode), big))
+			 && get32(dpos + offsetof(struct image_file, offset), big) >= next
+			 && (get32(dpos + offsetof(struct image_attr, ino), big) & XIP_FLAGS)) {
+				error("%s doesn't fit and %s, which runs in place, would have to move. Rebuild the image with mkifs",
+						path, (const char *)base + dpos + offsetof(struct image_file, path));
+			}
+		}
+		if(spos != -1) {
+			int		sbig = base[spos + offsetof(struct startup_header, flags1)] & STARTUP_HDR_FLAGS1_BIGENDIAN;
+
+			if(get32(spos + offsetof(struct startup_header, ram_paddr), sbig)
+			 != get32(spos + offsetof(struct startup_header, image_paddr), sbig)) {
+				error("%s doesn't fit and the image is split between ROM and RAM. Rebuild the image with mkifs", path);
+			}
+		}
+
+		// Move everything from the next file on.
+		if(ftruncate(fd, size + move) == -1) {
+			error("Unable to grow %s: %s", image, strerror(errno));
+		}
+		map_image(fd, size + move);
+		memmove(base + ipos + next + move, base + ipos + next, size - (ipos + next));
+		memcpy(base + ipos + foff, data, nsize);
+		memset(base + ipos + foff + nsize, 0, next + move - (foff + nsize));
+
+		for(dpos = ipos + get32(ipos + offsetof(struct image_header, dir_offset), big); dpos < dend; dpos += get16(dpos, big)) {
+			if(get16(dpos, big) < sizeof(struct image_attr)) {
+				break;
+			}
+			if(S_ISREG(get32(dpos + offsetof(struct image_attr, mode), big))
+			 && (off = get32(dpos + offsetof(struct image_file, offset), big)) >= next && dpos != tpos) {
+				put32(dpos + offsetof(struct image_file, offset), off + move, big);
+			}
+		}
+		put32(tpos + offsetof(struct image_file, size), nsize, big);
+		put32(tpos + offsetof(struct image_attr, mtime), nst.st_mtime, big);
+		put32(tpos + offsetof(struct image_attr, ino), ino & ~IFS_INO_PROCESSED_ELF, big);
+
+		isize += move;
+		trailer += move;
+		put32(ipos + offsetof(struct image_header, image_size), isize, big);
+		put32(ipos + trailer, -ifs_cksum_words(base + ipos, trailer, big), big);
+
+		if(spos != -1) {
+			int		sbig = base[spos + offsetof(struct startup_header, flags1)] & STARTUP_HDR_FLAGS1_BIGENDIAN;
+			size_t	fields[] = {
+				offsetof(struct startup_header, stored_size),
+				offsetof(struct startup_header, imagefs_size),
+				offsetof(struct startup_header, ram_size),
+			};
+			unsigned	i;
+
+			for(i = 0; i < sizeof fields / sizeof *fields; ++i) {
+				put32(spos + fields[i], get32(spos + fields[i], sbig) + move, sbig);
+			}
+			spad = get32(spos + offsetof(struct startup_header, startup_size), sbig) - sizeof(struct startup_trailer);
+			put32(spos + spad, -ifs_cksum_words(base + spos, spad, sbig), sbig);
+		}
+		if(verbose) {
+			printf("Replaced %s at %#x, %u bytes (was %u), moved the files after it by %#x\n",
+					path, foff, nsize, fsize, move);
+		}
+	}
+
+	if(msync(base, base_size, MS_SYNC) == -1 || munmap(base, base_size) == -1 || close(fd) == -1) {
+		error("Error writing %s: %s", image, strerror(errno));
+	}
+	free(data);
+	return EXIT_SUCCESS;
+}
+
+__SRCVERSION("ifsreplace.c $Rev$");
@@ -0,0 +1,161 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+
+
+#include <lib/compat.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "libifs/ifs_cksum.h"
+
+
+#if defined(__SSE2__)
+static inline __m128i
+bswap_epi32(__m128i v) {
+	v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+	return _mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16));
+}
+#endif
+
+
+uint32_t
+ifs_cksum_words(const void *buf, size_t len, int big) {
+	const unsigned char	*p = buf;
+	uint32_t			sum = 0;
+
+#if defined(__SSE2__)
+	// The sum is modulo 2^32, so four words at a time can be added up
+	// in separate lanes and the lanes added together at the end.
+	if(len >= 32) {
+		__m128i		a0 = _mm_setzero_si128();
+		__m128i		a1 = _mm_setzero_si128();
+		uint32_t	lanes[4];
+
+		if(big) {
+			for( ; len >= 32; len -= 32, p += 32) {
+				a0 = _mm_add_epi32(a0, bswap_epi32(_mm_loadu_si128((const __m128i *)p)));
+				a1 = _mm_add_epi32(a1, bswap_epi32(_mm_loadu_si128((const __m128i *)(p + 16))));
+			}
+		} else {
+			for( ; len >= 32; len -= 32, p += 32) {
+				a0 = _mm_add_epi32(a0, _mm_loadu_si128((const __m128i *)p));
+				a1 = _mm_add_epi32(a1, _mm_loadu_si128((const __m128i *)(p + 16)));
+			}
+		}
+		_mm_storeu_si128((__m128i *)lanes, _mm_add_epi32(a0, a1));
+		sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+#endif
+	if(big) {
+		for( ; len >= 4; len -= 4, p += 4) {
+			sum += ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+		}
+	} else {
+		for( ; len >= 4; len -= 4, p += 4) {
+			sum += ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+		}
+	}
+	return sum;
+}
+
+
+void
+ifs_cksum_add(struct ifs_cksum *ck, unsigned off, const void *buf, size_t len) {
+	const unsigned char	*p = buf;
+	size_t				n;
+
+	// Finish a word started by an earlier call.
+	for( ; len != 0 && (off & 3) != 0; --len, ++off) {
+		ck->hold[off & 3] = *p++;
+		if((off & 3) == 3) {
+			ck->sum += ifs_cksum_words(ck->hold, 4, ck->big);
+		}
+	}
+	n = len & ~(size_t)3;
+	ck->sum += ifs_cksum_words(p, n, ck->big);
+
+	// Hang on to the start of a word for the next call.
+	for(p += n, off += n, len -= n; len != 0; --len, ++off) {
+		ck->hold[off & 3] = *p++;
+	}
+}
+
+int
+ifs_cksum_ok(const void *region, size_t len, int big) {
+	return ifs_cksum_words(region, len, big) == 0;
+}
+
+
+// One word of the region with 'n' bytes from 'src' put in at 'pos'.
+static uint32_t
+patched_word(const unsigned char *word, unsigned pos, const unsigned char *src, unsigned n, int big) {
+	unsigned char	w[4];
+
+	memcpy(w, word, sizeof w);
+	memcpy(w + pos, src, n);
+	return ifs_cksum_words(w, sizeof w, big);
+}
+
+
+uint32_t
+ifs_cksum_delta(const void *region, size_t off, const void *new, size_t len, int big) {
+	const unsigned char	*r = region;
+	const unsigned char	*p = new;
+	uint32_t			delta = 0;
+	size_t				n;
+
+	// A word the patch starts part way into.
+	if((off & 3) != 0 && len != 0) {
+		n = 4 - (off & 3);
+		if(n > len) n = len;
+		delta += patched_word(r + (off & ~(size_t)3), off & 3, p, n, big)
+				- ifs_cksum_words(r + (off & ~(size_t)3), 4, big);
+		off += n;
+		p += n;
+		len -= n;
+	}
+	n = len & ~(size_t)3;
+	delta += ifs_cksum_words(p, n, big) - ifs_cksum_words(r + off, n, big);
+
+	// A word it ends part way into.
+	if(len > n) {
+		delta += patched_word(r + off + n, 0, p + n, len - n, big)
+				- ifs_cksum_words(r + off + n, 4, big);
+	}
+	return delta;
+}
+
+
+uint32_t
+ifs_cksum_patch(uint32_t stored, uint32_t delta, int big) {
+	unsigned char	b[4];
+	uint32_t		v;
+	int				i;
+
+	// The trailer holds the negated sum of the rest of the region.
+	memcpy(b, &stored, sizeof b);
+	v = ifs_cksum_words(b, sizeof b, big) - delta;
+	for(i = 0; i < 4; ++i, v >>= 8) {
+		b[big ? 3 - i : i] = v & 0xff;
+	}
+	memcpy(&stored, b, sizeof b);
+	return stored;
+}
+
+__SRCVERSION("ifs_cksum.c $Rev$");
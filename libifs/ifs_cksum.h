@@ -0,0 +1,59 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+#ifndef __IFS_CKSUM_H_INCLUDED
+#define __IFS_CKSUM_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Startup and image checksums.
+//
+// Both are the 32-bit sum of their region taken as words in the byte
+// order of the target, starting at the region's first byte. The
+// trailer at the end of the region holds the negated sum of the rest,
+// so a region with a good checksum sums to zero.
+//
+
+struct ifs_cksum {
+	uint32_t		sum;
+	int				big;		// big endian target
+	unsigned char	hold[4];	// bytes of a word not complete yet
+};
+
+// Sum of the whole words in 'len' bytes starting at 'buf'.
+uint32_t	ifs_cksum_words(const void *buf, size_t len, int big);
+
+// Add 'len' bytes that are 'off' bytes into the region.
+void		ifs_cksum_add(struct ifs_cksum *ck, unsigned off, const void *buf, size_t len);
+
+// Whether a region, trailer included, has a good checksum.
+int			ifs_cksum_ok(const void *region, size_t len, int big);
+
+//
+// Incremental updates. Patching 'len' bytes at 'off' in a region from
+// what 'region' holds now to 'new' changes its sum by the returned
+// amount. The words the patch only partly covers are completed from
+// 'region', so call this before the new bytes are copied in. The
+// stored trailer value is then brought up to date with
+// ifs_cksum_patch(), which takes and returns it in target byte order.
+//
+uint32_t	ifs_cksum_delta(const void *region, size_t off, const void *new, size_t len, int big);
+uint32_t	ifs_cksum_patch(uint32_t stored, uint32_t delta, int big);
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+#include <lib/compat.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+#include "libifs/ifs_copy.h"
+
+#define COPY_CHUNK		0x40000000	// per system call
+#define COPY_BUFSIZE	0x100000
+
+
+static int
+write_all(int fd, const unsigned char *buf, size_t len) {
+	ssize_t		n;
+
+	while(len != 0) {
+		if((n = write(fd, buf, len)) == -1) {
+			if(errno == EINTR) continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+
+static int
+copy_buffered(int out, int in, off_t off, uint64_t len) {
+	unsigned char	*buf;
+	size_t			size;
+	ssize_t			n;
+	int				ret = 0;
+
+	size = len < COPY_BUFSIZE ? len : COPY_BUFSIZE;
+	if(size == 0) return 0;
+	if((buf = malloc(size)) == NULL) return -1;
+	while(len != 0) {
+		n = pread(in, buf, len < size ? len : size, off);
+		if(n == -1 && errno == EINTR) continue;
+		if(n <= 0) {
+			if(n == 0) errno = EIO;
+			ret = -1;
+			break;
+		}
+		if(write_all(out, buf, n) == -1) {
+			ret = -1;
+			break;
+		}
+		off += n;
+		len -= n;
+	}
+	free(buf);
+	return ret;
+}
+
+
+#if defined(__linux__)
+// Whether the kernel turned the copy down for these descriptors, as
+// opposed to failing it.
+static int
+unsupported(int err) {
+	return err == EINVAL || err == ENOSYS || err == EXDEV
+		|| err == EOPNOTSUPP || err == EBADF;
+}
+#endif
+
+
+int
+ifs_copy_range(int out, int in, off_t off, uint64_t len) {
+	struct stat		st;
+	ssize_t			n;
+
+	if(fstat(in, &st) == -1) return -1;
+	if(!S_ISREG(st.st_mode)) {
+		return copy_buffered(out, in, off, len);
+	}
+
+#if defined(__linux__)
+	// Both files regular: the data can stay in the page cache, or
+	// not be copied at all on filesystems that share extents.
+	if(fstat(out, &st) == 0 && S_ISREG(st.st_mode)) {
+		while(len != 0) {
+			n = copy_file_range(in, &off, out, NULL, len < COPY_CHUNK ? len : COPY_CHUNK, 0);
+			if(n > 0) {
+				len -= n;
+			} else if(n == 0) {
+				errno = EIO;
+				return -1;
+			} else if(errno != EINTR) {
+				if(!unsupported(errno)) return -1;
+				break;
+			}
+		}
+	}
+
+	// sendfile() reads from a regular file into anything, pipes
+	// included.
+	while(len != 0) {
+		n = sendfile(out, in, &off, len < COPY_CHUNK ? len : COPY_CHUNK);
+		if(n > 0) {
+			len -= n;
+		} else if(n == 0) {
+			errno = EIO;
+			return -1;
+		} else if(errno != EINTR) {
+			if(!unsupported(errno)) return -1;
+			break;
+		}
+	}
+#endif
+	return copy_buffered(out, in, off, len);
+}
+
+__SRCVERSION("ifs_copy.c $Rev$");
@@ -0,0 +1,37 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+#ifndef __IFS_COPY_H_INCLUDED
+#define __IFS_COPY_H_INCLUDED
+
+#include <stdint.h>
+#include <sys/types.h>
+
+//
+// Bulk copies between files.
+//
+// 'len' bytes at offset 'off' of descriptor 'in', which has to be
+// seekable, are written at the current position of descriptor 'out';
+// the position of 'in' is left alone. Between regular files the kernel does the copy (with
+// copy_file_range() or sendfile() where the host has them), otherwise
+// the data goes through a large buffer. Flush any stdio stream on
+// either descriptor first. Returns 0, or -1 with errno set; running
+// into the end of 'in' early fails with EIO.
+//
+int		ifs_copy_range(int out, int in, off_t off, uint64_t len);
+
+#endif
@@ -0,0 +1,397 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+
+
+#include <lib/compat.h>
+#include <string.h>
+#include "libifs/ifs_hash.h"
+
+
+static inline uint32_t
+rd32(const unsigned char *p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t
+rd64(const unsigned char *p) {
+	return rd32(p) | ((uint64_t)rd32(p + 4) << 32);
+}
+
+
+//
+// XXH3, 64 bit, default secret, seed 0.
+//
+
+#define PRIME32_1	0x9E3779B1U
+#define PRIME32_2	0x85EBCA77U
+#define PRIME32_3	0xC2B2AE3DU
+#define PRIME64_1	0x9E3779B185EBCA87ULL
+#define PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3	0x165667B19E3779F9ULL
+#define PRIME64_4	0x85EBCA77C2B2AE63ULL
+#define PRIME64_5	0x27D4EB2F165667C5ULL
+#define PRIME_MX1	0x165667919E3779F9ULL
+#define PRIME_MX2	0x9FB21C651E98DF25ULL
+
+#define XXH_SECRET_SIZE		192
+#define XXH_STRIPE			64
+#define XXH_STRIPES			((XXH_SECRET_SIZE - XXH_STRIPE) / 8)
+#define XXH_BLOCK			(XXH_STRIPE * XXH_STRIPES)
+
+static const unsigned char xxh_secret[XXH_SECRET_SIZE] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static inline uint64_t
+rotl64(uint64_t x, int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+swap64(uint64_t x) {
+	return ((uint64_t)__builtin_bswap32((uint32_t)x) << 32) | __builtin_bswap32((uint32_t)(x >> 32));
+}
+
+// Low and high halves of the 128 bit product xor'ed together.
+static inline uint64_t
+mul128_fold64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+	unsigned __int128	r = (unsigned __int128)a * b;
+
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+	uint64_t	lo_lo = (a & 0xffffffff) * (b & 0xffffffff);
+	uint64_t	hi_lo = (a >> 32) * (b & 0xffffffff);
+	uint64_t	lo_hi = (a & 0xffffffff) * (b >> 32);
+	uint64_t	hi_hi = (a >> 32) * (b >> 32);
+	uint64_t	cross = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+	uint64_t	upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	uint64_t	lower = (cross << 32) | (lo_lo & 0xffffffff);
+
+	return lower ^ upper;
+#endif
+}
+
+static inline uint64_t
+xxh64_avalanche(uint64_t h) {
+	h ^= h >> 33;
+	h *= PRIME64_2;
+	h ^= h >> 29;
+	h *= PRIME64_3;
+	return h ^ (h >> 32);
+}
+
+static inline uint64_t
+xxh3_avalanche(uint64_t h) {
+	h ^= h >> 37;
+	h *= PRIME_MX1;
+	return h ^ (h >> 32);
+}
+
+static inline uint64_t
+xxh3_rrmxmx(uint64_t h, uint64_t len) {
+	h ^= rotl64(h, 49) ^ rotl64(h, 24);
+	h *= PRIME_MX2;
+	h ^= (h >> 35) + len;
+	h *= PRIME_MX2;
+	return h ^ (h >> 28);
+}
+
+static inline uint64_t
+xxh3_mix16(const unsigned char *p, const unsigned char *s) {
+	return mul128_fold64(rd64(p) ^ rd64(s), rd64(p + 8) ^ rd64(s + 8));
+}
+
+static void
+xxh3_stripe(uint64_t acc[8], const unsigned char *p, const unsigned char *s) {
+	int		i;
+
+	for(i = 0; i < 8; ++i) {
+		uint64_t	val = rd64(p + 8 * i);
+		uint64_t	key = val ^ rd64(s + 8 * i);
+
+		acc[i ^ 1] += val;
+		acc[i] += (key & 0xffffffff) * (key >> 32);
+	}
+}
+
+static void
+xxh3_scramble(uint64_t acc[8], const unsigned char *s) {
+	int		i;
+
+	for(i = 0; i < 8; ++i) {
+		uint64_t	a = acc[i];
+
+		a ^= a >> 47;
+		a ^= rd64(s + 8 * i);
+		acc[i] = a * PRIME32_1;
+	}
+}
+
+static uint64_t
+xxh3_long(const unsigned char *p, size_t len) {
+	uint64_t	acc[8] = {
+		PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+		PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1
+	};
+	size_t		blocks = (len - 1) / XXH_BLOCK;
+	size_t		n, stripes;
+	uint64_t	h;
+	int			i;
+
+	for(n = 0; n < blocks; ++n) {
+		for(i = 0; i < XXH_STRIPES; ++i) {
+			xxh3_stripe(acc, p + n * XXH_BLOCK + i * XXH_STRIPE, xxh_secret + i * 8);
+		}
+		xxh3_scramble(acc, xxh_secret + XXH_SECRET_SIZE - XXH_STRIPE);
+	}
+	stripes = ((len - 1) - blocks * XXH_BLOCK) / XXH_STRIPE;
+	for(n = 0; n < stripes; ++n) {
+		xxh3_stripe(acc, p + blocks * XXH_BLOCK + n * XXH_STRIPE, xxh_secret + n * 8);
+	}
+	xxh3_stripe(acc, p + len - XXH_STRIPE, xxh_secret + XXH_SECRET_SIZE - XXH_STRIPE - 7);
+
+	h = len * PRIME64_1;
+	for(i = 0; i < 4; ++i) {
+		h += mul128_fold64(acc[2 * i] ^ rd64(xxh_secret + 11 + 16 * i),
+						   acc[2 * i + 1] ^ rd64(xxh_secret + 11 + 16 * i + 8));
+	}
+	return xxh3_avalanche(h);
+}
+
+static uint64_t
+xxh3_64(const unsigned char *p, size_t len) {
+	const unsigned char	*s = xxh_secret;
+	uint64_t			acc, end;
+	size_t				i;
+
+	if(len == 0) {
+		return xxh64_avalanche(rd64(s + 56) ^ rd64(s + 64));
+	}
+	if(len <= 3) {
+		uint32_t	combined = ((uint32_t)p[0] << 16) | ((uint32_t)p[len >> 1] << 24)
+								| p[len - 1] | ((uint32_t)len << 8);
+
+		return xxh64_avalanche(combined ^ (uint64_t)(rd32(s) ^ rd32(s + 4)));
+	}
+	if(len <= 8) {
+		uint64_t	in = rd32(p + len - 4) + ((uint64_t)rd32(p) << 32);
+
+		return xxh3_rrmxmx(in ^ (rd64(s + 8) ^ rd64(s + 16)), len);
+	}
+	if(len <= 16) {
+		uint64_t	lo = rd64(p) ^ (rd64(s + 24) ^ rd64(s + 32));
+		uint64_t	hi = rd64(p + len - 8) ^ (rd64(s + 40) ^ rd64(s + 48));
+
+		return xxh3_avalanche(len + swap64(lo) + hi + mul128_fold64(lo, hi));
+	}
+	if(len <= 128) {
+		acc = len * PRIME64_1;
+		if(len > 32) {
+			if(len > 64) {
+				if(len > 96) {
+					acc += xxh3_mix16(p + 48, s + 96);
+					acc += xxh3_mix16(p + len - 64, s + 112);
+				}
+				acc += xxh3_mix16(p + 32, s + 64);
+				acc += xxh3_mix16(p + len - 48, s + 80);
+			}
+			acc += xxh3_mix16(p + 16, s + 32);
+			acc += xxh3_mix16(p + len - 32, s + 48);
+		}
+		acc += xxh3_mix16(p, s);
+		acc += xxh3_mix16(p + len - 16, s + 16);
+		return xxh3_avalanche(acc);
+	}
+	if(len <= 240) {
+		acc = len * PRIME64_1;
+		for(i = 0; i < 8; ++i) {
+			acc += xxh3_mix16(p + 16 * i, s + 16 * i);
+		}
+		acc = xxh3_avalanche(acc);
+		end = xxh3_mix16(p + len - 16, s + 136 - 17);
+		for(i = 8; i < len / 16; ++i) {
+			end += xxh3_mix16(p + 16 * i, s + 16 * (i - 8) + 3);
+		}
+		return xxh3_avalanche(acc + end);
+	}
+	return xxh3_long(p, len);
+}
+
+void
+ifs_xxh3(const void *buf, size_t len, unsigned char digest[IFS_XXH3_SIZE]) {
+	uint64_t	h = xxh3_64(buf, len);
+	int			i;
+
+	for(i = IFS_XXH3_SIZE - 1; i >= 0; --i, h >>= 8) {
+		digest[i] = h & 0xff;
+	}
+}
+
+
+//
+// BLAKE3, hashing mode, 256 bit output.
+//
+
+#define B3_CHUNK		1024
+#define B3_BLOCK		64
+
+#define B3_CHUNK_START	0x01
+#define B3_CHUNK_END	0x02
+#define B3_PARENT		0x04
+#define B3_ROOT			0x08
+
+static const uint32_t b3_iv[8] = {
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+	0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const unsigned char b3_perm[16] = {
+	2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8
+};
+
+static inline uint32_t
+rotr32(uint32_t x, int r) {
+	return (x >> r) | (x << (32 - r));
+}
+
+#define B3_G(a, b, c, d, x, y)					\
+	do {										\
+		v[a] += v[b] + (x);	v[d] = rotr32(v[d] ^ v[a], 16);	\
+		v[c] += v[d];		v[b] = rotr32(v[b] ^ v[c], 12);	\
+		v[a] += v[b] + (y);	v[d] = rotr32(v[d] ^ v[a], 8);	\
+		v[c] += v[d];		v[b] = rotr32(v[b] ^ v[c], 7);	\
+	} while(0)
+
+// Compress one block, leaving the new chaining value in 'cv'.
+static void
+b3_compress(uint32_t cv[8], const unsigned char block[B3_BLOCK],
+			uint64_t counter, uint32_t len, uint32_t flags) {
+	uint32_t	v[16], m[16], t[16];
+	int			i, r;
+
+	for(i = 0; i < 16; ++i) {
+		m[i] = rd32(block + 4 * i);
+	}
+	memcpy(v, cv, 8 * sizeof *v);
+	memcpy(v + 8, b3_iv, 4 * sizeof *v);
+	v[12] = (uint32_t)counter;
+	v[13] = (uint32_t)(counter >> 32);
+	v[14] = len;
+	v[15] = flags;
+
+	for(r = 0; ; ++r) {
+		B3_G(0, 4,  8, 12, m[0],  m[1]);
+		B3_G(1, 5,  9, 13, m[2],  m[3]);
+		B3_G(2, 6, 10, 14, m[4],  m[5]);
+		B3_G(3, 7, 11, 15, m[6],  m[7]);
+		B3_G(0, 5, 10, 15, m[8],  m[9]);
+		B3_G(1, 6, 11, 12, m[10], m[11]);
+		B3_G(2, 7,  8, 13, m[12], m[13]);
+		B3_G(3, 4,  9, 14, m[14], m[15]);
+		if(r == 6) break;
+		for(i = 0; i < 16; ++i) {
+			t[i] = m[b3_perm[i]];
+		}
+		memcpy(m, t, sizeof m);
+	}
+	for(i = 0; i < 8; ++i) {
+		cv[i] = v[i] ^ v[i + 8];
+	}
+}
+
+// Chaining value of a chunk of at most B3_CHUNK bytes.
+static void
+b3_chunk(const unsigned char *p, size_t len, uint64_t counter, uint32_t root, uint32_t cv[8]) {
+	unsigned char	last[B3_BLOCK];
+	uint32_t		flags = B3_CHUNK_START;
+
+	memcpy(cv, b3_iv, sizeof b3_iv);
+	for( ; len > B3_BLOCK; len -= B3_BLOCK, p += B3_BLOCK) {
+		b3_compress(cv, p, counter, B3_BLOCK, flags);
+		flags = 0;
+	}
+	memset(last, 0, sizeof last);
+	memcpy(last, p, len);
+	b3_compress(cv, last, counter, len, flags | B3_CHUNK_END | root);
+}
+
+static void
+b3_parent(const uint32_t left[8], const uint32_t right[8], uint32_t root, uint32_t cv[8]) {
+	unsigned char	block[B3_BLOCK];
+	int				i;
+
+	for(i = 0; i < 8; ++i) {
+		block[4 * i + 0] = left[i];
+		block[4 * i + 1] = left[i] >> 8;
+		block[4 * i + 2] = left[i] >> 16;
+		block[4 * i + 3] = left[i] >> 24;
+		block[32 + 4 * i + 0] = right[i];
+		block[32 + 4 * i + 1] = right[i] >> 8;
+		block[32 + 4 * i + 2] = right[i] >> 16;
+		block[32 + 4 * i + 3] = right[i] >> 24;
+	}
+	memcpy(cv, b3_iv, sizeof b3_iv);
+	b3_compress(cv, block, 0, B3_BLOCK, B3_PARENT | root);
+}
+
+// The left subtree holds the largest power of two chunks that leaves
+// at least one byte for the right.
+static void
+b3_subtree(const unsigned char *p, size_t len, uint64_t counter, uint32_t root, uint32_t cv[8]) {
+	uint32_t	l[8], r[8];
+	size_t		left;
+
+	if(len <= B3_CHUNK) {
+		b3_chunk(p, len, counter, root, cv);
+		return;
+	}
+	for(left = B3_CHUNK; left * 2 < len; left *= 2) {
+		// nothing
+	}
+	b3_subtree(p, left, counter, 0, l);
+	b3_subtree(p + left, len - left, counter + left / B3_CHUNK, 0, r);
+	b3_parent(l, r, root, cv);
+}
+
+void
+ifs_blake3(const void *buf, size_t len, unsigned char digest[IFS_BLAKE3_SIZE]) {
+	uint32_t	cv[8];
+	int			i;
+
+	b3_subtree(buf, len, 0, B3_ROOT, cv);
+	for(i = 0; i < 8; ++i) {
+		digest[4 * i + 0] = cv[i];
+		digest[4 * i + 1] = cv[i] >> 8;
+		digest[4 * i + 2] = cv[i] >> 16;
+		digest[4 * i + 3] = cv[i] >> 24;
+	}
+}
+
+__SRCVERSION("ifs_hash.c $Rev$");
@@ -0,0 +1,40 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+#ifndef __IFS_HASH_H_INCLUDED
+#define __IFS_HASH_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Fast file hashes for dumpifs -m.
+//
+// XXH3 (64 bit, no seed) is for change detection only. BLAKE3 (256 bit
+// output) is a cryptographic hash that runs well ahead of MD5. Both
+// match the reference implementations, so the digests can be compared
+// with xxhsum -H3 and b3sum.
+//
+
+#define IFS_XXH3_SIZE		8
+#define IFS_BLAKE3_SIZE		32
+
+// The digest is stored big endian, the way xxhsum prints it.
+void	ifs_xxh3(const void *buf, size_t len, unsigned char digest[IFS_XXH3_SIZE]);
+void	ifs_blake3(const void *buf, size_t len, unsigned char digest[IFS_BLAKE3_SIZE]);
+
+#endif
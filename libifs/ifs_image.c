@@ -0,0 +1,659 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+
+
+#include <lib/compat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include _NTO_HDR_(sys/startup.h)
+#include <lzo/lzo1x.h>
+#include <ucl/ucl.h>
+#include "libifs/ifs_image.h"
+#include "libifs/ifs_cksum.h"
+#include "libifs/ifs_trace.h"
+
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+
+
+static void *
+nomem(struct ifs_image *img, const char *why) {
+	img->error = why;
+	img->nomem = 1;
+	return NULL;
+}
+
+
+static void *
+failed(struct ifs_image *img, const char *why) {
+	img->error = why;
+	img->nomem = 0;
+	return NULL;
+}
+
+
+void
+ifs_image_unmap(struct ifs_image *img) {
+	unsigned	i;
+
+	if(img->mapped) {
+		munmap(img->base, img->size);
+	} else if(!img->borrowed) {
+		free(img->base);
+	}
+	if(img->method == STARTUP_HDR_FLAGS1_COMPRESS_ZLIB) {
+		inflateEnd(&img->zs);
+		for(i = 0; i < img->num_restart; ++i) {
+			inflateEnd(img->restart[i]);
+			free(img->restart[i]);
+		}
+	}
+	for(i = 0; i < IFS_CACHE; ++i) {
+		free(img->cache[i].data);
+	}
+	free(img->restart);
+	free(img->blocks);
+	free(img->scratch);
+	memset(img, 0, sizeof *img);
+}
+
+
+int
+ifs_image_map(struct ifs_image *img, int fd) {
+	struct stat		st;
+	void			*p;
+
+	ifs_image_unmap(img);
+	if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(p != MAP_FAILED) {
+			img->base = p;
+			img->size = st.st_size;
+			img->mapped = 1;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+
+void
+ifs_image_mem(struct ifs_image *img, void *buf, size_t len, int borrowed) {
+	ifs_image_unmap(img);
+	img->base = buf;
+	img->size = len;
+	img->borrowed = borrowed;
+}
+
+
+static struct ifs_block *
+add_block(struct ifs_image *img) {
+	struct ifs_block	*bp;
+
+	if(img->num_blocks >= img->max_blocks) {
+		img->max_blocks = img->max_blocks ? img->max_blocks * 2 : 256;
+		if((bp = realloc(img->blocks, img->max_blocks * sizeof *img->blocks)) == NULL) {
+			return nomem(img, "No memory for image block index");
+		}
+		img->blocks = bp;
+	}
+	return memset(&img->blocks[img->num_blocks++], 0, sizeof *img->blocks);
+}
+
+
+int
+ifs_image_index(struct ifs_image *img, int method, long zstart) {
+	struct ifs_block	*bp;
+	unsigned long		pos = zstart;
+	unsigned			len;
+
+	if(pos >= img->size) {
+		return -1;
+	}
+	img->method = method;
+	img->zstart = zstart;
+	switch(method) {
+	case STARTUP_HDR_FLAGS1_COMPRESS_ZLIB:
+		if(inflateInit2(&img->zs, MAX_WBITS + 16) != Z_OK) {
+			img->method = 0;
+			return -1;
+		}
+		img->zs.next_in = img->base + pos;
+		img->zs.avail_in = img->size - pos;
+		return 0;
+	case STARTUP_HDR_FLAGS1_COMPRESS_LZO:
+		if(lzo_init() != LZO_E_OK) {
+			return -1;
+		}
+		break;
+	case STARTUP_HDR_FLAGS1_COMPRESS_UCL:
+		break;
+	default:
+		return -1;
+	}
+	for( ;; ) {
+		if(pos + 2 > img->size) {
+			return -1;
+		}
+		len = (img->base[pos] << 8) | img->base[pos + 1];
+		pos += 2;
+		if(len == 0) break;
+		if(pos + len > img->size) {
+			return -1;
+		}
+		if((bp = add_block(img)) == NULL) {
+			return -1;
+		}
+		bp->cpos = pos;
+		bp->clen = len;
+		bp->upos = -1;
+		pos += len;
+	}
+	return img->num_blocks ? 0 : -1;
+}
+
+
+static struct ifs_cache *
+cached(struct ifs_image *img, unsigned block) {
+	struct ifs_cache	*cp;
+
+	for(cp = img->cache; cp < &img->cache[IFS_CACHE]; ++cp) {
+		if(cp->used != 0 && cp->block == block) {
+			cp->used = ++img->tick;
+			return cp;
+		}
+	}
+	return NULL;
+}
+
+
+static struct ifs_cache *
+victim(struct ifs_image *img, unsigned block) {
+	struct ifs_cache	*cp, *vp = img->cache;
+
+	for(cp = img->cache; cp < &img->cache[IFS_CACHE]; ++cp) {
+		if(cp->used < vp->used) vp = cp;
+	}
+	if(vp->data == NULL && (vp->data = malloc(IFS_BLOCK_SIZE)) == NULL) {
+		return nomem(img, "No memory for image block cache");
+	}
+	vp->block = block;
+	vp->used = ++img->tick;
+	return vp;
+}
+
+
+int
+ifs_block_decode(int method, const unsigned char *in, unsigned clen, unsigned char *out, unsigned *lenp) {
+	double		start = ifs_trace_now();
+	int			ok;
+
+	if(method == STARTUP_HDR_FLAGS1_COMPRESS_LZO) {
+		lzo_uint	out_len = IFS_BLOCK_SIZE;
+
+		ok = lzo1x_decompress_safe(in, clen, out, &out_len, NULL) == LZO_E_OK;
+		*lenp = out_len;
+	} else {
+		ucl_uint	out_len = IFS_BLOCK_SIZE;
+
+		ok = ucl_nrv2b_decompress_safe_8(in, clen, out, &out_len, NULL) == 0;
+		*lenp = out_len;
+	}
+	if(!ok) {
+		return -1;
+	}
+	ifs_trace_span("decompress", "block", start, NULL, clen, *lenp);
+	return 0;
+}
+
+
+int
+ifs_image_decode(const struct ifs_image *img, unsigned i, unsigned char *out, unsigned *lenp) {
+	const struct ifs_block	*bp = &img->blocks[i];
+
+	return ifs_block_decode(img->method, img->base + bp->cpos, bp->clen, out, lenp);
+}
+
+
+//
+// Uncompress LZO/UCL block 'i', placing it if it's the next one in
+// order.
+//
+static struct ifs_cache *
+load(struct ifs_image *img, unsigned i) {
+	struct ifs_block	*bp = &img->blocks[i];
+	struct ifs_cache	*cp;
+	unsigned			ulen;
+
+	if((cp = cached(img, i)) == NULL) {
+		if((cp = victim(img, i)) == NULL) {
+			return NULL;
+		}
+		if(ifs_image_decode(img, i, cp->data, &ulen) == -1) {
+			cp->used = 0;
+			return failed(img, "decompression failure");
+		}
+		bp->ulen = ulen;
+	}
+	// The last block may have been uncompressed (and placed from the
+	// end of the image) before its turn came.
+	if(i == img->sized) {
+		bp->upos = i ? img->blocks[i - 1].upos + img->blocks[i - 1].ulen : img->zstart;
+		img->sized++;
+	}
+	return cp;
+}
+
+
+//
+// Uncompressing a whole LZO/UCL image. Worker threads take the blocks
+// in order and uncompress them into a window of UNCOMPRESS_WINDOW
+// slots, while the calling thread writes the finished slots out in
+// order and frees them up for later blocks.
+//
+#define UNCOMPRESS_WINDOW	128
+
+struct uncompress {
+	const struct ifs_image	*img;
+	pthread_mutex_t			mutex;
+	pthread_cond_t			decoded;	// a slot has been filled
+	pthread_cond_t			written;	// a slot has been freed
+	unsigned				next;		// next block to hand out
+	unsigned				written_upto;
+	int						failed;
+	unsigned char			*out;
+	unsigned				len[UNCOMPRESS_WINDOW];
+	char					done[UNCOMPRESS_WINDOW];
+};
+
+struct uncompress_thread {
+	struct uncompress		*up;
+	int						id;
+};
+
+
+static void *
+uncompress_worker(struct uncompress *up) {
+	unsigned			i, slot, len;
+	int					status;
+
+	pthread_mutex_lock(&up->mutex);
+	for( ;; ) {
+		while(!up->failed && up->next < up->img->num_blocks && up->next >= up->written_upto + UNCOMPRESS_WINDOW) {
+			pthread_cond_wait(&up->written, &up->mutex);
+		}
+		if(up->failed || up->next >= up->img->num_blocks) break;
+		i = up->next++;
+		slot = i % UNCOMPRESS_WINDOW;
+		pthread_mutex_unlock(&up->mutex);
+
+		status = ifs_image_decode(up->img, i, up->out + slot * IFS_BLOCK_SIZE, &len);
+
+		pthread_mutex_lock(&up->mutex);
+		if(status == -1) {
+			up->failed = 1;
+			pthread_cond_broadcast(&up->written);
+		}
+		up->len[slot] = len;
+		up->done[slot] = 1;
+		pthread_cond_broadcast(&up->decoded);
+	}
+	pthread_mutex_unlock(&up->mutex);
+	return NULL;
+}
+
+
+static void *
+uncompress_thread(void *arg) {
+	struct uncompress_thread	*tp = arg;
+	char						tname[32];
+
+	snprintf(tname, sizeof tname, "decompress %d", tp->id);
+	ifs_trace_thread_name(tname);
+	return uncompress_worker(tp->up);
+}
+
+
+int
+ifs_image_uncompress(struct ifs_image *img, int fd, int nthreads) {
+	struct uncompress			u;
+	struct uncompress			*up = &u;
+	struct uncompress_thread	*tids;
+	pthread_t					*threads;
+	off_t						off;
+	unsigned					w, slot, len;
+	int							i;
+
+	if((off = lseek(fd, 0, SEEK_END)) == -1) {
+		failed(img, "Unable to write uncompressed image");
+		return -1;
+	}
+	memset(up, 0, sizeof *up);
+	up->img = img;
+	pthread_mutex_init(&up->mutex, NULL);
+	pthread_cond_init(&up->decoded, NULL);
+	pthread_cond_init(&up->written, NULL);
+	up->out = malloc(UNCOMPRESS_WINDOW * IFS_BLOCK_SIZE);
+	tids = malloc(nthreads * sizeof *tids);
+	threads = malloc(nthreads * sizeof *threads);
+	if(up->out == NULL || tids == NULL || threads == NULL) {
+		free(up->out);
+		free(tids);
+		free(threads);
+		nomem(img, "No memory for decompression");
+		return -1;
+	}
+	for(i = 0; i < nthreads; ++i) {
+		tids[i].up = up;
+		tids[i].id = i + 1;
+		if(pthread_create(&threads[i], NULL, uncompress_thread, &tids[i]) != 0) {
+			break;
+		}
+	}
+	nthreads = i;
+
+	for(w = 0; w < img->num_blocks; ++w) {
+		slot = w % UNCOMPRESS_WINDOW;
+		if(nthreads == 0) {
+			// No threads to be had, do it all here.
+			if(ifs_image_decode(img, w, up->out, &len) == -1) {
+				up->failed = 1;
+				break;
+			}
+			slot = 0;
+		} else {
+			int		ready;
+
+			pthread_mutex_lock(&up->mutex);
+			while(!up->done[slot] && !up->failed) {
+				pthread_cond_wait(&up->decoded, &up->mutex);
+			}
+			ready = up->done[slot];
+			len = up->len[slot];
+			pthread_mutex_unlock(&up->mutex);
+			if(!ready) break;
+		}
+		if(pwrite(fd, up->out + slot * IFS_BLOCK_SIZE, len, off) != len) {
+			break;
+		}
+		off += len;
+		pthread_mutex_lock(&up->mutex);
+		up->done[slot] = 0;
+		up->written_upto = w + 1;
+		pthread_cond_broadcast(&up->written);
+		pthread_mutex_unlock(&up->mutex);
+	}
+	pthread_mutex_lock(&up->mutex);
+	if(w < img->num_blocks) {
+		up->failed = 1;
+	}
+	pthread_cond_broadcast(&up->written);
+	pthread_mutex_unlock(&up->mutex);
+	for(i = 0; i < nthreads; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	free(tids);
+	free(up->out);
+	pthread_cond_destroy(&up->written);
+	pthread_cond_destroy(&up->decoded);
+	pthread_mutex_destroy(&up->mutex);
+	if(up->failed) {
+		failed(img, "decompression failure");
+		return -1;
+	}
+	return 0;
+}
+
+
+//
+// Uncompress zlib block 'i'. The stream is inflated forward from
+// wherever it is, or from the last restart point before the block.
+//
+static struct ifs_cache *
+inflate_block(struct ifs_image *img, unsigned i) {
+	struct ifs_block	*bp;
+	struct ifs_cache	*cp;
+	z_stream			**rp;
+	double				start;
+	unsigned			r, ulen, clen;
+	int					status;
+
+	if((cp = cached(img, i)) != NULL) {
+		return cp;
+	}
+	if(i < img->znext) {
+		r = MIN(i / IFS_ZLIB_RESTART, img->num_restart - 1);
+		inflateEnd(&img->zs);
+		if(inflateCopy(&img->zs, img->restart[r]) != Z_OK) {
+			return nomem(img, "No memory for decompression");
+		}
+		img->znext = r * IFS_ZLIB_RESTART;
+	}
+	for( ;; ) {
+		if(img->zdone && img->znext >= img->sized) {
+			return NULL;
+		}
+		if(img->znext % IFS_ZLIB_RESTART == 0 && img->znext / IFS_ZLIB_RESTART == img->num_restart) {
+			if((rp = realloc(img->restart, (img->num_restart + 1) * sizeof *img->restart)) == NULL) {
+				return nomem(img, "No memory for decompression");
+			}
+			img->restart = rp;
+			if((rp[img->num_restart] = calloc(1, sizeof(z_stream))) == NULL
+			 || inflateCopy(rp[img->num_restart], &img->zs) != Z_OK) {
+				free(rp[img->num_restart]);
+				return nomem(img, "No memory for decompression");
+			}
+			img->num_restart++;
+		}
+		if((cp = cached(img, img->znext)) == NULL && (cp = victim(img, img->znext)) == NULL) {
+			return NULL;
+		}
+		start = ifs_trace_now();
+		clen = img->zs.avail_in;
+		img->zs.next_out = cp->data;
+		img->zs.avail_out = IFS_BLOCK_SIZE;
+		do {
+			status = inflate(&img->zs, Z_NO_FLUSH);
+		} while(status == Z_OK && img->zs.avail_out != 0);
+		if(status != Z_OK && status != Z_STREAM_END) {
+			cp->used = 0;
+			return failed(img, "decompression failure");
+		}
+		ulen = IFS_BLOCK_SIZE - img->zs.avail_out;
+		clen -= img->zs.avail_in;
+		if(status == Z_STREAM_END) {
+			img->zdone = 1;
+		}
+		if(ulen == 0) {
+			cp->used = 0;
+			return NULL;
+		}
+		ifs_trace_span("decompress", "block", start, NULL, clen, ulen);
+		if(img->znext == img->sized) {
+			if((bp = add_block(img)) == NULL) {
+				cp->used = 0;
+				return NULL;
+			}
+			bp->upos = img->zstart + (long)img->znext * IFS_BLOCK_SIZE;
+			bp->ulen = ulen;
+			img->sized++;
+		}
+		if(img->znext++ == i) {
+			return cp;
+		}
+	}
+}
+
+
+//
+// Find the block holding image offset 'off' (at or past zstart),
+// placing blocks until it turns up. Returns -1 past the end.
+//
+static long
+find_block(struct ifs_image *img, long off) {
+	struct ifs_block	*bp;
+	unsigned			lo, hi, mid;
+
+	for( ;; ) {
+		if(img->sized != 0) {
+			bp = &img->blocks[img->sized - 1];
+			if(off < bp->upos + bp->ulen) {
+				for(lo = 0, hi = img->sized - 1; lo < hi; ) {
+					mid = (lo + hi) / 2;
+					if(off < img->blocks[mid].upos + img->blocks[mid].ulen) {
+						hi = mid;
+					} else {
+						lo = mid + 1;
+					}
+				}
+				return lo;
+			}
+		}
+		if(img->method == STARTUP_HDR_FLAGS1_COMPRESS_ZLIB) {
+			if(img->zdone || inflate_block(img, img->sized) == NULL) {
+				return -1;
+			}
+			continue;
+		}
+		if(img->sized == img->num_blocks) {
+			return -1;
+		}
+		bp = &img->blocks[img->num_blocks - 1];
+		if(img->zend != 0 && img->sized < img->num_blocks - 1) {
+			if(bp->upos == -1) {
+				if(load(img, img->num_blocks - 1) == NULL) {
+					return -1;
+				}
+				bp->upos = img->zend - bp->ulen;
+			}
+			if(off >= bp->upos) {
+				return (off < img->zend) ? (long)img->num_blocks - 1 : -1;
+			}
+		}
+		if(load(img, img->sized) == NULL) {
+			return -1;
+		}
+	}
+}
+
+
+const unsigned char *
+ifs_image_piece(struct ifs_image *img, long off, unsigned long len, unsigned long *lenp) {
+	struct ifs_block	*bp;
+	struct ifs_cache	*cp;
+	unsigned long		end;
+	long				b;
+
+	img->error = NULL;
+	if(off < 0) {
+		return NULL;
+	}
+	if(img->method == 0 || off < img->zstart) {
+		end = img->method ? img->zstart : img->size;
+		if((unsigned long)off >= end) {
+			return NULL;
+		}
+		*lenp = MIN(len, end - off);
+		return img->base + off;
+	}
+	if((b = find_block(img, off)) == -1) {
+		return NULL;
+	}
+	cp = (img->method == STARTUP_HDR_FLAGS1_COMPRESS_ZLIB) ? inflate_block(img, b) : load(img, b);
+	if(cp == NULL) {
+		return NULL;
+	}
+	bp = &img->blocks[b];
+	*lenp = MIN(len, bp->upos + bp->ulen - off);
+	return cp->data + (off - bp->upos);
+}
+
+
+const void *
+ifs_image_span(struct ifs_image *img, long off, unsigned long len) {
+	const unsigned char	*p;
+	unsigned long		n, done;
+
+	if(len == 0) {
+		img->error = NULL;
+		return (off >= 0) ? img->base : NULL;
+	}
+	if((p = ifs_image_piece(img, off, len, &n)) == NULL) {
+		return NULL;
+	}
+	if(n == len) {
+		return p;
+	}
+	if(len > img->scratch_size) {
+		free(img->scratch);
+		img->scratch_size = 0;
+		if((img->scratch = malloc(len)) == NULL) {
+			return nomem(img, "No memory to read image");
+		}
+		img->scratch_size = len;
+	}
+	for(done = 0; done < len; done += n) {
+		if((p = ifs_image_piece(img, off + done, len - done, &n)) == NULL) {
+			return NULL;
+		}
+		memcpy(img->scratch + done, p, n);
+	}
+	return img->scratch;
+}
+
+
+int
+ifs_image_read(struct ifs_image *img, long off, void *buf, unsigned long len) {
+	const unsigned char	*p;
+	unsigned long		n;
+
+	for( ; len != 0; len -= n) {
+		if((p = ifs_image_piece(img, off, len, &n)) == NULL) {
+			return -1;
+		}
+		memcpy(buf, p, n);
+		buf = (char *)buf + n;
+		off += n;
+	}
+	return 0;
+}
+
+
+int
+ifs_image_cksum(struct ifs_image *img, long off, unsigned long len, int big, uint32_t *sump) {
+	struct ifs_cksum	ck = { 0, big };
+	const unsigned char	*p;
+	unsigned long		n;
+	unsigned			pos;
+
+	for(pos = 0; len != 0; off += n, len -= n, pos += n) {
+		if((p = ifs_image_piece(img, off, len, &n)) == NULL) {
+			return -1;
+		}
+		ifs_cksum_add(&ck, pos, p, n);
+	}
+	*sump = ck.sum;
+	return 0;
+}
+
+__SRCVERSION("ifs_image.c $Rev$");
@@ -0,0 +1,128 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+#ifndef __IFS_IMAGE_H_INCLUDED
+#define __IFS_IMAGE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+
+//
+// Random access to an image that may be compressed.
+//
+// The file holding the image is mapped read-only (or handed over as a
+// buffer) and read where it lies up to the start of its compressed
+// part. The compressed data is indexed as blocks (the length prefixed
+// LZO and UCL blocks, or fixed size pieces of the zlib output) which
+// are uncompressed when something in them is read, keeping the most
+// recently used ones. LZO and UCL blocks don't record their
+// uncompressed size, so where a block lands in the image is learned by
+// uncompressing the blocks in order. The last block ends the image
+// though, so once 'zend' is set the image trailer can be read without
+// uncompressing everything before it. zlib can only be read forward;
+// a copy of the stream state is kept every IFS_ZLIB_RESTART blocks to
+// go back to.
+//
+// Offsets are from the start of the file. An image isn't safe to use
+// from several threads at once, except through ifs_image_decode().
+//
+#define IFS_BLOCK_SIZE		0x10000
+#define IFS_CACHE			16
+#define IFS_ZLIB_RESTART	64
+
+struct ifs_block {
+	long				cpos;		// LZO/UCL compressed data in the file
+	unsigned			clen;
+	long				upos;		// offset in the image, -1 until known
+	unsigned			ulen;
+};
+
+struct ifs_cache {
+	unsigned			block;
+	unsigned			used;		// 0 for a free slot
+	unsigned char		*data;
+};
+
+struct ifs_image {
+	unsigned char		*base;
+	size_t				size;
+	int					mapped;		// base is mapped, else malloc'd
+	int					borrowed;	// base belongs to the caller
+
+	int					method;		// STARTUP_HDR_FLAGS1_COMPRESS_*, 0 if uncompressed
+	long				zstart;		// image offset of the uncompressed data
+	long				zend;		// end of the image, 0 if unknown
+	struct ifs_block	*blocks;
+	unsigned			num_blocks;
+	unsigned			max_blocks;
+	unsigned			sized;		// blocks[0 .. sized) have been placed
+	struct ifs_cache	cache[IFS_CACHE];
+	unsigned			tick;
+	unsigned char		*scratch;
+	unsigned long		scratch_size;
+	z_stream			zs;			// positioned at block 'znext'
+	unsigned			znext;
+	int					zdone;		// every zlib block has been seen
+	z_stream			**restart;	// zlib state can't be moved
+	unsigned			num_restart;
+
+	const char			*error;		// why the last call failed
+	int					nomem;		// ... and it was for want of memory
+};
+
+// Map the regular file open on 'fd'. -1 if it can't be mapped.
+int			ifs_image_map(struct ifs_image *img, int fd);
+
+// Use 'len' bytes at 'buf', which are freed with the image unless
+// 'borrowed' is set.
+void		ifs_image_mem(struct ifs_image *img, void *buf, size_t len, int borrowed);
+
+void		ifs_image_unmap(struct ifs_image *img);
+
+// Index the compressed data at 'zstart', which becomes the image from
+// 'zstart' on.
+int			ifs_image_index(struct ifs_image *img, int method, long zstart);
+
+//
+// Reading. ifs_image_piece() returns a pointer to the image at 'off'
+// and sets '*lenp' to how much of the 'len' bytes wanted are there;
+// ifs_image_span() returns all 'len' of them. Both return NULL past
+// the end, and the pointer is good until the next call. On a failure
+// other than running off the end, 'error' says what went wrong.
+//
+const unsigned char	*ifs_image_piece(struct ifs_image *img, long off, unsigned long len, unsigned long *lenp);
+const void	*ifs_image_span(struct ifs_image *img, long off, unsigned long len);
+int			ifs_image_read(struct ifs_image *img, long off, void *buf, unsigned long len);
+
+// Checksum of the 'len' bytes at 'off', summed as words of the given
+// byte order. -1 if the image ends early.
+int			ifs_image_cksum(struct ifs_image *img, long off, unsigned long len, int big, uint32_t *sump);
+
+// Uncompress all of the indexed LZO/UCL image onto the end of the file
+// open on 'fd' using 'nthreads' threads.
+int			ifs_image_uncompress(struct ifs_image *img, int fd, int nthreads);
+
+// Uncompress LZO/UCL block 'i' into 'out' (IFS_BLOCK_SIZE bytes). Safe
+// to call from several threads at once.
+int			ifs_image_decode(const struct ifs_image *img, unsigned i, unsigned char *out, unsigned *lenp);
+
+// Uncompress the 'clen' byte LZO/UCL block at 'in' into 'out'
+// (IFS_BLOCK_SIZE bytes).
+int			ifs_block_decode(int method, const unsigned char *in, unsigned clen, unsigned char *out, unsigned *lenp);
+
+#endif
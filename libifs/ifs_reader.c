@@ -0,0 +1,680 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+
+
+#define _GNU_SOURCE		// memmem()
+#include <lib/compat.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include _NTO_HDR_(sys/startup.h)
+#include _NTO_HDR_(sys/image.h)
+#include "libifs/ifs_reader.h"
+
+#define INDEX_MIN		64
+
+struct index_slot {
+	uint32_t				hash;
+	long					pos;		// of the dirent, 0 for a free slot
+};
+
+struct ifs_reader {
+	struct ifs_image		img;
+	long					spos;
+	long					ipos;
+	int						big;
+	int						cross;		// the image isn't in host byte order
+	struct startup_header	shdr;
+	struct image_header		*ihdr;		// mountpoint included
+	struct index_slot		*index;
+	unsigned				index_mask;
+	union image_dirent		*dir;		// IFS_DIRENT_MAX bytes
+};
+
+
+static const char	*errors[] = {
+	"No error",
+	"System error",
+	"Out of memory",
+	"No image found",
+	"Invalid header",
+	"Unsupported compression or corrupt data",
+	"Image ends early",
+	"Checksum mismatch",
+	"Invalid directory entry",
+	"No such file in image",
+};
+
+const char *
+ifs_strerror(int err) {
+	if(err == IFS_ESYS) {
+		return strerror(errno);
+	}
+	if(err < 0 || err >= (int)(sizeof errors / sizeof *errors)) {
+		return "Unknown error";
+	}
+	return errors[err];
+}
+
+
+static int
+host_big(void) {
+	static const uint16_t	one = 1;
+
+	return *(const unsigned char *)&one == 0;
+}
+
+static uint16_t
+swap16(uint16_t v) {
+	return (v >> 8) | (v << 8);
+}
+
+static uint32_t
+swap32(uint32_t v) {
+	return (v >> 24) | ((v >> 8) & 0xff00) | ((v & 0xff00) << 8) | (v << 24);
+}
+
+
+void
+ifs_swap_startup(struct startup_header *shdr) {
+	uint32_t	*p;
+
+	shdr->signature = swap32(shdr->signature);
+	shdr->version = swap16(shdr->version);
+	shdr->header_size = swap16(shdr->header_size);
+	shdr->machine = swap16(shdr->machine);
+	for(p = &shdr->startup_vaddr; p <= &shdr->imagefs_size; ++p) {
+		*p = swap32(*p);
+	}
+	shdr->preboot_size = swap16(shdr->preboot_size);
+	shdr->zero0 = swap16(shdr->zero0);
+	for(p = shdr->zero; p < (uint32_t *)(shdr + 1); ++p) {
+		*p = swap32(*p);
+	}
+}
+
+
+void
+ifs_swap_header(struct image_header *ihdr) {
+	uint32_t	*p;
+
+	for(p = &ihdr->image_size; (char *)p < (char *)ihdr + offsetof(struct image_header, mountpoint); ++p) {
+		*p = swap32(*p);
+	}
+}
+
+
+// Why an ifs_image call came back empty handed.
+static int
+image_error(const struct ifs_image *img) {
+	if(img->error == NULL) {
+		return IFS_ETRUNC;
+	}
+	return img->nomem ? IFS_ENOMEM : IFS_ECOMPRESS;
+}
+
+
+int
+ifs_dirent_get(struct ifs_image *img, long pos, int cross, union image_dirent *dir) {
+	const void		*p;
+	unsigned		size, fixed;
+
+	if((p = ifs_image_span(img, pos, sizeof dir->attr)) == NULL) {
+		return -image_error(img);
+	}
+	memcpy(&dir->attr, p, sizeof dir->attr);
+	size = cross ? swap16(dir->attr.size) : dir->attr.size;
+	if(size < sizeof dir->attr) {
+		return (size != 0) ? -IFS_EDIRENT : 0;
+	}
+	if((p = ifs_image_span(img, pos, size)) == NULL) {
+		return -image_error(img);
+	}
+	memcpy(dir, p, size);
+	((char *)dir)[size] = '\0';
+
+	if(cross) {
+		uint32_t	*wp;
+
+		dir->attr.size = size;
+		dir->attr.extattr_offset = swap16(dir->attr.extattr_offset);
+		for(wp = &dir->attr.ino; (char *)wp < (char *)dir + sizeof dir->attr; ++wp) {
+			*wp = swap32(*wp);
+		}
+	}
+	switch(dir->attr.mode & S_IFMT) {
+	case S_IFREG:
+		fixed = offsetof(struct image_file, path);
+		if(size > fixed && cross) {
+			dir->file.offset = swap32(dir->file.offset);
+			dir->file.size = swap32(dir->file.size);
+		}
+		break;
+	case S_IFDIR:
+		fixed = offsetof(struct image_dir, path);
+		break;
+	case S_IFLNK:
+		fixed = offsetof(struct image_symlink, path);
+		if(size > fixed) {
+			if(cross) {
+				dir->symlink.sym_offset = swap16(dir->symlink.sym_offset);
+				dir->symlink.sym_size = swap16(dir->symlink.sym_size);
+			}
+			if(dir->symlink.sym_offset + dir->symlink.sym_size > size - fixed) {
+				return -IFS_EDIRENT;
+			}
+		}
+		break;
+	case S_IFCHR:
+	case S_IFBLK:
+	case S_IFIFO:
+	case S_IFNAM:
+		fixed = offsetof(struct image_device, path);
+		if(size > fixed && cross) {
+			dir->device.dev = swap32(dir->device.dev);
+			dir->device.rdev = swap32(dir->device.rdev);
+		}
+		break;
+	default:
+		fixed = sizeof dir->attr;
+		break;
+	}
+	return (size > fixed) ? (int)size : -IFS_EDIRENT;
+}
+
+
+//
+// Finding the image. A startup header leads to the image after it,
+// which may be compressed; failing that the first good image header
+// is used.
+//
+static long
+find(const struct ifs_image *img, long from, const void *sig, size_t len) {
+	const unsigned char	*p;
+
+	if(from < 0 || (size_t)from >= img->size) {
+		return -1;
+	}
+	p = memmem(img->base + from, img->size - from, sig, len);
+	return (p != NULL) ? p - img->base : -1;
+}
+
+
+// Whether the 'len' bytes of 'sig' are at 'pos'.
+static int
+at(const struct ifs_image *img, long pos, const void *sig, size_t len) {
+	return pos >= 0 && (size_t)pos + len <= img->size && memcmp(img->base + pos, sig, len) == 0;
+}
+
+
+static int
+check_image(struct ifs_image *img, long pos, struct ifs_location *loc) {
+	struct image_header		ihdr;
+	int						big;
+
+	if(ifs_image_read(img, pos, &ihdr, sizeof ihdr) == -1) {
+		return image_error(img);
+	}
+	if(memcmp(ihdr.signature, IMAGE_SIGNATURE, sizeof ihdr.signature) != 0) {
+		return IFS_ENOIMAGE;
+	}
+	big = (ihdr.flags & IMAGE_FLAGS_BIGENDIAN) != 0;
+	if(big != host_big()) {
+		ifs_swap_header(&ihdr);
+	}
+	if(ihdr.image_size < sizeof ihdr + sizeof(struct image_trailer)
+	 || ihdr.hdr_dir_size > ihdr.image_size
+	 || ihdr.dir_offset < sizeof ihdr || ihdr.dir_offset > ihdr.hdr_dir_size
+	 || (img->method == 0 && ihdr.image_size > img->size - pos)) {
+		return IFS_EHEADER;
+	}
+	loc->ipos = pos;
+	loc->big = big;
+	loc->ihdr = ihdr;
+	if(img->method != 0) {
+		img->zend = pos + ihdr.image_size;
+	}
+	return IFS_OK;
+}
+
+
+static int
+check_startup(struct ifs_image *img, long pos, int big, unsigned flags, struct ifs_location *loc) {
+	struct startup_header	shdr;
+	long					zstart, ipos;
+	int						method, zero_ok, err;
+
+	if(pos + sizeof shdr > img->size) {
+		return IFS_ENOIMAGE;
+	}
+	memcpy(&shdr, img->base + pos, sizeof shdr);
+	zero_ok = shdr.zero[0] == 0 && shdr.zero[1] == 0 && shdr.zero[2] == 0;
+	if(((shdr.flags1 & STARTUP_HDR_FLAGS1_BIGENDIAN) != 0) != big
+	 || (!zero_ok && !(flags & IFS_OPEN_NOZERO))) {
+		return IFS_ENOIMAGE;
+	}
+	if(big != host_big()) {
+		ifs_swap_startup(&shdr);
+	}
+	if(shdr.startup_size < sizeof shdr + sizeof(struct startup_trailer)
+	 || shdr.startup_size > img->size - pos) {
+		return IFS_ENOIMAGE;
+	}
+	loc->spos = pos;
+	loc->big = big;
+	loc->zero_ok = zero_ok;
+	loc->shdr = shdr;
+
+	zstart = pos + shdr.startup_size;
+	if((method = shdr.flags1 & STARTUP_HDR_FLAGS1_COMPRESS_MASK) != 0) {
+		if(flags & IFS_LOCATE_NOINDEX) {
+			return IFS_OK;
+		}
+		if(ifs_image_index(img, method, zstart) == -1) {
+			return img->nomem ? IFS_ENOMEM : IFS_ECOMPRESS;
+		}
+		return check_image(img, zstart, loc);
+	}
+	for(ipos = zstart; (ipos = find(img, ipos, IMAGE_SIGNATURE, 7)) != -1; ++ipos) {
+		if((err = check_image(img, ipos, loc)) != IFS_EHEADER && err != IFS_ENOIMAGE) {
+			return err;
+		}
+	}
+	return IFS_ENOIMAGE;
+}
+
+
+int
+ifs_locate(struct ifs_image *img, long from, unsigned flags, struct ifs_location *loc) {
+	static const unsigned char	sigs[3][7] = {
+		{ 0xeb, 0x7e, 0xff, 0x00 },	// little endian startup
+		{ 0x00, 0xff, 0x7e, 0xeb },	// big endian startup
+		IMAGE_SIGNATURE,
+	};
+	static const size_t			lens[3] = { 4, 4, 7 };
+	long						next[3];
+	int							i, k, err;
+
+	memset(loc, 0, sizeof *loc);
+	loc->spos = -1;
+	loc->ipos = -1;
+	loc->zero_ok = 1;
+	for(i = 0; i < 3; ++i) {
+		if(flags & IFS_LOCATE_AT) {
+			next[i] = at(img, from, sigs[i], lens[i]) ? from : -1;
+		} else {
+			next[i] = find(img, from, sigs[i], lens[i]);
+		}
+	}
+	for( ;; ) {
+		for(k = -1, i = 0; i < 3; ++i) {
+			if(next[i] != -1 && (k == -1 || next[i] < next[k])) k = i;
+		}
+		if(k == -1) {
+			return IFS_ENOIMAGE;
+		}
+		err = (k == 2) ? check_image(img, next[k], loc) : check_startup(img, next[k], k, flags, loc);
+		if(err == IFS_OK || loc->spos != -1) {
+			// Past a startup header there's no going back.
+			return err;
+		}
+		if(err != IFS_ENOIMAGE && err != IFS_EHEADER) {
+			return err;
+		}
+		next[k] = (flags & IFS_LOCATE_AT) ? -1 : find(img, next[k] + 1, sigs[k], lens[k]);
+	}
+}
+
+
+static int
+reader_start(struct ifs_reader *r, unsigned flags) {
+	struct ifs_location	loc;
+	int					err;
+
+	r->spos = -1;
+	if((r->dir = malloc(IFS_DIRENT_MAX)) == NULL) {
+		return IFS_ENOMEM;
+	}
+	if((err = ifs_locate(&r->img, 0, flags & IFS_OPEN_NOZERO, &loc)) != IFS_OK) {
+		return err;
+	}
+	r->spos = loc.spos;
+	r->shdr = loc.shdr;
+	r->ipos = loc.ipos;
+	r->big = loc.big;
+	r->cross = loc.big != host_big();
+
+	// The header with the mountpoint, which runs up to the directory.
+	if((r->ihdr = malloc(loc.ihdr.dir_offset + 1)) == NULL) {
+		return IFS_ENOMEM;
+	}
+	if(ifs_image_read(&r->img, loc.ipos, r->ihdr, loc.ihdr.dir_offset) == -1) {
+		return image_error(&r->img);
+	}
+	memcpy(r->ihdr, &loc.ihdr, sizeof loc.ihdr);
+	((char *)r->ihdr)[loc.ihdr.dir_offset] = '\0';
+
+	if(flags & IFS_OPEN_VERIFY) {
+		return ifs_verify(r);
+	}
+	return IFS_OK;
+}
+
+
+int
+ifs_open(const char *path, unsigned flags, struct ifs_reader **rp) {
+	struct ifs_reader	*r;
+	unsigned char		*buf = NULL, *p;
+	size_t				len = 0, max = 0;
+	ssize_t				n;
+	int					fd, err;
+
+	*rp = NULL;
+	if((fd = open(path, O_RDONLY)) == -1) {
+		return IFS_ESYS;
+	}
+	if((r = calloc(1, sizeof *r)) == NULL) {
+		close(fd);
+		return IFS_ENOMEM;
+	}
+	if(ifs_image_map(&r->img, fd) == -1) {
+		// Not a regular file, read all of it in.
+		for( ;; ) {
+			if(len == max) {
+				max = max ? max * 2 : 0x100000;
+				if((p = realloc(buf, max)) == NULL) {
+					free(buf);
+					close(fd);
+					free(r);
+					return IFS_ENOMEM;
+				}
+				buf = p;
+			}
+			if((n = read(fd, buf + len, max - len)) <= 0) {
+				if(n == -1 && errno == EINTR) continue;
+				break;
+			}
+			len += n;
+		}
+		if(n == -1) {
+			err = errno;
+			free(buf);
+			close(fd);
+			free(r);
+			errno = err;
+			return IFS_ESYS;
+		}
+		ifs_image_mem(&r->img, buf, len, 0);
+	}
+	close(fd);
+	if((err = reader_start(r, flags)) != IFS_OK) {
+		ifs_close(r);
+		return err;
+	}
+	*rp = r;
+	return IFS_OK;
+}
+
+
+int
+ifs_open_mem(const void *buf, size_t len, unsigned flags, struct ifs_reader **rp) {
+	struct ifs_reader	*r;
+	int					err;
+
+	*rp = NULL;
+	if((r = calloc(1, sizeof *r)) == NULL) {
+		return IFS_ENOMEM;
+	}
+	ifs_image_mem(&r->img, (void *)buf, len, 1);
+	if((err = reader_start(r, flags)) != IFS_OK) {
+		ifs_close(r);
+		return err;
+	}
+	*rp = r;
+	return IFS_OK;
+}
+
+
+void
+ifs_close(struct ifs_reader *r) {
+	if(r == NULL) return;
+	ifs_image_unmap(&r->img);
+	free(r->ihdr);
+	free(r->index);
+	free(r->dir);
+	free(r);
+}
+
+
+const struct startup_header *
+ifs_startup(struct ifs_reader *r) {
+	return (r->spos != -1) ? &r->shdr : NULL;
+}
+
+const struct image_header *
+ifs_header(struct ifs_reader *r) {
+	return r->ihdr;
+}
+
+long
+ifs_startup_pos(struct ifs_reader *r) {
+	return r->spos;
+}
+
+long
+ifs_image_pos(struct ifs_reader *r) {
+	return r->ipos;
+}
+
+int
+ifs_big_endian(struct ifs_reader *r) {
+	return r->big;
+}
+
+
+int
+ifs_verify(struct ifs_reader *r) {
+	uint32_t	sum;
+
+	if(r->spos != -1) {
+		if(ifs_image_cksum(&r->img, r->spos, r->shdr.startup_size,
+				r->shdr.flags1 & STARTUP_HDR_FLAGS1_BIGENDIAN, &sum) == -1) {
+			return image_error(&r->img);
+		}
+		if(sum != 0) {
+			return IFS_ECKSUM;
+		}
+	}
+	if(ifs_image_cksum(&r->img, r->ipos, r->ihdr->image_size, r->big, &sum) == -1) {
+		return image_error(&r->img);
+	}
+	return (sum == 0) ? IFS_OK : IFS_ECKSUM;
+}
+
+
+static void
+fill_entry(struct ifs_reader *r, long pos, struct ifs_entry *ent) {
+	union image_dirent	*dir = r->dir;
+
+	ent->dirent = dir;
+	ent->pos = pos;
+	ent->target = NULL;
+	switch(dir->attr.mode & S_IFMT) {
+	case S_IFREG:
+		ent->path = dir->file.path;
+		break;
+	case S_IFDIR:
+		ent->path = dir->dir.path;
+		break;
+	case S_IFLNK:
+		ent->path = dir->symlink.path;
+		ent->target = &dir->symlink.path[dir->symlink.sym_offset];
+		break;
+	default:
+		ent->path = dir->device.path;
+		break;
+	}
+}
+
+
+int
+ifs_readdir(struct ifs_reader *r, long *pos, struct ifs_entry *ent) {
+	long	end = r->ipos + r->ihdr->hdr_dir_size;
+	int		n;
+
+	if(*pos == 0) {
+		*pos = r->ipos + r->ihdr->dir_offset;
+	}
+	for( ;; ) {
+		if(*pos >= end) {
+			return IFS_ENOENT;
+		}
+		if((n = ifs_dirent_get(&r->img, *pos, r->cross, r->dir)) <= 0) {
+			return n ? -n : IFS_ENOENT;
+		}
+		*pos += n;
+		switch(r->dir->attr.mode & S_IFMT) {
+		case S_IFREG:
+		case S_IFDIR:
+		case S_IFLNK:
+		case S_IFCHR:
+		case S_IFBLK:
+		case S_IFIFO:
+		case S_IFNAM:
+			fill_entry(r, *pos - n, ent);
+			return IFS_OK;
+		default:
+			// Nothing that can be said about it.
+			break;
+		}
+	}
+}
+
+
+// FNV-1a
+static uint32_t
+path_hash(const char *path) {
+	uint32_t	h = 2166136261u;
+
+	while(*path != '\0') {
+		h = (h ^ (unsigned char)*path++) * 16777619u;
+	}
+	return h;
+}
+
+
+static int
+index_build(struct ifs_reader *r) {
+	struct index_slot	*tab, *sp;
+	struct ifs_entry	ent;
+	long				pos = 0;
+	unsigned			count = 0, size;
+	uint32_t			h;
+	int					err;
+
+	// Count first so the table never has to grow.
+	while((err = ifs_readdir(r, &pos, &ent)) == IFS_OK) {
+		count++;
+	}
+	if(err != IFS_ENOENT) {
+		return err;
+	}
+	for(size = INDEX_MIN; size < count * 2; size *= 2) {
+		// nothing
+	}
+	if((tab = calloc(size, sizeof *tab)) == NULL) {
+		return IFS_ENOMEM;
+	}
+	for(pos = 0; ifs_readdir(r, &pos, &ent) == IFS_OK; ) {
+		h = path_hash(ent.path);
+		for(sp = &tab[h & (size - 1)]; sp->pos != 0; sp = &tab[(sp - tab + 1) & (size - 1)]) {
+			// linear probing
+		}
+		sp->hash = h;
+		sp->pos = ent.pos;
+	}
+	r->index = tab;
+	r->index_mask = size - 1;
+	return IFS_OK;
+}
+
+
+int
+ifs_lookup(struct ifs_reader *r, const char *path, struct ifs_entry *ent) {
+	const char			*mountpoint = r->ihdr->mountpoint;
+	struct index_slot	*sp;
+	uint32_t			h;
+	size_t				len;
+	int					n, err;
+
+	if(r->index == NULL && (err = index_build(r)) != IFS_OK) {
+		return err;
+	}
+	// Only a whole leading component matches: "/pr" is not in "/prfoo".
+	// A mountpoint of "/" has nothing to strip but the slashes.
+	for(len = strlen(mountpoint); len > 0 && mountpoint[len - 1] == '/'; --len) {
+		// nothing
+	}
+	if(len > 0 && strncmp(path, mountpoint, len) == 0
+	 && (path[len] == '/' || path[len] == '\0')) {
+		path += len;
+	}
+	while(*path == '/') {
+		path++;
+	}
+	h = path_hash(path);
+	for(sp = &r->index[h & r->index_mask]; sp->pos != 0; sp = &r->index[(sp - r->index + 1) & r->index_mask]) {
+		if(sp->hash != h) continue;
+		if((n = ifs_dirent_get(&r->img, sp->pos, r->cross, r->dir)) <= 0) {
+			return n ? -n : IFS_EDIRENT;
+		}
+		fill_entry(r, sp->pos, ent);
+		if(strcmp(ent->path, path) == 0) {
+			return IFS_OK;
+		}
+	}
+	return IFS_ENOENT;
+}
+
+
+long
+ifs_read(struct ifs_reader *r, const struct ifs_entry *ent, uint64_t off, void *buf, size_t len, int *errp) {
+	const struct image_file	*file = &ent->dirent->file;
+
+	if(!S_ISREG(file->attr.mode)) {
+		*errp = IFS_EDIRENT;
+		return -1;
+	}
+	if(off >= file->size) {
+		return 0;
+	}
+	if(len > file->size - off) {
+		len = file->size - off;
+	}
+	if(ifs_image_read(&r->img, r->ipos + file->offset + off, buf, len) == -1) {
+		*errp = image_error(&r->img);
+		return -1;
+	}
+	return len;
+}
+
+__SRCVERSION("ifs_reader.c $Rev$");
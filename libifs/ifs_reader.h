@@ -0,0 +1,137 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+#ifndef __IFS_READER_H_INCLUDED
+#define __IFS_READER_H_INCLUDED
+
+#include <lib/compat.h>
+#include <stddef.h>
+#include <stdint.h>
+#include _NTO_HDR_(sys/startup.h)
+#include _NTO_HDR_(sys/image.h)
+#include "libifs/ifs_image.h"
+
+//
+// Reading image file systems.
+//
+// An image is opened from a file or a buffer holding it. The first
+// startup header or image header in it is found, the headers are
+// checked and a compressed image is uncompressed as it's read (see
+// ifs_image.h). Headers and directory entries are handed back in host
+// byte order whatever the target's. Paths are looked up through a hash
+// of the whole directory, built the first time one is needed.
+//
+// A reader is used by one thread at a time. Entries and headers stay
+// good until the next call on the same reader.
+//
+
+enum {
+	IFS_OK,
+	IFS_ESYS,			// see errno
+	IFS_ENOMEM,
+	IFS_ENOIMAGE,		// no startup or image header found
+	IFS_EHEADER,		// a header makes no sense
+	IFS_ECOMPRESS,		// unknown compression, or corrupt data
+	IFS_ETRUNC,			// ends early
+	IFS_ECKSUM,			// bad startup or image checksum
+	IFS_EDIRENT,		// bad directory entry
+	IFS_ENOENT			// no such path in the image
+};
+
+#define IFS_OPEN_VERIFY		0x0001	// check the checksums when opening
+#define IFS_OPEN_NOZERO		0x0002	// take startup headers whose zero fields aren't
+
+// The dirent union is big enough for any entry it's been given.
+#define IFS_DIRENT_MAX		0x10000
+
+struct ifs_reader;
+
+struct ifs_entry {
+	const union image_dirent	*dirent;	// host byte order
+	long						pos;		// file offset of the dirent
+	const char					*path;
+	const char					*target;	// of a symlink, else NULL
+};
+
+int			ifs_open(const char *path, unsigned flags, struct ifs_reader **rp);
+int			ifs_open_mem(const void *buf, size_t len, unsigned flags, struct ifs_reader **rp);
+void		ifs_close(struct ifs_reader *r);
+const char	*ifs_strerror(int err);
+
+// NULL if the image has no startup header.
+const struct startup_header	*ifs_startup(struct ifs_reader *r);
+const struct image_header	*ifs_header(struct ifs_reader *r);
+
+// The file offsets of the startup header (-1 without one) and image
+// header, and the image's byte order.
+long		ifs_startup_pos(struct ifs_reader *r);
+long		ifs_image_pos(struct ifs_reader *r);
+int			ifs_big_endian(struct ifs_reader *r);
+
+// Check the startup and image checksums.
+int			ifs_verify(struct ifs_reader *r);
+
+//
+// Walking the directory. 'pos' starts at 0 and is moved on by each
+// call. Returns IFS_OK with the next entry, IFS_ENOENT after the last
+// one, or the error that stopped the walk.
+//
+int			ifs_readdir(struct ifs_reader *r, long *pos, struct ifs_entry *ent);
+
+// Find 'path', which may start with the image's mountpoint.
+int			ifs_lookup(struct ifs_reader *r, const char *path, struct ifs_entry *ent);
+
+// Up to 'len' bytes from 'off' into a file. Returns how many were
+// read, or -1 with the error in '*errp'.
+long		ifs_read(struct ifs_reader *r, const struct ifs_entry *ent, uint64_t off, void *buf, size_t len, int *errp);
+
+//
+// The parts the reader is built from, for callers that find and map
+// images themselves. The swaps reverse the byte order of a header's
+// fields in place. ifs_dirent_get() reads the dirent at file offset
+// 'pos' into 'dir' (IFS_DIRENT_MAX bytes), swapping it if 'cross' is
+// set. It returns the dirent's size, 0 for the empty one ending the
+// directory, or a negated IFS_E* error.
+//
+void		ifs_swap_startup(struct startup_header *shdr);
+void		ifs_swap_header(struct image_header *ihdr);
+int			ifs_dirent_get(struct ifs_image *img, long pos, int cross, union image_dirent *dir);
+
+//
+// Finding an image the way ifs_open() does: the first good startup
+// header, or failing that image header, at or after 'from'. With
+// IFS_LOCATE_AT only headers right at 'from' are looked at. The image
+// behind a compressed startup is indexed, unless IFS_LOCATE_NOINDEX
+// leaves it (and 'ipos') for the caller to uncompress. IFS_OPEN_NOZERO
+// applies too. A failure after a good startup header still fills in
+// 'spos' and 'shdr'.
+//
+#define IFS_LOCATE_AT		0x0100
+#define IFS_LOCATE_NOINDEX	0x0200
+
+struct ifs_location {
+	long					spos;		// -1 without a startup header
+	long					ipos;		// -1 if not found yet
+	int						big;
+	int						zero_ok;	// the startup's zero fields are zero
+	struct startup_header	shdr;		// host byte order
+	struct image_header		ihdr;		// host byte order, no mountpoint
+};
+
+int			ifs_locate(struct ifs_image *img, long from, unsigned flags, struct ifs_location *loc);
+
+#endif
@@ -0,0 +1,237 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+
+
+#include <lib/compat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "libifs/ifs_trace.h"
+
+#define TRACE_BUFSIZE	(64*1024)
+#define TRACE_FD_ENV	"IFS_TRACE_FD"
+
+int						ifs_trace_enabled;
+
+static FILE				*trace_fp;
+static int				 trace_pid;
+static int				 trace_events;
+static int				 trace_next_tid;
+static int				 trace_shared;		// other processes write to the file too
+static int				 trace_child;
+static pthread_mutex_t	 trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread int		 trace_tid;
+
+
+double
+ifs_trace_now(void) {
+	struct timespec		ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+
+static void
+trace_string(const char *str) {
+	putc('"', trace_fp);
+	for( ; *str != '\0'; ++str) {
+		unsigned char	c = *str;
+
+		if(c == '"' || c == '\\') {
+			fprintf(trace_fp, "\\%c", c);
+		} else if(c < 0x20) {
+			fprintf(trace_fp, "\\u%04x", c);
+		} else {
+			putc(c, trace_fp);
+		}
+	}
+	putc('"', trace_fp);
+}
+
+
+//
+// Start an event record. Called with trace_mutex held.
+//
+static void
+trace_begin(const char *ph) {
+	if(trace_tid == 0) trace_tid = ++trace_next_tid;
+	fprintf(trace_fp, "%s\n{\"ph\":\"%s\",\"pid\":%d,\"tid\":%d",
+			trace_events++ ? "," : "", ph, trace_pid, trace_tid);
+}
+
+
+//
+// Finish an event record. Once the file is shared each record goes out
+// in a single append, so records from different processes don't mix.
+//
+static void
+trace_end(void) {
+	fprintf(trace_fp, "}}");
+	if(trace_shared) fflush(trace_fp);
+}
+
+
+static void
+trace_metadata(const char *what, const char *name) {
+	trace_begin("M");
+	fprintf(trace_fp, ",\"name\":\"%s\",\"args\":{\"name\":", what);
+	trace_string(name);
+	trace_end();
+}
+
+
+int
+ifs_trace_open(const char *path, const char *process_name) {
+	const char	*env;
+	char		*end;
+	long		fd = -1;
+
+	// After ifs_trace_exec() the file is already open and has the start
+	// of the array and this process's names in it.
+	if((env = getenv(TRACE_FD_ENV)) != NULL) {
+		fd = strtol(env, &end, 10);
+		if(*end != '\0' || fd < 0) fd = -1;
+		unsetenv(TRACE_FD_ENV);
+	}
+	if(fd != -1 && (trace_fp = fdopen(fd, "a")) != NULL) {
+		trace_events = 1;
+	} else if((trace_fp = fopen(path, "w")) == NULL) {
+		return -1;
+	}
+	// Large enough for any one record to be written out in one go.
+	setvbuf(trace_fp, NULL, _IOFBF, TRACE_BUFSIZE);
+	trace_pid = getpid();
+	if(trace_events == 0) {
+		fprintf(trace_fp, "[");
+		trace_metadata("process_name", process_name);
+		trace_metadata("thread_name", "main");
+	}
+	ifs_trace_enabled = 1;
+	atexit(ifs_trace_close);
+	return 0;
+}
+
+
+void
+ifs_trace_close(void) {
+	pthread_mutex_lock(&trace_mutex);
+	if(trace_fp != NULL) {
+		// The parent closes the array once its children are done.
+		if(!trace_child) fprintf(trace_fp, "\n]\n");
+		fclose(trace_fp);
+		trace_fp = NULL;
+	}
+	ifs_trace_enabled = 0;
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+
+void
+ifs_trace_thread_name(const char *name) {
+	if(!ifs_trace_enabled) return;
+	pthread_mutex_lock(&trace_mutex);
+	if(trace_fp != NULL) {
+		trace_metadata("thread_name", name);
+	}
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+
+//
+// Record a span that began at 'start' (from ifs_trace_now()) and ends
+// now. 'path' may be NULL and negative byte counts are left out.
+//
+void
+ifs_trace_span(const char *cat, const char *name, double start,
+				const char *path, long long bytes_in, long long bytes_out) {
+	double	end;
+
+	if(!ifs_trace_enabled) return;
+	end = ifs_trace_now();
+	pthread_mutex_lock(&trace_mutex);
+	if(trace_fp != NULL) {
+		trace_begin("X");
+		fprintf(trace_fp, ",\"ts\":%.3f,\"dur\":%.3f,\"cat\":\"%s\",\"name\":", start, end - start, cat);
+		trace_string(name);
+		fprintf(trace_fp, ",\"args\":{");
+		if(path != NULL) {
+			fprintf(trace_fp, "\"path\":");
+			trace_string(path);
+		}
+		if(bytes_in >= 0) {
+			fprintf(trace_fp, "%s\"bytes_in\":%lld", path ? "," : "", bytes_in);
+		}
+		if(bytes_out >= 0) {
+			fprintf(trace_fp, "%s\"bytes_out\":%lld", (path || bytes_in >= 0) ? "," : "", bytes_out);
+		}
+		trace_end();
+	}
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+
+void
+ifs_trace_fork(void) {
+	int		fd;
+
+	if(!ifs_trace_enabled) return;
+	pthread_mutex_lock(&trace_mutex);
+	if(trace_fp != NULL && !trace_shared) {
+		// Buffered records would be written again by every child.
+		fflush(trace_fp);
+		// Children share the file offset; appends keep whole records.
+		fd = fileno(trace_fp);
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_APPEND);
+		trace_shared = 1;
+	}
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+
+void
+ifs_trace_child(const char *process_name) {
+	if(!ifs_trace_enabled) return;
+	pthread_mutex_lock(&trace_mutex);
+	if(trace_fp != NULL) {
+		trace_child = 1;
+		trace_pid = getpid();
+		trace_metadata("process_name", process_name);
+		trace_metadata("thread_name", "main");
+	}
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+void
+ifs_trace_exec(void) {
+	char	buf[16];
+
+	if(!ifs_trace_enabled) return;
+	pthread_mutex_lock(&trace_mutex);
+	if(trace_fp != NULL && fflush(trace_fp) == 0) {
+		snprintf(buf, sizeof(buf), "%d", fileno(trace_fp));
+		setenv(TRACE_FD_ENV, buf, 1);
+	}
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+__SRCVERSION("ifs_trace.c $Rev$");
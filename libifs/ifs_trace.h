@@ -0,0 +1,54 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+#ifndef __IFS_TRACE_H_INCLUDED
+#define __IFS_TRACE_H_INCLUDED
+
+//
+// Chrome trace event output (the --trace option of mkifs and dumpifs).
+//
+// Events are written as they complete in the JSON array format, which
+// chrome://tracing and Perfetto load directly. Spans may be recorded
+// from any thread; each thread shows up as its own track.
+//
+
+extern int	ifs_trace_enabled;
+
+int		ifs_trace_open(const char *path, const char *process_name);
+void	ifs_trace_close(void);
+double	ifs_trace_now(void);
+void	ifs_trace_span(const char *cat, const char *name, double start,
+						const char *path, long long bytes_in, long long bytes_out);
+void	ifs_trace_thread_name(const char *name);
+
+//
+// Processes forked while tracing add their events to the same file.
+// Call ifs_trace_fork() before forking and ifs_trace_child() in the
+// child, which shows up as a process of its own. From the first fork on
+// every event is written out whole as soon as it is recorded.
+//
+void	ifs_trace_fork(void);
+void	ifs_trace_child(const char *process_name);
+
+//
+// A process about to exec itself calls ifs_trace_exec() first. The
+// file stays open across the exec and ifs_trace_open() in the new image
+// carries on writing to it rather than starting it over.
+//
+void	ifs_trace_exec(void);
+
+#endif
@@ -0,0 +1,229 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+
+
+//
+// Arena allocation and string interning for the build model.
+//
+// Everything describing the files going into an image (file entries,
+// their paths, tree nodes, section and soname records) lives as long
+// as the build does, so it is carved out of large blocks and released
+// all at once instead of being malloc'ed piece by piece. Strings are
+// interned so that identical paths and attribute values share storage
+// and can be compared by pointer.
+//
+
+#include <lib/compat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "struct.h"
+
+#define ARENA_BLOCK_SIZE	0x40000
+#define ARENA_ALIGN			sizeof(union arena_align)
+
+union arena_align {
+	void		*p;
+	long long	ll;
+	double		d;
+};
+
+struct arena_block {
+	struct arena_block	*next;
+	size_t				size;
+	size_t				used;
+	union arena_align	data[1];
+};
+
+struct strtab_entry {
+	struct strtab_entry	*next;
+	unsigned			hash;
+	char				str[1];
+};
+
+
+void *
+arena_alloc(struct arena *ap, size_t size) {
+	struct arena_block	*bp;
+	void				*p;
+
+	size = RUP(size, ARENA_ALIGN);
+	bp = ap->head;
+	if(bp == NULL || bp->size - bp->used < size) {
+		size_t	bsize = max(size, ARENA_BLOCK_SIZE);
+
+		bp = malloc(offsetof(struct arena_block, data) + bsize);
+		if(bp == NULL) {
+			error_exit("No memory for build information.\n");
+		}
+		bp->size = bsize;
+		bp->used = 0;
+		bp->next = ap->head;
+		ap->head = bp;
+	}
+	p = (char *)bp->data + bp->used;
+	bp->used += size;
+	ap->total += size;
+	memset(p, 0, size);
+	return p;
+}
+
+
+char *
+arena_strdup(struct arena *ap, const char *str) {
+	size_t	len = strlen(str) + 1;
+
+	return memcpy(arena_alloc(ap, len), str, len);
+}
+
+
+void
+arena_release(struct arena *ap) {
+	struct arena_block	*bp, *next;
+
+	for(bp = ap->head; bp != NULL; bp = next) {
+		next = bp->next;
+		free(bp);
+	}
+	ap->head = NULL;
+	ap->total = 0;
+}
+
+
+static unsigned
+strtab_hash(const char *str, size_t len) {
+	unsigned	h = 2166136261u;
+
+	while(len-- != 0) {
+		h = (h ^ (unsigned char)*str++) * 16777619u;
+	}
+	return h;
+}
+
+
+static void
+strtab_grow(struct strtab *tp) {
+	struct strtab_entry	**new, *ep, *next;
+	unsigned			new_mask, i;
+
+	new_mask = tp->mask ? tp->mask * 2 + 1 : 1023;
+	new = calloc(new_mask + 1, sizeof(*new));
+	if(new == NULL) {
+		error_exit("No memory for string table.\n");
+	}
+	for(i = 0; tp->bucket != NULL && i <= tp->mask; ++i) {
+		for(ep = tp->bucket[i]; ep != NULL; ep = next) {
+			next = ep->next;
+			ep->next = new[ep->hash & new_mask];
+			new[ep->hash & new_mask] = ep;
+		}
+	}
+	free(tp->bucket);
+	tp->bucket = new;
+	tp->mask = new_mask;
+}
+
+
+//
+// Return the canonical copy of the first 'len' characters of 'str'.
+// The result must never be modified.
+//
+char *
+strtab_intern_len(struct strtab *tp, const char *str, size_t len) {
+	struct strtab_entry	*ep;
+	unsigned			h;
+
+	h = strtab_hash(str, len);
+	if(tp->bucket != NULL) {
+		for(ep = tp->bucket[h & tp->mask]; ep != NULL; ep = ep->next) {
+			if(ep->hash == h && strncmp(ep->str, str, len) == 0 && ep->str[len] == '\0') {
+				return ep->str;
+			}
+		}
+	}
+	if(tp->count >= tp->mask) {
+		strtab_grow(tp);
+	}
+	ep = arena_alloc(tp->arena, offsetof(struct strtab_entry, str) + len + 1);
+	ep->hash = h;
+	memcpy(ep->str, str, len);
+	ep->str[len] = '\0';
+	ep->next = tp->bucket[h & tp->mask];
+	tp->bucket[h & tp->mask] = ep;
+	tp->count++;
+	return ep->str;
+}
+
+
+//
+// Return the canonical copy of 'str' if it has been interned, NULL
+// otherwise.
+//
+char *
+strtab_lookup(struct strtab *tp, const char *str) {
+	struct strtab_entry	*ep;
+	size_t				len = strlen(str);
+	unsigned			h;
+
+	if(tp->bucket == NULL) return NULL;
+	h = strtab_hash(str, len);
+	for(ep = tp->bucket[h & tp->mask]; ep != NULL; ep = ep->next) {
+		if(ep->hash == h && strcmp(ep->str, str) == 0) return ep->str;
+	}
+	return NULL;
+}
+
+
+char *
+strtab_intern(struct strtab *tp, const char *str) {
+	return strtab_intern_len(tp, str, strlen(str));
+}
+
+
+void
+strtab_release(struct strtab *tp) {
+	free(tp->bucket);
+	tp->bucket = NULL;
+	tp->mask = 0;
+	tp->count = 0;
+}
+
+
+//
+// The build model of the current build.
+//
+
+void *
+model_alloc(size_t size) {
+	return arena_alloc(&mk->model_arena, size);
+}
+
+char *
+model_intern(const char *str) {
+	return strtab_intern(&mk->model_strings, str);
+}
+
+void
+model_release(void) {
+	strtab_release(&mk->model_strings);
+	arena_release(&mk->model_arena);
+}
+
+__SRCVERSION("arena.c $Rev$");
@@ -29,10 +29,6 @@
 #include "struct.h"
 
 
-struct attr_booter_entry	booter;
-struct addr_space			default_image;
-struct addr_space			default_ram;
-
 enum {
 	ATTR_ATTR,
 	ATTR_DEF_IMAGE,
@@ -76,51 +72,51 @@ parse_booter_attr(int tokenc, char *tokenv[]) {
 			attr_len += sprintf(&attr_buf[attr_len], " %s", sval);
 			break;
 		case ATTR_DEF_IMAGE:
-			parse_addr_space_spec(&default_image, sval);
+			parse_addr_space_spec(&mk->default_image, sval);
 			break;
 		case ATTR_DEF_RAM:
-			parse_addr_space_spec(&default_ram, sval);
-			split_image = 1;
+			parse_addr_space_spec(&mk->default_ram, sval);
+			mk->split_image = 1;
 			break;
 		case ATTR_FILTER:
-			booter.filter_spec = strdup(sval);
+			mk->booter.filter_spec = strdup(sval);
 			while(*sval != '\0') {
 				if(*sval++ == '%') {
 					if(*sval++ == 'I') {
 						/* The filter program makes a copy of the image,
 						   rather than working on it in place. */
-						booter.copy_filter = 1;
+						mk->booter.copy_filter = 1;
 					}
 				}
 			}
 			break;
 		case ATTR_LEN:
-			booter.boot_len = ival;
+			mk->booter.boot_len = ival;
 			break;
 		case ATTR_NOTLOADED:
-			booter.notloaded_len = ival;
+			mk->booter.notloaded_len = ival;
 			break;
 		case ATTR_PAGESIZE:
-			booter.pagesize = ival;
+			mk->booter.pagesize = ival;
 			break;
 		case ATTR_PADDR_BIAS:
-			booter.paddr_bias = ival;
+			mk->booter.paddr_bias = ival;
 			break;
 		case ATTR_RSVD_VADDR:
-			booter.rsvd_vaddr = ival;
+			mk->booter.rsvd_vaddr = ival;
 			break;
 		case ATTR_VBOOT:
-			booter.vboot_addr = ival;
+			mk->booter.vboot_addr = ival;
 			break;
 		}
 	}
 	if(attr_len > 0) {
 		attr_len += 4;
-		boot_attr_buf = malloc(attr_len+1);
-		if(boot_attr_buf == NULL) {
+		mk->boot_attr_buf = malloc(attr_len+1);
+		if(mk->boot_attr_buf == NULL) {
 			error_exit("Not enough memory for boot attributes.\n");
 		}
-		sprintf(boot_attr_buf, "[%s]\n", attr_buf);
+		sprintf(mk->boot_attr_buf, "[%s]\n", attr_buf);
 	}
 }
 
@@ -145,15 +141,15 @@ handle_elf(char *p)
 	i = 0;
 	for( ;; ) {
 		if(i > n) {
-			error_exit( "Can not find information section in %s\n", booter.name );
+			error_exit( "Can not find information section in %s\n", mk->booter.name );
 		}
 		if(swap32(endian, shdr->sh_flags) & SHF_EXECINSTR) break;
 		++shdr;
 		++i;
 	}
 	p += swap32(endian, shdr->sh_offset);
-	booter.data = p;
-	booter.data_len = swap32(endian, shdr->sh_size);
+	mk->booter.data = p;
+	mk->booter.data_len = swap32(endian, shdr->sh_size);
 	return(p);
 }
 	
@@ -172,7 +168,7 @@ proc_booter_data(char *boot, int virtual) {
 	unsigned		len;
 	FILE			*fp;
 
-	booter.virtual = virtual;
+	mk->booter.virtual = virtual;
 	len = strcspn(boot, boot[0] == '/' ? "," : ",/");
 	end = &boot[len];
 	if(*end != '\0') {
@@ -184,27 +180,27 @@ proc_booter_data(char *boot, int virtual) {
 	
 	if(end != NULL) {
 		*end = '\0';
-		booter.filter_args = strdup(end + 1);
+		mk->booter.filter_args = strdup(end + 1);
 	} else {
-		booter.filter_args = "";
+		mk->booter.filter_args = "";
 	}
 	sprintf(name, "%s.boot", boot);
-	booter.name = strdup(find_file(NULL, hbuf, &sbuf, name, 0));
-	booter.data_len = sbuf.st_size;
-	booter.data = p = malloc(booter.data_len + 1);
+	mk->booter.name = strdup(find_file(NULL, hbuf, &sbuf, name, 0));
+	mk->booter.data_len = sbuf.st_size;
+	mk->booter.data = p = malloc(mk->booter.data_len + 1);
 	if(p == NULL) {
 		error_exit("Can not allocate %u bytes for boot information.\n",
-				booter.data_len);
+				mk->booter.data_len);
 	}
-	fp = fopen(booter.name, "rb");
+	fp = fopen(mk->booter.name, "rb");
 	if(fp == NULL) {
-		error_exit("Unable to open %s: %s\n", booter.name, strerror(errno));
+		error_exit("Unable to open %s: %s\n", mk->booter.name, strerror(errno));
 	}
-	fread(p, 1, booter.data_len, fp);
+	fread(p, 1, mk->booter.data_len, fp);
 	fclose(fp);
 	p = handle_elf(p);
-	p[booter.data_len] = '\0'; // makes processing easier
-	end = p + booter.data_len;
+	p[mk->booter.data_len] = '\0'; // makes processing easier
+	end = p + mk->booter.data_len;
 	if(*p == '[' ) {
 		//
 		// process booter attributes
@@ -212,14 +208,14 @@ proc_booter_data(char *boot, int virtual) {
 		push_token_state();
 		p = tokenize(p + 1, " \r\t\n", ']');
 		if(*p++ != ']') {
-			error_exit("Missing ] in %s\n", booter.name);
+			error_exit("Missing ] in %s\n", mk->booter.name);
 		}
-		parse_booter_attr(token->c, token->v);
+		parse_booter_attr(mk->token->c, mk->token->v);
 		pop_token_state();
 	}
 	while(isspace(*p)) ++p;
-	booter.data = p;
-	booter.data_len = end - p;
+	mk->booter.data = p;
+	mk->booter.data_len = end - p;
 	if(p < end) {
 		for( ;; ) {
 			if(p == end) {
@@ -232,8 +228,8 @@ proc_booter_data(char *boot, int virtual) {
 			++p;
 		}
 		p += 4;
-		booter.data = p;
-		booter.data_len = end - p;
+		mk->booter.data = p;
+		mk->booter.data_len = end - p;
 	}
 }
 
@@ -245,7 +241,7 @@ proc_booter_filter(unsigned startup_offset, char *intermediate_path, char *outpu
 	char	c;
 
 	p = buf;
-	fmt = booter.filter_spec;
+	fmt = mk->booter.filter_spec;
 	for( ;; ) {
 		c = *fmt++;
 		if(c == '\0') break;
@@ -253,7 +249,7 @@ proc_booter_filter(unsigned startup_offset, char *intermediate_path, char *outpu
 			c = *fmt++;
 			switch(c) {
 			case 'a':
-				p += sprintf(p, "%s", booter.filter_args);
+				p += sprintf(p, "%s", mk->booter.filter_args);
 				break;
 			case 's':
 				p += sprintf(p, "0x%x", startup_offset);
@@ -276,8 +272,8 @@ proc_booter_filter(unsigned startup_offset, char *intermediate_path, char *outpu
 #if defined (__WIN32__) || defined(__NT__)
 	fixenviron(buf, sizeof(buf));
 #endif
-	if(verbose >= 3)
-		fprintf(debug_fp, "Execute: %s\n", buf);
+	if(mk->verbose >= 3)
+		fprintf(mk->debug_fp, "Execute: %s\n", buf);
 	if(system(buf) != 0)
 		error_exit("Unable to run filter program '%s'.\n", buf);
 }
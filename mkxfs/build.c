@@ -0,0 +1,521 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+
+
+
+//
+// The image builder library entry points (mkxfs.h).
+//
+// The build routines work on the build 'mk' points at, which each entry
+// point sets to the build it was called for. error_exit() returns to
+// the entry point through the build's error_jmp while error_catch is
+// set, so that a failed build doesn't take the process with it.
+//
+
+#include <lib/compat.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "struct.h"
+#include "mkxfs.h"
+#include "libifs/ifs_copy.h"
+
+struct mkxfs_build	*mk;
+
+
+// Start a library call on 'b'. Temp files are made with no umask.
+static mode_t
+build_enter(struct mkxfs_build *b) {
+	mk = b;
+	b->error_catch = 1;
+	b->caller_umask = umask(0);
+	return b->caller_umask;
+}
+
+static int
+build_leave(struct mkxfs_build *b, mode_t mask, int ret) {
+	b->error_catch = 0;
+	umask(mask);
+	return ret;
+}
+
+// Whether 'b' can take another call. Writing the image gives the files
+// their final names and lays them out in place, so a written build is
+// finished with.
+static int
+build_usable(struct mkxfs_build *b) {
+	if(b->written && b->error[0] == '\0') {
+		snprintf(b->error, sizeof(b->error), "The image for this build has already been written.\n");
+	}
+	return b->error[0] == '\0';
+}
+
+
+struct mkxfs_build *
+mkxfs_new(const struct mkxfs_options *opts) {
+	struct mkxfs_build	*b;
+	int					n;
+
+	// Calculate the endian of the host this program is running on.
+	n = 1;
+	host_endian = *(char *)&n != 1;
+
+	b = calloc(1, sizeof(*b));
+	if(b == NULL) {
+		return NULL;
+	}
+	if(opts->type == NULL) {
+		free(b);
+		errno = EINVAL;
+		return NULL;
+	} else if(strcmp(opts->type, "ifs") == 0) {
+		b->parse_file_init = ifs_parse_init;
+		b->parse_file_attr = ifs_parse_attr;
+		b->need_seekable   = ifs_need_seekable;
+		b->make_fsys       = ifs_make_fsys;
+	} else if(strcmp(opts->type, "ffs3") == 0) {
+		b->parse_file_init = ffs_parse_init;
+		b->parse_file_attr = ffs_parse_attr;
+		b->need_seekable   = ffs_need_seekable;
+		b->make_fsys       = ffs_make_fsys_3;
+	} else if(strcmp(opts->type, "ffs2") == 0) {
+		b->parse_file_init = ffs_parse_init;
+		b->parse_file_attr = ffs_parse_attr;
+		b->need_seekable   = ffs_need_seekable;
+		b->make_fsys       = ffs_make_fsys_2;
+		fprintf(stderr, "Warning: FFS2 no longer supported. ");
+		fprintf(stderr, "Use for backwards compatability only.\n");
+	} else if(strcmp(opts->type, "ffs2-quiet") == 0) {
+		// Same as above, but no warning message.
+		b->parse_file_init = ffs_parse_init;
+		b->parse_file_attr = ffs_parse_attr;
+		b->need_seekable   = ffs_need_seekable;
+		b->make_fsys       = ffs_make_fsys_2;
+	} else if(strcmp(opts->type, "etfs") == 0) {
+		b->parse_file_init = etfs_parse_init;
+		b->parse_file_attr = etfs_parse_attr;
+		b->need_seekable   = etfs_need_seekable;
+		b->make_fsys       = etfs_make_fsys;
+	} else {
+		free(b);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	b->verbose = opts->verbose;
+	b->debug_fp = opts->debug_fp != NULL ? opts->debug_fp : stderr;
+	b->no_time = opts->no_time;
+	b->new_style_bootstrap = opts->new_style_bootstrap;
+	b->target_endian = -1;
+	b->spare_blocks = 1;
+	b->ext_sched = SCRIPT_SCHED_EXT_NONE;
+	strcpy(b->globapsv[SCRIPT_APS_SYSTEM_PARTITION_ID].name, SCRIPT_APS_SYSTEM_PARTITION_NAME);
+	b->globapsv[SCRIPT_APS_SYSTEM_PARTITION_ID].budget = 100;
+	b->globapsc = SCRIPT_APS_SYSTEM_PARTITION_ID;
+	b->model_strings.arena = &b->model_arena;
+	b->dep_names.arena = &b->dep_arena;
+
+	if((opts->symfile_suffix != NULL && (b->symfile_suffix = strdup(opts->symfile_suffix)) == NULL)
+	 || (opts->lines != NULL && (b->option_lines = strdup(opts->lines)) == NULL)) {
+		mkxfs_free(b);
+		errno = ENOMEM;
+		return NULL;
+	}
+	return b;
+}
+
+
+// Set up the parse state the first time the build is given input.
+static void
+build_start(void) {
+	if(mk->token == NULL) {
+		push_token_state();
+		mk->parse_file_init(&mk->file_attr);
+		parse_script_init(&mk->script_attr);
+	}
+}
+
+
+void
+mkxfs_abort(struct mkxfs_build *b) {
+	struct tmpfile_entry	*tmp;
+
+	for(tmp = b->tmpfile_list ; tmp ; tmp = tmp->next)
+		unlink(tmp->name);
+}
+
+
+void
+mkxfs_forked(struct mkxfs_build *b) {
+	struct tmpfile_entry	*tmp;
+
+	while((tmp = b->tmpfile_list) != NULL) {
+		b->tmpfile_list = tmp->next;
+		free(tmp->name);
+		free(tmp);
+	}
+}
+
+
+void
+mkxfs_free(struct mkxfs_build *b) {
+	struct tmpfile_entry	*tmp;
+	struct name_list		*np;
+	int						i;
+
+	mk = b;
+	mkxfs_abort(b);
+	mkxfs_forked(b);
+	while(b->token != NULL) {
+		pop_token_state();
+	}
+	while((np = b->section_list) != NULL) {
+		b->section_list = np->next;
+		free(np);
+	}
+	for(i = 0; i < GLOBENVC; ++i) {
+		free(b->globenvv[i]);
+	}
+	free(b->input_file.data);
+	free(b->input_script.data);
+	free(b->input_boot.data);
+	free(b->option_lines);
+	free(b->symfile_suffix);
+	destroy_stack(&b->inode_list);
+	model_cache_close();
+	model_release();
+	free(b);
+	mk = NULL;
+}
+
+
+const char *
+mkxfs_error(struct mkxfs_build *b) {
+	return b->error;
+}
+
+
+int
+mkxfs_cache(struct mkxfs_build *b, char *buildfile, int argc, char *argv[], int first_arg) {
+	mode_t	mask;
+
+	if(!build_usable(b)) return -1;
+	mask = build_enter(b);
+	if(setjmp(b->error_jmp) != 0) {
+		return build_leave(b, mask, -1);
+	}
+	model_cache_open(buildfile, argc, argv, first_arg);
+	return build_leave(b, mask, 0);
+}
+
+
+int
+mkxfs_keep_section(struct mkxfs_build *b, const char *name) {
+	mode_t	mask;
+
+	if(!build_usable(b)) return -1;
+	mask = build_enter(b);
+	if(setjmp(b->error_jmp) != 0) {
+		return build_leave(b, mask, -1);
+	}
+	ifs_section(NULL, name);
+	return build_leave(b, mask, 0);
+}
+
+
+// Close off the script file once parsing is done.
+static void
+end_script(void) {
+	int		n;
+
+	if(mk->script_fp != NULL) {
+		// Terminate list with a size of 0
+		n = 0;
+		fwrite(&n, sizeof(n), 1, mk->script_fp);
+		fclose(mk->script_fp);
+		mk->script_fp = NULL;
+	}
+}
+
+
+int
+mkxfs_parse(struct mkxfs_build *b, FILE *src_fp) {
+	struct file_entry	*fip;
+	mode_t				mask;
+	long				parsed;
+
+	if(!build_usable(b)) return -1;
+	mask = build_enter(b);
+	if(setjmp(b->error_jmp) != 0) {
+		return build_leave(b, mask, -1);
+	}
+	build_start();
+	if(!model_cache_load()) {
+		prof_start(PROF_PARSE);
+		parse_file(src_fp);
+		parsed = ftell(src_fp);
+		prof_stop(PROF_PARSE, parsed > 0 ? parsed : 0, 0);
+		end_script();
+		model_cache_save();
+	}
+	for(fip = b->file_list; fip != NULL; fip = fip->next) {
+		b->file_list_end = fip;
+	}
+	return build_leave(b, mask, 0);
+}
+
+
+int
+mkxfs_parse_string(struct mkxfs_build *b, const char *lines) {
+	mode_t	mask;
+	char	*buf;
+
+	if(!build_usable(b)) return -1;
+	mask = build_enter(b);
+	if(setjmp(b->error_jmp) != 0) {
+		return build_leave(b, mask, -1);
+	}
+	build_start();
+	// Tokens are parsed in place, so work on a copy that lives as long
+	// as the build.
+	buf = model_alloc(strlen(lines) + 2);
+	strcpy(buf, lines);
+	strcat(buf, "\n");
+	b->line_num = 1;
+	parse_one_file(buf);
+	b->line_num = 0;
+	end_script();
+	return build_leave(b, mask, 0);
+}
+
+
+// Add 'name' to 'd' as a quoted buildfile token.
+static char *
+quote_name(char *d, const char *name) {
+	*d++ = '"';
+	for( ; *name != '\0'; ++name) {
+		if(*name == '"' || *name == '\\') *d++ = '\\';
+		*d++ = *name;
+	}
+	*d++ = '"';
+	return d;
+}
+
+
+int
+mkxfs_add_file(struct mkxfs_build *b, const char *attrs, const char *target, const char *host) {
+	mode_t	mask;
+	char	*buf;
+	char	*d;
+
+	if(!build_usable(b)) return -1;
+	mask = build_enter(b);
+	if(setjmp(b->error_jmp) != 0) {
+		return build_leave(b, mask, -1);
+	}
+	build_start();
+	buf = model_alloc((attrs != NULL ? strlen(attrs) : 0)
+				+ 2 * ((target != NULL ? strlen(target) : 0) + strlen(host)) + 10);
+	d = buf;
+	if(attrs != NULL) {
+		d += sprintf(d, "[%s] ", attrs);
+	}
+	if(target != NULL) {
+		d = quote_name(d, target);
+		*d++ = '=';
+	}
+	d = quote_name(d, host);
+	strcpy(d, "\n");
+	parse_one_file(buf);
+	end_script();
+	return build_leave(b, mask, 0);
+}
+
+
+int
+mkxfs_remove_file(struct mkxfs_build *b, const char *target) {
+	struct file_entry	**owner;
+	struct file_entry	*fip;
+	struct file_entry	*prev = NULL;
+
+	if(!build_usable(b)) return -1;
+	for(owner = &b->file_list; (fip = *owner) != NULL; owner = &fip->next) {
+		if(strcmp(fip->targpath, target) == 0) {
+			*owner = fip->next;
+			if(b->file_list_end == fip) b->file_list_end = prev;
+			return 0;
+		}
+		prev = fip;
+	}
+	errno = ENOENT;
+	return -1;
+}
+
+
+struct mkxfs_file *
+mkxfs_file_first(struct mkxfs_build *b) {
+	if(b->written) return NULL;
+	return (struct mkxfs_file *)b->file_list;
+}
+
+struct mkxfs_file *
+mkxfs_file_next(struct mkxfs_file *f) {
+	return (struct mkxfs_file *)((struct file_entry *)f)->next;
+}
+
+const char *
+mkxfs_file_host(struct mkxfs_file *f) {
+	return ((struct file_entry *)f)->hostpath;
+}
+
+const char *
+mkxfs_file_target(struct mkxfs_file *f) {
+	return ((struct file_entry *)f)->targpath;
+}
+
+
+// Where 'host', named by a file from the buildfile, is on the host.
+static const char *
+host_path(struct file_entry *fip, const char *host, char *buf, size_t size) {
+	if(*host == '/' || fip->attr == NULL) return host;
+	snprintf(buf, size, "%s/%s", fip->attr->cd, host);
+	return buf;
+}
+
+
+int
+mkxfs_refresh(struct mkxfs_build *b, const char *path) {
+	struct file_entry	*fip;
+	struct stat			sbuf;
+	char				buf[PATH_MAX];
+	mode_t				mask;
+	int					n = 0;
+
+	if(!build_usable(b)) return -1;
+	mask = build_enter(b);
+	if(setjmp(b->error_jmp) != 0) {
+		return build_leave(b, mask, -1);
+	}
+	for(fip = b->file_list; fip != NULL; fip = fip->next) {
+		if(fip->filter_input != NULL
+		  && strcmp(host_path(fip, fip->filter_input, buf, sizeof(buf)), path) == 0) {
+			return build_leave(b, mask, 0);
+		}
+		if(strcmp(host_path(fip, fip->hostpath, buf, sizeof(buf)), path) != 0) continue;
+		if(!S_ISREG(fip->attr->mode) || fip->attr->scriptfile
+		  || stat(path, &sbuf) == -1 || !S_ISREG(sbuf.st_mode)) {
+			return build_leave(b, mask, 0);
+		}
+		fip->host_perms = sbuf.st_mode & ~S_IFMT;
+		fip->host_uid = sbuf.st_uid;
+		fip->host_gid = sbuf.st_gid;
+		fip->host_mtime = b->no_time > 1 ? 0 : sbuf.st_mtime;
+		fip->flags &= ~FILE_FLAGS_CRC_VALID;
+		if(crc32_fn((char *)path, &fip->host_file_crc) != -1) {
+			fip->flags |= FILE_FLAGS_CRC_VALID;
+		}
+		++n;
+	}
+	return build_leave(b, mask, n);
+}
+
+
+int
+mkxfs_write(struct mkxfs_build *b, const char *output) {
+	FILE				*dst_fp;
+	char				*specified_dest = (char *)output;
+	char				*intermediate_dest;
+	char 				*output_dest;
+	unsigned			startup_offset;
+	struct file_entry	*fip;
+	struct stat			sbuf;
+	mode_t				mask;
+
+	if(!build_usable(b)) return -1;
+	mask = build_enter(b);
+	if(setjmp(b->error_jmp) != 0) {
+		return build_leave(b, mask, -1);
+	}
+	b->written = 1;
+
+	for(fip = b->file_list; fip != NULL; fip = fip->next) {
+		//NYI: should run the list & check for duplicate target names
+		if(fip->attr->prefix == NULL) {
+			fip->attr->prefix = b->booter.name ? "proc/boot" : "";
+		}
+		set_target_name(fip);
+	}
+
+	if(b->booter.copy_filter) {
+		intermediate_dest = mk_tmpfile();
+	} else if((specified_dest == NULL)
+	    && ((b->booter.filter_spec != NULL) || b->need_seekable(b->file_list))) {
+		intermediate_dest = mk_tmpfile();
+	} else {
+		intermediate_dest = specified_dest;
+	}
+
+	dst_fp = stdout;
+	if(intermediate_dest != NULL) {
+		// Final output file should be created with original umask()
+		umask(mask);
+		dst_fp = fopen(intermediate_dest, "w+b");
+		umask(0);
+		if(dst_fp == NULL) {
+			error_exit("Unable to open '%s': %s.\n", intermediate_dest, strerror(errno));
+		}
+	}
+
+	if(specified_dest == NULL) MAKE_BINARY_FP(stdout);
+
+	startup_offset = b->make_fsys(dst_fp, b->file_list, b->mountpoint, intermediate_dest);
+
+	if(dst_fp != stdout) fclose(dst_fp);
+
+	output_dest = intermediate_dest;
+	if(b->booter.filter_spec != NULL) {
+		if(specified_dest != NULL) {
+			output_dest = specified_dest;
+		} else if(b->booter.copy_filter) {
+			output_dest = mk_tmpfile();
+		}
+		prof_start(PROF_BOOTER_FILTER);
+		proc_booter_filter(startup_offset, intermediate_dest, output_dest);
+		prof_stop(PROF_BOOTER_FILTER, prof_size(intermediate_dest), prof_size(output_dest));
+	}
+	if(specified_dest == NULL && (dst_fp != stdout)) {
+		dst_fp = fopen(output_dest, "rb");
+		if(dst_fp == NULL) {
+			error_exit("Can not open '%s' for input.\n", intermediate_dest);
+		}
+		fflush(stdout);
+		if(fstat(fileno(dst_fp), &sbuf) != 0
+				|| ifs_copy_range(fileno(stdout), fileno(dst_fp), 0, sbuf.st_size) != 0) {
+			error_exit("Error writing image to standard output: %s.\n", strerror(errno));
+		}
+		fclose(dst_fp);
+	}
+	return build_leave(b, mask, 0);
+}
+
+__SRCVERSION("build.c $Rev$");
@@ -0,0 +1,429 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+
+
+//
+// Content addressed cache for filter output (the -c option).
+//
+// An entry is named after the SHA-256 of the filter command, the
+// identity of the filter program and the contents of the input file,
+// so touched or restored sources and edited filter lines are handled
+// correctly and a cache directory can be shared between machines.
+// Entries live in cache_dir/xx/<rest of digest>. They are written to a
+// temporary name in the same directory and renamed into place, and
+// their modification time is refreshed on every hit so that eviction
+// can discard the least recently used ones first. Entries and their
+// directories are made with the user's umask, like the image.
+//
+// The build reads filter output when the image is written, and another
+// mkifs sharing the cache may evict the entry before then. So the build
+// gets a temp file linked to the entry (or a copy of it) instead of the
+// entry's own name.
+//
+
+#include <lib/compat.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <utime.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sha2.h>
+#include "struct.h"
+#include "xplatform.h"
+#include "libifs/ifs_copy.h"
+
+#define CACHE_KEY_VERSION	"mkxfs-filter-cache-1"
+
+// Temporary entries left behind by a killed build are removed once
+// they are this old.
+#define CACHE_STALE_TMP		(60*60)
+
+char					*cache_dir;
+unsigned long long		 cache_limit;
+
+static struct {
+	unsigned			hits;
+	unsigned			misses;
+	unsigned			evicted;
+	unsigned long long	bytes_stored;
+	unsigned long long	bytes_evicted;
+} stats;
+
+struct filter_ident {
+	struct filter_ident	*next;
+	char				*filter;
+	char				 ident[SHA256_DIGEST_LENGTH*2+1];
+};
+
+static struct filter_ident	*ident_list;
+
+struct cache_victim {
+	char				*path;
+	off_t				size;
+	time_t				mtime;
+};
+
+
+static void
+hex_digest(const uint8_t *digest, char *hex) {
+	static const char	xdigit[] = "0123456789abcdef";
+	int					i;
+
+	for(i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
+		*hex++ = xdigit[digest[i] >> 4];
+		*hex++ = xdigit[digest[i] & 0xf];
+	}
+	*hex = '\0';
+}
+
+
+static int
+hash_fd(SHA2_CTX *ctx, int fd) {
+	uint8_t		buf[0x10000];
+	ssize_t		n;
+
+	while((n = read(fd, buf, sizeof(buf))) > 0) {
+		SHA256Update(ctx, buf, n);
+	}
+	return n;
+}
+
+
+//
+// Find the program the filter command runs. A name without a path
+// separator is looked up in $PATH the same way the shell would.
+//
+int
+filter_program(const char *filter, char *path, size_t size) {
+	const char	*p;
+	const char	*env;
+	size_t		len;
+	struct stat	sbuf;
+
+	while(*filter == ' ' || *filter == '\t') ++filter;
+	len = strcspn(filter, " \t<>|;&");
+	if(len == 0 || len >= size) return -1;
+
+	if(memchr(filter, '/', len) != NULL || memchr(filter, '\\', len) != NULL) {
+		memcpy(path, filter, len);
+		path[len] = '\0';
+		return stat(path, &sbuf) == 0 && S_ISREG(sbuf.st_mode) ? 0 : -1;
+	}
+
+	if((env = getenv("PATH")) == NULL) return -1;
+	for(;;) {
+		p = env;
+		while(*env != '\0' && *env != PATHSEP_CHR) ++env;
+		if(env != p && (size_t)(env - p) + len + 2 <= size) {
+			sprintf(path, "%.*s/%.*s", (int)(env - p), p, (int)len, filter);
+			if(stat(path, &sbuf) == 0 && S_ISREG(sbuf.st_mode)) return 0;
+		}
+		if(*env == '\0') break;
+		++env;
+	}
+	return -1;
+}
+
+
+//
+// The identity of a filter is the digest of the program it runs, so
+// that upgrading the tool invalidates everything it produced. Programs
+// which can not be located (shell builtins, functions) are identified
+// by their name only.
+//
+static char *
+filter_ident(char *filter) {
+	struct filter_ident	*fi;
+	SHA2_CTX			ctx;
+	uint8_t				digest[SHA256_DIGEST_LENGTH];
+	char				path[PATH_MAX];
+	int					fd;
+
+	for(fi = ident_list; fi != NULL; fi = fi->next) {
+		if(strcmp(fi->filter, filter) == 0) return fi->ident;
+	}
+
+	SHA256Init(&ctx);
+	if(filter_program(filter, path, sizeof(path)) == 0
+	  && (fd = open(path, O_RDONLY | O_BINARY)) != -1) {
+		if(hash_fd(&ctx, fd) == -1) {
+			error_exit("Unable to read filter program %s: %s.\n", path, strerror(errno));
+		}
+		close(fd);
+	} else {
+		SHA256Update(&ctx, (uint8_t *)"unresolved:", 11);
+		SHA256Update(&ctx, (uint8_t *)filter, strcspn(filter, " \t<>|;&"));
+	}
+	SHA256Final(digest, &ctx);
+
+	if((fi = malloc(sizeof(*fi))) == NULL || (fi->filter = strdup(filter)) == NULL) {
+		error_exit("No memory for filter cache.\n");
+	}
+	hex_digest(digest, fi->ident);
+	fi->next = ident_list;
+	ident_list = fi;
+	if(mk->verbose > 2) {
+		fprintf(mk->debug_fp, "Filter '%s' identity %s\n", filter, fi->ident);
+	}
+	return fi->ident;
+}
+
+
+static void
+make_cache_dir(char *path) {
+	struct stat	sbuf;
+
+	int			ret;
+
+	if(stat(path, &sbuf) == 0 && S_ISDIR(sbuf.st_mode)) return;
+	umask(mk->caller_umask);
+	ret = gen_mkdir(path, S_IRWXU | S_IRWXG | S_IRWXO);
+	umask(0);
+	if(ret == -1 && errno != EEXIST) {
+		error_exit("Unable to make cache directory %s: %s.\n", path, strerror(errno));
+	}
+}
+
+
+//
+// Return a temp file with the contents of the entry 'cfile'. It is a
+// hard link where the temp directory is on the same file system.
+//
+static char *
+pin_entry(const char *cfile) {
+	char		*tfile;
+	struct stat	sbuf;
+	int			in, out;
+
+	tfile = mk_tmpfile();
+	if(link(cfile, tfile) == 0) return tfile;
+	if((in = open(cfile, O_RDONLY | O_BINARY)) == -1 || fstat(in, &sbuf) == -1) {
+		error_exit("Unable to read %s: %s.\n", cfile, strerror(errno));
+	}
+	if((out = open(tfile, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666)) == -1
+	  || ifs_copy_range(out, in, 0, sbuf.st_size) != 0 || close(out) != 0) {
+		error_exit("Unable to copy %s to %s: %s.\n", cfile, tfile, strerror(errno));
+	}
+	close(in);
+	return tfile;
+}
+
+
+//
+// Return the name of a file holding the output of 'filter' run on
+// 'host', running the filter only when the cache has no such entry.
+//
+char *
+filter_cache_file(char *host, char *filter) {
+	char			cfile[PATH_MAX];
+	static unsigned	seq;
+	char			tfile[PATH_MAX];
+	char			cmd[1024];
+	char			key[SHA256_DIGEST_LENGTH*2+1];
+	uint8_t			digest[SHA256_DIGEST_LENGTH];
+	SHA2_CTX		ctx;
+	struct stat		sbuf;
+	int				fd, ret;
+
+	if((fd = open(host, O_RDONLY | O_BINARY)) == -1) {
+		error_exit("Unable to open %s: %s.\n", host, strerror(errno));
+	}
+	SHA256Init(&ctx);
+	SHA256Update(&ctx, (uint8_t *)CACHE_KEY_VERSION, sizeof(CACHE_KEY_VERSION));
+	SHA256Update(&ctx, (uint8_t *)filter, strlen(filter) + 1);
+	SHA256Update(&ctx, (uint8_t *)filter_ident(filter), SHA256_DIGEST_LENGTH*2);
+	if(hash_fd(&ctx, fd) == -1) {
+		error_exit("Unable to read %s: %s.\n", host, strerror(errno));
+	}
+	close(fd);
+	SHA256Final(digest, &ctx);
+	hex_digest(digest, key);
+
+	make_cache_dir(cache_dir);
+	if(snprintf(cfile, sizeof(cfile), "%s/%.2s/%s", cache_dir, key, &key[2]) >= (int)sizeof(cfile)) {
+		error_exit("Filter cache path in %s is too long.\n", cache_dir);
+	}
+	// The directory is a prefix of cfile, so it fits.
+	snprintf(tfile, sizeof(tfile), "%s/%.2s", cache_dir, key);
+	make_cache_dir(tfile);
+
+	if(stat(cfile, &sbuf) == 0 && S_ISREG(sbuf.st_mode)) {
+		// Mark the entry as recently used for eviction.
+		utime(cfile, NULL);
+		stats.hits++;
+		if(mk->verbose > 1) {
+			fprintf(mk->debug_fp, "Filter cache hit for %s (%s)\n", host, key);
+		}
+		return pin_entry(cfile);
+	}
+
+	stats.misses++;
+	if(snprintf(tfile, sizeof(tfile), "%s/%.2s/.tmp-%ld-%u", cache_dir, key, (long)getpid(), seq++) >= (int)sizeof(tfile)) {
+		error_exit("Filter cache path in %s is too long.\n", cache_dir);
+	}
+	if(snprintf(cmd, sizeof(cmd), "%s <%s >%s", filter, host, tfile) >= (int)sizeof(cmd)) {
+		error_exit("Filter command for %s is too long.\n", host);
+	}
+#if defined (__WIN32__) || defined(__NT__)
+	fixenviron(cmd, sizeof(cmd));
+#endif
+	// The shell creates the entry.
+	umask(mk->caller_umask);
+	ret = system(cmd);
+	umask(0);
+	if(ret != 0) {
+		unlink(tfile);
+		error_exit("Filter %s failed.\n", cmd);
+	}
+	if(rename(tfile, cfile) != 0) {
+		unlink(tfile);
+		error_exit("Unable to store %s in cache: %s.\n", cfile, strerror(errno));
+	}
+	if(stat(cfile, &sbuf) == 0) {
+		stats.bytes_stored += sbuf.st_size;
+	}
+	if(mk->verbose > 1) {
+		fprintf(mk->debug_fp, "Filter cache miss for %s (%s)\n", host, key);
+	}
+	return pin_entry(cfile);
+}
+
+
+//
+// Parse the argument of -C: a size with an optional k/m/g suffix.
+//
+void
+filter_cache_set_limit(char *str) {
+	char				*end;
+	unsigned long long	v;
+
+	v = strtoull(str, &end, 0);
+	switch(*end) {
+	case 'G':
+	case 'g':
+		v *= 1024;
+		/* fall through */
+	case 'M':
+	case 'm':
+		v *= 1024;
+		/* fall through */
+	case 'K':
+	case 'k':
+		v *= 1024;
+		end++;
+		break;
+	}
+	if(end == str || *end != '\0') {
+		error_exit("Invalid cache size '%s'.\n", str);
+	}
+	cache_limit = v;
+}
+
+
+static int
+cmp_victim(const void *a, const void *b) {
+	const struct cache_victim	*va = a;
+	const struct cache_victim	*vb = b;
+
+	if(va->mtime != vb->mtime) return va->mtime < vb->mtime ? -1 : 1;
+	return strcmp(va->path, vb->path);
+}
+
+
+//
+// Remove least recently used entries until the cache fits in
+// cache_limit bytes.
+//
+void
+filter_cache_trim(void) {
+	struct cache_victim	*list = NULL;
+	unsigned			nlist = 0, max = 0, i;
+	unsigned long long	total = 0;
+	char				path[PATH_MAX];
+	DIR					*top, *sub;
+	struct dirent		*tde, *sde;
+	struct stat			sbuf;
+	time_t				now;
+
+	if(cache_dir == NULL || cache_limit == 0) return;
+	if((top = opendir(cache_dir)) == NULL) return;
+
+	now = time(NULL);
+	while((tde = readdir(top)) != NULL) {
+		if(strlen(tde->d_name) != 2 || tde->d_name[0] == '.') continue;
+		sprintf(path, "%s/%s", cache_dir, tde->d_name);
+		if((sub = opendir(path)) == NULL) continue;
+		while((sde = readdir(sub)) != NULL) {
+			if(strcmp(sde->d_name, ".") == 0 || strcmp(sde->d_name, "..") == 0) continue;
+			snprintf(path, sizeof(path), "%s/%s/%s", cache_dir, tde->d_name, sde->d_name);
+			if(stat(path, &sbuf) != 0 || !S_ISREG(sbuf.st_mode)) continue;
+			if(sde->d_name[0] == '.') {
+				if(now - sbuf.st_mtime > CACHE_STALE_TMP) unlink(path);
+				continue;
+			}
+			if(nlist == max) {
+				max = max ? max * 2 : 256;
+				if((list = realloc(list, max * sizeof(*list))) == NULL) {
+					error_exit("No memory for filter cache.\n");
+				}
+			}
+			if((list[nlist].path = strdup(path)) == NULL) {
+				error_exit("No memory for filter cache.\n");
+			}
+			list[nlist].size = sbuf.st_size;
+			list[nlist].mtime = sbuf.st_mtime;
+			total += sbuf.st_size;
+			++nlist;
+		}
+		closedir(sub);
+	}
+	closedir(top);
+
+	if(total > cache_limit) {
+		qsort(list, nlist, sizeof(*list), cmp_victim);
+		for(i = 0; i < nlist && total > cache_limit; ++i) {
+			if(unlink(list[i].path) != 0) continue;
+			total -= list[i].size;
+			stats.evicted++;
+			stats.bytes_evicted += list[i].size;
+		}
+	}
+
+	for(i = 0; i < nlist; ++i) free(list[i].path);
+	free(list);
+}
+
+
+void
+filter_cache_report(FILE *fp) {
+	if(cache_dir == NULL) return;
+	fprintf(fp, "Filter cache %s: %u hits, %u misses, %llu bytes stored",
+			cache_dir, stats.hits, stats.misses, stats.bytes_stored);
+	if(stats.evicted) {
+		fprintf(fp, ", %u entries (%llu bytes) evicted", stats.evicted, stats.bytes_evicted);
+	}
+	fprintf(fp, "\n");
+}
+
+__SRCVERSION("filter_cache.c $Rev$");
@@ -0,0 +1,1054 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+// Hidden option 'N' to allow for more than 4 bootstrap executables.
+// Document later...
+#ifdef __USAGE
+%-mkxfs
+
+%C - make a image/flash file system
+
+%C	-t type [-r root] [-l input] [-s section] [-nv] [in-file [out-file]]
+
+Options:
+ -t ffs2|ffs3|ifs|etfs Set the type of the output file system.
+ -l input              Prefix a line to the input-file.
+ -n                    No timestamps. Allows for binary identical images. One
+                       'n' will strip timestamps from files which vary from run
+                       to run. More than one will strip ALL time information
+                       which is necessary on Windows NTFS with daylight savings
+                       time.
+ -r root               Search the default paths in this directory before the
+                       default.
+ -s section            Do not strip the named section from ELF executable 
+                       when creating an IFS image.
+ -v                    Operate verbosely.
+ -a suffix             Append suffix to symbol files generated via [+keeplinked]
+ -b                    Save the parsed buildfile in in-file.bldc and reuse it
+                       while the buildfile, environment and inputs are unchanged.
+ -c cache_dir          Cache the output of file filters in cache_dir.
+ -C size               Limit the filter cache to size bytes (k, m or g suffix
+                       allowed), evicting least recently used entries.
+ --profile=file        Write build phase timings and byte counts to file as
+                       JSON ('-' for stderr).
+ --trace=file          Write a Chrome trace (chrome://tracing, Perfetto) of
+                       the build to file.
+ --batch=file          Build one image per line of file, each line naming a
+                       buildfile overlay ('-' for none) and the output. The
+                       in-file is parsed once and shared by all of them.
+ --jobs=n              Build up to n batch images at a time (default: the
+                       number of CPUs).
+ --watch               Stay running after the build and rebuild out-file
+                       whenever the in-file or one of its inputs changes.
+%-mkefs
+
+%C - make an embedded (flash) file system
+
+%C	[-l inputline] [-nv] [input-file [output-file]]
+
+Options:
+ -t ffs2|ffs3   Set the type of the output file system.
+ -c cache_dir   Cache the output of file filters in cache_dir.
+ -C size        Limit the filter cache to size bytes (k, m or g suffix
+                allowed), evicting least recently used entries.
+ -l inputline   Prefix a line to the input-file.
+ -n             No timestamps. Allows for binary identical images.  One 'n'
+                will strip timestamps from files which vary from run to run.
+                More than one will strip ALL time information which is 
+                necessary on Windows NTFS with daylight savings time.
+ -v             Operate verbosely.
+%-mketfs
+
+%C - make an embedded transaction file system
+
+%C	[-l inputline] [-nv] [input-file [output-file]]
+
+Options:
+ -l inputline   Prefix a line to the input-file.
+ -n             No timestamps. Allows for binary identical images.  One 'n'
+                will strip timestamps from files which vary from run to run.
+                More than one will strip ALL time information which is 
+                necessary on Windows NTFS with daylight savings time.
+ -v             Operate verbosely.
+%-mkifs
+
+%C - make an image file system
+
+%C	[-r root] [-l input] [-s section] [-c cache_dir [-C size]] [-bnv] [--profile=file] [--trace=file] [--batch=file [--jobs=n]] [--watch] [in-file [out-file]]
+
+Options:
+ -b             Save the parsed buildfile in in-file.bldc and reuse it
+                while the buildfile, environment and inputs are unchanged.
+ -c cache_dir   Cache the output of file filters in cache_dir.
+ -C size        Limit the filter cache to size bytes (k, m or g suffix
+                allowed), evicting least recently used entries.
+ -l input       Prefix a line to the input-file.
+ -n             No timestamps. Allows for binary identical images.  One 'n'
+                will strip timestamps from files which vary from run to run.
+                More than one will strip ALL time information which is 
+                necessary on Windows NTFS with daylight savings time.
+ -p             Do not strip PhAB resource information. (experimental)
+ -r root        Search the default paths in this directory before the default.
+ -s section     Do not strip the named section from ELF executable 
+                when creating an IFS image.
+ -v             Operate verbosely.
+ --profile=file Write build phase timings and byte counts to file as JSON
+                ('-' for stderr).
+ --trace=file   Write a Chrome trace (chrome://tracing, Perfetto) of the
+                build to file.
+ --batch=file   Build one image per line of file, each line naming a
+                buildfile overlay ('-' for none) and the output. Files
+                the overlay names again replace the in-file ones. The
+                in-file is parsed once and shared by all of them.
+ --jobs=n       Build up to n batch images at a time (default: the number
+                of CPUs).
+ --watch        Stay running after the build and rebuild out-file whenever
+                the in-file or one of its inputs changes. A changed input
+                that is only copied into the image is rewritten without
+                parsing the in-file again.
+#endif
+
+#include <lib/compat.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+#include "struct.h"
+#include "mkxfs.h"
+#include "xplatform.h"
+#include "libifs/ifs_trace.h"
+
+
+#if defined(VARIANT_le)
+	#define ENDIAN_STRING	"le"
+#elif defined(VARIANT_be)
+	#define ENDIAN_STRING	"be"
+#endif
+
+#if defined(DEFAULT_CPU)
+	//Nothing to do
+#elif defined(__386__) || defined(__X86__)
+	#define DEFAULT_CPU	"x86"
+#elif defined(__SH__)
+	#define DEFAULT_CPU	"sh" ENDIAN_STRING
+#elif defined(__ARM__)
+	#define DEFAULT_CPU	"arm" ENDIAN_STRING
+#elif defined(__MIPS__)
+	#define DEFAULT_CPU	"mips" ENDIAN_STRING
+#elif defined(__PPC__)
+	#define DEFAULT_CPU	"ppc" ENDIAN_STRING
+#elif defined(__SOLARIS__) || defined(linux)
+	#define DEFAULT_CPU	"mipsbe"
+#else
+	#error DEFAULT_CPU not defined
+#endif
+
+//
+// The mkifs/mkefs/mketfs command line, a client of the builder library.
+//
+
+static struct mkxfs_build	*build;
+static char					*option_lines;
+
+
+static void
+rm_tmpfiles(void) {
+	if(build != NULL) mkxfs_abort(build);
+}
+
+static void
+die(int signum) {
+	rm_tmpfiles();
+	_exit(1);
+}
+
+
+static void
+add_data(char *string) {
+	unsigned	size;
+	char		*new;
+
+	size = (option_lines == NULL) ? 0 : strlen(option_lines);
+	new = realloc(option_lines, size + strlen(string) + 1);
+	if(new == NULL) {
+		error_exit("No memory for -l option.\n");
+	}
+	option_lines = new;
+	strcpy(&new[size], string);
+}
+
+
+static void
+build_failed(void) {
+	fputs(mkxfs_error(build), stderr);
+	exit(1);
+}
+
+
+//
+// Build one --batch variant in a child process that has the parsed
+// base build. Returns the exit status.
+//
+static int
+build_variant(char *overlay, char *output) {
+	struct mkxfs_file	*last = NULL;
+	struct mkxfs_file	*base;
+	struct mkxfs_file	*f;
+	struct mkxfs_file	*next;
+	FILE				*fp;
+	char				*text = NULL;
+	size_t				len = 0;
+	size_t				n;
+
+	// The base's temp files belong to the parent, which removes them
+	// once every variant is done.
+	mkxfs_forked(build);
+
+	if(strcmp(overlay, "-") != 0) {
+		if((fp = fopen(overlay, "r")) == NULL) {
+			fprintf(stderr, "Unable to open '%s': %s.\n", overlay, strerror(errno));
+			return 1;
+		}
+		for( ;; ) {
+			if((text = realloc(text, len + 4096 + 1)) == NULL) {
+				fprintf(stderr, "No memory for '%s'.\n", overlay);
+				return 1;
+			}
+			if((n = fread(&text[len], 1, 4096, fp)) == 0) break;
+			len += n;
+		}
+		fclose(fp);
+		text[len] = '\0';
+
+		for(f = mkxfs_file_first(build); f != NULL; f = mkxfs_file_next(f)) {
+			last = f;
+		}
+		if(mkxfs_parse_string(build, text) != 0) {
+			fprintf(stderr, "%s: %s", overlay, mkxfs_error(build));
+			mkxfs_abort(build);
+			return 1;
+		}
+		free(text);
+
+		// Files the overlay names again replace the base ones.
+		if(last != NULL) {
+			for(base = mkxfs_file_first(build); base != NULL; base = next) {
+				next = mkxfs_file_next(base);
+				for(f = mkxfs_file_next(last); f != NULL; f = mkxfs_file_next(f)) {
+					if(strcmp(mkxfs_file_target(f), mkxfs_file_target(base)) == 0) break;
+				}
+				if(f != NULL) mkxfs_remove_file(build, mkxfs_file_target(base));
+				if(base == last) break;
+			}
+		}
+	}
+
+	if(mkxfs_write(build, output) != 0) {
+		fprintf(stderr, "%s: %s", output, mkxfs_error(build));
+		mkxfs_abort(build);
+		return 1;
+	}
+	mkxfs_abort(build);
+	return 0;
+}
+
+
+// Wait for a --batch child, returning non-zero if it failed.
+static int
+reap_variant(void) {
+	int		status;
+
+	if(wait(&status) == -1) return 1;
+	return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+
+struct variant {
+	char	*overlay;
+	char	*output;
+};
+
+
+//
+// Read the --batch file. All of it is checked before any variant
+// starts, so that a bad line can't end the run while children are
+// still reading the base build's temp files.
+//
+static struct variant *
+read_variants(char *name, unsigned *num) {
+	FILE			*fp;
+	char			line[2*PATH_MAX + 2];
+	char			*overlay;
+	char			*output;
+	struct variant	*list = NULL;
+	unsigned		max = 0;
+	int				line_no = 0;
+
+	if((fp = fopen(name, "r")) == NULL) {
+		error_exit("Unable to open '%s': %s.\n", name, strerror(errno));
+	}
+	*num = 0;
+	while(fgets(line, sizeof(line), fp) != NULL) {
+		++line_no;
+		overlay = strtok(line, " \t\r\n");
+		if(overlay == NULL || *overlay == '#') continue;
+		output = strtok(NULL, " \t\r\n");
+		if(output == NULL || strtok(NULL, " \t\r\n") != NULL) {
+			error_exit("%s: line %d: Expected a buildfile overlay and an output.\n", name, line_no);
+		}
+		if(*num >= max) {
+			max = max ? max * 2 : 16;
+			if((list = realloc(list, max * sizeof(*list))) == NULL) {
+				error_exit("No memory for '%s'.\n", name);
+			}
+		}
+		list[*num].overlay = strdup(overlay);
+		list[*num].output = strdup(output);
+		if(list[*num].overlay == NULL || list[*num].output == NULL) {
+			error_exit("No memory for '%s'.\n", name);
+		}
+		++*num;
+	}
+	fclose(fp);
+	return list;
+}
+
+
+//
+// --batch: the base buildfile has been parsed; fork a child for each
+// variant so they all start from it, up to 'jobs' at a time. Returns
+// the number of variants that failed.
+//
+static int
+run_batch(char *name, int jobs) {
+	struct variant	*list;
+	unsigned		num;
+	unsigned		i;
+	int				running = 0;
+	int				failed = 0;
+	int				ret;
+	pid_t			pid;
+
+	list = read_variants(name, &num);
+	for(i = 0; i < num; ++i) {
+		if(running >= jobs) {
+			failed += reap_variant();
+			--running;
+		}
+		fflush(stdout);
+		fflush(stderr);
+		ifs_trace_fork();
+		pid = fork();
+		if(pid == -1) {
+			ret = errno;
+			// Let the running ones finish with the base build first.
+			for( ; running > 0; --running) {
+				reap_variant();
+			}
+			error_exit("Unable to start building '%s': %s.\n", list[i].output, strerror(ret));
+		}
+		if(pid == 0) {
+			ifs_trace_child(list[i].output);
+			ret = build_variant(list[i].overlay, list[i].output);
+			fflush(stdout);
+			fflush(stderr);
+			_exit(ret);
+		}
+		++running;
+	}
+	for( ; running > 0; --running) {
+		failed += reap_variant();
+	}
+	for(i = 0; i < num; ++i) {
+		free(list[i].overlay);
+		free(list[i].output);
+	}
+	free(list);
+	return failed;
+}
+
+
+#if defined(__linux__)
+
+//
+// --watch. The parsed build is kept and each image is written by a
+// child process that starts from it, the same way --batch variants
+// are, so the parent's copy stays as it was parsed. The host paths the
+// parse looked at are watched with inotify. A changed file that is
+// only copied into the image is taken into the kept build and the
+// image written again. Any other change (the buildfile, a filter input,
+// what is in an included directory, a file turning up somewhere else
+// on the search path) needs the buildfile parsed again, which is done
+// by starting over with the same command line.
+//
+
+#define WATCH_EVENTS	(IN_CLOSE_WRITE|IN_ATTRIB|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO)
+#define WATCH_LISTING	(IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO)
+#define WATCH_SETTLE	100		// ms without events before acting on them
+
+enum {
+	WATCH_NONE,
+	WATCH_CHANGE,
+	WATCH_RESTART
+};
+
+struct watch_dir {
+	int			wd;
+	int			listed;		// included by the buildfile
+	char		*path;
+};
+
+struct watch_file {
+	char		*name;		// real path, as inotify reports it
+	char		*path;		// path as the build knows it
+	int			present;	// there when the buildfile was parsed
+	int			buildfile;
+	int			changed;
+};
+
+static int					watch_fd = -1;
+static char					watch_cwd[PATH_MAX];
+static char					watch_exe[PATH_MAX];
+static struct watch_dir		*watch_dirs;
+static unsigned				num_watch_dirs;
+static struct watch_file	*watch_files;
+static unsigned				num_watch_files;
+static unsigned				max_watch_files;
+
+
+static void
+watch_dir(const char *path, int listed) {
+	struct watch_dir	*wp;
+	unsigned			i;
+	int					wd;
+
+	// Search path entries that don't exist can't be watched.
+	wd = inotify_add_watch(watch_fd, path, WATCH_EVENTS | IN_ONLYDIR);
+	if(wd == -1) return;
+	for(i = 0; i < num_watch_dirs; ++i) {
+		if(watch_dirs[i].wd == wd) {
+			watch_dirs[i].listed |= listed;
+			return;
+		}
+	}
+	wp = realloc(watch_dirs, (num_watch_dirs + 1) * sizeof(*wp));
+	if(wp == NULL) {
+		error_exit("No memory for watching %s.\n", path);
+	}
+	watch_dirs = wp;
+	wp = &watch_dirs[num_watch_dirs++];
+	wp->wd = wd;
+	wp->listed = listed;
+	if((wp->path = strdup(path)) == NULL) {
+		error_exit("No memory for watching %s.\n", path);
+	}
+}
+
+
+// 'path' with its directory made a real path. Returns 0 if the
+// directory isn't there.
+static int
+real_dir_name(const char *path, char *buf) {
+	char	dir[PATH_MAX];
+	char	*base;
+	size_t	len;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	base = strrchr(dir, '/');
+	if(base == NULL) {
+		strcpy(dir, ".");
+		base = (char *)path;
+	} else if(base == dir) {
+		strcpy(dir, "/");
+		base = (char *)path + 1;
+	} else {
+		*base++ = '\0';
+	}
+	if(realpath(dir, buf) == NULL) return 0;
+	len = strlen(buf);
+	snprintf(buf + len, PATH_MAX - len, "%s%s", len > 1 ? "/" : "", base);
+	return 1;
+}
+
+
+static void
+watch_name(const char *name, const char *path, int present, int buildfile) {
+	struct watch_file	*wf;
+	char				dir[PATH_MAX];
+	char				*p;
+
+	if(num_watch_files >= max_watch_files) {
+		max_watch_files = max_watch_files ? max_watch_files * 2 : 256;
+		wf = realloc(watch_files, max_watch_files * sizeof(*wf));
+		if(wf == NULL) {
+			error_exit("No memory for watching %s.\n", path);
+		}
+		watch_files = wf;
+	}
+	wf = &watch_files[num_watch_files++];
+	wf->name = strdup(name);
+	wf->path = strdup(path);
+	if(wf->name == NULL || wf->path == NULL) {
+		error_exit("No memory for watching %s.\n", path);
+	}
+	wf->present = present;
+	wf->buildfile = buildfile;
+	wf->changed = 0;
+
+	strcpy(dir, name);
+	p = strrchr(dir, '/');
+	p[p == dir] = '\0';
+	watch_dir(dir, 0);
+}
+
+
+//
+// Watch 'path' for changes, and what is in it as well if it's a
+// directory the buildfile included. A symbolic link is watched both
+// where it is and where it points.
+//
+static void
+watch_path(const char *path, int present, int listed, int buildfile) {
+	char	name[PATH_MAX];
+	char	real[PATH_MAX];
+
+	if(real_dir_name(path, name)) {
+		watch_name(name, path, present, buildfile);
+	}
+	if(realpath(path, real) != NULL) {
+		if(strcmp(real, name) != 0) {
+			watch_name(real, path, present, buildfile);
+		}
+		if(listed) watch_dir(real, 1);
+	}
+}
+
+
+// Get ready to watch 'buildfile', before the parse changes directory.
+static void
+watch_init(char *buildfile) {
+	if(getcwd(watch_cwd, sizeof(watch_cwd)) == NULL) {
+		error_exit("Unable to get the current directory: %s.\n", strerror(errno));
+	}
+	if(realpath("/proc/self/exe", watch_exe) == NULL) {
+		error_exit("Unable to find the running program: %s.\n", strerror(errno));
+	}
+	watch_fd = inotify_init1(IN_CLOEXEC);
+	if(watch_fd == -1) {
+		error_exit("Unable to watch for changes: %s.\n", strerror(errno));
+	}
+	watch_path(buildfile, 1, 0, 1);
+}
+
+
+static int
+watch_event(struct inotify_event *ev) {
+	struct watch_dir	*wp = NULL;
+	char				name[PATH_MAX];
+	unsigned			i;
+	int					ret = WATCH_NONE;
+
+	if(ev->mask & IN_Q_OVERFLOW) return WATCH_RESTART;
+	for(i = 0; i < num_watch_dirs; ++i) {
+		if(watch_dirs[i].wd == ev->wd) wp = &watch_dirs[i];
+	}
+	if(wp == NULL || ev->len == 0) return WATCH_NONE;
+	snprintf(name, sizeof(name), "%s/%s", strcmp(wp->path, "/") ? wp->path : "", ev->name);
+	for(i = 0; i < num_watch_files; ++i) {
+		if(strcmp(watch_files[i].name, name) == 0) {
+			if(watch_files[i].buildfile) return WATCH_RESTART;
+			watch_files[i].changed = 1;
+			ret = WATCH_CHANGE;
+		}
+	}
+	if(ret == WATCH_NONE && wp->listed && (ev->mask & WATCH_LISTING)) {
+		ret = WATCH_RESTART;
+	}
+	return ret;
+}
+
+
+//
+// Take the changed files into the kept build. Returns how many files
+// of the image changed, -1 if the buildfile has to be parsed again.
+//
+static int
+watch_refresh(void) {
+	struct watch_file	*wf;
+	struct stat			sbuf;
+	unsigned			i;
+	int					present;
+	int					n;
+	int					total = 0;
+
+	for(i = 0; i < num_watch_files; ++i) {
+		wf = &watch_files[i];
+		if(!wf->changed) continue;
+		wf->changed = 0;
+		present = stat(wf->path, &sbuf) == 0;
+		if(present != wf->present) return -1;
+		if(!present) continue;
+		if((n = mkxfs_refresh(build, wf->path)) <= 0) return -1;
+		total += n;
+	}
+	return total;
+}
+
+
+// Write the image from the kept build.
+static void
+watch_write(char *output) {
+	double	start = prof_now();
+	int		status;
+	pid_t	pid;
+
+	fflush(stdout);
+	fflush(stderr);
+	ifs_trace_fork();
+	pid = fork();
+	if(pid == -1) {
+		fprintf(stderr, "Unable to start building '%s': %s.\n", output, strerror(errno));
+		return;
+	}
+	if(pid == 0) {
+		ifs_trace_child(output);
+		// The kept build's temp files belong to the parent.
+		mkxfs_forked(build);
+		status = mkxfs_write(build, output) != 0;
+		if(status) fputs(mkxfs_error(build), stderr);
+		mkxfs_abort(build);
+		fflush(stdout);
+		fflush(stderr);
+		_exit(status);
+	}
+	while(waitpid(pid, &status, 0) == -1) {
+		if(errno != EINTR) return;
+	}
+	if(WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		fprintf(stderr, "Wrote %s in %.3f seconds.\n", output, prof_now() - start);
+	}
+}
+
+
+// Parse the buildfile again by running the same command again.
+static void
+watch_restart(char *argv[]) {
+	if(chdir(watch_cwd) == -1) {
+		error_exit("Unable to change to %s: %s.\n", watch_cwd, strerror(errno));
+	}
+	mkxfs_free(build);
+	build = NULL;
+	fflush(stdout);
+	fflush(stderr);
+	ifs_trace_exec();
+	execv(watch_exe, argv);
+	error_exit("Unable to run %s again: %s.\n", argv[0], strerror(errno));
+}
+
+
+//
+// Write the image if the buildfile was parsed and then wait for
+// changes. If it wasn't ('failed'), any change to the buildfile or the
+// paths looked at before the error starts over.
+//
+static void
+run_watch(char *argv[], char *output, int failed) {
+	union {
+		struct inotify_event	ev;
+		char					buf[4096];
+	}						u;
+	struct inotify_event	*ev;
+	struct mc_dep			*dp;
+	struct pollfd			pfd;
+	ssize_t					len;
+	char					*p;
+	int						timeout;
+	int						restart;
+	int						changed;
+	int						n;
+
+	for(dp = build->dep_list; dp != NULL; dp = dp->next) {
+		watch_path(dp->path, dp->present, dp->present && S_ISDIR(dp->sbuf.st_mode), 0);
+	}
+	if(!failed) {
+		watch_write(output);
+	}
+	for( ;; ) {
+		restart = changed = 0;
+		timeout = -1;
+		for( ;; ) {
+			pfd.fd = watch_fd;
+			pfd.events = POLLIN;
+			n = poll(&pfd, 1, timeout);
+			if(n == 0) break;
+			if(n == -1) {
+				if(errno == EINTR) continue;
+				error_exit("Unable to watch for changes: %s.\n", strerror(errno));
+			}
+			len = read(watch_fd, u.buf, sizeof(u.buf));
+			for(p = u.buf; len > 0 && p < u.buf + len; p += sizeof(*ev) + ev->len) {
+				ev = (struct inotify_event *)p;
+				switch(watch_event(ev)) {
+				case WATCH_CHANGE:
+					changed = 1;
+					break;
+				case WATCH_RESTART:
+					restart = 1;
+					break;
+				}
+			}
+			// Wait for the rest of an editor's save or a build's copy.
+			if(restart || changed) timeout = WATCH_SETTLE;
+		}
+		if(restart || failed || (n = watch_refresh()) < 0) {
+			watch_restart(argv);
+		}
+		if(n > 0) {
+			watch_write(output);
+		}
+	}
+}
+
+#endif
+
+
+enum {
+	OPT_PROFILE = 0x100,
+	OPT_TRACE,
+	OPT_BATCH,
+	OPT_JOBS,
+	OPT_WATCH
+};
+
+static const struct option long_opts[] = {
+	{ "profile",	required_argument,	NULL,	OPT_PROFILE },
+	{ "trace",		required_argument,	NULL,	OPT_TRACE },
+	{ "batch",		required_argument,	NULL,	OPT_BATCH },
+	{ "jobs",		required_argument,	NULL,	OPT_JOBS },
+	{ "watch",		no_argument,		NULL,	OPT_WATCH },
+	{ NULL }
+};
+
+int
+main(int argc, char *argv[]) {
+	struct mkxfs_options	opts;
+	int						n;
+	FILE					*src_fp;
+	char					*specified_dest;
+	char					*cmd;
+	char					*type = NULL;
+	char					*rootdir = NULL;
+	int						use_model_cache = 0;
+	char					**sections;
+	int						num_sections = 0;
+	char					*batch_name = NULL;
+	int						jobs = 0;
+	int						watch = 0;
+	int						failed = 0;
+
+
+	cmd = basename(argv[0]);
+	if(IS_EXE_NAME(cmd, "mkifs")) {
+		type = "ifs";
+	} else if(IS_EXE_NAME(cmd, "mkefs")) {
+		type = "ffs3";
+	} else if(IS_EXE_NAME(cmd, "mketfs")) {
+		type = "etfs";
+	}
+
+	memset(&opts, 0, sizeof(opts));
+	sections = malloc(argc * sizeof(*sections));
+	if(sections == NULL) {
+		error_exit("No memory for section list information.\n");
+	}
+
+	while((n = getopt_long(argc, argv, "a:bc:C:r:l:nNps:t:v", long_opts, NULL)) != -1) {
+		switch(n) {
+		case OPT_PROFILE:
+			profile_name = optarg;
+			break;
+		case OPT_TRACE:
+			if(ifs_trace_open(optarg, "mkifs") != 0) {
+				error_exit("Unable to open '%s': %s.\n", optarg, strerror(errno));
+			}
+			break;
+		case OPT_BATCH:
+			batch_name = optarg;
+			break;
+		case OPT_JOBS:
+			jobs = atoi(optarg);
+			if(jobs <= 0) {
+				error_exit("Invalid number of jobs '%s'.\n", optarg);
+			}
+			break;
+		case OPT_WATCH:
+			watch = 1;
+			break;
+		case 'a':
+			opts.symfile_suffix = optarg;
+			break;
+		case 'b':
+			use_model_cache = 1;
+			break;
+		case 'c':
+			cache_dir = optarg;
+			break;
+		case 'C':
+			filter_cache_set_limit(optarg);
+			break;
+		case 'l':
+			add_data(optarg);
+			add_data("\n");
+			break;
+		case 'n':
+			opts.no_time++;
+			break;
+		case 'N':
+			opts.new_style_bootstrap++;
+			break;
+		case 'p':
+			// Place holder for old, experimental switch
+			break;
+		case 's':
+			sections[num_sections++] = optarg;
+			break;
+		case 't':
+			type = optarg;
+			break;
+		case 'r':
+			if(rootdir) {
+				error_exit("Only one rootdir can be passed\n");
+			}
+			rootdir = optarg;
+			break;
+		case 'v':
+			++opts.verbose;
+			break;
+		default:
+			exit(1);
+		}
+	}
+	if(profile_name != NULL || ifs_trace_enabled) {
+		prof_init();
+	}
+
+	if(type == NULL) {
+		error_exit("Output file system type not specified\n");
+	}
+	opts.type = type;
+	opts.lines = option_lines;
+	opts.debug_fp = stderr;
+	build = mkxfs_new(&opts);
+	if(build == NULL) {
+		if(errno == EINVAL) {
+			error_exit("Unknown file system '%s'\n", type);
+		}
+		error_exit("No memory for the build.\n");
+	}
+	for(n = 0; n < num_sections; ++n) {
+		if(mkxfs_keep_section(build, sections[n]) != 0) build_failed();
+	}
+
+	set_cpu(DEFAULT_CPU, 0);
+#if 0
+#if defined(__WIN32__) || defined(__NT__)
+	{
+		char *p, *qnx_target = getenv("QNX_TARGET");
+		if(!qnx_target) {
+			qnx_target = getenv("QSSL_TARGET");
+		}
+		if ( qnx_target ) {
+			if ( qnx_target[0] == '\"' ) { 
+				qnx_target++;
+				if ( (p = strrchr( qnx_target, '\"')) ) {
+					*p = '\0';
+				}
+			}
+		} else {
+			error_exit("QNX_TARGET environment variable must be set\n");
+		}
+		setenv( "QNX_TARGET", qnx_target, 0 );
+	}
+#else
+	{
+		char *qnx_target = getenv("QNX_TARGET");
+		if(!qnx_target) {
+			qnx_target = getenv("QSSL_TARGET");
+		}
+		if(qnx_target) {
+			setenv("QNX_TARGET",qnx_target, 0);
+		} else {
+			error_exit("QNX_TARGET environment variable must be set\n");
+		}
+    }
+#endif
+#endif
+    if(rootdir) {
+		setenv("_ROOTDIR_", rootdir, 1);
+
+		/* @@@ This should not duplicate the paths, but for now it is the least risky */
+		setenv("MKIFS_PATH",
+	       // If there is something in sbin, and also somewhere else
+	       // we probably want the sbin version so look there first
+	       "${_ROOTDIR_}/${PROCESSOR}/sbin"   
+	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/usr/sbin"
+
+	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/boot/sys"
+
+	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/bin"
+	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/usr/bin"
+	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/lib"
+	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/lib/dll"
+	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/usr/lib"
+	       
+	       // Feel free to get rid of this if /usr/photon/bin goes away
+	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/usr/photon/bin"
+#if 0
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/sbin"   
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/sbin"
+
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/boot/sys"
+
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/bin"
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/bin"
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/lib"
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/lib/dll"
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/lib"
+	       
+	       // Feel free to get rid of this if /usr/photon/bin goes away
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/photon/bin"
+	       , 0 );
+	} else {
+		setenv("MKIFS_PATH",
+	       // If there is something in sbin, and also somewhere else
+	       // we probably want the sbin version so look there first
+	       "${QNX_TARGET}/${PROCESSOR}/sbin"   
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/sbin"
+
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/boot/sys"
+
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/bin"
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/bin"
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/lib"
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/lib/dll"
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/lib"
+	       
+	       // Feel free to get rid of this if /usr/photon/bin goes away
+	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/photon/bin"
+#endif
+	       , 0 );
+	}
+
+	src_fp = stdin;
+	specified_dest = NULL;
+
+	atexit(rm_tmpfiles);
+
+	signal(SIGHUP, die);
+#if !defined(__WIN32__) && !defined(__NT__)
+	signal(SIGPIPE, die);
+#endif
+	signal(SIGINT, die);
+	signal(SIGQUIT, die);
+	signal(SIGTERM, die);
+
+	n = argc - optind;
+	if(n) {
+		if(strcmp(argv[optind], "-") != 0) {
+			src_fp = fopen(argv[optind], "r");
+			if(src_fp == NULL)
+				error_exit("Unable to open '%s': %s.\n", argv[optind], strerror(errno));
+		}
+
+		if(n > 1) {
+			if(batch_name != NULL) {
+				error_exit("--batch takes the outputs from '%s'.\n", batch_name);
+			}
+			if(strcmp(argv[optind + 1], "-") != 0) {
+				specified_dest = argv[optind + 1];
+			}
+		}
+	}
+
+	if(watch) {
+#if defined(__linux__)
+		if(src_fp == stdin || specified_dest == NULL) {
+			error_exit("--watch needs a named in-file and out-file.\n");
+		}
+		if(batch_name != NULL) {
+			error_exit("--watch can't be used with --batch.\n");
+		}
+		watch_init(argv[optind]);
+		build->track_deps = 1;
+#else
+		error_exit("--watch is not supported on this host.\n");
+#endif
+	}
+
+	if(use_model_cache) {
+		if(src_fp == stdin) {
+			fprintf(stderr, "Warning: -b needs a named buildfile, not using a buildfile cache.\n");
+		} else if(mkxfs_cache(build, argv[optind], argc, argv, optind) != 0) {
+			build_failed();
+		}
+	}
+
+	if(mkxfs_parse(build, src_fp) != 0) {
+		if(!watch) build_failed();
+		fputs(mkxfs_error(build), stderr);
+		failed = 1;
+	}
+#if defined(__linux__)
+	if(watch) {
+		run_watch(argv, specified_dest, failed);
+	}
+#endif
+	if(batch_name != NULL) {
+		if(jobs == 0) {
+			jobs = sysconf(_SC_NPROCESSORS_ONLN);
+			if(jobs <= 0) jobs = 1;
+		}
+		failed = run_batch(batch_name, jobs);
+	} else if(mkxfs_write(build, specified_dest) != 0) {
+		build_failed();
+	}
+
+	filter_cache_trim();
+	if(opts.verbose) {
+		filter_cache_report(stderr);
+	}
+	prof_report((n = argc - optind) > 0 ? argv[optind] : NULL, specified_dest);
+	if(opts.verbose > 1) {
+		fprintf(stderr, "Build model: %lu bytes, %u strings\n",
+				(unsigned long)build->model_arena.total, build->model_strings.count);
+	}
+	mkxfs_free(build);
+	build = NULL;
+	return(failed ? 1 : 0);
+}
+
+__SRCVERSION("main.c $Rev$");
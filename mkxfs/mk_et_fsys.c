@@ -57,7 +57,7 @@ int			num_fids;
 
 
 #define CLUSTERS(nfiles)	(((nfiles) + (files_per_cluster-1))/files_per_cluster)
-#define NCLS(size)			(((size) + cluster_size - 1) / cluster_size)
+#define NCLS(size)			(((size) + mk->cluster_size - 1) / mk->cluster_size)
 
 #define MEG	(1024*1024)
 
@@ -70,18 +70,19 @@ etfs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *de
 	int					i;
 
 	if(mountpoint == NULL) mountpoint = "";
+	totaldirs = totalfiles = totalclusters = totaltransactions = 0;
 
 	// Set default to a 16M NAND flash part.
-	if(cluster_size == 0) 	cluster_size = 1024;
-	if(block_size == 0) 	block_size = 1024*16;
+	if(mk->cluster_size == 0) 	mk->cluster_size = 1024;
+	if(mk->block_size == 0) 	mk->block_size = 1024*16;
 
-	num_clusters = block_size / cluster_size;
-	blockdata = malloc(block_size);
+	num_clusters = mk->block_size / mk->cluster_size;
+	blockdata = malloc(mk->block_size);
 	if (blockdata == NULL) {
 		fprintf(stderr, "Not enough memory\n");
 		return -1;
 	}
-	files_per_cluster = cluster_size/sizeof(struct etfs_ftable_file);
+	files_per_cluster = mk->cluster_size/sizeof(struct etfs_ftable_file);
 
 	trp = make_tree(list);
 	num_fids = FID_FIRSTFILE;
@@ -92,12 +93,12 @@ etfs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *de
 	write_filedata(dst_fp, trp, FID_ROOT);
 
 	// Pad out with ff's if num_blocks was specified.
-	memset(&blockdata[0], 0xff, cluster_size + sizeof(struct etfs_trans));
-	for(i = totalclusters ; i < num_blocks*num_clusters ; ++i)
-		fwrite(&blockdata[0], cluster_size + sizeof(struct etfs_trans), 1, dst_fp);
+	memset(&blockdata[0], 0xff, mk->cluster_size + sizeof(struct etfs_trans));
+	for(i = totalclusters ; i < mk->num_blocks*num_clusters ; ++i)
+		fwrite(&blockdata[0], mk->cluster_size + sizeof(struct etfs_trans), 1, dst_fp);
 
-	if(verbose)
-		fprintf(stderr, "Dirs %u  Files %u  Clusters %u  Bytes %u  Transactions %u\n", totaldirs, totalfiles, totalclusters, totalclusters*cluster_size, totaltransactions);
+	if(mk->verbose)
+		fprintf(stderr, "Dirs %u  Files %u  Clusters %u  Bytes %u  Transactions %u\n", totaldirs, totalfiles, totalclusters, totalclusters*mk->cluster_size, totaltransactions);
 
 	return 0;
 }
@@ -142,20 +143,20 @@ write_filetable(FILE *dst_fp, struct tree_entry *trp, unsigned parent) {
 	struct file_entry			*fip;
 	unsigned					perms;
 	struct etfs_ftable_file		*fep;
-	time_t						now = no_time ? 0 : time(NULL);
+	time_t						now = mk->no_time ? 0 : time(NULL);
 
 	// We make a special case for the root of the filesystem and
 	// the special files.
 	if(parent == FID_ROOT) {
-		if(verbose)
+		if(mk->verbose)
 			fprintf(stderr, " Fid Pfid  Mode Clusters Name\n");
-		memset(&blockdata[0], 0xff, block_size);
+		memset(&blockdata[0], 0xff, mk->block_size);
 
 		fep = (struct etfs_ftable_file *)blockdata;
 		mkrootentry(&fep[FID_ROOT], "", S_IFDIR | S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH, 0, now);
-		mkrootentry(&fep[FID_FILETABLE], ".filetable", S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, CLUSTERS(num_fids) * cluster_size, now);
-		mkrootentry(&fep[FID_BADBLKS], ".badblks", S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, cluster_size, now);
-		mkrootentry(&fep[FID_COUNTS], ".counts", S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, num_blocks * (2 * sizeof(uint16_t)), now);
+		mkrootentry(&fep[FID_FILETABLE], ".filetable", S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, CLUSTERS(num_fids) * mk->cluster_size, now);
+		mkrootentry(&fep[FID_BADBLKS], ".badblks", S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, mk->cluster_size, now);
+		mkrootentry(&fep[FID_COUNTS], ".counts", S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, mk->num_blocks * (2 * sizeof(uint16_t)), now);
 		mkrootentry(&fep[FID_LOSTFOUND], ".lost+found", S_IFDIR | S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH, 0, now);
 		mkrootentry(&fep[FID_RESERVED], ".reserved", S_IFREG | S_IRUSR | S_IRGRP | S_IROTH, 0, now);
 
@@ -166,8 +167,8 @@ write_filetable(FILE *dst_fp, struct tree_entry *trp, unsigned parent) {
 		struct stat	sbuf;
 
 		if(index == 0)
-			memset(&blockdata[0], 0xff, block_size);
-		fep = (struct etfs_ftable_file *)((char *)blockdata + ((index / files_per_cluster) * cluster_size) + ((index % files_per_cluster) * sizeof(struct etfs_ftable_file)));
+			memset(&blockdata[0], 0xff, mk->block_size);
+		fep = (struct etfs_ftable_file *)((char *)blockdata + ((index / files_per_cluster) * mk->cluster_size) + ((index % files_per_cluster) * sizeof(struct etfs_ftable_file)));
 
 		fep->efid = 0;
 		if(strlen(tp->name) > ETFS_FNAME_SHORT_LEN)
@@ -215,7 +216,7 @@ write_filetable(FILE *dst_fp, struct tree_entry *trp, unsigned parent) {
 		fep->uid = fip->attr->uid;
 		strncpy(fep->name, tp->name, ETFS_FNAME_SHORT_LEN);
 
-		if(verbose)
+		if(mk->verbose)
 			fprintf(stderr, "%4x %4x  %4.4x %5d %s\n",
 				tp->flags, fep->pfid, fep->mode, NCLS(fep->size), tp->name);
 
@@ -230,7 +231,7 @@ write_filetable(FILE *dst_fp, struct tree_entry *trp, unsigned parent) {
 		if(strlen(tp->name) > ETFS_FNAME_SHORT_LEN) {
 			struct etfs_ftable_extname	*efep;
 
-			efep = (struct etfs_ftable_extname *)((char *)blockdata + ((index / files_per_cluster) * cluster_size) + ((index % files_per_cluster) * sizeof(struct etfs_ftable_file)));
+			efep = (struct etfs_ftable_extname *)((char *)blockdata + ((index / files_per_cluster) * mk->cluster_size) + ((index % files_per_cluster) * sizeof(struct etfs_ftable_file)));
 
 			efep->efid = swap16(0,ETFS_FTABLE_EXTENSION);
 			efep->pfid = swap16(0,tp->flags);
@@ -272,9 +273,9 @@ write_filedata(FILE *dst_fp, struct tree_entry *trp, unsigned parent) {
 				}
 
 				for(index = 0;;) {
-					n = (num_clusters - index) * cluster_size;
-					memset(&blockdata[index*cluster_size], 0xff, n);
-					n = fread(&blockdata[index*cluster_size], 1, n, src_fp);
+					n = (num_clusters - index) * mk->cluster_size;
+					memset(&blockdata[index*mk->cluster_size], 0xff, n);
+					n = fread(&blockdata[index*mk->cluster_size], 1, n, src_fp);
 					if(n <= 0 && index == 0)
 						break;
 					index = write_transaction(dst_fp, blockdata, index + NCLS(n), tp->flags);
@@ -284,7 +285,7 @@ write_filedata(FILE *dst_fp, struct tree_entry *trp, unsigned parent) {
 				break;
 
 			case S_IFLNK:
-				memset(&blockdata[0], 0, cluster_size);
+				memset(&blockdata[0], 0, mk->cluster_size);
 				strcpy(&blockdata[0], tp->fip->hostpath);
 				index = write_transaction(dst_fp, blockdata, 1, tp->flags);
 				break;
@@ -327,7 +328,7 @@ write_transaction(FILE *dst_fp, uint8_t *data, unsigned nclusters, unsigned fid)
 		trans.sequence  = sequence;
 		endian_trans(&trans);
 
-		fwrite(data + i*cluster_size, cluster_size, 1, dst_fp);
+		fwrite(data + i*mk->cluster_size, mk->cluster_size, 1, dst_fp);
 		fwrite(&trans, sizeof(trans), 1, dst_fp);
 	}
 
@@ -341,7 +342,7 @@ write_transaction(FILE *dst_fp, uint8_t *data, unsigned nclusters, unsigned fid)
 	}
 
 	if(n != nclusters  &&  nclusters != INT_MAX)
-		memcpy(data, data + n*cluster_size, (nclusters - n)*cluster_size);
+		memcpy(data, data + n*mk->cluster_size, (nclusters - n)*mk->cluster_size);
 
 	return(nclusters - n);
 }
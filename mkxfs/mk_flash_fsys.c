@@ -100,15 +100,15 @@ static block_info_t *init_block(int block_size, uint16_t unit_flags){
 	//	structure
 	//
 
-	unit.status = swap16(target_endian,unit_flags);
-	unit.struct_size = swap16(target_endian,sizeof(unit));
-	unit.endian = target_endian ? 'B' : 'L';
+	unit.status = swap16(mk->target_endian,unit_flags);
+	unit.struct_size = swap16(mk->target_endian,sizeof(unit));
+	unit.endian = mk->target_endian ? 'B' : 'L';
 	unit.age = 0;					//	hard coded, does not apply here
         if (unit_flags&F3S_UNIT_NO_LOGI)
 	 unit.logi = ~0;
         else
-	 unit.logi = swap16(target_endian,block_index+1);
-	unit.unit_pow2 = swap16(target_endian,calc_log2(block_size));
+	 unit.logi = swap16(mk->target_endian,block_index+1);
+	unit.unit_pow2 = swap16(mk->target_endian,calc_log2(block_size));
 	unit.reserve = 0xffff;
 	unit.erase_count = 0;			//	hard coded, does not apply here
 
@@ -117,8 +117,8 @@ static block_info_t *init_block(int block_size, uint16_t unit_flags){
 	//	these values are hard coded since they should not change
 	//
 
-	extptr.logi_unit = swap16(target_endian,F3S_FIRST_LOGI);
-	extptr.index = swap16(target_endian,F3S_BOOT_INDEX);
+	extptr.logi_unit = swap16(mk->target_endian,F3S_FIRST_LOGI);
+	extptr.index = swap16(mk->target_endian,F3S_BOOT_INDEX);
 
 	unit.boot = extptr;
 
@@ -197,8 +197,8 @@ static void write_boot_record(block_info_t *block_info, uint16_t spare, ffs_sort
 	//
 
 	boot_flags = ~F3S_BOOT_NO_INDEX;
-	boot_record.status = swap16(target_endian,boot_flags);
-	boot_record.struct_size = swap16(target_endian,sizeof(boot_record));
+	boot_record.status = swap16(mk->target_endian,boot_flags);
+	boot_record.struct_size = swap16(mk->target_endian,sizeof(boot_record));
 	memcpy(&boot_record.sig, F3S_SIG_STRING, F3S_SIG_SIZE);
 	boot_record.rev_major = F3S_REV_MAJOR;
 	boot_record.rev_minor = F3S_REV_MINOR;
@@ -215,21 +215,21 @@ static void write_boot_record(block_info_t *block_info, uint16_t spare, ffs_sort
 
 	boot_record.unit_total = 0;
 
-	boot_record.unit_spare = swap16(target_endian,spare);
+	boot_record.unit_spare = swap16(mk->target_endian,spare);
   	
 	//
 	//	these two entries are hard coded for now
 	//
 
-	boot_record.align_pow2 = swap16(target_endian,2);
-	boot_record.xip_pow2 = swap16(target_endian,12);
+	boot_record.align_pow2 = swap16(mk->target_endian,2);
+	boot_record.xip_pow2 = swap16(mk->target_endian,12);
 
 	//
 	//	setup root extent pointer
 	//
 
-	root.logi_unit = swap16(target_endian,F3S_FIRST_LOGI);
-	root.index = swap16(target_endian,F3S_ROOT_INDEX);	
+	root.logi_unit = swap16(mk->target_endian,F3S_FIRST_LOGI);
+	root.index = swap16(mk->target_endian,F3S_ROOT_INDEX);	
 
 	boot_record.root = root;
 
@@ -308,7 +308,7 @@ static void write_f3s(ffs_sort_t *sort, int block_size){
 	// first block requires a boot record
 	//
 
-	write_boot_record (block_info, spare_blocks,sort);
+	write_boot_record (block_info, mk->spare_blocks,sort);
 
 	//
 	// write the initialized block to the file.  each entry will be written  
@@ -324,23 +324,23 @@ static void write_f3s(ffs_sort_t *sort, int block_size){
 			switch(sort->mode & S_IFMT){
 
 			case S_IFDIR:
-				if(verbose)
-					fprintf(debug_fp,"writing directory entry -> %s\n",sort->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing directory entry -> %s\n",sort->name);
 				block_info = write_dir_entry(sort, block_info);
 				break;
 			case S_IFREG:
-				if(verbose)
-					fprintf(debug_fp,"writing file entry      -> %s ",sort->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing file entry      -> %s ",sort->name);
 				block_info = write_file(sort,block_info);
 				break;	        
 			case S_IFLNK:
-				if(verbose)
-					fprintf(debug_fp,"writing link entry      -> %s ",sort->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing link entry      -> %s ",sort->name);
 				block_info = write_lnk(sort,block_info);
 				break;	        
 			case S_IFIFO:
-				if(verbose)
-					fprintf(debug_fp,"writing fifo entry      -> %s\n",sort->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing fifo entry      -> %s\n",sort->name);
 				block_info = write_dir_entry(sort, block_info);
 				break;
 			} 
@@ -388,29 +388,29 @@ static void write_f3s(ffs_sort_t *sort, int block_size){
 			switch(sort_temp_ptr->mode & S_IFMT){
 			
 			case S_IFDIR:
-				if(verbose)
-					fprintf(debug_fp,"writing directory entry -> %s\n",sort_temp_ptr->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing directory entry -> %s\n",sort_temp_ptr->name);
 
 				block_info = write_dir_entry(sort_temp_ptr, block_info);
 				break;
 
 			case S_IFREG:
-				if(verbose)
-					fprintf(debug_fp,"writing file entry      -> %s ",sort_temp_ptr->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing file entry      -> %s ",sort_temp_ptr->name);
 
 				block_info = write_file(sort_temp_ptr,block_info);
 			    break;
 				
 			case S_IFLNK:
-				if(verbose)
-					fprintf(debug_fp,"writing link entry      -> %s ",sort_temp_ptr->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing link entry      -> %s ",sort_temp_ptr->name);
 
 				block_info = write_lnk(sort_temp_ptr,block_info);
 				break;
 			
 			case S_IFIFO:
-				if(verbose)
-					fprintf(debug_fp,"writing FIFO entry      -> %s\n",sort_temp_ptr->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing FIFO entry      -> %s\n",sort_temp_ptr->name);
 
 				block_info = write_dir_entry(sort_temp_ptr, block_info);
 				break;
@@ -438,29 +438,29 @@ static void write_f3s(ffs_sort_t *sort, int block_size){
 			switch(sort_temp_ptr->mode & S_IFMT){
 				
 			case S_IFDIR:
-				if(verbose)
-					fprintf(debug_fp,"writing directory entry -> %s\n",sort_temp_ptr->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing directory entry -> %s\n",sort_temp_ptr->name);
 
 				block_info = write_dir_entry(sort_temp_ptr, block_info);
 				break;
 						
 			case S_IFREG:
-				if(verbose)
-					fprintf(debug_fp,"writing file entry      -> %s ",sort_temp_ptr->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing file entry      -> %s ",sort_temp_ptr->name);
 
 				block_info = write_file(sort_temp_ptr,block_info);
 				break;
 
 			case S_IFLNK:
-				if(verbose)
-					fprintf(debug_fp,"writing link entry      -> %s ",sort_temp_ptr->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing link entry      -> %s ",sort_temp_ptr->name);
 
 				block_info = write_lnk(sort_temp_ptr,block_info);
 				break;
 
 			case S_IFIFO:
-				if(verbose)
-					fprintf(debug_fp,"writing fifo entry      -> %s\n",sort_temp_ptr->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing fifo entry      -> %s\n",sort_temp_ptr->name);
 
 				block_info = write_dir_entry(sort_temp_ptr, block_info);
 				break;
@@ -507,8 +507,8 @@ static block_info_t *write_dir_entry(ffs_sort_t *sorted_list, block_info_t *bloc
 	//	setup directory entry
 	//
 
-	dir.status = swap16(target_endian,~F3S_DIRENT_NO_STAT);
-	dir.struct_size = swap16(target_endian,sizeof(dir));
+	dir.status = swap16(mk->target_endian,~F3S_DIRENT_NO_STAT);
+	dir.struct_size = swap16(mk->target_endian,sizeof(dir));
 	dir.first = first;
 	namelen = strlen(sorted_list->name) + sizeof(char);
 	dir.namelen = namelen;
@@ -519,16 +519,16 @@ static block_info_t *write_dir_entry(ffs_sort_t *sorted_list, block_info_t *bloc
 	//
 
 	if (sorted_list->status  & COMPRESSED)
-		stat.status = swap16(target_endian, ~F3S_STAT_NO_COMP);
+		stat.status = swap16(mk->target_endian, ~F3S_STAT_NO_COMP);
 	else
 		stat.status = FNULL;
 
-	stat.struct_size = swap16(target_endian,sizeof(stat));
-	stat.uid = swap32(target_endian,sorted_list->uid);
-	stat.gid = swap32(target_endian,sorted_list-> gid);
-	stat.mtime = swap32(target_endian,sorted_list->ffs_ftime);
-	stat.ctime = swap32(target_endian,sorted_list->ffs_ftime);
-	stat.mode = swap32(target_endian,sorted_list->mode);
+	stat.struct_size = swap16(mk->target_endian,sizeof(stat));
+	stat.uid = swap32(mk->target_endian,sorted_list->uid);
+	stat.gid = swap32(mk->target_endian,sorted_list-> gid);
+	stat.mtime = swap32(mk->target_endian,sorted_list->ffs_ftime);
+	stat.ctime = swap32(mk->target_endian,sorted_list->ffs_ftime);
+	stat.mode = swap32(mk->target_endian,sorted_list->mode);
 
 	dir_size = sizeof(dir) + F3S_NAME_ALIGN(namelen) + sizeof(stat);
 	dir.moves = 0;
@@ -583,7 +583,7 @@ static void write_extent(block_info_t *block_info, f3s_extptr_t next, uint16_t e
 	//	setup the extent header information
 	//
 
-	extent.status = swap16(target_endian,extent_flags);
+	extent.status = swap16(mk->target_endian,extent_flags);
 
 	//
 	//	must make sure that the offset is dword aligned
@@ -591,8 +591,8 @@ static void write_extent(block_info_t *block_info, f3s_extptr_t next, uint16_t e
 
 	extent.reserve = 0xff;
 	extent.text_offset_hi = block_info->offset_top>> (2 /* debug: hardcoded */ +F3S_OFFSET_HI_POW2);
-	extent.text_offset_lo = swap16(target_endian,block_info->offset_top>> 2 /* debug: hardcoded */);
-	extent.text_size      = swap16(target_endian,size);
+	extent.text_offset_lo = swap16(mk->target_endian,block_info->offset_top>> 2 /* debug: hardcoded */);
+	extent.text_size      = swap16(mk->target_endian,size);
 
 	super.logi_unit = FNULL;  //this utility will never have to deal with supersede extents.
 	super.index     = FNULL;
@@ -632,7 +632,7 @@ static void write_extent(block_info_t *block_info, f3s_extptr_t next, uint16_t e
 		if (read(flashimage,&extent_prev,sizeof(extent_prev)) != sizeof(extent_prev))
 			mk_flash_exit("read failed: %s\n",strerror(errno));
 
-		extent_prev.status &= swap16(target_endian,~F3S_EXT_LAST);
+		extent_prev.status &= swap16(mk->target_endian,~F3S_EXT_LAST);
 		memcpy(blk_buffer_ptr,&extent_prev, sizeof(extent_prev));
 
 		if (lseek(flashimage,position+sizeof(extent),SEEK_SET) == -1)
@@ -656,8 +656,8 @@ static void child_extent(ffs_sort_t *entry, uint32_t size_child_entry, block_inf
 	// Setup 'first' pointer to new extent
 	//
 	
-	first.logi_unit = swap16(target_endian,block_info->block_index + 1);	
-	first.index =  swap16(target_endian,block_info->extent_index);
+	first.logi_unit = swap16(mk->target_endian,block_info->block_index + 1);	
+	first.index =  swap16(mk->target_endian,block_info->extent_index);
 
 	//
 	// now write the entry to the correct place 
@@ -703,8 +703,8 @@ static void sibling_extent(ffs_sort_t *entry, uint32_t size_sib_entry, block_inf
 	// Setup 'next' pointer to new extent
 	//
 	
-	dir_next.logi_unit = swap16(target_endian,block_info->block_index + 1);			
-	dir_next.index =  swap16(target_endian,block_info->extent_index);
+	dir_next.logi_unit = swap16(mk->target_endian,block_info->block_index + 1);			
+	dir_next.index =  swap16(mk->target_endian,block_info->extent_index);
 
 	//
 	// now write the entry to the correct place 
@@ -718,7 +718,7 @@ static void sibling_extent(ffs_sort_t *entry, uint32_t size_sib_entry, block_inf
 	if (read(flashimage,&dir_extent,sizeof(dir_extent)) != sizeof(dir_extent))
 		mk_flash_exit("read failed: %s\n",strerror(errno));
 
-	dir_extent.status &= swap16(target_endian,~F3S_EXT_NO_NEXT);
+	dir_extent.status &= swap16(mk->target_endian,~F3S_EXT_NO_NEXT);
 	dir_extent.next = dir_next;
 	
 	lseek(flashimage, pos, SEEK_SET);
@@ -802,9 +802,9 @@ static block_info_t *write_file(ffs_sort_t *sort, block_info_t *block_info){
 	block_info = write_dir_entry(sort, block_info);
 
 
-    if(verbose){
-		putc(42,debug_fp);
-		fflush(debug_fp);
+    if(mk->verbose){
+		putc(42,mk->debug_fp);
+		fflush(mk->debug_fp);
 	}
 
 	prev_extent = 0;
@@ -862,11 +862,11 @@ static block_info_t *write_file(ffs_sort_t *sort, block_info_t *block_info){
 		//	verbose display of file being written
 		//
 
-		if(verbose){
+		if(mk->verbose){
 			update_dot +=remain;
 			if (update_dot >=MAX_WRITE){
-				putc(42,debug_fp);
-				fflush(debug_fp);
+				putc(42,mk->debug_fp);
+				fflush(mk->debug_fp);
 				update_dot = 0;
 			}
 		}
@@ -899,8 +899,8 @@ static block_info_t *write_file(ffs_sort_t *sort, block_info_t *block_info){
 
 	fclose(read_file_fp);
 
-	if (verbose)
-		fprintf(debug_fp,"\n");
+	if (mk->verbose)
+		fprintf(mk->debug_fp,"\n");
 	
 	free(file_buffer);
 	return block_info;
@@ -935,9 +935,9 @@ static block_info_t *write_lnk(ffs_sort_t *sort, block_info_t *block_info){
 		lnk_size = strlen(lnk_buffer);
 	}
 
-    if(verbose){
-		putc(42,debug_fp);
-		fflush(debug_fp);
+    if(mk->verbose){
+		putc(42,mk->debug_fp);
+		fflush(mk->debug_fp);
 	}
 
 
@@ -971,8 +971,8 @@ static block_info_t *write_lnk(ffs_sort_t *sort, block_info_t *block_info){
 
 	lnk_dword = (((lnk_size) + (sizeof(uint32_t)-1))&~(sizeof(uint32_t)-1));
 
-	if (verbose)
-		fprintf(debug_fp,"\n");
+	if (mk->verbose)
+		fprintf(mk->debug_fp,"\n");
 
 	block_info->offset_top += lnk_dword;
 	block_info->available_space -= lnk_dword;
@@ -994,8 +994,8 @@ static void first_file_extent(uint32_t position, uint32_t size_file_entry, block
 	// Setup extent pointer to new extent
 	//
 	
-	first.logi_unit = swap16(target_endian,block_info->block_index + 1);			
-	first.index = swap16(target_endian,block_info->extent_index);
+	first.logi_unit = swap16(mk->target_endian,block_info->block_index + 1);			
+	first.index = swap16(mk->target_endian,block_info->extent_index);
 
 	//
 	// write the update to the correct place 
@@ -1036,8 +1036,8 @@ static void file_extent(uint32_t position, uint32_t size_file_entry, block_info_
 	// Setup 'next' pointer to new extent
 	//
 	
-	dir_next.logi_unit = swap16(target_endian,block_info->block_index + 1);			
-	dir_next.index =  swap16(target_endian,block_info->extent_index);
+	dir_next.logi_unit = swap16(mk->target_endian,block_info->block_index + 1);			
+	dir_next.index =  swap16(mk->target_endian,block_info->extent_index);
 
 	//
 	// now write the entry to the correct place 
@@ -1049,7 +1049,7 @@ static void file_extent(uint32_t position, uint32_t size_file_entry, block_info_
 	if (read(flashimage,&dir_extent,sizeof(dir_extent)) != sizeof(dir_extent))
 		mk_flash_exit("read failed: %s\n", strerror(errno));
 
-	dir_extent.status &= swap16(target_endian,~F3S_EXT_NO_NEXT);
+	dir_extent.status &= swap16(mk->target_endian,~F3S_EXT_NO_NEXT);
 	dir_extent.next = dir_next;
 	
 	lseek(flashimage, position, SEEK_SET);
@@ -1087,16 +1087,16 @@ static void spare_block_alloc(block_info_t *block_info){
 	//	calculate minimum number of blocks for the specified filesystem
 	//
 
-	min_block_count = image.minsize/block_size;
+	min_block_count = mk->image.minsize/mk->block_size;
 
 	//
 	//	calculate maximum number of blocks for the specified filesystem
 	//
 
-	if(image.maxsize == 0)
+	if(mk->image.maxsize == 0)
 		max_block_count = 0xffff;
 	else
-		max_block_count = image.maxsize/block_size;
+		max_block_count = mk->image.maxsize/mk->block_size;
 
 
 	//
@@ -1111,7 +1111,7 @@ static void spare_block_alloc(block_info_t *block_info){
 	// the 1 is because the the block_info->block_index is indexed from 0
 	//
 										
-	block_count = block_info->block_index + 1 + spare_blocks;	
+	block_count = block_info->block_index + 1 + mk->spare_blocks;	
 
 	//
 	// if filesystem is smaller than minsize, pad the filesyste
@@ -1126,11 +1126,11 @@ static void spare_block_alloc(block_info_t *block_info){
 
 	if (max_block_count < block_count){
 		fprintf(stderr,"\n");
-		fprintf(stderr,"WARNING -- filesystem size exceeds %dK (max_size).\n",image.maxsize/1024);
+		fprintf(stderr,"WARNING -- filesystem size exceeds %dK (max_size).\n",mk->image.maxsize/1024);
 	}
 	
 
-	boot_block_count = swap16(target_endian,block_count);
+	boot_block_count = swap16(mk->target_endian,block_count);
 		
 	memcpy(blk_buffer_ptr,&boot_block_count,sizeof(boot_block_count));
 
@@ -1151,14 +1151,14 @@ static void spare_block_alloc(block_info_t *block_info){
 
 	unit_flags = (~F3S_UNIT_MASK | F3S_UNIT_SPARE);
 
-	for(i=0;i<spare_blocks;i++)
+	for(i=0;i<mk->spare_blocks;i++)
 		init_block(block_info->block_size, unit_flags);
 
-	if(verbose){
+	if(mk->verbose){
 		fprintf(stderr,"Filesystem size = %dK\n",(block_info->block_size*block_count)
 			/1024);
 		fprintf(stderr, "block size = %dK\n",block_info->block_size/1024);
-		fprintf(stderr,"%d spare block(s)\n", spare_blocks);
+		fprintf(stderr,"%d spare block(s)\n", mk->spare_blocks);
 	}
 };
 
@@ -1168,26 +1168,27 @@ ffs_make_fsys_2(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *d
 	ffs_sort_t			*sort;
 
 	if(mountpoint == NULL) mountpoint = "";
+	block_index = 0;
 
 	//
 	//	If target endian is unknown, set to little endian
 	//
 
-	if (target_endian == -1)
-		target_endian = 0;
+	if (mk->target_endian == -1)
+		mk->target_endian = 0;
 	
 	//
 	//	Make sure block size is defined and reasonable (at least 1K)
 	//
 
-	if (block_size < 1024)
+	if (mk->block_size < 1024)
 		mk_flash_exit("Error: block_size not defined or incorrectly defined (>1K), exiting ...\n");
 
 	trp = make_tree(list);
 
 	sort = ffs_entries(trp, mountpoint);
 
-	write_f3s(sort, block_size);
+	write_f3s(sort, mk->block_size);
 
 	write_image(dst_fp);
 
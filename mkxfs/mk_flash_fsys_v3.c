@@ -107,10 +107,10 @@ static void unit_logi_md5 (f3s_unit_logi_t *unit_logi, uint32_t *md5)
 	memcpy (logi, unit_logi, sizeof(uint32_t) * 2);
 
 	/* Perform optional endian swapping of input */
-	logi[0] = swap32(target_endian,logi[0]);
-	logi[1] = swap32(target_endian,logi[1]);
-	wpad[0] = swap32(target_endian,wpad[0]);
-	wlen[0] = swap32(target_endian,wlen[0]);
+	logi[0] = swap32(mk->target_endian,logi[0]);
+	logi[1] = swap32(mk->target_endian,logi[1]);
+	wpad[0] = swap32(mk->target_endian,wpad[0]);
+	wlen[0] = swap32(mk->target_endian,wlen[0]);
 
 	/* Initialize accumulators */
 	a = 0x01234567;
@@ -249,23 +249,23 @@ static block_info_t *init_block(int block_size, uint16_t unit_flags){
 	//
 
 	memset(&unit_info, 0xFF, sizeof(unit_info));
-	unit_info.struct_size    = swap16(target_endian,sizeof(unit_info));
-	unit_info.endian         = target_endian ? 'B' : 'L';
-	unit_info.unit_pow2      = swap16(target_endian,calc_log2(block_size));
+	unit_info.struct_size    = swap16(mk->target_endian,sizeof(unit_info));
+	unit_info.endian         = mk->target_endian ? 'B' : 'L';
+	unit_info.unit_pow2      = swap16(mk->target_endian,calc_log2(block_size));
 	unit_info.erase_count    = 0;
-	unit_info.boot.logi_unit = swap16(target_endian,F3S_FIRST_LOGI);
-	unit_info.boot.index     = swap16(target_endian,F3S_BOOT_INDEX);
+	unit_info.boot.logi_unit = swap16(mk->target_endian,F3S_FIRST_LOGI);
+	unit_info.boot.index     = swap16(mk->target_endian,F3S_BOOT_INDEX);
 	memcpy(&init_blk_ptr[0],                &unit_info,sizeof(unit_info));
 
 	if (!spare) {
-		unit_logi.struct_size = swap16(target_endian,sizeof(unit_logi));
-		unit_logi.logi        = (unit_flags&F3S_UNIT_NO_LOGI) ? ~0 : swap16(target_endian,block_index+1);
+		unit_logi.struct_size = swap16(mk->target_endian,sizeof(unit_logi));
+		unit_logi.logi        = (unit_flags&F3S_UNIT_NO_LOGI) ? ~0 : swap16(mk->target_endian,block_index+1);
 		unit_logi.age         = 0;
 		unit_logi_md5(&unit_logi, unit_logi.md5);
-		unit_logi.md5[0] = swap32(target_endian,unit_logi.md5[0]);
-		unit_logi.md5[1] = swap32(target_endian,unit_logi.md5[1]);
-		unit_logi.md5[2] = swap32(target_endian,unit_logi.md5[2]);
-		unit_logi.md5[3] = swap32(target_endian,unit_logi.md5[3]);
+		unit_logi.md5[0] = swap32(mk->target_endian,unit_logi.md5[0]);
+		unit_logi.md5[1] = swap32(mk->target_endian,unit_logi.md5[1]);
+		unit_logi.md5[2] = swap32(mk->target_endian,unit_logi.md5[2]);
+		unit_logi.md5[3] = swap32(mk->target_endian,unit_logi.md5[3]);
 		memcpy(&init_blk_ptr[sizeof(unit_info)],&unit_logi,sizeof(unit_logi));
 	}
 
@@ -316,7 +316,7 @@ static void write_boot_record(block_info_t *block_info, uint16_t spare, ffs_sort
 	//	setup the boot record structure
 	//
 
-	boot_record.struct_size = swap16(target_endian,sizeof(boot_record));
+	boot_record.struct_size = swap16(mk->target_endian,sizeof(boot_record));
 	memcpy(&boot_record.sig, F3S_SIG_STRING, F3S_SIG_SIZE);
 	boot_record.rev_major = F3S_REV_MAJOR;
 	boot_record.rev_minor = F3S_REV_MINOR;
@@ -332,20 +332,20 @@ static void write_boot_record(block_info_t *block_info, uint16_t spare, ffs_sort
 	//
 
 	boot_record.unit_total = 0;
-	boot_record.unit_spare = swap16(target_endian,spare);
+	boot_record.unit_spare = swap16(mk->target_endian,spare);
   	
 	//
 	//	these two entries are hard coded for now
 	//
 
-	boot_record.align_pow2 = swap16(target_endian,2);
+	boot_record.align_pow2 = swap16(mk->target_endian,2);
 
 	//
 	//	setup root extent pointer
 	//
 
-	root.logi_unit = swap16(target_endian,F3S_FIRST_LOGI);
-	root.index = swap16(target_endian,F3S_ROOT_INDEX);	
+	root.logi_unit = swap16(mk->target_endian,F3S_FIRST_LOGI);
+	root.index = swap16(mk->target_endian,F3S_ROOT_INDEX);	
 
 	boot_record.root = root;
 
@@ -430,7 +430,7 @@ static void write_f3s(ffs_sort_t *sort, int block_size){
 	// first block requires a boot record
     //
 	
-	write_boot_record (block_info, spare_blocks,sort);
+	write_boot_record (block_info, mk->spare_blocks,sort);
 	
 	//
 	// write the initialized block to the file.  each entry will be written  
@@ -446,23 +446,23 @@ static void write_f3s(ffs_sort_t *sort, int block_size){
 			switch(sort->mode & S_IFMT){
 	
 			case S_IFDIR:
-				if(verbose)
-					fprintf(debug_fp,"writing directory entry -> %s\n",sort->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing directory entry -> %s\n",sort->name);
 				block_info = write_dir_entry(sort, block_info);
 				break;
 			case S_IFREG:
-				if(verbose)
-					fprintf(debug_fp,"writing file entry   -> %s ",sort->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing file entry   -> %s ",sort->name);
 				block_info = write_file(sort,block_info);
 				break;	        
 			case S_IFLNK:
-				if(verbose)
-					fprintf(debug_fp,"writing link entry   -> %s ",sort->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing link entry   -> %s ",sort->name);
 				block_info = write_lnk(sort,block_info);
 				break;	        
 			case S_IFIFO:
-				if(verbose)
-					fprintf(debug_fp,"writing fifo entry -> %s\n",sort->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing fifo entry -> %s\n",sort->name);
 				block_info = write_dir_entry(sort, block_info);
 				break;
 			} 
@@ -522,28 +522,28 @@ static void write_f3s(ffs_sort_t *sort, int block_size){
 			switch(sort_temp_ptr->mode & S_IFMT){
 			
 			case S_IFDIR:
-				if(verbose)
-					fprintf(debug_fp,"writing directory entry -> %s\n",sort_temp_ptr->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing directory entry -> %s\n",sort_temp_ptr->name);
 
 				block_info = write_dir_entry(sort_temp_ptr, block_info);
 				break;
 						
 			case S_IFREG:
-				if(verbose)
-					fprintf(debug_fp,"writing file entry      -> %s ",sort_temp_ptr->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing file entry      -> %s ",sort_temp_ptr->name);
 
 				block_info = write_file(sort_temp_ptr,block_info);
 			    break;
 				
 			case S_IFLNK:
-				if(verbose)
-					fprintf(debug_fp,"writing link entry      -> %s ",sort_temp_ptr->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing link entry      -> %s ",sort_temp_ptr->name);
 
 				block_info = write_lnk(sort_temp_ptr,block_info);
 				break;
 			case S_IFIFO:
-				if(verbose)
-					fprintf(debug_fp,"writing fifo entry      -> %s\n",sort_temp_ptr->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing fifo entry      -> %s\n",sort_temp_ptr->name);
 
 				block_info = write_dir_entry(sort_temp_ptr,block_info);
 			    break;
@@ -576,28 +576,28 @@ static void write_f3s(ffs_sort_t *sort, int block_size){
 			switch(sort_temp_ptr->mode & S_IFMT){
 				
 			case S_IFDIR:
-				if(verbose)
-					fprintf(debug_fp,"writing directory entry -> %s\n",sort_temp_ptr->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing directory entry -> %s\n",sort_temp_ptr->name);
 
 				block_info = write_dir_entry(sort_temp_ptr, block_info);
 				break;
 						
 			case S_IFREG:
-				if(verbose)
-					fprintf(debug_fp,"writing file entry      -> %s ",sort_temp_ptr->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing file entry      -> %s ",sort_temp_ptr->name);
 
 				block_info = write_file(sort_temp_ptr,block_info);
 				break;
 
 			case S_IFLNK:
-				if(verbose)
-					fprintf(debug_fp,"writing link entry      -> %s ",sort_temp_ptr->name);
+				if(mk->verbose)
+					fprintf(mk->debug_fp,"writing link entry      -> %s ",sort_temp_ptr->name);
 
 				block_info = write_lnk(sort_temp_ptr,block_info);
 				break;
 			case S_IFIFO:
-				if (verbose)
-					fprintf(debug_fp,"writing fifo entry      -> %s\n",sort_temp_ptr->name);
+				if (mk->verbose)
+					fprintf(mk->debug_fp,"writing fifo entry      -> %s\n",sort_temp_ptr->name);
 				
 				block_info = write_dir_entry(sort_temp_ptr, block_info);
 				break;
@@ -644,7 +644,7 @@ static block_info_t *write_dir_entry(ffs_sort_t *sorted_list, block_info_t *bloc
 	//	setup directory entry
 	//
 
-	dir.struct_size = swap16(target_endian,sizeof(dir));
+	dir.struct_size = swap16(mk->target_endian,sizeof(dir));
 	dir.first = first;
 
 	namelen = strlen(sorted_list->name) + sizeof(char);
@@ -658,12 +658,12 @@ static block_info_t *write_dir_entry(ffs_sort_t *sorted_list, block_info_t *bloc
 	//	is this entry a compressed file?
 	//
 
-	stat.struct_size = swap16(target_endian,sizeof(stat));
-	stat.uid = swap32(target_endian,sorted_list->uid);
-	stat.gid = swap32(target_endian,sorted_list-> gid);
-	stat.mtime = swap32(target_endian,sorted_list->ffs_ftime);
-	stat.ctime = swap32(target_endian,sorted_list->ffs_ftime);
-	stat.mode = swap16(target_endian,sorted_list->mode);
+	stat.struct_size = swap16(mk->target_endian,sizeof(stat));
+	stat.uid = swap32(mk->target_endian,sorted_list->uid);
+	stat.gid = swap32(mk->target_endian,sorted_list-> gid);
+	stat.mtime = swap32(mk->target_endian,sorted_list->ffs_ftime);
+	stat.ctime = swap32(mk->target_endian,sorted_list->ffs_ftime);
+	stat.mode = swap16(mk->target_endian,sorted_list->mode);
 
 	dir_size = sizeof(dir) + F3S_NAME_ALIGN(namelen) + sizeof(stat);
 	dir.moves = 0;
@@ -718,7 +718,7 @@ static void write_extent(block_info_t *block_info, f3s_extptr_t next, uint16_t e
 	//
 
 	memset(&extent, 0xFF, sizeof(extent));
-	extent.status[0] = swap32(target_endian,extent_flags);
+	extent.status[0] = swap32(mk->target_endian,extent_flags);
 	extent.status[1] = extent.status[0];
 	extent.status[2] = extent.status[0];
 
@@ -727,8 +727,8 @@ static void write_extent(block_info_t *block_info, f3s_extptr_t next, uint16_t e
 	//
 
 	extent.text_offset_hi = block_info->offset_top>> (2 /* debug: hardcoded */ +F3S_OFFSET_HI_POW2);
-	extent.text_offset_lo = swap16(target_endian,block_info->offset_top>> 2 /* debug: hardcoded */);
-	extent.text_size      = swap16(target_endian,size);
+	extent.text_offset_lo = swap16(mk->target_endian,block_info->offset_top>> 2 /* debug: hardcoded */);
+	extent.text_size      = swap16(mk->target_endian,size);
 
 	// This utility will never have to deal with supersede extents.
 
@@ -766,7 +766,7 @@ static void write_extent(block_info_t *block_info, f3s_extptr_t next, uint16_t e
 			mk_flash_exit("read failed: %s.  %s:%d\n",strerror(errno),
 					__FILE__, __LINE__);
 
-		extent_prev.status[0] &= swap32(target_endian,~F3S_EXT_LAST);
+		extent_prev.status[0] &= swap32(mk->target_endian,~F3S_EXT_LAST);
 		extent_prev.status[1]  = extent_prev.status[0];
 		extent_prev.status[2]  = extent_prev.status[0];
 		memcpy(blk_buffer_ptr,&extent_prev, sizeof(extent_prev));
@@ -794,8 +794,8 @@ static void child_extent(ffs_sort_t *entry, uint32_t size_child_entry, block_inf
 	// Setup 'first' pointer to new extent
 	//
 	
-	first.logi_unit = swap16(target_endian,block_info->block_index + 1);	
-	first.index =  swap16(target_endian,block_info->extent_index);
+	first.logi_unit = swap16(mk->target_endian,block_info->block_index + 1);	
+	first.index =  swap16(mk->target_endian,block_info->extent_index);
 
 	//
 	// now write the entry to the correct place 
@@ -842,8 +842,8 @@ static void sibling_extent(ffs_sort_t *entry, uint32_t size_sib_entry, block_inf
 	// Setup 'next' pointer to new extent
 	//
 
-	dir_next.logi_unit = swap16(target_endian,block_info->block_index + 1);			
-	dir_next.index =  swap16(target_endian,block_info->extent_index);
+	dir_next.logi_unit = swap16(mk->target_endian,block_info->block_index + 1);			
+	dir_next.index =  swap16(mk->target_endian,block_info->extent_index);
 
 	//
 	// now write the entry to the correct place 
@@ -858,7 +858,7 @@ static void sibling_extent(ffs_sort_t *entry, uint32_t size_sib_entry, block_inf
 		mk_flash_exit("read failed: %s.  %s:%d\n",strerror(errno),
 				__FILE__, __LINE__);
 
-	dir_extent.status[0] &= swap32(target_endian,~F3S_EXT_NO_NEXT);
+	dir_extent.status[0] &= swap32(mk->target_endian,~F3S_EXT_NO_NEXT);
 	dir_extent.status[1] &= dir_extent.status[0];
 	dir_extent.status[2] &= dir_extent.status[0];
 	dir_extent.next = dir_next;
@@ -928,9 +928,9 @@ static block_info_t *write_file(ffs_sort_t *sort, block_info_t *block_info){
 
 	block_info = write_dir_entry(sort, block_info);
 
-	if(verbose){
-		putc(42,debug_fp);
-		fflush(debug_fp);
+	if(mk->verbose){
+		putc(42,mk->debug_fp);
+		fflush(mk->debug_fp);
 	}
 
 	prev_extent = 0;
@@ -992,11 +992,11 @@ static block_info_t *write_file(ffs_sort_t *sort, block_info_t *block_info){
 		//	verbose display of file being written
 		//
 
-		if(verbose){
+		if(mk->verbose){
 			update_dot +=remain;
 			if (update_dot >=MAX_WRITE){
-				putc(42,debug_fp);
-				fflush(debug_fp);
+				putc(42,mk->debug_fp);
+				fflush(mk->debug_fp);
 				update_dot = 0;
 			}
 		}
@@ -1030,8 +1030,8 @@ static block_info_t *write_file(ffs_sort_t *sort, block_info_t *block_info){
 
 	fclose(read_file_fp);
 
-	if (verbose)
-		fprintf(debug_fp,"\n");
+	if (mk->verbose)
+		fprintf(mk->debug_fp,"\n");
 	
 	free(file_buffer);
 	return block_info;
@@ -1067,9 +1067,9 @@ static block_info_t *write_lnk(ffs_sort_t *sort, block_info_t *block_info){
 		lnk_size = strlen(lnk_buffer);
 	}
 
-    if(verbose){
-		putc(42,debug_fp);
-		fflush(debug_fp);
+    if(mk->verbose){
+		putc(42,mk->debug_fp);
+		fflush(mk->debug_fp);
 	}
 
 
@@ -1109,8 +1109,8 @@ static block_info_t *write_lnk(ffs_sort_t *sort, block_info_t *block_info){
 
 	lnk_dword = (((lnk_size) + (sizeof(uint32_t)-1))&~(sizeof(uint32_t)-1));
 
-	if (verbose)
-		fprintf(debug_fp,"\n");
+	if (mk->verbose)
+		fprintf(mk->debug_fp,"\n");
 
 	block_info->offset_top += lnk_dword;
 	block_info->available_space -= lnk_dword;
@@ -1130,8 +1130,8 @@ static void first_file_extent(uint32_t position, uint32_t size_file_entry, block
 	// Setup extent pointer to new extent
 	//
 	
-	first.logi_unit = swap16(target_endian,block_info->block_index + 1);			
-	first.index = swap16(target_endian,block_info->extent_index);
+	first.logi_unit = swap16(mk->target_endian,block_info->block_index + 1);			
+	first.index = swap16(mk->target_endian,block_info->extent_index);
 
 	//
 	// write the update to the correct place 
@@ -1173,8 +1173,8 @@ static void file_extent(uint32_t position, uint32_t size_file_entry, block_info_
 	// Setup 'next' pointer to new extent
 	//
 	
-	dir_next.logi_unit = swap16(target_endian,block_info->block_index + 1);			
-	dir_next.index =  swap16(target_endian,block_info->extent_index);
+	dir_next.logi_unit = swap16(mk->target_endian,block_info->block_index + 1);			
+	dir_next.index =  swap16(mk->target_endian,block_info->extent_index);
 
 	//
 	// now write the entry to the correct place 
@@ -1187,7 +1187,7 @@ static void file_extent(uint32_t position, uint32_t size_file_entry, block_info_
 		mk_flash_exit("read failed: %s.  %s:%d\n", strerror(errno),
 				__FILE__, __LINE__);
 
-	dir_extent.status[0] &= swap32(target_endian,~F3S_EXT_NO_NEXT);
+	dir_extent.status[0] &= swap32(mk->target_endian,~F3S_EXT_NO_NEXT);
 	dir_extent.status[1]  = dir_extent.status[0];
 	dir_extent.status[2]  = dir_extent.status[0];
 	dir_extent.next = dir_next;
@@ -1227,16 +1227,16 @@ static void spare_block_alloc(block_info_t *block_info){
 	//	calculate minimum number of blocks for the specified filesystem
 	//
 
-	min_block_count = image.minsize/block_size;
+	min_block_count = mk->image.minsize/mk->block_size;
 
 	//
 	//	calculate maximum number of blocks for the specified filesystem
 	//
 
-	if(image.maxsize == 0)
+	if(mk->image.maxsize == 0)
 		max_block_count = 0xffff;
 	else
-		max_block_count = image.maxsize/block_size;
+		max_block_count = mk->image.maxsize/mk->block_size;
 
 	//
 	// forward the list to the last entry
@@ -1250,7 +1250,7 @@ static void spare_block_alloc(block_info_t *block_info){
 	// the 1 is because the the block_info->block_index is indexed from 0
 	//
 
-	block_count = block_info->block_index + 1 + spare_blocks;
+	block_count = block_info->block_index + 1 + mk->spare_blocks;
 
 	//
 	// if filesystem is smaller than minsize, pad the filesystem
@@ -1270,10 +1270,10 @@ static void spare_block_alloc(block_info_t *block_info){
 
 	if (max_block_count < block_count){
 		fprintf(stderr,"\n");
-		fprintf(stderr,"WARNING -- filesystem size exceeds %dK (max_size).\n",image.maxsize/1024);
+		fprintf(stderr,"WARNING -- filesystem size exceeds %dK (max_size).\n",mk->image.maxsize/1024);
 	}
 
-	boot_block_count = swap16(target_endian,block_count);
+	boot_block_count = swap16(mk->target_endian,block_count);
 	memcpy(blk_buffer_ptr,&boot_block_count,sizeof(boot_block_count));
 
 	//
@@ -1295,7 +1295,7 @@ static void spare_block_alloc(block_info_t *block_info){
 
 	unit_flags = (~F3S_UNIT_MASK | F3S_UNIT_SPARE);
 
-	for(i=0;i<spare_blocks;i++){
+	for(i=0;i<mk->spare_blocks;i++){
 		init_block(block_info->block_size, unit_flags);
 		if (NULL == block_info){
 			mk_flash_exit("init_block failed: %s.  %s:%d\n",strerror(errno),
@@ -1304,11 +1304,11 @@ static void spare_block_alloc(block_info_t *block_info){
 	}
 
 	
-	if(verbose){
+	if(mk->verbose){
 		fprintf(stderr,"Filesystem size = %dK\n",(block_info->block_size*block_count)
 			/1024);
 		fprintf(stderr, "block size = %dK\n",block_info->block_size/1024);
-		fprintf(stderr,"%d spare block(s)\n", spare_blocks);
+		fprintf(stderr,"%d spare block(s)\n", mk->spare_blocks);
 	}
 }
 
@@ -1318,26 +1318,27 @@ ffs_make_fsys_3(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *d
 	ffs_sort_t			*sort;
 
 	if(mountpoint == NULL) mountpoint = "";
+	block_index = 0;
 
 	//
 	//	If target endian is unknown, set to little endian
 	//
 
-	if (target_endian == -1)
-		target_endian = 0;
+	if (mk->target_endian == -1)
+		mk->target_endian = 0;
 	
 	//
 	//	Make sure block size is defined and reasonable (at least 1K)
 	//
 
-	if (block_size < 1024)
+	if (mk->block_size < 1024)
 		mk_flash_exit("Error: block_size not defined or incorrectly defined (>1K), exiting ...\n");
 
 	trp = make_tree(list);
 
 	sort = ffs_entries(trp, mountpoint);
 
-	write_f3s(sort, block_size);
+	write_f3s(sort, mk->block_size);
 		
 	write_image(dst_fp);		
 
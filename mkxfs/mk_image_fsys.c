@@ -35,6 +35,8 @@
 #include <lzo/lzo1x.h>
 #include <ucl/ucl.h>
 #include "xplatform.h"
+#include "libifs/ifs_trace.h"
+#include "libifs/ifs_cksum.h"
 
 
 struct soname_entry {
@@ -50,15 +52,6 @@ struct keep_section {
 	Elf32_Shdr			shdr;
 };
 
-struct soname_entry	*soname_head;
-char 				copybuf[4096];
-unsigned	 		image_cksum = 0;
-unsigned	 		image_offset;		// uncompressed image offset
-unsigned	 		cimage_offset;		// compressed image offset
-unsigned	 		ram_offset;
-void				*compress_fp;
-char				*compress_name;
-struct name_list	*section_list;
 
 #if !(defined(__QNX__) || defined(__QNXNTO__))
 	#define PT_SEGREL	0x4001
@@ -120,7 +113,7 @@ void
 ifs_section(struct name_list **owner, const char *name) {
 	struct name_list	*kn;
 
-	if(owner == NULL) owner = &section_list;
+	if(owner == NULL) owner = &mk->section_list;
 	kn = malloc(sizeof(*kn) + strlen(name));
 	if(kn == NULL) {
 		error_exit("No memory for section list information.\n");
@@ -166,12 +159,12 @@ seg_uip_congruence(struct file_entry *fip, Elf32_Phdr *phdr) {
 	if(p_flags & PF_W) p_flags &= ~PF_X;  // In case data segment is execute
 	if(fip->flags & FILE_FLAGS_STARTUP) return(~0UL);
 	u_flags = fip->attr->uip_flags;
-	if(split_image && !(fip->flags & FILE_FLAGS_BOOT)) u_flags &= ~PF_W;
+	if(mk->split_image && !(fip->flags & FILE_FLAGS_BOOT)) u_flags &= ~PF_W;
 	if(fip->flags & FILE_FLAGS_SO) u_flags |= PF_W;
 
 	if(!(u_flags & p_flags)) return(0);
-	if(booter.virtual) {
-		if((fip->flags & FILE_FLAGS_BOOT) && (booter.vboot_addr == 0)) {
+	if(mk->booter.virtual) {
+		if((fip->flags & FILE_FLAGS_BOOT) && (mk->booter.vboot_addr == 0)) {
 			return(~0UL);
 		}
 		return(EHost32(fip, phdr->p_align)-1);
@@ -202,10 +195,9 @@ expand_out(int congruence, struct file_entry *fip) {
 int
 ropen(struct file_entry *fip) {
 	int			 fd;
-	static char	*lastcd;
 
-	if(*fip->hostpath != '/'  &&  fip->attr  &&  lastcd != fip->attr->cd)
-		chdir(lastcd = fip->attr->cd);
+	if(*fip->hostpath != '/'  &&  fip->attr  &&  mk->lastcd != fip->attr->cd)
+		chdir(mk->lastcd = fip->attr->cd);
 
 	fd = open(fip->hostpath, O_RDONLY);
 	if(fd == -1) {
@@ -238,6 +230,129 @@ enum {
 	COMPRESS_ENUM(UCL)
 };
 
+//
+// The compressed part of the image is collected here until the
+// uncompressed size is known and the startup header can be filled in.
+// It is kept in memory up to COMPRESS_MEM_LIMIT bytes and spilled to a
+// temporary file beyond that. Either way the destination is written
+// strictly in order, so the image can go straight to a pipe.
+//
+#define COMPRESS_MEM_LIMIT	(64 * 1024 * 1024)
+
+static FILE *
+compress_output(void) {
+	mk->compress_name = NULL;
+	mk->compress_mem = NULL;
+	mk->compress_mem_len = 0;
+	return open_memstream(&mk->compress_mem, &mk->compress_mem_len);
+}
+
+static int
+compress_put(FILE **fpp, const void *buf, size_t len) {
+	FILE	*fp;
+
+	clearerr(*fpp);
+	if((fwrite(buf, 1, len, *fpp) != len) || ferror(*fpp)) {
+		return 0;
+	}
+	if((mk->compress_name == NULL) && (ftell(*fpp) > COMPRESS_MEM_LIMIT)) {
+		fflush(*fpp);
+		mk->compress_name = mk_tmpfile();
+		if((fp = fopen(mk->compress_name, "w+b")) == NULL) {
+			return 0;
+		}
+		if(fwrite(mk->compress_mem, 1, mk->compress_mem_len, fp) != mk->compress_mem_len) {
+			fclose(fp);
+			return 0;
+		}
+		fclose(*fpp);
+		free(mk->compress_mem);
+		mk->compress_mem = NULL;
+		*fpp = fp;
+	}
+	return 1;
+}
+
+static int
+compress_end(FILE *fp) {
+	int		status;
+
+	mk->compress_len = ftell(fp);
+	if(mk->compress_name == NULL) {
+		return fclose(fp) == 0;
+	}
+	status = (fflush(fp) == 0) && !ferror(fp);
+	fclose(fp);
+	return status;
+}
+
+struct compress_zlib {
+	FILE			*fp;
+	z_stream		strm;
+	unsigned char	out[0x4000];
+};
+
+static struct compress_zlib *
+zlibopen(void) {
+	struct compress_zlib	*z;
+
+	z = malloc(sizeof(*z));
+	if(z == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	memset(&z->strm, 0, sizeof(z->strm));
+	// Same stream parameters gzopen(name, "wb") uses.
+	if(deflateInit2(&z->strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		free(z);
+		errno = EDOM;
+		return NULL;
+	}
+	if((z->fp = compress_output()) == NULL) {
+		deflateEnd(&z->strm);
+		free(z);
+		return NULL;
+	}
+	return z;
+}
+
+static int
+zlibdeflate(struct compress_zlib *z, int flush) {
+	int		status;
+
+	do {
+		z->strm.next_out = z->out;
+		z->strm.avail_out = sizeof(z->out);
+		status = deflate(&z->strm, flush);
+		if(status == Z_STREAM_ERROR) {
+			errno = EDOM;
+			return 0;
+		}
+		if(compress_put(&z->fp, z->out, sizeof(z->out) - z->strm.avail_out) == 0) {
+			return 0;
+		}
+	} while(z->strm.avail_out == 0);
+	return 1;
+}
+
+static int
+zlibwrite(struct compress_zlib *z, const void *buf, size_t len) {
+	z->strm.next_in = (void *)buf;
+	z->strm.avail_in = len;
+	return zlibdeflate(z, Z_NO_FLUSH);
+}
+
+static int
+zlibclose(struct compress_zlib *z) {
+	int		status;
+
+	status = zlibdeflate(z, Z_FINISH);
+	deflateEnd(&z->strm);
+	if(compress_end(z->fp) == 0) status = 0;
+	free(z);
+	return status;
+}
+
 #define BUFFSIZE_LZO	0x10000
 struct compress_lzo {
 	FILE			*fp;
@@ -248,7 +363,7 @@ struct compress_lzo {
 };
 
 static struct compress_lzo *
-lzoopen(const char *name) {
+lzoopen(void) {
 	struct compress_lzo	*lzo;
 
 	lzo = malloc(sizeof(*lzo));
@@ -256,14 +371,16 @@ lzoopen(const char *name) {
 		errno = ENOMEM;
 		return NULL;
 	}
-	lzo->fp = fopen(name, "wb");
-	if(lzo->fp == NULL) {
-		return NULL;
-	}
 	if(lzo_init() != LZO_E_OK) {
+		free(lzo);
 		errno = EDOM; //Strange error so we know what failed.
 		return NULL;
 	}
+	lzo->fp = compress_output();
+	if(lzo->fp == NULL) {
+		free(lzo);
+		return NULL;
+	}
 	lzo->in_off = 0;
 	return lzo;
 }
@@ -274,9 +391,12 @@ lzoflush(struct compress_lzo *lzo) {
 	lzo_uint	out_len;
 	unsigned char		*buf;
 	unsigned	len;
+	unsigned char		hdr[2];
+	double		start;
 
 	buf = lzo->in;
 	len = lzo->in_off;
+	start = ifs_trace_now();
 
 	while(lzo->in_off != 0) {
 		status = lzo1x_999_compress(buf, len, lzo->out, &out_len, lzo->work);
@@ -291,15 +411,17 @@ lzoflush(struct compress_lzo *lzo) {
 			continue;
 		}
 		//write out block
-		clearerr(lzo->fp);
-		putc(out_len >> 8, lzo->fp);
-		putc(out_len & 0xff, lzo->fp);
-		if((fwrite(lzo->out, 1, out_len, lzo->fp) != out_len) || ferror(lzo->fp)) {
+		hdr[0] = out_len >> 8;
+		hdr[1] = out_len & 0xff;
+		if(compress_put(&lzo->fp, hdr, 2) == 0
+		 || compress_put(&lzo->fp, lzo->out, out_len) == 0) {
 			return 0;
 		}
+		prof_block(start, len, out_len + 2);
 		buf += len;
 		lzo->in_off -= len;
 		len = lzo->in_off;
+		start = ifs_trace_now();
 	}
 	return 1;
 }
@@ -331,9 +453,8 @@ lzoclose(struct compress_lzo *lzo) {
 		status = lzoflush(lzo);
 	}
 	//Mark end of compression
-	putc(0, lzo->fp);
-	putc(0, lzo->fp);
-	fclose(lzo->fp);
+	if(compress_put(&lzo->fp, "\0\0", 2) == 0) status = 0;
+	if(compress_end(lzo->fp) == 0) status = 0;
 	free(lzo);
 	return status;
 }
@@ -347,7 +468,7 @@ struct compress_ucl {
 };
 
 static struct compress_ucl *
-uclopen(const char *name) {
+uclopen(void) {
 	struct compress_ucl	*ucl;
 
 	ucl = malloc(sizeof(*ucl));
@@ -355,8 +476,9 @@ uclopen(const char *name) {
 		errno = ENOMEM;
 		return NULL;
 	}
-	ucl->fp = fopen(name, "wb");
+	ucl->fp = compress_output();
 	if(ucl->fp == NULL) {
+		free(ucl);
 		return NULL;
 	}
 	ucl->in_off = 0;
@@ -369,9 +491,12 @@ uclflush(struct compress_ucl *ucl) {
 	unsigned		out_len;
 	unsigned char	*buf;
 	unsigned		len;
+	unsigned char	hdr[2];
+	double			start;
 
 	buf = ucl->in;
 	len = ucl->in_off;
+	start = ifs_trace_now();
 
 	while(ucl->in_off != 0) {
 		status = ucl_nrv2b_99_compress(buf, len, ucl->out, &out_len, NULL, 9, NULL, NULL);
@@ -386,15 +511,17 @@ uclflush(struct compress_ucl *ucl) {
 			continue;
 		}
 		//write out block
-		clearerr(ucl->fp);
-		putc(out_len >> 8, ucl->fp);
-		putc(out_len & 0xff, ucl->fp);
-		if((fwrite(ucl->out, 1, out_len, ucl->fp) != out_len) || ferror(ucl->fp)) {
+		hdr[0] = out_len >> 8;
+		hdr[1] = out_len & 0xff;
+		if(compress_put(&ucl->fp, hdr, 2) == 0
+		 || compress_put(&ucl->fp, ucl->out, out_len) == 0) {
 			return 0;
 		}
+		prof_block(start, len, out_len + 2);
 		buf += len;
 		ucl->in_off -= len;
 		len = ucl->in_off;
+		start = ifs_trace_now();
 	}
 	return 1;
 }
@@ -426,113 +553,108 @@ uclclose(struct compress_ucl *ucl) {
 		status = uclflush(ucl);
 	}
 	//Mark end of compression
-	putc(0, ucl->fp);
-	putc(0, ucl->fp);
-	fclose(ucl->fp);
+	if(compress_put(&ucl->fp, "\0\0", 2) == 0) status = 0;
+	if(compress_end(ucl->fp) == 0) status = 0;
 	free(ucl);
 	return status;
 }
 
 static void
 compress_start(void) {
-	compress_name = mk_tmpfile();
-	switch(compressed) {
+	switch(mk->compressed) {
 	case COMPRESS_ZLIB:
-		if((compress_fp = gzopen(compress_name, "wb")) == NULL) {
-			error_exit("Error opening compression stream.\n");
+		if((mk->compress_fp = zlibopen()) == NULL) {
+			error_exit("Error opening compression stream: %s.\n", strerror(errno));
 		}
 		break;
 	case COMPRESS_LZO:
-		if((compress_fp = lzoopen(compress_name)) == NULL) {
+		if((mk->compress_fp = lzoopen()) == NULL) {
 			error_exit("Error opening compression stream: %s.\n", strerror(errno));
 		}
 		break;
 	case COMPRESS_UCL:
-		if((compress_fp = uclopen(compress_name)) == NULL) {
+		if((mk->compress_fp = uclopen()) == NULL) {
 			error_exit("Error opening compression stream: %s.\n", strerror(errno));
 		}
 		break;
 	default:
-		error_exit("Unsupported compression type %d.\n", compressed);
+		error_exit("Unsupported compression type %d.\n", mk->compressed);
 		break;
 	}
 }
 
 static void
 compress_stop(void) {
-	switch(compressed) {
+	int		status = 0;
+
+	prof_start(PROF_COMPRESS);
+	switch(mk->compressed) {
 	case COMPRESS_ZLIB:
-		gzclose(compress_fp);
+		status = zlibclose(mk->compress_fp);
 		break;
 	case COMPRESS_LZO:
-		lzoclose(compress_fp);
+		status = lzoclose(mk->compress_fp);
 		break;
 	case COMPRESS_UCL:
-		uclclose(compress_fp);
+		status = uclclose(mk->compress_fp);
 		break;
 	default:
 		//Should never happen
-		error_exit("Unsupported compression type %d - 2.\n", compressed);
+		error_exit("Unsupported compression type %d - 2.\n", mk->compressed);
 		break;
 	}
-	compress_fp = NULL;
+	mk->compress_fp = NULL;
+	prof_stop(PROF_COMPRESS, 0, mk->compress_len);
+	if(status == 0) {
+		error_exit("Error writing compression file: %s.\n", strerror(errno));
+	}
 }
 
 void
 iwrite(void *buf, int nbytes, FILE *dst_fp, char *fname) {
-	char	*cp;
+	double	start = 0;
 
-	if(compress_fp != NULL) {
-		switch(compressed) {
+	if(prof_active) {
+		start = prof_now();
+	}
+	if(mk->compress_fp != NULL) {
+		prof_start(PROF_COMPRESS);
+		switch(mk->compressed) {
 		case COMPRESS_ZLIB:
-			if(gzwrite(compress_fp, buf, nbytes) == 0) {
+			if(zlibwrite(mk->compress_fp, buf, nbytes) == 0) {
 				error_exit("Error writing compression file: %s.\n", strerror(errno));
 			}
 			break;
 		case COMPRESS_LZO:
-			if(lzowrite(compress_fp, buf, nbytes) == 0) {
+			if(lzowrite(mk->compress_fp, buf, nbytes) == 0) {
 				error_exit("Error writing compression file: %s.\n", strerror(errno));
 			}
 			break;
 		case COMPRESS_UCL:
-			if(uclwrite(compress_fp, buf, nbytes) == 0) {
+			if(uclwrite(mk->compress_fp, buf, nbytes) == 0) {
 				error_exit("Error writing compression file: %s.\n", strerror(errno));
 			}
 			break;
 		default:
 			//Should never happen
-			error_exit("Unsupported compression type %d - 3.\n", compressed);
+			error_exit("Unsupported compression type %d - 3.\n", mk->compressed);
 			break;
 		}
+		prof_stop(PROF_COMPRESS, nbytes, 0);
 	} else {
 		if(fwrite(buf, 1, nbytes, dst_fp) != nbytes) {
 			error_exit("Error writing image: %s.\n", strerror(errno));
 		}
 	}
-
-	for(cp = buf ; nbytes ; --nbytes, ++cp, ++image_offset) {
-		static unsigned char	hold_cksum[4];
-		unsigned 				index = image_offset & 0x3;
-
-		hold_cksum[index] = *cp;
-		if(index == 0x3) {
-			if(target_endian) {
-				image_cksum +=
-					  ((uint32_t)hold_cksum[0] << 24)
-					+ ((uint32_t)hold_cksum[1] << 16)
-					+ ((uint32_t)hold_cksum[2] <<  8)
-					+ ((uint32_t)hold_cksum[3]);
-			} else {
-				image_cksum +=
-					  ((uint32_t)hold_cksum[3] << 24)
-					+ ((uint32_t)hold_cksum[2] << 16)
-					+ ((uint32_t)hold_cksum[1] <<  8)
-					+ ((uint32_t)hold_cksum[0]);
-			}
-		}
+	if(prof_active) {
+		prof_written(prof_now() - start, nbytes, mk->compress_fp == NULL);
 	}
 
-	check_over(fname, "image", &image, image_offset);
+	mk->image_cksum.big = mk->target_endian;
+	ifs_cksum_add(&mk->image_cksum, mk->image_offset, buf, nbytes);
+	mk->image_offset += nbytes;
+
+	check_over(fname, "image", &mk->image, mk->image_offset);
 }
 
 
@@ -541,11 +663,11 @@ padfile(FILE *dst_fp, unsigned off, char *fname) {
 	static char		zeros[1024];
 	int				nbytes, n;
 
-	if(image_offset > off) {
-		error_exit("%s: internal error in function padfile (%x>%x).\n", fname, image_offset, off);
+	if(mk->image_offset > off) {
+		error_exit("%s: internal error in function padfile (%x>%x).\n", fname, mk->image_offset, off);
 	}
 
-	for(nbytes = off - image_offset ; nbytes ; nbytes -= n) {
+	for(nbytes = off - mk->image_offset ; nbytes ; nbytes -= n) {
 		n = nbytes;
 		if(n > sizeof(zeros)) n = sizeof(zeros);
 		iwrite(zeros, n, dst_fp, fname);
@@ -589,8 +711,8 @@ copy_data(int fd, FILE *dst_fp, int nbytes, struct file_entry *fip) {
 		return;
 	}
 
-	while((n = read(fd, copybuf, MIN(nbytes, sizeof(copybuf)))) > 0) {
-		iwrite(copybuf, n, dst_fp, fip->hostpath);
+	while((n = read(fd, mk->copybuf, MIN(nbytes, sizeof(mk->copybuf)))) > 0) {
+		iwrite(mk->copybuf, n, dst_fp, fip->hostpath);
 		nbytes -= n;
 	}
 }
@@ -610,7 +732,7 @@ section_keep(struct file_entry *fip, int fd, Elf32_Ehdr *ehdr) {
 		if(fip->flags & FILE_FLAGS_BOOT) {
 			return 0;
 		}
-		list = section_list;
+		list = mk->section_list;
 	}
 
 	shstrndx = EHost16(fip, ehdr->e_shstrndx);
@@ -667,10 +789,7 @@ section_keep(struct file_entry *fip, int fd, Elf32_Ehdr *ehdr) {
 		name = &strtab[EHost32(fip, shdr.sh_name)];
 		for(chk = list; chk != NULL; chk = chk->next) {
 			if(strcmp(name, chk->name) == 0) {
-				ks = malloc(sizeof(*ks));
-				if(ks == NULL) {
-					error_exit("No memory for keep section information.\n");
-				}
+				ks = model_alloc(sizeof(*ks));
 				ks->next = fip->sect;
 				ks->name = chk->name;
 				ks->shdr = shdr;
@@ -916,11 +1035,11 @@ do_load:
 						ram_loc += segsize;
 					} else {
 						phdr->p_paddr = ETarget32(fip,
-							adjusted_off + fip->file_offset + image.addr + booter.paddr_bias);
+							adjusted_off + fip->file_offset + mk->image.addr + mk->booter.paddr_bias);
 					}
 #else
 					phdr->p_paddr = ETarget32(fip,
-						adjusted_off + fip->file_offset + image.addr + booter.paddr_bias);
+						adjusted_off + fip->file_offset + mk->image.addr + mk->booter.paddr_bias);
 #endif
 					off = adjusted_off + sinfo[i].hdr_adjust;
 				}
@@ -980,7 +1099,7 @@ static char *
 find_linker(unsigned machine, unsigned e_type, unsigned p_type) {
 	struct linker_entry	*lnk;
 
-	for(lnk = booter.linker; lnk != NULL; lnk = lnk->next) {
+	for(lnk = mk->booter.linker; lnk != NULL; lnk = lnk->next) {
 		if(match_class(&lnk->class[CLASS_MACHINE], machine)
 		 &&match_class(&lnk->class[CLASS_EHDR], e_type)
 		 &&match_class(&lnk->class[CLASS_PHDR], p_type)) return(lnk->spec);
@@ -990,8 +1109,8 @@ find_linker(unsigned machine, unsigned e_type, unsigned p_type) {
 
 static unsigned
 ram_start(struct file_entry *fip) {
-	if((fip->ram_offset == 0) && split_image) {
-		fip->ram_offset = ram.addr + ram_offset;
+	if((fip->ram_offset == 0) && mk->split_image) {
+		fip->ram_offset = mk->ram.addr + mk->ram_offset;
 	}
 	return(fip->ram_offset);
 }
@@ -999,8 +1118,8 @@ ram_start(struct file_entry *fip) {
 static void
 bump_ram(struct file_entry *fip, unsigned size) {
 	ram_start(fip);
-	ram_offset += RUP(size, ram.align);
-	check_over(fip->hostpath, "ram", &ram, ram_offset);
+	mk->ram_offset += RUP(size, mk->ram.align);
+	check_over(fip->hostpath, "ram", &mk->ram, mk->ram_offset);
 }
 
 static void
@@ -1028,15 +1147,12 @@ add_soname(struct file_entry *fip, char *soname) {
 	} else {
 		other_is_real = 1;
 	}
-	new = malloc(sizeof(struct soname_entry) + strlen(soname));
-	if(new == NULL) {
-		error_exit("No memory for SONAME structure.\n");
-	}
+	new = model_alloc(sizeof(struct soname_entry) + strlen(soname));
 	new->fip = fip;
 	new->make_other_the_targpath = other_is_real;
 	strcpy(new->other_name, soname);
-	new->next = soname_head;
-	soname_head = new;
+	new->next = mk->soname_head;
+	mk->soname_head = new;
 }
 //
 // Detect elf executables. If it is a relocatable elf module invoke ld.
@@ -1105,7 +1221,7 @@ classify_file(struct file_entry *fip) {
 #endif
 
 	fip->big_endian = (ehdr.e_ident[EI_DATA] != ELFDATA2LSB);
-	if(target_endian < 0) target_endian = fip->big_endian;
+	if(mk->target_endian < 0) mk->target_endian = fip->big_endian;
 	e_type = EHost16(fip, ehdr.e_type);
 	switch(e_type) {
 	case ET_DYN:
@@ -1220,7 +1336,7 @@ do_load:
 					fip->flags |= FILE_FLAGS_RUNONCE;
 				}
 			}
-			if(split_image) {
+			if(mk->split_image) {
 				unsigned	tst_flag;
 
 				if(EHost32(fip, phdr->p_flags) & PF_W) {
@@ -1299,15 +1415,15 @@ do_load:
 									p = fip->targpath - 1;
 								}
 								targ_dir_len = p - fip->targpath + 1;
-								memcpy(copybuf, fip->targpath, targ_dir_len);
+								memcpy(mk->copybuf, fip->targpath, targ_dir_len);
 
 								#define MAX_SONAME	256
-								if(read(fd, &copybuf[targ_dir_len], MAX_SONAME) == -1) {
+								if(read(fd, &mk->copybuf[targ_dir_len], MAX_SONAME) == -1) {
 									error_exit("Failed reading SONAME in %s.\n", fip->hostpath);
 								}
 								/* only add soname if we managed to read one */
-								if( copybuf[targ_dir_len] != '\0' )
-									add_soname(fip, copybuf);
+								if( mk->copybuf[targ_dir_len] != '\0' )
+									add_soname(fip, mk->copybuf);
 								break;
 							}
 						}
@@ -1337,8 +1453,8 @@ do_load:
 	fip->size = off;
 	if(pad_phdr != NULL) {
 
-		off = RUP(off, booter.pagesize);
-		if(split_image) {
+		off = RUP(off, mk->booter.pagesize);
+		if(mk->split_image) {
 			unsigned	tst_flag;
 
 			if(EHost32(fip, pad_phdr->p_flags) & PF_W) {
@@ -1354,7 +1470,7 @@ do_load:
 	}
 
 	close(fd);
-	return(RUP(vend, booter.pagesize) - (vstart & ~(booter.pagesize-1)));
+	return(RUP(vend, mk->booter.pagesize) - (vstart & ~(mk->booter.pagesize-1)));
 }
 
 //
@@ -1385,6 +1501,7 @@ relocate(struct file_entry *fip, int text_addr, int data_addr, int ehdr_size, ch
 	struct repeat_entry		*new;
 	struct name_list		*list;
 	int						want_dir;
+	char					dirbuf[PATH_MAX];
 
 	// HACK: don't relocate elf files
 	return 0;
@@ -1393,11 +1510,11 @@ relocate(struct file_entry *fip, int text_addr, int data_addr, int ehdr_size, ch
 
 	if(fip->attr->keep_linked) {
 		name = basename(fip->hostpath);
-		linked_name = malloc(strlen(name) + (symfile_suffix ? strlen(symfile_suffix)+1:0) + 5);
+		linked_name = malloc(strlen(name) + (mk->symfile_suffix ? strlen(mk->symfile_suffix)+1:0) + 5);
 		if(linked_name == NULL) {
 			error_exit("No memory for link name.\n");
 		}
-		sprintf(linked_name, "%s%s%s.sym", name, symfile_suffix ? ".":"", symfile_suffix ?: "");
+		sprintf(linked_name, "%s%s%s.sym", name, mk->symfile_suffix ? ".":"", mk->symfile_suffix ?: "");
 	} else {
 		linked_name = mk_tmpfile();
 	}
@@ -1406,7 +1523,7 @@ relocate(struct file_entry *fip, int text_addr, int data_addr, int ehdr_size, ch
 	 * Build the linker command line
 	 */
 	skip = 0;
-	p = copybuf;
+	p = mk->copybuf;
 	fmt = fip->linker;
 	while(*fmt != '\0') {
 		if(*fmt == '%') {
@@ -1445,7 +1562,8 @@ relocate(struct file_entry *fip, int text_addr, int data_addr, int ehdr_size, ch
 					break;
 				case 'i':
 					name = fip->hostpath;
-					if(want_dir) name = dirname(name);
+					// hostpath is interned and must not be modified
+					if(want_dir) name = dirname(strcpy(dirbuf, name));
 					p += sprintf(p, "\"%s\"", name);
 					break;
 				case '(':
@@ -1472,10 +1590,10 @@ relocate(struct file_entry *fip, int text_addr, int data_addr, int ehdr_size, ch
 						}
 						break;
 					case 'v':
-						var = (booter.virtual && !(fip->flags & FILE_FLAGS_STARTUP));
+						var = (mk->booter.virtual && !(fip->flags & FILE_FLAGS_STARTUP));
 						break;
 					case 'V':
-						var = booter.virtual;
+						var = mk->booter.virtual;
 						break;
 					default:
 						error_exit("Unknown conditional variable '%c'\n", *fmt);
@@ -1588,13 +1706,13 @@ relocate(struct file_entry *fip, int text_addr, int data_addr, int ehdr_size, ch
 	*p = '\0';
 
 #if defined (__WIN32__) || defined(__NT__)
-	fixenviron(copybuf, sizeof(copybuf));
+	fixenviron(mk->copybuf, sizeof(mk->copybuf));
 #endif
 
-	if(verbose >= 3) {
-		fprintf(debug_fp, "Execute: %s\n", copybuf);
+	if(mk->verbose >= 3) {
+		fprintf(mk->debug_fp, "Execute: %s\n", mk->copybuf);
 	}
-	if(system(copybuf) != 0) {
+	if(system(mk->copybuf) != 0) {
 		if(unlink(destname) != 0) {
 			fprintf(stderr, "unlink of %s failed : %d (%s)\n",destname, errno, strerror(errno));
 		}
@@ -1664,11 +1782,11 @@ locate_files(struct file_entry *list, int offset, char *destname) {
 		} else if(fip->linker != NULL || (fip->flags & (FILE_FLAGS_EXEC|FILE_FLAGS_SO))) {
 
 			/* alignment should be based on the image load address */
-			ioffset = offset + image.addr;
+			ioffset = offset + mk->image.addr;
 
 			if (fip->attr->uip_flags & PF_X) {
 				// If the code is executed in place it must be on a page boundry.
-				align = max(fip->attr->phys_align,booter.pagesize);
+				align = max(fip->attr->phys_align,mk->booter.pagesize);
 			} else {
 				align = fip->attr->phys_align;
 			}
@@ -1691,32 +1809,32 @@ locate_files(struct file_entry *list, int offset, char *destname) {
 					group_id = fip->attr->phys_align_group;
 					group_address = ioffset;
 
-					fip->file_offset = ioffset - image.addr;
+					fip->file_offset = ioffset - mk->image.addr;
 				} else {
 					if (ioffset + fip->size > (group_address + fip->attr->phys_align)) {
 						// if we would straddle the alignment group, start a new group
 						ioffset = RUP(ioffset, align);
-						offset = fip->file_offset = ioffset - image.addr;
+						offset = fip->file_offset = ioffset - mk->image.addr;
 						group_id = 0;
 					} else {
 						// Otherwise continue the group
 						if (fip->attr->uip_flags & PF_X) {
 							// If the code is executed in place it must be on a page boundry.
-							ioffset = RUP(ioffset, booter.pagesize);
+							ioffset = RUP(ioffset, mk->booter.pagesize);
 						}
-						offset = fip->file_offset = ioffset - image.addr;
+						offset = fip->file_offset = ioffset - mk->image.addr;
 					}
 				}
 			} else {
 				fip->file_offset = offset;
 			}
 
-			if((fip->flags & FILE_FLAGS_BOOT) && (booter.vboot_addr != 0) ) {
-				fip->run_offset = RUP(booter.vboot_addr, booter.pagesize);
+			if((fip->flags & FILE_FLAGS_BOOT) && (mk->booter.vboot_addr != 0) ) {
+				fip->run_offset = RUP(mk->booter.vboot_addr, mk->booter.pagesize);
 			} else if(fip->flags & FILE_FLAGS_CODE_IN_RAM) {
 				fip->run_offset = ram_start(fip);
 			} else {
-				fip->run_offset = fip->file_offset + image.addr;
+				fip->run_offset = fip->file_offset + mk->image.addr;
 			}
 	
 			// For relocatable elf files, invoke the linker to lock it down.
@@ -1726,34 +1844,34 @@ locate_files(struct file_entry *list, int offset, char *destname) {
 				unsigned	data_start;
 				
 				data_start = 0;
-				if(!split_image) {
+				if(!mk->split_image) {
 					//Not a split image
 				} else if(fip->flags & FILE_FLAGS_CODE_IN_RAM) {
 					//Data still follows code
 					fip->flags |= FILE_FLAGS_DATA_IN_RAM;
 				} else if(fip->flags & FILE_FLAGS_BOOT) {
 					// Bootstrap file
-					if((booter.vboot_addr == 0) || !booter.virtual) {
+					if((mk->booter.vboot_addr == 0) || !mk->booter.virtual) {
 						data_start = ram_start(fip);
 						fip->flags |= FILE_FLAGS_DATA_IN_RAM;
 					}
 				} else {
 					// Normal file
-					if(!booter.virtual) {
+					if(!mk->booter.virtual) {
 						data_start = ram_start(fip);
 						fip->flags |= FILE_FLAGS_DATA_IN_RAM;
 					}
 				}
-				vsize = relocate(fip, fip->run_offset, data_start, booter.pagesize, destname);
-				if((fip->flags & FILE_FLAGS_BOOT) && (booter.vboot_addr != 0) ) {
-					booter.vboot_addr += vsize;
+				vsize = relocate(fip, fip->run_offset, data_start, mk->booter.pagesize, destname);
+				if((fip->flags & FILE_FLAGS_BOOT) && (mk->booter.vboot_addr != 0) ) {
+					mk->booter.vboot_addr += vsize;
 				}
 			}
 			offset = fip->file_offset + fip->size;
 			owner = &fip->next;
 		} else if(fip->attr->page_align) {
 			// HACK: "abuse" phys_align attribute to specify a file alignment
-			align = max(fip->attr->phys_align, booter.pagesize);
+			align = max(fip->attr->phys_align, mk->booter.pagesize);
 			fip->file_offset = RUP(offset, align);
 			offset = fip->file_offset + fip->size;
 			owner = &fip->next;
@@ -1812,11 +1930,8 @@ add_solink(struct file_entry *list, struct soname_entry *so) {
 		fip = fip->next;
 	}
 	//no one using the name, add the link
-	new = malloc(sizeof(*new));
-	attr = malloc(sizeof(*attr));
-	if(new == NULL || attr == NULL) {
-		error_exit("No memory for SONAME link entry.\n");
-	}
+	new = model_alloc(sizeof(*new));
+	attr = model_alloc(sizeof(*attr));
 	fip = so->fip;
 	*new = *fip;
 	*attr = *fip->attr;
@@ -1824,9 +1939,9 @@ add_solink(struct file_entry *list, struct soname_entry *so) {
 	attr->mode &= ~S_IFMT;
 	attr->mode |= S_IFLNK;
 	if(so->make_other_the_targpath) {
-		fip->targpath = strdup(so->other_name);
+		fip->targpath = model_intern(so->other_name);
 	} else {
-		new->targpath = strdup(so->other_name);
+		new->targpath = model_intern(so->other_name);
 	}
 	p = strrchr(fip->targpath, '/');
 	if(p == NULL) p = fip->targpath - 1;
@@ -1837,7 +1952,9 @@ add_solink(struct file_entry *list, struct soname_entry *so) {
 int
 ifs_need_seekable(struct file_entry *list) {
 
-	return compressed ? 1 : 0;
+	// Compressed images hold back everything in front of the compressed
+	// data until its size is known, so no seeking is needed.
+	return 0;
 }
 
 void
@@ -1846,7 +1963,7 @@ fixup_ram_offsets(struct file_entry *list)
 	for ( ; list != NULL; list = list->next ) {
 		if ( (list->flags &(FILE_FLAGS_SO|FILE_FLAGS_EXEC)) &&
 				!(list->flags & FILE_FLAGS_RELOCATED) ) {
-			list->ram_offset = list->ram_offset + ram_offset;
+			list->ram_offset = list->ram_offset + mk->ram_offset;
 		}
 	}
 }
@@ -1877,13 +1994,25 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 	int						shdr_file_offset = 0;
 	int						stlr_file_offset = 0;
 	int						stlr_cksum = 0;
+	FILE					*hdr_fp = dst_fp;
+	char					*hdr_buf = NULL;
+	size_t					hdr_len = 0;
 
-	if(compressed && split_image) {
+	if(mk->compressed && mk->split_image) {
 		error_exit( "You can't compress a split image (image=xxxx ram=xxx and +compress).\n");
 	}
 
+	// For a compressed image the startup header needs the compressed
+	// size, so everything in front of the compressed data is held in
+	// memory and written out once that is known.
+	if(mk->compressed) {
+		if((hdr_fp = open_memstream(&hdr_buf, &hdr_len)) == NULL) {
+			error_exit("No memory for startup header: %s.\n", strerror(errno));
+		}
+	}
+
 	// If no "-s" options were specified, use defaults.
-	if(section_list == NULL) {
+	if(mk->section_list == NULL) {
 		ifs_section(NULL, "QNX_Phab");
 		ifs_section(NULL, "QNX_info");
 		ifs_section(NULL, "QNX_usage");
@@ -1894,14 +2023,14 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 	// that secondary (non-bootable) image file systems will only be
 	// used on virtual systems (we have to turn on the virtual flag so
 	// that UIP stuff gets done properly).
-	if(booter.name == NULL) booter.virtual = 1;
+	if(mk->booter.name == NULL) mk->booter.virtual = 1;
 
-	if(booter.pagesize == 0) booter.pagesize = 4 K;
-	fill_addr_defaults(&ram, &default_ram);
-	fill_addr_defaults(&image, &default_image);
+	if(mk->booter.pagesize == 0) mk->booter.pagesize = 4 K;
+	fill_addr_defaults(&mk->ram, &mk->default_ram);
+	fill_addr_defaults(&mk->image, &mk->default_image);
 
-	if(verbose) {
-		fprintf(debug_fp, "  Offset   Size    Entry   Ramoff Target=Host\n");
+	if(mk->verbose) {
+		fprintf(mk->debug_fp, "  Offset   Size    Entry   Ramoff Target=Host\n");
 	}
 
 	tsize = sizeof(itlr);
@@ -1921,7 +2050,7 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 		//
 		if(fip->flags & FILE_FLAGS_BOOT) {
 			fip->flags |= FILE_FLAGS_STRIP_RELOCS;
-			if(split_image) {
+			if(mk->split_image) {
 				fip->flags |= FILE_FLAGS_DATA_IN_RAM;
 #ifdef COPY_BOOTFILES
 				if(!(fip->attr->uip_flags & PF_X) || (fip->flags & FILE_FLAGS_STARTUP)) {
@@ -1932,7 +2061,7 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 				}
 			}
 #if 0	//Enable this later on
-		} else if(booter.virtual) {
+		} else if(mk->booter.virtual) {
 			if(!fip->attr->keep_relocs) {
 				fip->flags |= FILE_FLAGS_STRIP_RELOCS;
 			}
@@ -1940,7 +2069,9 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 		} else if(fip->attr->strip_relocs) {
 			fip->flags |= FILE_FLAGS_STRIP_RELOCS;
 		}
+		prof_start(PROF_CLASSIFY);
 		classify_file(fip);
+		prof_stop(PROF_CLASSIFY, 0, fip->size);
 		if(fip->flags & FILE_FLAGS_STARTUP) {
 			// Remove startup program from normal image fsys
 			startup = fip;
@@ -1948,17 +2079,17 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 		} else {
 			fip->inode = ++inode;
 			owner = &fip->next;
-			while(soname_head != NULL) {
+			while(mk->soname_head != NULL) {
 				struct soname_entry		*tmp;
 
-				add_solink(list, soname_head);
-				tmp = soname_head;
-				soname_head = tmp->next;
+				add_solink(list, mk->soname_head);
+				tmp = mk->soname_head;
+				mk->soname_head = tmp->next;
 				free(tmp);
 			}
 		}
 	}
-	if(!booter.virtual) booter.vboot_addr = 0;
+	if(!mk->booter.virtual) mk->booter.vboot_addr = 0;
 
 	if(mountpoint == NULL) {
 		mountpoint = (startup != NULL) ? "/" : "";
@@ -1970,42 +2101,42 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 	//
 	// If there is a boot header supplied we sneak it in right up front
 	//
-	if(booter.name != NULL) {
+	if(mk->booter.name != NULL) {
 		if(startup == NULL) {
 			error_exit( "No startup program found while creating bootable image\n");
 		}
 
-		iwrite(booter.data, booter.data_len, dst_fp, booter.name);
-		bsize = booter.data_len;
+		iwrite(mk->booter.data, mk->booter.data_len, hdr_fp, mk->booter.name);
+		bsize = mk->booter.data_len;
 
 		//
 		// Pad out the file to what was asked and make sure it is a multiple
 		// of 4 bytes so the startup header which follows is dword aligned.
 		//
-		while(bsize < booter.boot_len  ||  (bsize & 0x03)) {
-			if(putc(0, dst_fp) == -1)
+		while(bsize < mk->booter.boot_len  ||  (bsize & 0x03)) {
+			if(putc(0, hdr_fp) == -1)
 				error_exit("Error writing image file: %s .\n", strerror(errno));
 			++bsize;
 		}
 
-		if(booter.notloaded_len > bsize) booter.notloaded_len = bsize;
-		bsize -= booter.notloaded_len;
+		if(mk->booter.notloaded_len > bsize) mk->booter.notloaded_len = bsize;
+		bsize -= mk->booter.notloaded_len;
 
-		if((bsize > 0) && verbose) {
-			fprintf(debug_fp, "%8x %6x %8x      --- %s\n",
-						image.addr, bsize, 0, booter.name);
+		if((bsize > 0) && mk->verbose) {
+			fprintf(mk->debug_fp, "%8x %6x %8x      --- %s\n",
+						mk->image.addr, bsize, 0, mk->booter.name);
 		}
-		image_cksum = 0;
-		image_offset = bsize;
+		mk->image_cksum.sum = 0;
+		mk->image_offset = bsize;
 
 		//
 		// Figure out where the startup program is going for a bootable image.
 		//
-		ram_offset = startup->file_offset = bsize + sizeof(shdr);
-		if(split_image) {
-			startup->run_offset = ram.addr + startup->file_offset;
+		mk->ram_offset = startup->file_offset = bsize + sizeof(shdr);
+		if(mk->split_image) {
+			startup->run_offset = mk->ram.addr + startup->file_offset;
 		} else {
-			startup->run_offset = image.addr + startup->file_offset;
+			startup->run_offset = mk->image.addr + startup->file_offset;
 		}
 		relocate(startup, startup->run_offset, 0, 0, destname);
 		ihdr_offset = RUP(bsize + sizeof(shdr) + startup->size + sizeof(stlr), 8);
@@ -2014,10 +2145,10 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 		// For split images, we want the ram_offset to begin after the startup
 		// code + data
 		//
-		if(split_image) {
-			ram_offset = ssize;
+		if(mk->split_image) {
+			mk->ram_offset = ssize;
 		}
-	} else if(compressed != 0) {
+	} else if(mk->compressed != 0) {
 		// We're going to write out a dummy startup header so we
 		// can get the compression type recorded.
 		ihdr_offset = ssize = sizeof(shdr) + sizeof(stlr);
@@ -2027,7 +2158,7 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 	// If nobody's set or complained about the target endianness by this
 	// point, just write stuff out in host endian format.
 	//
-	if(target_endian < 0) target_endian = host_endian;
+	if(mk->target_endian < 0) mk->target_endian = host_endian;
 
 	//
 	// Calculate the size of the image header.
@@ -2075,20 +2206,22 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 	//
 	// If required, adjust the vaddr to take startup into account
 	//
-	if((booter.vboot_addr != 0) && booter.rsvd_vaddr) { 
-		booter.vboot_addr += bsize + ssize + hsize + dsize;
+	if((mk->booter.vboot_addr != 0) && mk->booter.rsvd_vaddr) { 
+		mk->booter.vboot_addr += bsize + ssize + hsize + dsize;
 	}
 	//
 	// Sort and locate files in the image.
 	//
+	prof_start(PROF_LOCATE);
 	list = locate_files(list, bsize + ssize + hsize + dsize, destname);
+	prof_stop(PROF_LOCATE, 0, 0);
 
 	//
 	// For split images - check if startup files and proc were relocated
 	// All other files will need their ram_offset nudged up if this is
 	// true
 	//
-	if(split_image) {
+	if(mk->split_image) {
 		fixup_ram_offsets(list);
 	}
 
@@ -2117,7 +2250,7 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 		if(fip->flags & FILE_FLAGS_BOOT) {
 			fip->inode |= IFS_INO_BOOTSTRAP_EXE;
 			if(fip->bootargs) {
-				fip->bootargs->shdr_addr = swap32(target_endian, image.addr + bsize);
+				fip->bootargs->shdr_addr = swap32(mk->target_endian, mk->image.addr + bsize);
 			}
 			//After a suitable period of time, we can remove the
 			//setting of the boot_ino array and just assume that all
@@ -2126,23 +2259,23 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 			n = 0;
 			for( ;; ) {
 				if(n >= sizeof(ihdr.boot_ino)/sizeof(ihdr.boot_ino[0])) {
-					if(new_style_bootstrap == 0) {
+					if(mk->new_style_bootstrap == 0) {
 						error_exit("%s: Maximum of %d bootstrap files.\n", fip->hostpath, n);
 					}
-					if(new_style_bootstrap == 1) {
+					if(mk->new_style_bootstrap == 1) {
 						fprintf(stderr, "%s: Old startups may not work with more than %d bootstrap files.\n", fip->hostpath, n);
 					}
 					break;
 				}
 				if(ihdr.boot_ino[n] == 0) {
-					ihdr.boot_ino[n] = swap32(target_endian, fip->inode);
+					ihdr.boot_ino[n] = swap32(mk->target_endian, fip->inode);
 					break;
 				}
 				++n;
 			}
 		} else if(fip->flags & FILE_FLAGS_SCRIPT) {
 			// Look for script file
-			ihdr.script_ino = swap32(target_endian, fip->inode);
+			ihdr.script_ino = swap32(mk->target_endian, fip->inode);
 		}
 		if(*owner == NULL) break;
 	}
@@ -2150,107 +2283,110 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 	fsize = RUP(fip->file_offset + fip->size, 0x10000) - (bsize + ssize + hsize + dsize);
 
 	totalsize = bsize+ssize+hsize+dsize+fsize+tsize;
-	if(image.totalsize != 0) {
-		if(totalsize > image.totalsize) {
-			error_exit("Image size of 0x%x bytes exceeds total size of 0x%x.\n", totalsize, image.totalsize);
+	if(mk->image.totalsize != 0) {
+		if(totalsize > mk->image.totalsize) {
+			error_exit("Image size of 0x%x bytes exceeds total size of 0x%x.\n", totalsize, mk->image.totalsize);
 		}
-		totalsize = image.totalsize;
+		totalsize = mk->image.totalsize;
 	}
-	totalsize = RUP(totalsize, image.align);
+	totalsize = RUP(totalsize, mk->image.align);
 	isize = totalsize - (bsize+ssize);
 	tsize = isize - (hsize+dsize+fsize);
 
-	if((startup != NULL) || (compressed != 0)) {
+	prof_start(PROF_WRITE);
+	if((startup != NULL) || (mk->compressed != 0)) {
 		//
 		// Put out the startup header
 		//
 		memset(&shdr, 0, sizeof(shdr));
-		if(target_endian) shdr.flags1 |= STARTUP_HDR_FLAGS1_BIGENDIAN;
-		shdr.signature = swap32(target_endian, STARTUP_HDR_SIGNATURE);
-		shdr.version = swap16(target_endian, STARTUP_HDR_VERSION);
-		shdr.header_size = swap16(target_endian, sizeof(shdr));
+		if(mk->target_endian) shdr.flags1 |= STARTUP_HDR_FLAGS1_BIGENDIAN;
+		shdr.signature = swap32(mk->target_endian, STARTUP_HDR_SIGNATURE);
+		shdr.version = swap16(mk->target_endian, STARTUP_HDR_VERSION);
+		shdr.header_size = swap16(mk->target_endian, sizeof(shdr));
 		if(startup != NULL) {
-			if(booter.virtual) shdr.flags1 |= STARTUP_HDR_FLAGS1_VIRTUAL;
-			shdr.machine = swap16(target_endian, startup->machine);
-			shdr.startup_vaddr = swap32(target_endian, startup->entry);
-			shdr.image_paddr = swap32(target_endian, image.addr + bsize + booter.paddr_bias);
-			shdr.paddr_bias = swap32(target_endian, -booter.paddr_bias);
-			if(split_image) {
-				shdr.ram_paddr = swap32(target_endian, ram.addr + bsize + booter.paddr_bias);
-				if(ram.totalsize != 0) {
-					if(ram_offset > ram.totalsize) {
-						error_exit("Ram size of 0x%x bytes exceeds total size of 0x%x.\n", ram_offset, ram.totalsize);
+			if(mk->booter.virtual) shdr.flags1 |= STARTUP_HDR_FLAGS1_VIRTUAL;
+			shdr.machine = swap16(mk->target_endian, startup->machine);
+			shdr.startup_vaddr = swap32(mk->target_endian, startup->entry);
+			shdr.image_paddr = swap32(mk->target_endian, mk->image.addr + bsize + mk->booter.paddr_bias);
+			shdr.paddr_bias = swap32(mk->target_endian, -mk->booter.paddr_bias);
+			if(mk->split_image) {
+				shdr.ram_paddr = swap32(mk->target_endian, mk->ram.addr + bsize + mk->booter.paddr_bias);
+				if(mk->ram.totalsize != 0) {
+					if(mk->ram_offset > mk->ram.totalsize) {
+						error_exit("Ram size of 0x%x bytes exceeds total size of 0x%x.\n", mk->ram_offset, mk->ram.totalsize);
 					}
-					ram_offset = ram.totalsize;
+					mk->ram_offset = mk->ram.totalsize;
 				}
-				shdr.ram_size = swap32(target_endian, RUP(ram_offset, ram.align));
+				shdr.ram_size = swap32(mk->target_endian, RUP(mk->ram_offset, mk->ram.align));
 			} else {
 				shdr.ram_paddr = shdr.image_paddr;
-				shdr.ram_size = swap32(target_endian, ssize+isize);
+				shdr.ram_size = swap32(mk->target_endian, ssize+isize);
 			}
 		}
-		shdr.startup_size = swap32(target_endian, ssize);
-		shdr.stored_size = swap32(target_endian, ssize+isize);
-		shdr.imagefs_size = swap32(target_endian, isize);
-		shdr.preboot_size = swap16(target_endian, bsize);
+		shdr.startup_size = swap32(mk->target_endian, ssize);
+		shdr.stored_size = swap32(mk->target_endian, ssize+isize);
+		shdr.imagefs_size = swap32(mk->target_endian, isize);
+		shdr.preboot_size = swap16(mk->target_endian, bsize);
 
 		// For a compressed file we need to patch stored_size
 		// after we figure out how much the image was compressed.
-		if(compressed != 0) {
+		if(mk->compressed != 0) {
 			shdr.stored_size = 0;
-			shdr_file_offset = ftell(dst_fp);
-			shdr.flags1 |= compressed << STARTUP_HDR_FLAGS1_COMPRESS_SHIFT;
+			shdr_file_offset = ftell(hdr_fp);
+			shdr.flags1 |= mk->compressed << STARTUP_HDR_FLAGS1_COMPRESS_SHIFT;
 		}
-		iwrite(&shdr, sizeof(shdr), dst_fp, "Startup-header");
+		iwrite(&shdr, sizeof(shdr), hdr_fp, "Startup-header");
 
 		if(startup != NULL) {
-			if(verbose)
-				fprintf(debug_fp, "%8x %6x     ----      --- Startup-header\n",
-							image.addr + bsize, sizeof(shdr));
+			if(mk->verbose)
+				fprintf(mk->debug_fp, "%8x %6x     ----      --- Startup-header\n",
+							mk->image.addr + bsize, sizeof(shdr));
 				
 			if(startup->bootargs) {
-				startup->bootargs->shdr_addr = swap32(target_endian, (split_image ? ram.addr : image.addr) + bsize);
+				startup->bootargs->shdr_addr = swap32(mk->target_endian, (mk->split_image ? mk->ram.addr : mk->image.addr) + bsize);
 			}
+			prof_file_start(startup);
 			fd = ropen(startup);
-			copy_elf(fd, dst_fp, startup);
-			padfile(dst_fp, ihdr_offset-sizeof(stlr), "Startup-trailer");
+			copy_elf(fd, hdr_fp, startup);
+			padfile(hdr_fp, ihdr_offset-sizeof(stlr), "Startup-trailer");
 			close(fd);
+			prof_file_stop(startup);
 		}
 
-		if(compressed) {
-			stlr_file_offset = ftell(dst_fp);
-			stlr_cksum = image_cksum;
+		if(mk->compressed) {
+			stlr_file_offset = ftell(hdr_fp);
+			stlr_cksum = mk->image_cksum.sum;
 		}
-		stlr.cksum = swap32(target_endian, -image_cksum);
-		iwrite(&stlr, sizeof(stlr), dst_fp, "Startup-trailer");
+		stlr.cksum = swap32(mk->target_endian, -mk->image_cksum.sum);
+		iwrite(&stlr, sizeof(stlr), hdr_fp, "Startup-trailer");
 
-		if((startup != NULL) && verbose) {
-			fprintf(debug_fp, "%8x %6x %8x      --- %s",
-						image.addr + bsize + sizeof(shdr), image_offset - sizeof(shdr), startup->entry,
+		if((startup != NULL) && mk->verbose) {
+			fprintf(mk->debug_fp, "%8x %6x %8x      --- %s",
+						mk->image.addr + bsize + sizeof(shdr), mk->image_offset - sizeof(shdr), startup->entry,
 						startup->hostpath);
-			if(verbose>=2 && (fip->flags & FILE_FLAGS_CRC_VALID)) {
-				fprintf(debug_fp, " (%u)", startup->host_file_crc);
+			if(mk->verbose>=2 && (fip->flags & FILE_FLAGS_CRC_VALID)) {
+				fprintf(mk->debug_fp, " (%u)", startup->host_file_crc);
 			}
-			fprintf(debug_fp, "\n");
+			fprintf(mk->debug_fp, "\n");
 		}
-		image_cksum = 0;
+		mk->image_cksum.sum = 0;
 
 	}
 
 	//
 	// Put out the image header
 	//
-	ihdr.image_size = swap32(target_endian, isize);
-	ihdr.hdr_dir_size = swap32(target_endian, hsize + dsize);
-	ihdr.dir_offset = swap32(target_endian, hsize);
-	ihdr.chain_paddr = swap32(target_endian, chain_paddr);
+	ihdr.image_size = swap32(mk->target_endian, isize);
+	ihdr.hdr_dir_size = swap32(mk->target_endian, hsize + dsize);
+	ihdr.dir_offset = swap32(mk->target_endian, hsize);
+	ihdr.chain_paddr = swap32(mk->target_endian, mk->chain_paddr);
 
 	ihdr.flags |= IMAGE_FLAGS_INO_BITS;
-	if(target_endian != 0) ihdr.flags |= IMAGE_FLAGS_BIGENDIAN;
-	if(split_image) ihdr.flags |= IMAGE_FLAGS_READONLY;
+	if(mk->target_endian != 0) ihdr.flags |= IMAGE_FLAGS_BIGENDIAN;
+	if(mk->split_image) ihdr.flags |= IMAGE_FLAGS_READONLY;
 
-	if(compressed) {
-		cimage_offset = image_offset;	// Remember offset
+	if(mk->compressed) {
+		mk->cimage_offset = mk->image_offset;	// Remember offset
 		compress_start();
 	}
 	iwrite(&ihdr, n = offsetof(struct image_header, mountpoint), dst_fp, "Image-header");
@@ -2266,14 +2402,14 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 	//
 	// Put out the directory entries
 	//
-	dent = (void *)copybuf;
+	dent = (void *)mk->copybuf;
 	dent->dir.path[0] = '\0';
 	n = RUP(offsetof(struct image_dir, path) + 1, 4);
-	dent->attr.size = swap16(target_endian, n);
+	dent->attr.size = swap16(mk->target_endian, n);
 	dent->attr.extattr_offset = 0;
-	dent->attr.ino = swap32(target_endian, 1);
-	dent->attr.mode = swap32(target_endian, S_IFDIR | S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
-	dent->attr.mtime = no_time ? 0 : swap32(target_endian, time(NULL));
+	dent->attr.ino = swap32(mk->target_endian, 1);
+	dent->attr.mode = swap32(mk->target_endian, S_IFDIR | S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+	dent->attr.mtime = mk->no_time ? 0 : swap32(mk->target_endian, time(NULL));
 	dent->attr.gid = 0;
 	dent->attr.uid = 0;
 	iwrite(dent, n, dst_fp, "Image-directory");
@@ -2286,39 +2422,39 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 		switch(mode) {
 		case S_IFLNK:
 			n = offsetof(struct image_symlink, path);
-			val = sprintf(&copybuf[n], "%s", fip->targpath) + 1;
-			dent->symlink.sym_offset = swap16(target_endian, val);
+			val = sprintf(&mk->copybuf[n], "%s", fip->targpath) + 1;
+			dent->symlink.sym_offset = swap16(mk->target_endian, val);
 			n += val;
-			val = sprintf(&copybuf[n], "%s", fip->hostpath);
-			dent->symlink.sym_size = swap16(target_endian, val);
+			val = sprintf(&mk->copybuf[n], "%s", fip->hostpath);
+			dent->symlink.sym_size = swap16(mk->target_endian, val);
 			n += val + 1;
 			break;
 		case S_IFREG:
 			n = offsetof(struct image_file, path);
-			n += sprintf(&copybuf[n], "%s", fip->targpath) + 1;
-			dent->file.offset = swap32(target_endian, fip->file_offset - ihdr_offset);
-			dent->file.size = swap32(target_endian, fip->size);
+			n += sprintf(&mk->copybuf[n], "%s", fip->targpath) + 1;
+			dent->file.offset = swap32(mk->target_endian, fip->file_offset - ihdr_offset);
+			dent->file.size = swap32(mk->target_endian, fip->size);
 			break;
 		case S_IFDIR:
 			n = offsetof(struct image_dir, path);
-			n += sprintf(&copybuf[n], "%s", fip->targpath) + 1;
+			n += sprintf(&mk->copybuf[n], "%s", fip->targpath) + 1;
 			break;
 		default:
 			n = offsetof(struct image_device, path);
-			n += sprintf(&copybuf[n], "%s", fip->targpath) + 1;
+			n += sprintf(&mk->copybuf[n], "%s", fip->targpath) + 1;
 			dent->device.dev = 0;
 			dent->device.rdev = 0;
 			break;
 		}
 
-		memset(&copybuf[n], 0, 4);
+		memset(&mk->copybuf[n], 0, 4);
 		n = RUP(n, 4);
 
-		dent->attr.size = swap16(target_endian, n);
+		dent->attr.size = swap16(mk->target_endian, n);
 		dent->attr.extattr_offset = 0;
-		dent->attr.ino = swap32(target_endian, fip->inode);
+		dent->attr.ino = swap32(mk->target_endian, fip->inode);
 		val = (fip->attr->inherit_mtime) ? fip->host_mtime : fip->attr->mtime;
-		dent->attr.mtime = no_time > 1 ? 0 : swap32(target_endian, val);
+		dent->attr.mtime = mk->no_time > 1 ? 0 : swap32(mk->target_endian, val);
 		val = fip->host_perms;
 		if(fip->flags & FILE_FLAGS_RELOCATED) {
 			//If the file was relocatable, we've linked it, so make sure
@@ -2337,11 +2473,11 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 				if(!(fip->flags & FILE_FLAGS_RUNONCE)) val |= S_ISVTX;
 			}
 		}
-		dent->attr.mode = swap32(target_endian, mode | val);
+		dent->attr.mode = swap32(mk->target_endian, mode | val);
 		val = (fip->attr->inherit_gid) ? fip->host_gid : fip->attr->gid;
-		dent->attr.gid = swap32(target_endian, val);
+		dent->attr.gid = swap32(mk->target_endian, val);
 		val = (fip->attr->inherit_uid) ? fip->host_uid : fip->attr->uid;
-		dent->attr.uid = swap32(target_endian, val);
+		dent->attr.uid = swap32(mk->target_endian, val);
 		iwrite(dent, n, dst_fp, "Image-directory");
 	}
 	// Put out the 0 size entry
@@ -2351,15 +2487,16 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 	//
 	// Put out each file
 	//
-	if(verbose) {
-		fprintf(debug_fp, "%8x %6x     ----      --- Image-header\n", image.addr + bsize + ssize, hsize);
-		fprintf(debug_fp, "%8x %6x     ----      --- Image-directory\n", image.addr + bsize + ssize + hsize, dsize);
+	if(mk->verbose) {
+		fprintf(mk->debug_fp, "%8x %6x     ----      --- Image-header\n", mk->image.addr + bsize + ssize, hsize);
+		fprintf(mk->debug_fp, "%8x %6x     ----      --- Image-directory\n", mk->image.addr + bsize + ssize + hsize, dsize);
 	}
 
 	for(fip = list; fip ; fip = fip->next) {
 		switch(fip->attr->mode) {
 		case S_IFREG:
 			padfile(dst_fp, fip->file_offset, fip->hostpath);
+			prof_file_start(fip);
 			fd = ropen(fip);
 
 			if(fip->flags & (FILE_FLAGS_EXEC|FILE_FLAGS_SO)) {
@@ -2368,40 +2505,41 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 				copy_data(fd, dst_fp, fip->size, fip);
 			}
 			close(fd);
+			prof_file_stop(fip);
 			break;
 		}
 
-		if(verbose && fip->targpath[0] != '\0') {
+		if(mk->verbose && fip->targpath[0] != '\0') {
 			switch(fip->attr->mode) {
 			case S_IFREG:
-				fprintf(debug_fp, "%8x %6x ",
-						image.addr + fip->file_offset, fip->size);
+				fprintf(mk->debug_fp, "%8x %6x ",
+						mk->image.addr + fip->file_offset, fip->size);
 				if(fip->flags & (FILE_FLAGS_EXEC|FILE_FLAGS_SO)) {
-					fprintf(debug_fp, "%8x ", fip->entry);
+					fprintf(mk->debug_fp, "%8x ", fip->entry);
 					if(fip->ram_offset != 0) {
-						fprintf(debug_fp, "%8x", fip->ram_offset);
+						fprintf(mk->debug_fp, "%8x", fip->ram_offset);
 					} else {
-						fprintf(debug_fp, "     ---");
+						fprintf(mk->debug_fp, "     ---");
 					}
 				} else {
-					fprintf(debug_fp, "    ----      ---");
+					fprintf(mk->debug_fp, "    ----      ---");
 				}
 				break;
 			default:
-				fprintf(debug_fp, "    ----    ---     ----      ---" );
+				fprintf(mk->debug_fp, "    ----    ---     ----      ---" );
 				break;
 			}
-			fprintf(debug_fp, " %s", fip->targpath);
+			fprintf(mk->debug_fp, " %s", fip->targpath);
 			switch(fip->attr->mode) {
 			case S_IFREG:
 			case S_IFLNK:
-				fprintf(debug_fp, "=%s", fip->hostpath);
+				fprintf(mk->debug_fp, "=%s", fip->hostpath);
 				break;
 			}
-			if(verbose>=2 && (fip->flags & FILE_FLAGS_CRC_VALID)) {
-				fprintf(debug_fp," (%u)", fip->host_file_crc);
+			if(mk->verbose>=2 && (fip->flags & FILE_FLAGS_CRC_VALID)) {
+				fprintf(mk->debug_fp," (%u)", fip->host_file_crc);
 			}
-			fprintf(debug_fp, "\n");
+			fprintf(mk->debug_fp, "\n");
 		}
 	}
 
@@ -2411,55 +2549,77 @@ ifs_make_fsys(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *des
 	//
 	// Put out the image trailer
 	//
-	if(verbose) {
-		fprintf(debug_fp, "%8x %6x     ----      --- Image-trailer\n",
-			image.addr + bsize + ssize + hsize + dsize + fsize, tsize);
+	if(mk->verbose) {
+		fprintf(mk->debug_fp, "%8x %6x     ----      --- Image-trailer\n",
+			mk->image.addr + bsize + ssize + hsize + dsize + fsize, tsize);
 	}
-	itlr.cksum = swap32(target_endian, -image_cksum);
+	itlr.cksum = swap32(mk->target_endian, -mk->image_cksum.sum);
 	iwrite(&itlr, sizeof(itlr), dst_fp, "Image-trailer");
 
-	if(totalsize != image_offset) {
-		error_exit("Internal error in size calc (%x!=%x).\n", totalsize, image_offset);
+	if(totalsize != mk->image_offset) {
+		error_exit("Internal error in size calc (%x!=%x).\n", totalsize, mk->image_offset);
 	}
 
-	// Copy the compressed image to the image file and
-	// correct the stored size if compressed
-	if(compressed) {
-		FILE	*fp;
-		int		nbytes;
+	// Put out the held back headers with the stored size and checksum
+	// corrected, followed by the compressed image.
+	if(mk->compressed) {
+		FILE		*fp = NULL;
+		unsigned	end;
+		int			nbytes;
 
 		compress_stop();
-		// Open the file with the compressed data
-		if((fp = fopen(compress_name, "rb")) == NULL) {
-			error_exit("Unable to open compression file: %s\n", strerror(errno));
+		if(fclose(hdr_fp) != 0) {
+			error_exit("No memory for startup header: %s.\n", strerror(errno));
 		}
 
+		// The compressed image is padded to a multiple of the trailer
+		// checksum (4 bytes) and followed by the trailer.
+		end = RUP(mk->cimage_offset + mk->compress_len, sizeof(itlr)) + sizeof(itlr);
+		nbytes = hdr_len + (end - mk->cimage_offset) - bsize;
+
+		// Fix the stored_size, and the checksum by what that changes
+		shdr.stored_size = swap32(mk->target_endian, nbytes);
+		stlr_cksum += ifs_cksum_delta(hdr_buf + shdr_file_offset, 0, &shdr, sizeof(shdr), mk->target_endian);
+		memcpy(hdr_buf + shdr_file_offset, &shdr, sizeof(shdr));
+		stlr.cksum = swap32(mk->target_endian, -stlr_cksum);
+		memcpy(hdr_buf + stlr_file_offset, &stlr, sizeof(stlr));
+
+		if(fwrite(hdr_buf, 1, hdr_len, dst_fp) != hdr_len) {
+			error_exit("Error writing image: %s.\n", strerror(errno));
+		}
+		free(hdr_buf);
+
 		// Append the compressed data to the image file
-		image_cksum = 0;
-		image_offset = cimage_offset;	// For checksum calculation
-		while((nbytes = fread(copybuf, 1, sizeof(copybuf), fp)) > 0) {
-			iwrite(copybuf, nbytes, dst_fp, "compression-file");
+		mk->image_cksum.sum = 0;
+		mk->image_offset = mk->cimage_offset;	// For checksum calculation
+		if(mk->compress_name == NULL) {
+			iwrite(mk->compress_mem, mk->compress_len, dst_fp, "compression-file");
+			free(mk->compress_mem);
+			mk->compress_mem = NULL;
+		} else {
+			if((fp = fopen(mk->compress_name, "rb")) == NULL) {
+				error_exit("Unable to open compression file: %s\n", strerror(errno));
+			}
+			while((n = fread(mk->copybuf, 1, sizeof(mk->copybuf), fp)) > 0) {
+				iwrite(mk->copybuf, n, dst_fp, "compression-file");
+			}
+			fclose(fp);
 		}
 
 		// Pad file out to multiple of trailer checksum (4 bytes).
-		padfile(dst_fp, RUP(image_offset, sizeof(itlr)), "Image-trailer");
+		padfile(dst_fp, RUP(mk->image_offset, sizeof(itlr)), "Image-trailer");
 
-		itlr.cksum = swap32(target_endian, -image_cksum);
+		itlr.cksum = swap32(mk->target_endian, -mk->image_cksum.sum);
 		iwrite(&itlr, sizeof(itlr), dst_fp, "Image-trailer");
-		fclose(fp);
-
-		// Fix the stored_size
-		shdr.stored_size = swap32(target_endian, nbytes = ftell(dst_fp) - bsize);
-		fseek(dst_fp, shdr_file_offset, SEEK_SET);
-		fwrite(&shdr, sizeof(shdr), 1, dst_fp);
 
-		// Fix the checksum
-		fseek(dst_fp, stlr_file_offset, SEEK_SET);
-		stlr.cksum = swap32(target_endian, - (stlr_cksum + nbytes));
-		fwrite(&stlr, sizeof(stlr), 1, dst_fp);
+		if(mk->image_offset != end) {
+			error_exit("Internal error in compressed size calc (%x!=%x).\n", end, mk->image_offset);
+		}
 	}
 
-	return(bsize+booter.notloaded_len);
+	prof_stop(PROF_WRITE, 0, 0);
+
+	return(bsize+mk->booter.notloaded_len);
 }
 
 __SRCVERSION("mk_image_fsys.c $Rev: 203655 $");
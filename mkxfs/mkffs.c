@@ -62,14 +62,15 @@ uint8_t				*tmp_name;
 
 void mk_flash_exit(char *format, ...) {
 	va_list arglist;
+	char	msg[1024];
 
 	va_start(arglist, format);
-	vfprintf(stderr, format, arglist);
+	vsnprintf(msg, sizeof(msg), format, arglist);
 	va_end(arglist);
 
 	close(flashimage);
 
-	exit(1);
+	error_exit("%s", msg);
 }
 
 ffs_sort_t *ffs_entries(struct tree_entry *trp, uint8_t *mountpoint)
@@ -79,14 +80,8 @@ ffs_sort_t *ffs_entries(struct tree_entry *trp, uint8_t *mountpoint)
 					*sort_add;
 	uint16_t		level=1;
 
-	sort_add = (ffs_sort_t *)malloc(sizeof(ffs_sort_t));
-	if (sort_add == NULL) {
-		mk_flash_exit("%s\n",strerror(ENOMEM));
-	}
-	sort_hold = (ffs_sort_t *)malloc(sizeof(ffs_sort_t));
-	if (sort_hold == NULL) {
-		mk_flash_exit("%s\n",strerror(ENOMEM));
-	}
+	sort_add = model_alloc(sizeof(ffs_sort_t));
+	sort_hold = model_alloc(sizeof(ffs_sort_t));
 
 	//
 	//	special case root
@@ -108,8 +103,8 @@ ffs_sort_t *ffs_entries(struct tree_entry *trp, uint8_t *mountpoint)
 	sort_add->level = 0;
 	sort_add->sibling = NULL;
 	sort_add->parent = NULL;
-	sort_add->ffs_mtime = no_time ? 0 : time(NULL);
-	sort_add->ffs_ftime = no_time ? 0 : time(NULL);
+	sort_add->ffs_mtime = mk->no_time ? 0 : time(NULL);
+	sort_add->ffs_ftime = mk->no_time ? 0 : time(NULL);
 
 	// 
 	//	mode, uid and gid are hard coded for root entry
@@ -125,10 +120,7 @@ ffs_sort_t *ffs_entries(struct tree_entry *trp, uint8_t *mountpoint)
 	sort = sort_hold;
 
 	while(trp){
-		sort_add = (ffs_sort_t *)malloc(sizeof(ffs_sort_t));
-		if (sort_add == NULL) {
-			mk_flash_exit("%s\n",strerror(ENOMEM));
-		}
+		sort_add = model_alloc(sizeof(ffs_sort_t));
 		sort_hold->next = sort_add;
 		sort_add->name = trp->name;
 		sort_add->fip = trp->fip;
@@ -17,76 +17,6 @@
 
 
 
-// Hidden option 'N' to allow for more than 4 bootstrap executables.
-// Document later...
-#ifdef __USAGE
-%-mkxfs
-
-%C - make a image/flash file system
-
-%C	-t type [-r root] [-l input] [-s section] [-nv] [in-file [out-file]]
-
-Options:
- -t ffs2|ffs3|ifs|etfs Set the type of the output file system.
- -l input              Prefix a line to the input-file.
- -n                    No timestamps. Allows for binary identical images. One
-                       'n' will strip timestamps from files which vary from run
-                       to run. More than one will strip ALL time information
-                       which is necessary on Windows NTFS with daylight savings
-                       time.
- -r root               Search the default paths in this directory before the
-                       default.
- -s section            Do not strip the named section from ELF executable 
-                       when creating an IFS image.
- -v                    Operate verbosely.
- -a suffix             Append suffix to symbol files generated via [+keeplinked]
-%-mkefs
-
-%C - make an embedded (flash) file system
-
-%C	[-l inputline] [-nv] [input-file [output-file]]
-
-Options:
- -t ffs2|ffs3   Set the type of the output file system.
- -c cache_dir   Cache compressed files in cache_dir.
- -l inputline   Prefix a line to the input-file.
- -n             No timestamps. Allows for binary identical images.  One 'n'
-                will strip timestamps from files which vary from run to run.
-                More than one will strip ALL time information which is 
-                necessary on Windows NTFS with daylight savings time.
- -v             Operate verbosely.
-%-mketfs
-
-%C - make an embedded transaction file system
-
-%C	[-l inputline] [-nv] [input-file [output-file]]
-
-Options:
- -l inputline   Prefix a line to the input-file.
- -n             No timestamps. Allows for binary identical images.  One 'n'
-                will strip timestamps from files which vary from run to run.
-                More than one will strip ALL time information which is 
-                necessary on Windows NTFS with daylight savings time.
- -v             Operate verbosely.
-%-mkifs
-
-%C - make an image file system
-
-%C	[-r root] [-l input] [-s section] [-nv] [in-file [out-file]]
-
-Options:
- -l input       Prefix a line to the input-file.
- -n             No timestamps. Allows for binary identical images.  One 'n'
-                will strip timestamps from files which vary from run to run.
-                More than one will strip ALL time information which is 
-                necessary on Windows NTFS with daylight savings time.
- -p             Do not strip PhAB resource information. (experimental)
- -r root        Search the default paths in this directory before the default.
- -s section     Do not strip the named section from ELF executable 
-                when creating an IFS image.
- -v             Operate verbosely.
-#endif
-
 #include <fcntl.h>
 #include <lib/compat.h>
 #include <stdio.h>
@@ -101,96 +31,24 @@ Options:
 #include <string.h>
 #include <ctype.h>
 #include <dirent.h>
+#include <getopt.h>
 #include <sys/stat.h>
 #include "struct.h"
 #include <malloc.h>
 
 
-#if defined(VARIANT_le)
-	#define ENDIAN_STRING	"le"
-#elif defined(VARIANT_be)
-	#define ENDIAN_STRING	"be"
-#endif
-
-#if defined(DEFAULT_CPU)
-	//Nothing to do
-#elif defined(__386__) || defined(__X86__)
-	#define DEFAULT_CPU	"x86"
-#elif defined(__SH__)
-	#define DEFAULT_CPU	"sh" ENDIAN_STRING
-#elif defined(__ARM__)
-	#define DEFAULT_CPU	"arm" ENDIAN_STRING
-#elif defined(__MIPS__)
-	#define DEFAULT_CPU	"mips" ENDIAN_STRING
-#elif defined(__PPC__)
-	#define DEFAULT_CPU	"ppc" ENDIAN_STRING
-#elif defined(__SOLARIS__) || defined(linux)
-	#define DEFAULT_CPU	"mipsbe"
-#else
-	#error DEFAULT_CPU not defined
-#endif
-
-struct token_state	*token;
-
-#define GLOBENVC		100
-char				*globenvv[GLOBENVC];
-int					 globenvc;
-
-char				*boot_attr_buf;
-char				*option_lines;
-
-char				*symfile_suffix;
-
-struct input_buffer {
-	char			*data;
-	unsigned		len;
-};
-
-#define INPUT_FILE_LEN	4000
-struct input_buffer	input_file;
-
+#define INPUT_FILE_LEN		4000
 #define INPUT_SCRIPT_LEN	1000
-struct input_buffer	input_script;
-
 #define INPUT_BOOT_LEN		1000
-struct input_buffer	input_boot;
-
-struct tmpfile_entry		*tmpfile_list;
-
-struct attr_file_entry		 file_attr;
-struct attr_file_list		*attr_file_list;
 
-struct attr_script_entry	 script_attr;
-struct attr_script_list		*attr_script_list;
-
-struct file_entry	 *file_list;
-
-int					 verbose;
 int					 host_endian;	// 0 - little,  1 - big
-int					 target_endian = -1;// 0 - little,  1 - big,  -1 - unknown
-FILE				*debug_fp;
-FILE				*script_fp;
-unsigned			 line_num;
-char				*cache_dir;
-int					new_style_bootstrap;
-int					ext_sched = SCRIPT_SCHED_EXT_NONE;
-
-int no_time;
-
-struct {
-				char	name[SCRIPT_APS_PARTITION_NAME_LENGTH + 1];
-				int		budget;
-}		globapsv[SCRIPT_APS_MAX_PARTITIONS] = {
-			{ SCRIPT_APS_SYSTEM_PARTITION_NAME, 100 }
-		};
-int		globapsc = SCRIPT_APS_SYSTEM_PARTITION_ID;
 
 int aps_lookup(char *aps)
 {
 int		i;
 
-	for (i = 0; i <= globapsc; ++i)
-		if (!strcmp(globapsv[i].name, aps))
+	for (i = 0; i <= mk->globapsc; ++i)
+		if (!strcmp(mk->globapsv[i].name, aps))
 			return(i);
 	return(-1);
 }
@@ -204,32 +62,29 @@ char	*cp;
 		return("Invalid APS partition name.\n");
 	else if (aps_lookup(*pname) != -1)
 		return("Duplicate APS partition name.\n");
-	else if (globapsc >= SCRIPT_APS_MAX_PARTITIONS - 1)
+	else if (mk->globapsc >= SCRIPT_APS_MAX_PARTITIONS - 1)
 		return("Too many APS partitions defined.\n");
 	*budget = strtol(token2, &cp, 10);
 	if (cp[0] == '%')
 		cp += 1;
 	if (*cp != '\0' || *budget < 0 || *budget > 100)
 		return("Invalid APS partition budget.\n");
-	else if (*budget > globapsv[SCRIPT_APS_SYSTEM_PARTITION_ID].budget)
+	else if (*budget > mk->globapsv[SCRIPT_APS_SYSTEM_PARTITION_ID].budget)
 		return("Total APS budget exceeds 100%%.\n");
 	*critical = strtol(token3, &cp, 10);
 	if (cp[0] == 'm' && cp[1] == 's')
 		cp += 2;
 	if (*cp != '\0' || *critical < 0 || *critical > 1000)
 		return("Invalid APS partition critical time.\n");
-	++globapsc;
-	strncpy(globapsv[globapsc].name, *pname, SCRIPT_APS_PARTITION_NAME_LENGTH + 1);
-	globapsv[SCRIPT_APS_SYSTEM_PARTITION_ID].budget -= (globapsv[globapsc].budget = *budget);
+	++mk->globapsc;
+	strncpy(mk->globapsv[mk->globapsc].name, *pname, SCRIPT_APS_PARTITION_NAME_LENGTH + 1);
+	mk->globapsv[SCRIPT_APS_SYSTEM_PARTITION_ID].budget -= (mk->globapsv[mk->globapsc].budget = *budget);
 	return(NULL);
 }
 
-static void (*parse_file_init)(struct attr_file_entry *attrp);
-static void (*parse_file_attr)(int tokenc, char *tokenv[], struct attr_file_entry *attrp);
-static int (*need_seekable)(struct file_entry *list);
-static unsigned (*make_fsys)(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *destname);
-
 #include "xplatform.h"
+#include "libifs/ifs_trace.h"
+#include "libifs/ifs_copy.h"
 
 void
 set_cpu(const char *name, int overwrite) {
@@ -256,9 +111,23 @@ void error_exit(char *format, ...) __attribute__((noreturn, format(printf, 1, 2)
 void
 error_exit(char *format, ...) {
 	va_list arglist;
+	int		n = 0;
+
+	// Inside a library call the message is kept for mkxfs_error() and
+	// the call returns the failure.
+	if(mk != NULL && mk->error_catch) {
+		if(mk->line_num != 0) {
+			n = snprintf(mk->error, sizeof(mk->error), "Line %u: ", mk->line_num);
+		}
+		va_start(arglist, format);
+		vsnprintf(&mk->error[n], sizeof(mk->error) - n, format, arglist);
+		va_end(arglist);
+		mk->error_catch = 0;
+		longjmp(mk->error_jmp, 1);
+	}
 
-	if(line_num != 0) {
-		fprintf(stderr, "Line %u: ", line_num);
+	if(mk != NULL && mk->line_num != 0) {
+		fprintf(stderr, "Line %u: ", mk->line_num);
 	}
 	va_start(arglist, format);
 	vfprintf(stderr, format, arglist);
@@ -267,37 +136,7 @@ error_exit(char *format, ...) {
 	exit(1);
 }
 
-static void
-rm_tmpfiles() {
-	struct tmpfile_entry	*tmp;
-
-	for(tmp = tmpfile_list ; tmp ; tmp = tmp->next)
-		unlink(tmp->name);
-}
-
-static void
-die(int signum) {
-	rm_tmpfiles();
-	_exit(1);
-}
-	
-
-static void
-add_data(char *string) {
-	unsigned	size;
-	char		*new;
-
-	size = (option_lines == NULL) ? 0 : strlen(option_lines);
-	new = realloc(option_lines, size + strlen(string) + 1);
-	if(new == NULL) {
-		error_exit("No memory for -l option.\n");
-	}
-	option_lines = new;
-	strcpy(&new[size], string);
-}
-
-
-static void
+void
 set_target_name(struct file_entry *fip) {
 	char *	tbuf = NULL;
 	char	*s;
@@ -324,10 +163,9 @@ set_target_name(struct file_entry *fip) {
 		*d++ = *s++;
 	}
 	*d = '\0';
-	free(fip->targpath);
 	s = tbuf;
 	while(*s == '/') ++s;
-	fip->targpath = strdup(s);
+	fip->targpath = model_intern(s);
 	if (tbuf) free (tbuf);
 }
 
@@ -359,15 +197,15 @@ env_add(char *env) {
 	char	**sp;
 	int		i;
 
-	if( (sp = env_lookup(env, globenvc, globenvv)) ) {
+	if( (sp = env_lookup(env, mk->globenvc, mk->globenvv)) ) {
 		*sp = strdup(env);
 		return;
 	}
 
 	for(i = 0 ; i < GLOBENVC ; ++i)
-		if(globenvv[i] == NULL) {
-			globenvv[i] = strdup(env);
-			if(++i > globenvc) globenvc = i;
+		if(mk->globenvv[i] == NULL) {
+			mk->globenvv[i] = strdup(env);
+			if(++i > mk->globenvc) mk->globenvc = i;
 			break;
 		}
 }
@@ -377,7 +215,7 @@ char *
 checkenv(char *name) {
 	char	**sp;
 
-	if( (sp = env_lookup(name, globenvc, globenvv)) ) {
+	if( (sp = env_lookup(name, mk->globenvc, mk->globenvv)) ) {
 		return(strchr(*sp, '=') + 1);
 	}
 	return(getenv(name));
@@ -537,9 +375,9 @@ mk_tmpfile() {
 	if( !(tmpname = strdup(tmpname)) )
 		error_exit("Unable to get memory for a tmp file.\n");
 #endif
-	tmp->next = tmpfile_list;
+	tmp->next = mk->tmpfile_list;
 	tmp->name = tmpname;
-	tmpfile_list = tmp;
+	mk->tmpfile_list = tmp;
 
 	return(tmpname);
 }
@@ -603,17 +441,17 @@ push_token_state() {
 	if(new == NULL) {
 		error_exit("No memory for token state.\n");
 	}
-	new->prev = token;
-	token = new;
-	return(token->prev);
+	new->prev = mk->token;
+	mk->token = new;
+	return(mk->token->prev);
 }
 
 void
 pop_token_state() {
 	struct token_state	*old;
 
-	old = token;
-	token = old->prev;
+	old = mk->token;
+	mk->token = old->prev;
 	free(old);
 }
 
@@ -627,8 +465,8 @@ tokenize(char *input, char *space, char term) {
 	unsigned n, len;
 	char *s1, *s2, quoting;
 
-	for(s1 = input, s2 = token->buf, n = 0, len = 0; *s1 && *s1 != term; ++s1) {
-		if(line_num != 0 && *s1 == '\n') ++line_num;
+	for(s1 = input, s2 = mk->token->buf, n = 0, len = 0; *s1 && *s1 != term; ++s1) {
+		if(mk->line_num != 0 && *s1 == '\n') ++mk->line_num;
 		if(strchr(space, *s1)) {
 			// Skip leading white space
 			continue;
@@ -642,7 +480,7 @@ tokenize(char *input, char *space, char term) {
 		if(n >= TOKENC)
 			error_exit("Too many arguments.\n");
 
-		token->v[n] = s2;		// Save pointer to start of token
+		mk->token->v[n] = s2;		// Save pointer to start of token
 		quoting = 0;
 		while(*s1  &&  (quoting  ||  !strchr(space, *s1))) {
             
@@ -711,7 +549,7 @@ tokenize(char *input, char *space, char term) {
 		++n;
 	}
 
-	token->c = n;
+	mk->token->c = n;
 
 	return(s1);
 }
@@ -722,7 +560,7 @@ attr_in_attr_file_list(struct attr_file_entry *attrp) {
 	struct attr_file_list *list;
 
 	// Try and match an existing attribute.
-	for(list = attr_file_list; list; list = list->next)
+	for(list = mk->attr_file_list; list; list = list->next)
 		if(memcmp(attrp, &list->attr, sizeof(*attrp)) == 0)
 			return(list);
 	return(NULL);
@@ -733,13 +571,10 @@ struct attr_file_list *
 copy_attr_to_attr_file_list(struct attr_file_entry *attrp) {
 	struct attr_file_list *list;
 
-	list = calloc(1, sizeof(*list));
-	if(list == NULL) {
-		error_exit("No memory for attribute list.\n");
-	}
+	list = model_alloc(sizeof(*list));
 	memcpy(&list->attr, attrp, sizeof(*attrp));
-	list->next = attr_file_list;
-	attr_file_list = list;
+	list->next = mk->attr_file_list;
+	mk->attr_file_list = list;
 	return(list);
 }
 
@@ -757,10 +592,12 @@ struct file_entry *
 dir_in_file_list(char *hostpath, char *targpath) {
 	struct file_entry *tmp_entry;
 
-	tmp_entry = file_list;
+	/* paths in the file list are interned, so pointers can be compared */
+	hostpath = model_intern(hostpath);
+	targpath = model_intern(targpath);
+	tmp_entry = mk->file_list;
 	while (tmp_entry) {
-		if ((strcmp(tmp_entry->hostpath, hostpath) == 0) &&
-		    (strcmp(tmp_entry->targpath, targpath) == 0)) {
+		if (tmp_entry->hostpath == hostpath && tmp_entry->targpath == targpath) {
 			return(tmp_entry);
 		}
 		tmp_entry = tmp_entry->next;
@@ -824,7 +661,7 @@ find_file(char *search, char *hbuf, struct stat *sbuf, char *host, int optional)
 	 * working directory ('./') is searched first.
 	 */
 	if(!IS_ABSPATH(host)) {
-		if(search == NULL) search = file_attr.search_path;
+		if(search == NULL) search = mk->file_attr.search_path;
 		ifsp = start = rgetenv(search);
 		if(HAS_PATH(host)) {
 			tempsearch = (char*)malloc(strlen(ifsp) + strlen(PATHSEP_STR) + 1);
@@ -835,8 +672,8 @@ find_file(char *search, char *hbuf, struct stat *sbuf, char *host, int optional)
 			strcat(tempsearch, ifsp);
 			ifsp = start = tempsearch;
 		}
-		if (verbose > 5) {
-    		fprintf(debug_fp,"search path %s\n", ifsp);
+		if (mk->verbose > 5) {
+    		fprintf(mk->debug_fp,"search path %s\n", ifsp);
 		}
 		for( ;; ) {
 			unsigned	len;
@@ -851,6 +688,7 @@ find_file(char *search, char *hbuf, struct stat *sbuf, char *host, int optional)
 			memcpy(hbuf, ifsp, len);
 			if(len > 0 && !IS_DIRSEP(hbuf[len-1])) hbuf[len++] = '/';
 			strcpy(&hbuf[len], host);
+			model_cache_dep(hbuf);
 			if(stat(hbuf, sbuf) != -1) break;
 			if(end == NULL) {
 				if(optional) {
@@ -862,7 +700,7 @@ find_file(char *search, char *hbuf, struct stat *sbuf, char *host, int optional)
 		}
 		free(start);
 		host = hbuf;
-	} else if(stat(host, sbuf) == -1) {
+	} else if(model_cache_dep(host), stat(host, sbuf) == -1) {
 		if(optional)
 			return(NULL);
 		error_exit("Host file '%s' not available.\n", host);
@@ -907,64 +745,14 @@ collect_file(struct input_buffer *buf, unsigned grow, char *type, FILE *fp) {
 	new[buf->len+1] = '\0';
 }
 
-char *
-cache_file(char *host, char *target, struct attr_file_entry *attrp)
-{
-	static char cfile[1024];
-	char cmd[1024], *p;
-	int i=0;
-	struct stat hbuf, cbuf;
-
-	sprintf(cfile, "%s/%s", cache_dir, target ? target : host);
-
-	/* First we check that the path is there, creating intermediate
-	   directories if need be. */
-	strcpy(cmd, cfile);
-	strcpy(cmd, dirname(cmd));
-	if(cmd[1] == ':')
-		p = &cmd[3];
-	else{
-		while(cmd[i] && (cmd[i] == '/' || cmd[i] == '\\'))
-			i++;
-		p = &cmd[i];
-	}
-
-	while(1){
-		if(*p == '/' || *p == '\\' || *p == '\0'){
-			char c = *p;
-			struct stat buf;
-			*p = '\0';
-			if(stat(cmd, &buf) == -1 && errno == ENOENT){
-				if(gen_mkdir(cmd, S_IRWXU | S_IRWXG | S_IRWXO) == -1)
-					error_exit("Unable to make directory %s in cache directory %s.\n", cmd, cache_dir);
-			}
-			*p = c;
-		}
-		if(*p == '\0')
-			break;
-		p++;
-	}
-
-	if(stat(cfile, &cbuf) == 0 && stat(host, &hbuf) == 0 && hbuf.st_mtime <= cbuf.st_mtime)
-		return cfile;
-
-	sprintf(cmd, "%s <%s >%s", attrp->filter, host, cfile);
-#if defined (__WIN32__) || defined(__NT__)
-	fixenviron(cmd, sizeof(cmd));
-#endif
-	if(system(cmd) != 0)
-		error_exit("Filter %s failed.\n", cmd);
-	return cfile;
-}
-
 struct file_entry *
 add_file(struct file_entry **list, char *host, char *target,
 			struct attr_file_entry *attrp, struct stat *sbuf) {
-	static struct file_entry	*end = NULL;
 	struct file_entry			*fip;
 	char						*orig_host;
 
 	orig_host = host;
+	model_cache_dep(host);
 	//
 	// Look for a filter to run on the file.
 	// TF Ammended: Don't filter links and directories, 
@@ -972,40 +760,49 @@ add_file(struct file_entry **list, char *host, char *target,
 	//
 	if(!S_ISDIR(attrp->mode) && attrp->mode != S_IFLNK && attrp->filter) {
 		char *tfile, cmd[1024];
+		char prog[PATH_MAX];
+		double start = ifs_trace_now();
 
-		if(cache_dir && strstr(attrp->filter, "flashcmp") != NULL){
-			tfile = cache_file(host, target, attrp);
+		// The output changes with the program as well as its input.
+		if(filter_program(attrp->filter, prog, sizeof(prog)) == 0) {
+			model_cache_dep(prog);
+		}
+		prof_start(PROF_FILTER);
+		if(cache_dir != NULL) {
+			tfile = filter_cache_file(host, attrp->filter);
 		}
 		else {
 			tfile = mk_tmpfile();
-			sprintf(cmd, "%s <%s >%s", attrp->filter, host, tfile);
+			if(snprintf(cmd, sizeof(cmd), "%s <%s >%s", attrp->filter, host, tfile) >= (int)sizeof(cmd)) {
+				error_exit("Filter command for %s is too long.\n", host);
+			}
 #if defined (__WIN32__) || defined(__NT__)
 			fixenviron(cmd, sizeof(cmd));
 #endif
 			if(system(cmd) != 0)
 				error_exit("Filter %s failed.\n", cmd);
 		}
+		prof_stop(PROF_FILTER, prof_size(host), prof_size(tfile));
+		ifs_trace_span("filter", attrp->filter, start, host, -1, -1);
 		host = tfile;
 	}
 
-	fip = calloc(1, sizeof(*fip));
-	if(fip == NULL) {
-		error_exit("No memory for file list.\n");
-	}
+	fip = model_alloc(sizeof(*fip));
 	if(target == NULL) {
 		target = orig_host;
 		if(!S_ISFIFO(attrp->mode)) target = basename(target);
 	}
 	/* Populate with mode, permissions etc.  Make these
 	   user overridable by the attribute structure */
-	fip->targpath = strdup(target);
-	fip->hostpath = strdup(host);
+	fip->targpath = model_intern(target);
+	fip->hostpath = model_intern(host);
+	if(host != orig_host) fip->filter_input = model_intern(orig_host);
 
 	fip->attr = attrp;
 	fip->host_perms = sbuf->st_mode & ~S_IFMT;
 	fip->host_uid = sbuf->st_uid;
 	fip->host_gid = sbuf->st_gid;
-	fip->host_mtime = no_time > 1 ? 0 : sbuf->st_mtime;
+	fip->host_mtime = mk->no_time > 1 ? 0 : sbuf->st_mtime;
 
 	if(S_ISREG(attrp->mode) && !(attrp->scriptfile)) {
 		if (crc32_fn(fip->hostpath, &fip->host_file_crc) != -1) {
@@ -1013,8 +810,13 @@ add_file(struct file_entry **list, char *host, char *target,
 		}
 	}
 
-	if(no_time){ /* strip timestamps from tmpfiles */
-		struct tmpfile_entry *t = tmpfile_list;
+	if(mk->no_time && host != orig_host && cache_dir != NULL) {
+		/* cached filter output varies from run to run like a tmpfile */
+		fip->host_mtime = 0;
+	}
+
+	if(mk->no_time){ /* strip timestamps from tmpfiles */
+		struct tmpfile_entry *t = mk->tmpfile_list;
 		while(t){
 			if(strcmp(t->name, host) == 0){
 				fip->host_mtime = 0;
@@ -1024,12 +826,12 @@ add_file(struct file_entry **list, char *host, char *target,
 		}
 	}
 
-	if(end)
-		end->next = fip;
+	if(mk->file_list_end)
+		mk->file_list_end->next = fip;
 	else
 		*list = fip;
 
-	end = fip;
+	mk->file_list_end = fip;
 
 	return(fip);
 }
@@ -1041,13 +843,12 @@ parse_boot_cmd(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 	struct file_entry		*fip;
 	struct bootargs_entry	*bap;
 	char					buf[PATH_MAX+1], hbuf[PATH_MAX+1], *host;
-	static int				have_startup;
 	struct stat				sbuf;
 
 
 	// If no file is specified we set the global attributes.
 	if(tokenc == 0) {
-		file_attr = *attrp;
+		mk->file_attr = *attrp;
 		return;
 	}
 	// Look for leading env variables and calculate argc and envc
@@ -1065,9 +866,9 @@ parse_boot_cmd(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 	}
 
 	// Append global env vars to end of tokenv (do not duplicate any on cmd)
-	for(i = 0 ; i < globenvc ; ++i)
-		if(env_lookup(globenvv[i], envc, tokenv) == NULL)
-			tokenv[tokenc++] = globenvv[i];
+	for(i = 0 ; i < mk->globenvc ; ++i)
+		if(env_lookup(mk->globenvv[i], envc, tokenv) == NULL)
+			tokenv[tokenc++] = mk->globenvv[i];
 
 	// Guard against buffer overrun
 	if (strlen(tokenv[envc]) > PATH_MAX) {
@@ -1079,7 +880,7 @@ parse_boot_cmd(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 
 	// Add a file entry.
 	tokenv[envc] = basename(tokenv[envc]);
-	fip = add_file(&file_list, host, NULL, attrp, &sbuf);
+	fip = add_file(&mk->file_list, host, NULL, attrp, &sbuf);
 
 	n = 0;
 	for(i = envc ; i < tokenc ; ++i) {
@@ -1095,14 +896,11 @@ parse_boot_cmd(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 	}
 
 	fip->flags |= FILE_FLAGS_BOOT;
-	if(!have_startup) {
+	if(!mk->have_startup) {
 		fip->flags |= FILE_FLAGS_STARTUP;
-		have_startup = 1;
-	}
-	fip->bootargs = bap = calloc(1, sizeof(struct bootargs_entry) + n);
-	if (bap == NULL) {
-		error_exit("No memory for boot arguments.\n");
+		mk->have_startup = 1;
 	}
+	fip->bootargs = bap = model_alloc(sizeof(struct bootargs_entry) + n);
 	memcpy(bap->args, buf, n);
 	n += offsetof(struct bootargs_entry, args) + 1;
 	bap->size_lo = n;
@@ -1118,18 +916,18 @@ parse_boot(FILE *src_fp) {
 	struct attr_file_entry	attr;
 	struct attr_file_list	*list;
 
-	collect_file(&input_boot, INPUT_BOOT_LEN, "boot", src_fp);
+	collect_file(&mk->input_boot, INPUT_BOOT_LEN, "boot", src_fp);
 
 	//
 	// Parse the file.
 	//
-	for(s = input_boot.data; *s ; ++s) {
+	for(s = mk->input_boot.data; *s ; ++s) {
 		// Skip white space
 		if(isspace(*s))
 			continue;
 
 		// Look for attr's
-		attr = file_attr;
+		attr = mk->file_attr;
 		if(*s == '[') {
 			++s;
 			s = tokenize(s, " \t\n\r", ']');
@@ -1137,7 +935,7 @@ parse_boot(FILE *src_fp) {
 				error_exit("Missing ].\n");
 
 			// Assign global attr's which the routine may modify.
-			parse_file_attr(token->c, token->v, &attr);
+			mk->parse_file_attr(mk->token->c, mk->token->v, &attr);
 		}
 
 		// Skip white space
@@ -1166,7 +964,7 @@ parse_boot(FILE *src_fp) {
 		// Try and match an existing attribute & create if no match
 		list = add_attr(&attr);
 
-		parse_boot_cmd(token->c, token->v, &list->attr);
+		parse_boot_cmd(mk->token->c, mk->token->v, &list->attr);
 	}
 }
 
@@ -1194,7 +992,7 @@ parse_script_cmd(FILE *dst_fp, int tokenc, char *tokenv[], struct attr_script_en
 
 	// If no command is specified we set the global attributes.
 	if(tokenc == 0) {
-		script_attr = *attrp;
+		mk->script_attr = *attrp;
 		return;
 	}
 	size = 0;
@@ -1221,7 +1019,7 @@ parse_script_cmd(FILE *dst_fp, int tokenc, char *tokenv[], struct attr_script_en
 			for(i = 0 ; i < envc ; ++i)
 				env_add(tokenv[i]);
 		} else {
-			script_attr = *attrp;
+			mk->script_attr = *attrp;
 		}
 		return;
 	}
@@ -1318,9 +1116,9 @@ waitfor_reopen:
 		char	*err, *pname;
 		int		budget, critical;
 
-			if (ext_sched != SCRIPT_SCHED_EXT_NONE && ext_sched != SCRIPT_SCHED_EXT_APS)
+			if (mk->ext_sched != SCRIPT_SCHED_EXT_NONE && mk->ext_sched != SCRIPT_SCHED_EXT_APS)
 				error_exit("Invalid combination of SCHED_EXT features.\n");
-			ext_sched = SCRIPT_SCHED_EXT_APS;
+			mk->ext_sched = SCRIPT_SCHED_EXT_APS;
 			if ((err = aps_parse((argc >= 2) ? tokenv[envc + 1] : SCRIPT_APS_SYSTEM_PARTITION_NAME, &pname, (argc >= 3) ? tokenv[envc + 2] : "0", &budget, (argc >= 4) ? tokenv[envc + 3] : "0", &critical)) != NULL)
 				error_exit(err);
 			cmd.hdr.type = SCRIPT_TYPE_EXTSCHED_APS;
@@ -1349,9 +1147,9 @@ waitfor_reopen:
 		++tokenc;
 	
 		// Append global env vars to end of tokenv (do not duplicate any on cmd)
-		for(i = 0 ; i < globenvc ; ++i) {
-			if(env_lookup(globenvv[i], envc, tokenv) == NULL)
-				tokenv[tokenc++] = globenvv[i];
+		for(i = 0 ; i < mk->globenvc ; ++i) {
+			if(env_lookup(mk->globenvv[i], envc, tokenv) == NULL)
+				tokenv[tokenc++] = mk->globenvv[i];
 		}
 	
 		// Stuff the header and calculate the size of the entry
@@ -1393,19 +1191,19 @@ parse_script(FILE *src_fp, FILE *dst_fp) {
 	struct attr_script_entry	attr;
 	struct attr_script_list		*list;
 
-	collect_file(&input_script, INPUT_SCRIPT_LEN, "script", src_fp);
+	collect_file(&mk->input_script, INPUT_SCRIPT_LEN, "script", src_fp);
 
 	//
 	// Parse the file.
 	//
 	push_token_state();
-	for(s = input_script.data; *s ; ++s) {
+	for(s = mk->input_script.data; *s ; ++s) {
 		// Skip white space
 		if(isspace(*s))
 			continue;
 
 		// Look for attr's
-		attr = script_attr;
+		attr = mk->script_attr;
 		if(*s == '[') {
 			++s;
 			s = tokenize(s, " \t\n\r", ']');
@@ -1413,7 +1211,7 @@ parse_script(FILE *src_fp, FILE *dst_fp) {
 				error_exit("Missing ].\n");
 
 			// Assign global attr's which the routine may modify.
-			parse_script_attr(token->c, token->v, &attr);
+			parse_script_attr(mk->token->c, mk->token->v, &attr);
 		}
 
 		// Skip white space
@@ -1426,7 +1224,7 @@ parse_script(FILE *src_fp, FILE *dst_fp) {
 		s = tokenize(s, " \t\r", '\n');
 
 		// Try and match an existing attribute.
-		for(list = attr_script_list ; list ; list = list->next)
+		for(list = mk->attr_script_list ; list ; list = list->next)
 			if(memcmp(&attr, &list->attr, sizeof(attr)) == 0)
 				break;
 
@@ -1437,15 +1235,15 @@ parse_script(FILE *src_fp, FILE *dst_fp) {
 				error_exit("No memory for attribute list.\n");
 			}
 			list->attr = attr;
-			list->next = attr_script_list;
-			attr_script_list = list;
+			list->next = mk->attr_script_list;
+			mk->attr_script_list = list;
 		}
-		parse_script_cmd(dst_fp, token->c, token->v, &list->attr);
+		parse_script_cmd(dst_fp, mk->token->c, mk->token->v, &list->attr);
 	}
 	pop_token_state();
-	free(input_script.data);
-	input_script.data = NULL;
-	input_script.len = 0;
+	free(mk->input_script.data);
+	mk->input_script.data = NULL;
+	mk->input_script.len = 0;
 }
 
 
@@ -1463,7 +1261,6 @@ collect_dir(char *host, char *target, struct attr_file_entry *attrp, int callind
 
 	struct attr_file_entry my_attr;				
 	struct attr_file_list *list;
-	static struct inode_stack  inode_list;
 
 	/*
 	  Create a new attribute structure for us only when we 
@@ -1472,13 +1269,14 @@ collect_dir(char *host, char *target, struct attr_file_entry *attrp, int callind
 	*/
 	stat(host, &sbuf);
 	lstat(host, &lsbuf);
+	model_cache_dep(host);
 	memcpy(&my_attr, attrp, sizeof(*attrp));
 
 	if ((callindex != 0) && !attrp->follow_sym_link && S_ISLNK(lsbuf.st_mode)) {
 		//We have a link to a dir and want to store links as links,
 		//With callindex != 0 we know this is a recursive call
-		if (verbose > 5)
-			fprintf(debug_fp, "Adding Link to Directory\n\tHOST:%s\n\tTARGET:%s\n", host, target);
+		if (mk->verbose > 5)
+			fprintf(mk->debug_fp, "Adding Link to Directory\n\tHOST:%s\n\tTARGET:%s\n", host, target);
 		sbuf = lsbuf;
 	}
 	else {
@@ -1486,19 +1284,19 @@ collect_dir(char *host, char *target, struct attr_file_entry *attrp, int callind
 		//If it is a link we should check to see we haven't already recursed
 		//through the resolved directory since that would cause a cycle.
 		if (dir_in_file_list(host, target) != NULL) {
-			if (verbose)
-				fprintf(debug_fp, "Ignorning second inclusion of %s\n", host);
+			if (mk->verbose)
+				fprintf(mk->debug_fp, "Ignorning second inclusion of %s\n", host);
 			return;
 		}
 
-		if (verbose > 5)
-			fprintf(debug_fp, "Adding Directory\n\tHOST:%s\n\tTARGET:%s\n", host, target);
+		if (mk->verbose > 5)
+			fprintf(mk->debug_fp, "Adding Directory\n\tHOST:%s\n\tTARGET:%s\n", host, target);
 	}
 	my_attr.mode = sbuf.st_mode & S_IFMT;
 
 	//Add the directory entry to the file entry list
 	list = add_attr(&my_attr);
-	add_file(&file_list, host, target, &list->attr, &sbuf);
+	add_file(&mk->file_list, host, target, &list->attr, &sbuf);
 
 	//We don't recurse down links if we add them
 	if (S_ISLNK(my_attr.mode)) 
@@ -1534,31 +1332,31 @@ collect_dir(char *host, char *target, struct attr_file_entry *attrp, int callind
 
 		if (!attrp->follow_sym_link && S_ISLNK(lsbuf.st_mode) & !S_ISDIR(sbuf.st_mode)) {
 			//We don't want to resolve file links ... handle dir's recursively
-			if (verbose > 5)
-				fprintf(debug_fp, "Adding Link to File\n\tHOST:%s\n\tTARGET:%s\n", host, target);
+			if (mk->verbose > 5)
+				fprintf(mk->debug_fp, "Adding Link to File\n\tHOST:%s\n\tTARGET:%s\n", host, target);
 			my_attr.mode = lsbuf.st_mode & S_IFMT;
 
 			list = add_attr(&my_attr);
-			add_file(&file_list, host, target, &list->attr, &sbuf);
+			add_file(&mk->file_list, host, target, &list->attr, &sbuf);
 		}		
 		else if (S_ISDIR(sbuf.st_mode)) {
-			if (inode_in_stack(&inode_list, sbuf.st_ino)) {
-				if (verbose)
-					fprintf(debug_fp, "Warning! Cycle detected in path included by \n\t%s\n",host);
+			if (inode_in_stack(&mk->inode_list, sbuf.st_ino)) {
+				if (mk->verbose)
+					fprintf(mk->debug_fp, "Warning! Cycle detected in path included by \n\t%s\n",host);
 			}
 			else {
-				push_stack(&inode_list, sbuf.st_ino);
+				push_stack(&mk->inode_list, sbuf.st_ino);
 				collect_dir(host, target, attrp, 1);
-				pop_stack(&inode_list);
+				pop_stack(&mk->inode_list);
 			}
 		}
 		else if (S_ISFIFO(sbuf.st_mode)) {
 			my_attr.mode = sbuf.st_mode & S_IFMT;
 			list = add_attr(&my_attr);
-			add_file(&file_list, host, target, &list->attr, &sbuf);
+			add_file(&mk->file_list, host, target, &list->attr, &sbuf);
 		}
 		else {
-			add_file(&file_list, host, target, attrp, &sbuf);
+			add_file(&mk->file_list, host, target, attrp, &sbuf);
 		}
 	}
 	*sh = '\0';
@@ -1566,7 +1364,7 @@ collect_dir(char *host, char *target, struct attr_file_entry *attrp, int callind
 
 	closedir(dp);
 	if (callindex == 0)
-		destroy_stack(&inode_list);
+		destroy_stack(&mk->inode_list);
 	return;
 }
 
@@ -1615,7 +1413,7 @@ parse_file_name(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 	// If no filename is specified we set the global attributes.
 	if(tokenc == 0) {
 		attrp->bootfile = 0;
-		file_attr = *attrp;
+		mk->file_attr = *attrp;
 		return;
 	}
 
@@ -1653,7 +1451,7 @@ parse_file_name(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 			sbuf.st_uid = 0;
 			sbuf.st_gid = 0;
 			sbuf.st_mtime = 0;
-			fip = add_file(&file_list, host, target, attrp, &sbuf);
+			fip = add_file(&mk->file_list, host, target, attrp, &sbuf);
 			return;
 		}
 		full = find_file(attrp->search_path, hbuf, &sbuf, host, attrp->optional);
@@ -1668,7 +1466,9 @@ parse_file_name(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 			} else {
 				tbuf[0] = '\0';
 			}
+			prof_start(PROF_COLLECT_DIR);
 			collect_dir(hbuf, tbuf, attrp, 0);
+			prof_stop(PROF_COLLECT_DIR, 0, 0);
 			return;
 		}
 		if(!attrp->follow_sym_link){
@@ -1684,7 +1484,7 @@ parse_file_name(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 				sbuf.st_mode = S_IRWXU | S_IRWXG | S_IRWXO;
 				sbuf.st_uid = 0;
 				sbuf.st_gid = 0;
-				sbuf.st_mtime = no_time ? 0 : time(NULL);
+				sbuf.st_mtime = mk->no_time ? 0 : time(NULL);
 				host = linkbuf;
 			}
 		} else {
@@ -1695,22 +1495,22 @@ parse_file_name(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 		sbuf.st_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
 		sbuf.st_uid = 0;
 		sbuf.st_gid = 0;
-		sbuf.st_mtime = no_time ? 0 : time(NULL);
+		sbuf.st_mtime = mk->no_time ? 0 : time(NULL);
 		break;
 	case S_IFLNK:
 		sbuf.st_mode = S_IRWXU | S_IRWXG | S_IRWXO;
 		sbuf.st_uid = 0;
 		sbuf.st_gid = 0;
-		sbuf.st_mtime = no_time ? 0 : time(NULL);
+		sbuf.st_mtime = mk->no_time ? 0 : time(NULL);
 		break;
 	}
 
 	// Check for the special bootstrap file
 	if(attrp->bootfile) {
-		if(booter.processed) {
+		if(mk->booter.processed) {
 			error_exit("%s: Only one bootstrap file allowed in an image.\n", host);
 		}
-		booter.processed = 1;
+		mk->booter.processed = 1;
 		src_fp = fopen(host, "rb");
 		if(src_fp == NULL)
 			error_exit("Unable to open '%s': %s.\n", host, strerror(errno));
@@ -1725,12 +1525,12 @@ parse_file_name(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 	if(attrp->scriptfile) {
 		char	*src_file = host;
 
-		if(script_fp == NULL) {
+		if(mk->script_fp == NULL) {
 			flags |= FILE_FLAGS_SCRIPT;
 	
 			host = mk_tmpfile();
-			script_fp = fopen(host, "wb");
-			if(script_fp == NULL) {
+			mk->script_fp = fopen(host, "wb");
+			if(mk->script_fp == NULL) {
 				error_exit("Unable to open '%s': %s.\n", host, strerror(errno));
 			}
 		} else {
@@ -1741,7 +1541,7 @@ parse_file_name(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 		if(src_fp == NULL)
 			error_exit("Unable to open '%s': %s.\n", host, strerror(errno));
 
-		parse_script(src_fp, script_fp);
+		parse_script(src_fp, mk->script_fp);
 
 		fclose(src_fp);
 
@@ -1751,7 +1551,7 @@ parse_file_name(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 	}
 
 	if(host != NULL) {
-		fip = add_file(&file_list, host, target, attrp, &sbuf);
+		fip = add_file(&mk->file_list, host, target, attrp, &sbuf);
 		fip->flags |= flags;
 	}
 
@@ -1772,7 +1572,7 @@ collect_inline_file(char *input, char *tmpname) {
 			++s;
 			break;
 		}
-		if(*s == '\n' && line_num != 0) ++line_num;
+		if(*s == '\n' && mk->line_num != 0) ++mk->line_num;
 
 		if(*s == '\\' && *(s + 1))
 			++s;
@@ -1786,20 +1586,20 @@ collect_inline_file(char *input, char *tmpname) {
 }
 
 
-static void
+void
 parse_one_file(char *s) {
 	struct attr_file_entry	attr;
 	struct attr_file_list	*list;
 
 	for( ; *s ; ++s) {
-		if(*s == '\n' && line_num != 0) ++line_num;
+		if(*s == '\n' && mk->line_num != 0) ++mk->line_num;
 
 		// Skip white space
 		if(isspace(*s))
 			continue;
 
 		// Look for attr's
-		attr = file_attr;
+		attr = mk->file_attr;
 		if(*s == '[') {
 			++s;
 			s = tokenize(s, " \t\n\r", ']');
@@ -1807,7 +1607,7 @@ parse_one_file(char *s) {
 				error_exit("Missing ].\n");
 
 			// Assign global attr's which the routine may modify.
-			parse_file_attr(token->c, token->v, &attr);
+			mk->parse_file_attr(mk->token->c, mk->token->v, &attr);
 		}
 
 		// Skip white space
@@ -1818,51 +1618,105 @@ parse_one_file(char *s) {
 		if(*s == '[')
 			error_exit("Missing filename.\n");
 		s = tokenize(s, " \t=\r", '\n');
-		if(token->c > 2)
+		if(mk->token->c > 2)
 			error_exit("Improper filename specification.\n");
 
-		if(token->c == 2  &&  strcmp(token->v[1], "{") == 0) {
+		if(mk->token->c == 2  &&  strcmp(mk->token->v[1], "{") == 0) {
 			if(*s++ != '\n')
 				error_exit("Missing inline file data.\n");
 
-			if (line_num != 0)
-				++line_num;
+			if (mk->line_num != 0)
+				++mk->line_num;
 
-			token->v[1] = mk_tmpfile();
-			s = collect_inline_file(s, token->v[1]);
+			mk->token->v[1] = mk_tmpfile();
+			s = collect_inline_file(s, mk->token->v[1]);
 		}
 
 		list = add_attr(&attr);
 		
-		parse_file_name(token->c, token->v, &list->attr);
+		parse_file_name(mk->token->c, mk->token->v, &list->attr);
 
-		if(strcmp(attr.cd, file_attr.cd) != 0)
-			chdir(file_attr.cd);
+		if(strcmp(attr.cd, mk->file_attr.cd) != 0)
+			chdir(mk->file_attr.cd);
 
-		if(line_num != 0 && *s == '\n') ++line_num;
+		if(mk->line_num != 0 && *s == '\n') ++mk->line_num;
 	}
 }
 
 void
 parse_file(FILE *src_fp) {
 
-	collect_file(&input_file, INPUT_FILE_LEN, "control", src_fp);
+	collect_file(&mk->input_file, INPUT_FILE_LEN, "control", src_fp);
 	//
 	// Parse the input buffer(s).
 	//
-	if(option_lines != NULL) parse_one_file(option_lines);
-	line_num = 1;
-	parse_one_file(input_file.data);
-	line_num = 0;
-	if(boot_attr_buf != NULL) parse_one_file(boot_attr_buf);
+	if(mk->option_lines != NULL) parse_one_file(mk->option_lines);
+	mk->line_num = 1;
+	parse_one_file(mk->input_file.data);
+	mk->line_num = 0;
+	if(mk->boot_attr_buf != NULL) parse_one_file(mk->boot_attr_buf);
+}
+
+
+//
+// Tree entries come from the model arena and are found again through
+// a hash on (parent, name), so that directories with thousands of
+// entries don't make building the tree quadratic.
+//
+
+static unsigned
+tree_hash_key(struct tree_entry *parent, const char *name, unsigned len) {
+	unsigned	h = 2166136261u ^ (unsigned)((uintptr_t)parent >> 3);
+
+	while(len-- != 0) {
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	}
+	return h;
+}
+
+static void
+tree_hash_grow(void) {
+	struct tree_entry	**new, *trp, *next;
+	unsigned			new_mask, i, h;
+
+	new_mask = mk->tree_hash_mask ? mk->tree_hash_mask * 2 + 1 : 1023;
+	new = calloc(new_mask + 1, sizeof(*new));
+	if(new == NULL) {
+		error_exit("No memory for tree hash.\n");
+	}
+	for(i = 0; mk->tree_hash != NULL && i <= mk->tree_hash_mask; ++i) {
+		for(trp = mk->tree_hash[i]; trp != NULL; trp = next) {
+			next = trp->hash_next;
+			h = tree_hash_key(trp->parent, trp->name, strlen(trp->name)) & new_mask;
+			trp->hash_next = new[h];
+			new[h] = trp;
+		}
+	}
+	free(mk->tree_hash);
+	mk->tree_hash = new;
+	mk->tree_hash_mask = new_mask;
 }
 
+static struct tree_entry *
+tree_lookup(struct tree_entry *parent, const char *name, unsigned len) {
+	struct tree_entry	*trp;
+	unsigned			h;
+
+	h = tree_hash_key(parent, name, len) & mk->tree_hash_mask;
+	for(trp = mk->tree_hash[h]; trp != NULL; trp = trp->hash_next) {
+		if(trp->parent == parent && strncmp(trp->name, name, len) == 0
+		  && trp->name[len] == '\0') {
+			break;
+		}
+	}
+	return trp;
+}
 
 void
 add_tree(struct tree_entry *parent, struct file_entry *fip) {
-	struct tree_entry	*prev, *trp;
-	char				*pp, *np;
-	char				 name[PATH_MAX + 1];
+	struct tree_entry	*trp;
+	char				*pp;
+	unsigned			len, h;
 
 	/* 
 	   The root of the tree will have a targetpath of ""
@@ -1875,33 +1729,37 @@ add_tree(struct tree_entry *parent, struct file_entry *fip) {
 	trp = NULL;
 	for(pp = fip->targpath; *pp ; ) {
 		// Collect a single path component.
-		for(np = name ; *pp  &&  *pp != '/' ; ++pp, ++np) {
-			*np = *pp;
-			if (np == &name[PATH_MAX]) {
-				error_exit("File name too long.\n");
-			}
+		len = strcspn(pp, "/");
+		if(len > PATH_MAX) {
+			error_exit("File name too long.\n");
 		}
-		*np = '\0';
 
 		// Search the tree at the current level for a match
-		for(prev = (void *)&parent->child ; (trp = prev->sibling) ; prev = trp)
-			if(strcmp(trp->name, name) == 0) break;
+		trp = tree_lookup(parent, pp, len);
 
-		//If no match we build the tree piecewise
+		//If no match we build the tree piecewise, appending to the
+		//end of the sibling list to keep the file list order.
 		if(trp == NULL) {
 			static struct file_entry		file;
 			static struct attr_file_entry	attr;
 
-			trp = malloc(sizeof(*trp) + strlen(name));
-			if (trp == NULL) {
-				error_exit("No memory for tree entry.\n");
-			}
+			trp = model_alloc(offsetof(struct tree_entry, name) + len + 1);
 			trp->parent = parent;
-			trp->child = NULL;
-			trp->sibling = NULL;
-			trp->flags = 0;
-			strcpy(trp->name, name);
-			prev->sibling = trp;
+			memcpy(trp->name, pp, len);
+			trp->name[len] = '\0';
+			if(parent->last_child != NULL) {
+				parent->last_child->sibling = trp;
+			} else {
+				parent->child = trp;
+			}
+			parent->last_child = trp;
+
+			if(++mk->tree_hash_count > mk->tree_hash_mask) {
+				tree_hash_grow();
+			}
+			h = tree_hash_key(parent, pp, len) & mk->tree_hash_mask;
+			trp->hash_next = mk->tree_hash[h];
+			mk->tree_hash[h] = trp;
         	
 			/* Create dummy directory entry which will get
 			   filled in later.   This is required because 
@@ -1919,12 +1777,13 @@ add_tree(struct tree_entry *parent, struct file_entry *fip) {
 				file.host_perms = S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH;
 				file.host_uid = 0;
 				file.host_gid = 0;
-				file.host_mtime = no_time ? 0 : time(NULL);
+				file.host_mtime = mk->no_time ? 0 : time(NULL);
 			}
 			trp->fip = &file;
 		}
 
 		parent = trp;
+		pp += len;
 		if(*pp) ++pp;
 	}
 	/*After going through and making the path, set the last 
@@ -1955,306 +1814,6 @@ print_tree(struct tree_entry *trp, int level) {
 }
 
 
-int
-main(int argc, char *argv[]) {
-	int					n;
-	FILE				*src_fp;
-	FILE				*dst_fp;
-	char				*specified_dest;
-	char				*intermediate_dest;
-	char 				*output_dest;
-	unsigned			startup_offset;
-	struct file_entry	*fip;
-	char				*cmd;
-	char				*type = NULL;
-	mode_t				old_mask;
-	char				*rootdir = NULL;
-
-
-	cmd = basename(argv[0]);
-	if(IS_EXE_NAME(cmd, "mkifs")) {
-		type = "ifs";
-	} else if(IS_EXE_NAME(cmd, "mkefs")) {
-		type = "ffs3";
-	} else if(IS_EXE_NAME(cmd, "mketfs")) {
-		type = "etfs";
-	}
-
-	// Calculate the endian of the host this program is running on.
-	n = 1;
-	host_endian = *(char *)&n != 1;
-
-	// Get the right permissions on temp files
-	old_mask = umask(0);
-
-	while((n = getopt(argc, argv, "a:c:r:l:nNps:t:v")) != -1) {
-		switch(n) {
-		case 'a':
-			symfile_suffix = strdup( optarg );
-			break;
-		case 'c':
-			cache_dir = optarg;
-			break;
-		case 'l':
-			add_data(optarg);
-			add_data("\n");
-			break;
-		case 'n':
-			no_time++;
-			break;
-		case 'N':
-			new_style_bootstrap++;
-			break;
-		case 'p':
-			// Place holder for old, experimental switch
-			break;
-		case 's':
-			ifs_section(NULL, optarg);
-			break;
-		case 't':
-			type = optarg;
-			break;
-		case 'r':
-			if(rootdir) {
-				error_exit("Only one rootdir can be passed\n");
-			}
-			rootdir = optarg;
-			break;
-		case 'v':
-			++verbose;
-			break;
-		default:
-			exit(1);
-		}
-	}
-
-	if(type == NULL) {
-		error_exit("Output file system type not specified\n");
-	} else if(strcmp(type, "ifs") == 0) {
-		parse_file_init = ifs_parse_init;
-		parse_file_attr = ifs_parse_attr;
-		need_seekable   = ifs_need_seekable;
-		make_fsys       = ifs_make_fsys;
-	} else if(strcmp(type, "ffs3") == 0) {
-		parse_file_init = ffs_parse_init;
-		parse_file_attr = ffs_parse_attr;
-		need_seekable   = ffs_need_seekable;
-		make_fsys       = ffs_make_fsys_3;
-	} else if(strcmp(type, "ffs2") == 0) {
-		parse_file_init = ffs_parse_init;
-		parse_file_attr = ffs_parse_attr;
-		need_seekable   = ffs_need_seekable;
-		make_fsys       = ffs_make_fsys_2;
-		fprintf(stderr, "Warning: FFS2 no longer supported. ");
-		fprintf(stderr, "Use for backwards compatability only.\n");
-	} else if(strcmp(type, "ffs2-quiet") == 0) {
-		// Same as above, but no warning message.
-		parse_file_init = ffs_parse_init;
-		parse_file_attr = ffs_parse_attr;
-		need_seekable   = ffs_need_seekable;
-		make_fsys       = ffs_make_fsys_2;
-	} else if(strcmp(type, "etfs") == 0) {
-		parse_file_init = etfs_parse_init;
-		parse_file_attr = etfs_parse_attr;
-		need_seekable   = etfs_need_seekable;
-		make_fsys       = etfs_make_fsys;
-	} else {
-		error_exit("Unknown file system '%s'\n", type);
-	}
-
-	set_cpu(DEFAULT_CPU, 0);
-#if 0
-#if defined(__WIN32__) || defined(__NT__)
-	{
-		char *p, *qnx_target = getenv("QNX_TARGET");
-		if(!qnx_target) {
-			qnx_target = getenv("QSSL_TARGET");
-		}
-		if ( qnx_target ) {
-			if ( qnx_target[0] == '\"' ) { 
-				qnx_target++;
-				if ( (p = strrchr( qnx_target, '\"')) ) {
-					*p = '\0';
-				}
-			}
-		} else {
-			error_exit("QNX_TARGET environment variable must be set\n");
-		}
-		setenv( "QNX_TARGET", qnx_target, 0 );
-	}
-#else
-	{
-		char *qnx_target = getenv("QNX_TARGET");
-		if(!qnx_target) {
-			qnx_target = getenv("QSSL_TARGET");
-		}
-		if(qnx_target) {
-			setenv("QNX_TARGET",qnx_target, 0);
-		} else {
-			error_exit("QNX_TARGET environment variable must be set\n");
-		}
-    }
-#endif
-#endif
-    if(rootdir) {
-		setenv("_ROOTDIR_", rootdir, 1);
-
-		/* @@@ This should not duplicate the paths, but for now it is the least risky */
-		setenv("MKIFS_PATH",
-	       // If there is something in sbin, and also somewhere else
-	       // we probably want the sbin version so look there first
-	       "${_ROOTDIR_}/${PROCESSOR}/sbin"   
-	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/usr/sbin"
-
-	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/boot/sys"
-
-	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/bin"
-	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/usr/bin"
-	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/lib"
-	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/lib/dll"
-	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/usr/lib"
-	       
-	       // Feel free to get rid of this if /usr/photon/bin goes away
-	       PATHSEP_STR "${_ROOTDIR_}/${PROCESSOR}/usr/photon/bin"
-#if 0
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/sbin"   
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/sbin"
-
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/boot/sys"
-
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/bin"
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/bin"
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/lib"
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/lib/dll"
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/lib"
-	       
-	       // Feel free to get rid of this if /usr/photon/bin goes away
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/photon/bin"
-	       , 0 );
-	} else {
-		setenv("MKIFS_PATH",
-	       // If there is something in sbin, and also somewhere else
-	       // we probably want the sbin version so look there first
-	       "${QNX_TARGET}/${PROCESSOR}/sbin"   
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/sbin"
-
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/boot/sys"
-
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/bin"
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/bin"
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/lib"
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/lib/dll"
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/lib"
-	       
-	       // Feel free to get rid of this if /usr/photon/bin goes away
-	       PATHSEP_STR "${QNX_TARGET}/${PROCESSOR}/usr/photon/bin"
-#endif
-	       , 0 );
-	}
-
-	src_fp = stdin;
-	dst_fp = stdout;
-	debug_fp = stderr;
-	specified_dest = NULL;
-
-	atexit(rm_tmpfiles);
-
-	signal(SIGHUP, die);
-#if !defined(__WIN32__) && !defined(__NT__)
-	signal(SIGPIPE, die);
-#endif
-	signal(SIGINT, die);
-	signal(SIGQUIT, die);
-	signal(SIGTERM, die);
-
-	n = argc - optind;
-	if(n) {
-		if(strcmp(argv[optind], "-") != 0) {
-			src_fp = fopen(argv[optind], "r");
-			if(src_fp == NULL)
-				error_exit("Unable to open '%s': %s.\n", argv[optind], strerror(errno));
-		}
-
-		if(n > 1) {
-			if(strcmp(argv[optind + 1], "-") != 0) {
-				specified_dest = argv[optind + 1];
-			}
-		}
-	}
-
-	push_token_state();
-
-	parse_file_init(&file_attr);
-	parse_script_init(&script_attr);
-
-	parse_file(src_fp);
-
-	if(script_fp != NULL) {
-		int		n;
-
-		// Terminate list with a size of 0
-		n = 0;
-		fwrite(&n, sizeof(n), 1, script_fp);
-		fclose(script_fp);
-	}
-
-	for(fip = file_list; fip != NULL; fip = fip->next) {
-		//NYI: should run the list & check for duplicate target names
-		if(fip->attr->prefix == NULL) {
-			fip->attr->prefix = booter.name ? "proc/boot" : "";
-		}
-		set_target_name(fip);
-	}
-
-	if(booter.copy_filter) {
-		intermediate_dest = mk_tmpfile();
-	} else if((specified_dest == NULL)
-	    && ((booter.filter_spec != NULL) || need_seekable(file_list))) {
-		intermediate_dest = mk_tmpfile();
-	} else {
-		intermediate_dest = specified_dest;
-	}
-
-	// Final output file should be created with original umask()
-	umask(old_mask);
-
-	if(intermediate_dest != NULL) {
-		dst_fp = fopen(intermediate_dest, "w+b");
-		if(dst_fp == NULL) {
-			error_exit("Unable to open '%s': %s.\n", intermediate_dest, strerror(errno));
-		}
-	}
-
-	// make_fsys() might create more temp files
-	umask(0);
-
-	if(specified_dest == NULL) MAKE_BINARY_FP(stdout);
-
-	startup_offset = make_fsys(dst_fp, file_list, mountpoint, intermediate_dest);
-
-	if(dst_fp != stdout) fclose(dst_fp);
-
-	output_dest = intermediate_dest;
-	if(booter.filter_spec != NULL) {
-		if(specified_dest != NULL) {
-			output_dest = specified_dest;
-		} else if(booter.copy_filter) {
-			output_dest = mk_tmpfile();
-		}
-		proc_booter_filter(startup_offset, intermediate_dest, output_dest);
-	}
-	if(specified_dest == NULL && (dst_fp != stdout)) {
-		dst_fp = fopen(output_dest, "rb");
-		if(dst_fp == NULL) {
-			error_exit("Can not open '%s' for input.\n", intermediate_dest);
-		}
-		while((n = fread(token->buf, 1, sizeof(token->buf), dst_fp)) > 0) {
-			fwrite(token->buf, 1, n, stdout);
-		}
-	}
-	return(0);
-}
-
 struct tree_entry *
 make_tree(struct file_entry *list) {
 	struct file_entry	*fip;
@@ -2262,9 +1821,17 @@ make_tree(struct file_entry *list) {
 
 	// Build a tree from the file list.
 	root.child = NULL;
+	root.last_child = NULL;
+	mk->tree_hash_count = 0;
+	tree_hash_grow();
 	for(fip = list ; fip ; fip = fip->next)
 		add_tree(&root, fip);
 
+	// The hash is only needed while the tree is being built.
+	free(mk->tree_hash);
+	mk->tree_hash = NULL;
+	mk->tree_hash_mask = 0;
+
 	return(root.child);
 }
 
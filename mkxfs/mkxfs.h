@@ -0,0 +1,110 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+
+#ifndef __MKXFS_H_INCLUDED
+#define __MKXFS_H_INCLUDED
+
+#include <stdio.h>
+
+//
+// Image builder library.
+//
+// A build is parsed from a buildfile, can have files added to and
+// removed from its file list, and is then written out as an image.
+// Writing renames and lays out the files in place, so a build is
+// written once and can then only be freed. Each build keeps its own
+// state, so one process can make any number of images, one after
+// another or interleaved. The calls for any of them must not run
+// concurrently: the builder changes directory and sets environment
+// variables, and those are shared by the whole process.
+//
+// Calls that can fail return -1 and leave a message for mkxfs_error().
+// After a failure the build can only be freed.
+//
+
+struct mkxfs_build;
+struct mkxfs_file;
+
+struct mkxfs_options {
+	const char	*type;					// "ifs", "ffs3", "ffs2" or "etfs"
+	int			 verbose;
+	FILE		*debug_fp;				// verbose output, stderr if NULL
+	int			 no_time;				// 1 - no image time stamps, 2 - no file ones either
+	int			 new_style_bootstrap;
+	const char	*symfile_suffix;		// suffix of [+keeplinked] symbol files
+	const char	*lines;					// buildfile lines parsed ahead of the buildfile
+};
+
+// A new build, NULL with errno set if the type is unknown (EINVAL) or
+// there is no memory.
+struct mkxfs_build	*mkxfs_new(const struct mkxfs_options *opts);
+
+// Remove the build's temporary files and release everything it holds.
+void				 mkxfs_free(struct mkxfs_build *b);
+
+// Remove the build's temporary files, leaving the rest for
+// mkxfs_free(). Safe to call from a signal handler.
+void				 mkxfs_abort(struct mkxfs_build *b);
+
+// Call in a child forked from the process holding 'b'. The temporary
+// files made so far stay the parent's: the child's mkxfs_abort() and
+// mkxfs_free() leave them alone. The child can then write the image
+// while the parent keeps the build unwritten for the next child.
+void				 mkxfs_forked(struct mkxfs_build *b);
+
+const char			*mkxfs_error(struct mkxfs_build *b);
+
+// Reuse the parsed buildfile saved by an earlier build with the same
+// buildfile, command line and inputs (mkifs -b). Call before parsing.
+int					 mkxfs_cache(struct mkxfs_build *b, char *buildfile, int argc, char *argv[], int first_arg);
+
+// Keep the named section when stripping ELF files (mkifs -s).
+int					 mkxfs_keep_section(struct mkxfs_build *b, const char *name);
+
+// Parse a whole buildfile, or more buildfile lines after it.
+int					 mkxfs_parse(struct mkxfs_build *b, FILE *src_fp);
+int					 mkxfs_parse_string(struct mkxfs_build *b, const char *lines);
+
+//
+// The file list. mkxfs_add_file() adds 'host' as 'target' (the host
+// name if NULL) with the attributes in 'attrs', which are written as
+// in a buildfile without the brackets and can be NULL. Target names
+// are the ones the files were given, before any prefix is applied.
+//
+int					 mkxfs_add_file(struct mkxfs_build *b, const char *attrs, const char *target, const char *host);
+int					 mkxfs_remove_file(struct mkxfs_build *b, const char *target);
+struct mkxfs_file	*mkxfs_file_first(struct mkxfs_build *b);
+struct mkxfs_file	*mkxfs_file_next(struct mkxfs_file *f);
+const char			*mkxfs_file_host(struct mkxfs_file *f);
+const char			*mkxfs_file_target(struct mkxfs_file *f);
+
+//
+// Take a change to the host file at 'path' (an absolute path) into a
+// parsed build. Files that copy it into the image as is pick up its
+// new time stamp, permissions and contents, and their number is
+// returned. Returns 0 if the change alters what the buildfile means
+// (the file is filtered, is not a plain file any more or is used by no
+// file), in which case the buildfile has to be parsed again.
+//
+int					 mkxfs_refresh(struct mkxfs_build *b, const char *path);
+
+// Write the image to 'output', standard output if NULL. Every call on
+// the build after this one fails, and mkxfs_file_first() returns NULL.
+int					 mkxfs_write(struct mkxfs_build *b, const char *output);
+
+#endif
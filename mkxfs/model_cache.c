@@ -0,0 +1,668 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+
+
+//
+// Precompiled buildfile cache (the -b option).
+//
+// After the buildfile has been parsed, the resolved build model (file
+// list, attributes, bootstrap and script data) is saved next to it as
+// "<buildfile>.bldc". The cache records a digest of the command line,
+// working directory and environment, and a stat fingerprint of every
+// host path that was looked at while parsing, including the ones that
+// were searched for and not found. A later run with identical
+// fingerprints loads the model instead of parsing and goes straight
+// to layout.
+//
+// The file is private to the mkifs binary that wrote it: structures are
+// stored in host format and the header records their sizes.
+//
+
+#include <lib/compat.h>
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sha2.h>
+#include "struct.h"
+
+#define MODEL_CACHE_MAGIC		"MKXFSBC"
+#define MODEL_CACHE_VERSION		2
+#define MODEL_CACHE_SUFFIX		".bldc"
+#define NO_INDEX				0xffffffffu
+
+extern char						**environ;
+
+struct mc_buf {
+	unsigned char	*data;
+	size_t			len;
+	size_t			size;
+	size_t			pos;		// read position
+};
+
+
+
+//
+// Output buffer
+//
+
+static void
+put(struct mc_buf *bp, const void *data, size_t len) {
+	if(bp->len + len > bp->size) {
+		size_t	size = max(bp->size * 2, bp->len + len + 0x10000);
+
+		if((bp->data = realloc(bp->data, size)) == NULL) {
+			error_exit("No memory for buildfile cache.\n");
+		}
+		bp->size = size;
+	}
+	memcpy(bp->data + bp->len, data, len);
+	bp->len += len;
+}
+
+static void
+put_u32(struct mc_buf *bp, uint32_t v) {
+	put(bp, &v, sizeof(v));
+}
+
+static void
+put_blob(struct mc_buf *bp, const void *data, uint32_t len) {
+	if(data == NULL) {
+		put_u32(bp, NO_INDEX);
+	} else {
+		put_u32(bp, len);
+		put(bp, data, len);
+	}
+}
+
+static void
+put_str(struct mc_buf *bp, const char *str) {
+	put_blob(bp, str, str ? strlen(str) + 1 : 0);
+}
+
+static void
+put_names(struct mc_buf *bp, struct name_list *list) {
+	struct name_list	*nl;
+	uint32_t			n = 0;
+
+	for(nl = list; nl != NULL; nl = nl->next) ++n;
+	put_u32(bp, n);
+	for(nl = list; nl != NULL; nl = nl->next) put_str(bp, nl->name);
+}
+
+
+//
+// Input buffer. Anything inconsistent is caught by the digest check
+// before parsing starts, so running off the end is a fatal error.
+//
+
+static const void *
+get(struct mc_buf *bp, size_t len) {
+	const void	*p;
+
+	if(len > bp->len - bp->pos) {
+		error_exit("Buildfile cache %s is corrupt.\n", mk->cache_name);
+	}
+	p = bp->data + bp->pos;
+	bp->pos += len;
+	return p;
+}
+
+static uint32_t
+get_u32(struct mc_buf *bp) {
+	uint32_t	v;
+
+	memcpy(&v, get(bp, sizeof(v)), sizeof(v));
+	return v;
+}
+
+static const void *
+get_blob(struct mc_buf *bp, uint32_t *lenp) {
+	uint32_t	len = get_u32(bp);
+
+	if(lenp != NULL) *lenp = len;
+	return len == NO_INDEX ? NULL : get(bp, len);
+}
+
+static char *
+get_str(struct mc_buf *bp) {
+	const char	*str = get_blob(bp, NULL);
+
+	return str ? model_intern(str) : NULL;
+}
+
+static struct name_list *
+get_names(struct mc_buf *bp) {
+	struct name_list	*list = NULL, **owner = &list, *nl;
+	uint32_t			n = get_u32(bp);
+	const char			*name;
+	uint32_t			len;
+
+	while(n-- != 0) {
+		name = get_blob(bp, &len);
+		nl = model_alloc(offsetof(struct name_list, name) + len);
+		memcpy(nl->name, name, len);
+		*owner = nl;
+		owner = &nl->next;
+	}
+	return list;
+}
+
+
+//
+// Dependency fingerprints
+//
+
+static char *
+abs_path(const char *path, char *buf, size_t size) {
+	size_t	len;
+
+	if(IS_ABSPATH(path)) return (char *)path;
+	if(getcwd(buf, size) == NULL) return (char *)path;
+	len = strlen(buf);
+	snprintf(buf + len, size - len, "/%s", path);
+	return buf;
+}
+
+//
+// Remember that the model depends on 'path' existing (or not) with
+// its current attributes.
+//
+void
+model_cache_dep(const char *path) {
+	struct mc_dep	*dp;
+	char			buf[PATH_MAX];
+	char			*name;
+	unsigned		count;
+
+	if(!mk->track_deps) return;
+
+	count = mk->dep_names.count;
+	name = strtab_intern(&mk->dep_names, abs_path(path, buf, sizeof(buf)));
+	if(mk->dep_names.count == count) return;
+
+	dp = arena_alloc(&mk->dep_arena, sizeof(*dp));
+	dp->path = name;
+	dp->present = stat(name, &dp->sbuf) == 0;
+	dp->next = mk->dep_list;
+	mk->dep_list = dp;
+}
+
+static int
+same_stat(struct stat *a, struct stat *b) {
+	return a->st_size == b->st_size
+		&& a->st_mtime == b->st_mtime
+		&& a->st_ctime == b->st_ctime
+#if defined(__APPLE__)
+		&& a->st_mtimespec.tv_nsec == b->st_mtimespec.tv_nsec
+#elif defined(__LINUX__)
+		&& a->st_mtim.tv_nsec == b->st_mtim.tv_nsec
+#endif
+		&& a->st_ino == b->st_ino
+		&& a->st_dev == b->st_dev
+		&& a->st_mode == b->st_mode
+		&& a->st_uid == b->st_uid
+		&& a->st_gid == b->st_gid;
+}
+
+static int
+cmp_env(const void *a, const void *b) {
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+//
+// Digest of everything outside the file system that parsing depends
+// on: the options, the current directory and the environment.
+//
+static void
+make_fingerprint(int argc, char *argv[], int first_arg) {
+	SHA2_CTX	ctx;
+	char		buf[PATH_MAX];
+	char		**env;
+	unsigned	i, n;
+	uint32_t	sizes[4];
+
+	SHA256Init(&ctx);
+	sizes[0] = sizeof(struct file_entry);
+	sizes[1] = sizeof(struct attr_file_entry);
+	sizes[2] = sizeof(struct attr_booter_entry);
+	sizes[3] = sizeof(void *);
+	SHA256Update(&ctx, (uint8_t *)sizes, sizeof(sizes));
+
+	// Options and the input file, but not the output file.
+	for(i = 1; i < (unsigned)argc && i <= (unsigned)first_arg; ++i) {
+		SHA256Update(&ctx, (uint8_t *)argv[i], strlen(argv[i]) + 1);
+	}
+	if(getcwd(buf, sizeof(buf)) != NULL) {
+		SHA256Update(&ctx, (uint8_t *)buf, strlen(buf) + 1);
+	}
+
+	for(n = 0; environ[n] != NULL; ++n) {
+		// nothing
+	}
+	if((env = malloc((n + 1) * sizeof(*env))) == NULL) {
+		error_exit("No memory for buildfile cache.\n");
+	}
+	memcpy(env, environ, n * sizeof(*env));
+	qsort(env, n, sizeof(*env), cmp_env);
+	for(i = 0; i < n; ++i) {
+		// These change with the shell state, not with the build.
+		if(strncmp(env[i], "_=", 2) == 0 || strncmp(env[i], "OLDPWD=", 7) == 0) continue;
+		SHA256Update(&ctx, (uint8_t *)env[i], strlen(env[i]) + 1);
+	}
+	free(env);
+	SHA256Final(mk->fingerprint, &ctx);
+}
+
+
+//
+// Enable the cache for 'buildfile'. Must be called before the
+// environment is modified by parsing.
+//
+void
+model_cache_open(char *buildfile, int argc, char *argv[], int first_arg) {
+	mk->cache_name = malloc(strlen(buildfile) + sizeof(MODEL_CACHE_SUFFIX));
+	if(mk->cache_name == NULL) {
+		error_exit("No memory for buildfile cache.\n");
+	}
+	sprintf(mk->cache_name, "%s%s", buildfile, MODEL_CACHE_SUFFIX);
+	mk->track_deps = 1;
+	make_fingerprint(argc, argv, first_arg);
+	model_cache_dep(buildfile);
+}
+
+
+//
+// Save the model produced by parsing.
+//
+void
+model_cache_save(void) {
+	struct mc_buf			 b = { NULL };
+	struct mc_dep			*dp;
+	struct file_entry		*fip;
+	struct linker_entry		*lp;
+	struct tmpfile_entry	*tmp;
+	struct attr_file_entry	**attrs = NULL;
+	struct arena			 tmp_arena = { NULL };
+	struct strtab			 tmp_names = { &tmp_arena };
+	unsigned				 nattrs = 0, nfiles = 0, i, count;
+	uint8_t					 digest[SHA256_DIGEST_LENGTH];
+	SHA2_CTX				 ctx;
+	char					 tname[PATH_MAX];
+	char					 buf[PATH_MAX];
+	char					*data;
+	FILE					*fp;
+	int						 fd;
+	struct stat				 sbuf;
+
+	if(mk->cache_name == NULL) return;
+
+	// Everything the layout phase will read from the host.
+	for(tmp = mk->tmpfile_list; tmp != NULL; tmp = tmp->next) {
+		strtab_intern(&tmp_names, tmp->name);
+	}
+	for(fip = mk->file_list; fip != NULL; fip = fip->next) {
+		if(S_ISREG(fip->attr->mode) && strtab_lookup(&tmp_names, fip->hostpath) == NULL) {
+			model_cache_dep(fip->hostpath);
+		}
+	}
+
+	put(&b, MODEL_CACHE_MAGIC, sizeof(MODEL_CACHE_MAGIC));
+	put_u32(&b, MODEL_CACHE_VERSION);
+	put(&b, mk->fingerprint, sizeof(mk->fingerprint));
+	// Temporary files are recreated from their stored contents, they
+	// are not dependencies.
+	count = 0;
+	for(dp = mk->dep_list; dp != NULL; dp = dp->next) {
+		if(strtab_lookup(&tmp_names, dp->path) == NULL) ++count;
+	}
+	put_u32(&b, count);
+	for(dp = mk->dep_list; dp != NULL; dp = dp->next) {
+		if(strtab_lookup(&tmp_names, dp->path) != NULL) continue;
+		put_str(&b, dp->path);
+		put_u32(&b, dp->present);
+		put(&b, &dp->sbuf, sizeof(dp->sbuf));
+	}
+
+	// Global state set by the buildfile.
+	put_u32(&b, mk->block_size);
+	put_u32(&b, mk->chain_paddr);
+	put_u32(&b, mk->compressed);
+	put_u32(&b, mk->split_image);
+	put_u32(&b, mk->cluster_size);
+	put_u32(&b, mk->num_blocks);
+	put_u32(&b, mk->spare_blocks);
+	put_u32(&b, mk->target_endian);
+	put(&b, &mk->image, sizeof(mk->image));
+	put(&b, &mk->ram, sizeof(mk->ram));
+	put(&b, &mk->default_image, sizeof(mk->default_image));
+	put(&b, &mk->default_ram, sizeof(mk->default_ram));
+	put_str(&b, mk->mountpoint);
+	put_str(&b, getcwd(buf, sizeof(buf)));
+	put_str(&b, getenv("PROCESSOR"));
+	put_str(&b, getenv("CPU_BASE"));
+
+	// Bootstrap
+	put(&b, &mk->booter, sizeof(mk->booter));
+	put_str(&b, mk->booter.name);
+	put_str(&b, mk->booter.filter_spec);
+	put_str(&b, mk->booter.filter_args);
+	put_blob(&b, mk->booter.data, mk->booter.data_len + 1);
+	for(i = 0, lp = mk->booter.linker; lp != NULL; lp = lp->next) ++i;
+	put_u32(&b, i);
+	for(lp = mk->booter.linker; lp != NULL; lp = lp->next) {
+		put(&b, lp->class, sizeof(lp->class));
+		put_str(&b, lp->spec);
+	}
+
+	// Attributes referenced by the file list
+	for(fip = mk->file_list; fip != NULL; fip = fip->next) {
+		for(i = 0; i < nattrs; ++i) {
+			if(attrs[i] == fip->attr) break;
+		}
+		if(i == nattrs) {
+			if((nattrs & 0xff) == 0) {
+				attrs = realloc(attrs, (nattrs + 0x100) * sizeof(*attrs));
+				if(attrs == NULL) {
+					error_exit("No memory for buildfile cache.\n");
+				}
+			}
+			attrs[nattrs++] = fip->attr;
+		}
+		++nfiles;
+	}
+	put_u32(&b, nattrs);
+	for(i = 0; i < nattrs; ++i) {
+		put(&b, attrs[i], sizeof(*attrs[i]));
+		put_str(&b, attrs[i]->cd);
+		put_str(&b, attrs[i]->search_path);
+		put_str(&b, attrs[i]->prefix);
+		put_str(&b, attrs[i]->filter);
+		put_names(&b, attrs[i]->keepsection);
+		put_names(&b, attrs[i]->module_list);
+	}
+
+	// Files. Temporary files (inline files, the script, filter output)
+	// go away at exit, so their contents are stored.
+	put_u32(&b, nfiles);
+	for(fip = mk->file_list; fip != NULL; fip = fip->next) {
+		put(&b, fip, sizeof(*fip));
+		put_str(&b, fip->targpath);
+		put_str(&b, fip->hostpath);
+		put_str(&b, fip->filter_input);
+		for(i = 0; attrs[i] != fip->attr; ++i) {
+			// nothing
+		}
+		put_u32(&b, i);
+		if(fip->bootargs != NULL) {
+			put_blob(&b, fip->bootargs, fip->bootargs->size_lo | (fip->bootargs->size_hi << 8));
+		} else {
+			put_blob(&b, NULL, 0);
+		}
+		put_str(&b, fip->linker);
+
+		if(S_ISREG(fip->attr->mode) && strtab_lookup(&tmp_names, fip->hostpath) != NULL) {
+			if((fd = open(fip->hostpath, O_RDONLY | O_BINARY)) == -1 || fstat(fd, &sbuf) == -1) {
+				error_exit("Unable to read %s: %s.\n", fip->hostpath, strerror(errno));
+			}
+			if((data = malloc(sbuf.st_size + 1)) == NULL) {
+				error_exit("No memory for buildfile cache.\n");
+			}
+			if(read(fd, data, sbuf.st_size) != sbuf.st_size) {
+				error_exit("Unable to read %s: %s.\n", fip->hostpath, strerror(errno));
+			}
+			close(fd);
+			put_blob(&b, data, sbuf.st_size);
+			free(data);
+		} else {
+			put_blob(&b, NULL, 0);
+		}
+	}
+	free(attrs);
+	strtab_release(&tmp_names);
+	arena_release(&tmp_arena);
+
+	SHA256Init(&ctx);
+	SHA256Update(&ctx, b.data, b.len);
+	SHA256Final(digest, &ctx);
+	put(&b, digest, sizeof(digest));
+
+	// Written under a temporary name so readers never see a partial file.
+	snprintf(tname, sizeof(tname), "%s.%ld", mk->cache_name, (long)getpid());
+	// Not writable by others: whoever can write it decides what gets built.
+	umask(mk->caller_umask);
+	fp = fopen(tname, "wb");
+	umask(0);
+	if(fp == NULL || fwrite(b.data, 1, b.len, fp) != b.len || fclose(fp) != 0
+	  || rename(tname, mk->cache_name) != 0) {
+		fprintf(stderr, "Warning: unable to write buildfile cache %s: %s.\n", mk->cache_name, strerror(errno));
+		unlink(tname);
+	} else if(mk->verbose) {
+		fprintf(mk->debug_fp, "Saved buildfile cache %s (%u files, %u dependencies)\n",
+				mk->cache_name, nfiles, count);
+	}
+	free(b.data);
+}
+
+
+static int
+read_cache(struct mc_buf *bp) {
+	SHA2_CTX		ctx;
+	uint8_t			digest[SHA256_DIGEST_LENGTH];
+	struct stat		sbuf;
+	int				fd;
+
+	if((fd = open(mk->cache_name, O_RDONLY | O_BINARY)) == -1) return 0;
+	if(fstat(fd, &sbuf) == -1 || sbuf.st_size < (off_t)(sizeof(MODEL_CACHE_MAGIC) + sizeof(digest))) {
+		close(fd);
+		return 0;
+	}
+	bp->len = sbuf.st_size;
+	if((bp->data = malloc(bp->len)) == NULL) {
+		error_exit("No memory for buildfile cache.\n");
+	}
+	if(read(fd, bp->data, bp->len) != (ssize_t)bp->len) {
+		close(fd);
+		return 0;
+	}
+	close(fd);
+
+	bp->len -= sizeof(digest);
+	SHA256Init(&ctx);
+	SHA256Update(&ctx, bp->data, bp->len);
+	SHA256Final(digest, &ctx);
+	if(memcmp(digest, bp->data + bp->len, sizeof(digest)) != 0) return 0;
+	if(memcmp(bp->data, MODEL_CACHE_MAGIC, sizeof(MODEL_CACHE_MAGIC)) != 0) return 0;
+	bp->pos = sizeof(MODEL_CACHE_MAGIC);
+	if(get_u32(bp) != MODEL_CACHE_VERSION) return 0;
+	return memcmp(get(bp, sizeof(mk->fingerprint)), mk->fingerprint, sizeof(mk->fingerprint)) == 0;
+}
+
+
+static const char *
+check_deps(struct mc_buf *bp) {
+	uint32_t		n;
+	const char		*path;
+	uint32_t		present;
+	struct stat		old, new;
+
+	for(n = get_u32(bp); n != 0; --n) {
+		path = get_blob(bp, NULL);
+		present = get_u32(bp);
+		memcpy(&old, get(bp, sizeof(old)), sizeof(old));
+		if(stat(path, &new) == 0) {
+			if(!present || !same_stat(&old, &new)) return path;
+		} else if(present) {
+			return path;
+		}
+	}
+	return NULL;
+}
+
+
+//
+// Load the model if the cache is valid. Returns non-zero on success.
+//
+int
+model_cache_load(void) {
+	struct mc_buf			 b = { NULL };
+	struct attr_file_entry	**attrs;
+	struct file_entry		*fip, **owner;
+	struct linker_entry		*lp, **lowner;
+	struct bootargs_entry	*bap;
+	const void				*data;
+	const char				*why;
+	const char				*spec;
+	char					*str;
+	char					*tname;
+	uint32_t				 n, i, len, idx, nattrs;
+	size_t					 deps, end;
+	FILE					*fp;
+
+	if(mk->cache_name == NULL) return 0;
+	if(!read_cache(&b)) {
+		if(mk->verbose) fprintf(mk->debug_fp, "Buildfile cache %s not usable\n", mk->cache_name);
+		free(b.data);
+		return 0;
+	}
+	deps = b.pos;
+	if((why = check_deps(&b)) != NULL) {
+		if(mk->verbose) fprintf(mk->debug_fp, "Buildfile cache %s out of date (%s)\n", mk->cache_name, why);
+		free(b.data);
+		return 0;
+	}
+
+	// The cached parse looked at the same paths this one would have.
+	end = b.pos;
+	b.pos = deps;
+	for(n = get_u32(&b); n != 0; --n) {
+		model_cache_dep(get_blob(&b, NULL));
+		get_u32(&b);
+		get(&b, sizeof(struct stat));
+	}
+	b.pos = end;
+
+	mk->block_size = get_u32(&b);
+	mk->chain_paddr = get_u32(&b);
+	mk->compressed = get_u32(&b);
+	mk->split_image = get_u32(&b);
+	mk->cluster_size = get_u32(&b);
+	mk->num_blocks = get_u32(&b);
+	mk->spare_blocks = get_u32(&b);
+	mk->target_endian = get_u32(&b);
+	memcpy(&mk->image, get(&b, sizeof(mk->image)), sizeof(mk->image));
+	memcpy(&mk->ram, get(&b, sizeof(mk->ram)), sizeof(mk->ram));
+	memcpy(&mk->default_image, get(&b, sizeof(mk->default_image)), sizeof(mk->default_image));
+	memcpy(&mk->default_ram, get(&b, sizeof(mk->default_ram)), sizeof(mk->default_ram));
+	mk->mountpoint = get_str(&b);
+	if((str = get_str(&b)) != NULL && chdir(str) == -1) {
+		error_exit("Unable to change directory to %s: %s.\n", str, strerror(errno));
+	}
+	if((str = get_str(&b)) != NULL) setenv("PROCESSOR", str, 1);
+	if((str = get_str(&b)) != NULL) setenv("CPU_BASE", str, 1);
+
+	memcpy(&mk->booter, get(&b, sizeof(mk->booter)), sizeof(mk->booter));
+	mk->booter.name = get_str(&b);
+	mk->booter.filter_spec = get_str(&b);
+	mk->booter.filter_args = get_str(&b);
+	mk->booter.data = NULL;
+	if((data = get_blob(&b, &len)) != NULL) {
+		mk->booter.data = model_alloc(len);
+		memcpy(mk->booter.data, data, len);
+	}
+	mk->booter.linker = NULL;
+	lowner = &mk->booter.linker;
+	for(n = get_u32(&b); n != 0; --n) {
+		data = get(&b, sizeof(lp->class));
+		spec = get_blob(&b, &len);
+		lp = model_alloc(offsetof(struct linker_entry, spec) + len);
+		memcpy(lp->class, data, sizeof(lp->class));
+		memcpy(lp->spec, spec, len);
+		*lowner = lp;
+		lowner = &lp->next;
+	}
+
+	nattrs = get_u32(&b);
+	attrs = model_alloc((nattrs + 1) * sizeof(*attrs));
+	for(i = 0; i < nattrs; ++i) {
+		attrs[i] = model_alloc(sizeof(*attrs[i]));
+		memcpy(attrs[i], get(&b, sizeof(*attrs[i])), sizeof(*attrs[i]));
+		attrs[i]->cd = get_str(&b);
+		attrs[i]->search_path = get_str(&b);
+		attrs[i]->prefix = get_str(&b);
+		attrs[i]->filter = get_str(&b);
+		attrs[i]->keepsection = get_names(&b);
+		attrs[i]->module_list = get_names(&b);
+	}
+
+	mk->file_list = NULL;
+	owner = &mk->file_list;
+	for(n = get_u32(&b); n != 0; --n) {
+		fip = model_alloc(sizeof(*fip));
+		memcpy(fip, get(&b, sizeof(*fip)), sizeof(*fip));
+		fip->next = NULL;
+		fip->sect = NULL;
+		fip->targpath = get_str(&b);
+		fip->hostpath = get_str(&b);
+		fip->filter_input = get_str(&b);
+		if((idx = get_u32(&b)) >= nattrs) {
+			error_exit("Buildfile cache %s is corrupt.\n", mk->cache_name);
+		}
+		fip->attr = attrs[idx];
+		fip->bootargs = NULL;
+		if((data = get_blob(&b, &len)) != NULL) {
+			fip->bootargs = bap = model_alloc(sizeof(*bap) + len);
+			memcpy(bap, data, len);
+		}
+		fip->linker = get_str(&b);
+		if((data = get_blob(&b, &len)) != NULL) {
+			tname = mk_tmpfile();
+			fp = fopen(tname, "wb");
+			if(fp == NULL || fwrite(data, 1, len, fp) != len || fclose(fp) != 0) {
+				error_exit("Unable to write %s: %s.\n", tname, strerror(errno));
+			}
+			fip->hostpath = model_intern(tname);
+		}
+		*owner = fip;
+		owner = &fip->next;
+	}
+	free(b.data);
+
+	if(mk->verbose) {
+		fprintf(mk->debug_fp, "Loaded buildfile cache %s\n", mk->cache_name);
+	}
+	return 1;
+}
+
+
+void
+model_cache_close(void) {
+	strtab_release(&mk->dep_names);
+	arena_release(&mk->dep_arena);
+	free(mk->cache_name);
+	mk->cache_name = NULL;
+	mk->dep_list = NULL;
+}
+
+__SRCVERSION("model_cache.c $Rev$");
@@ -30,19 +30,6 @@
 #include "struct.h"
 
 
-int					block_size;
-int					chain_paddr;
-int					compressed;
-int 				split_image;
-struct addr_space	image;
-struct addr_space	ram;
-char				*mountpoint;
-
-int					cluster_size;
-int					num_blocks;
-int					spare_blocks=1;
-static int			align_group_id;
-
 enum common_attrs {
 	ATTR_BIGENDIAN,
 	ATTR_CD,
@@ -201,10 +188,10 @@ parse_common_attr(char *token, struct attr_file_entry *attrp) {
 
 	switch(decode_attr(0, common_attr_table, token, &ival, &sval)) {
 	case ATTR_BIGENDIAN:
-		target_endian = ival;
+		mk->target_endian = ival;
 		break;
 	case ATTR_CD:
-		if(chdir(attrp->cd = strdup(sval)) == -1)
+		if(chdir(attrp->cd = model_intern(sval)) == -1)
 			error_exit("Unable to cd to %s : %s\n", sval, strerror(errno));
 		break;
 	case ATTR_FILTER:
@@ -212,7 +199,7 @@ parse_common_attr(char *token, struct attr_file_entry *attrp) {
 			attrp->filter = NULL;
 			break;
 		}
-		attrp->filter = strdup(sval);
+		attrp->filter = model_intern(sval);
 		break;
 	case ATTR_GID:
 		if(strcmp(sval, "*") == 0) {
@@ -223,7 +210,7 @@ parse_common_attr(char *token, struct attr_file_entry *attrp) {
 		}
 		break;
 	case ATTR_MOUNT:
-		mountpoint = strdup(sval);
+		mk->mountpoint = strdup(sval);
 		break;
 	case ATTR_OPTIONAL:
 		attrp->optional = ival;
@@ -240,10 +227,10 @@ parse_common_attr(char *token, struct attr_file_entry *attrp) {
 		}
 		break;
 	case ATTR_PREFIX:
-		attrp->prefix = strdup(sval);
+		attrp->prefix = model_intern(sval);
 		break;
 	case ATTR_SEARCH:
-		attrp->search_path = strdup(sval);
+		attrp->search_path = model_intern(sval);
 		break;
 	case ATTR_TYPE:
 		/* Always reset newdir so that any other 
@@ -407,13 +394,11 @@ add_linker_spec(char *sval) {
 		tmp_linker.class[CLASS_EHDR].num = 1;
 		tmp_linker.class[CLASS_EHDR].list[0] = ET_REL;
 	}
-	new = malloc(sizeof(*new) + strlen(sval));
-	if(new == NULL) {
-		error_exit("No memory for linker spec.\n");
-	}
+	// Part of the build model, like the entries a cached parse loads.
+	new = model_alloc(sizeof(*new) + strlen(sval));
 	*new = tmp_linker;
-	new->next = booter.linker;
-	booter.linker = new;
+	new->next = mk->booter.linker;
+	mk->booter.linker = new;
 	strcpy(new->spec, sval);
 }
 
@@ -473,7 +458,7 @@ ifs_parse_attr(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 				attrp->autolink = ival;
 				break;
 			case ATTR_CHAIN:
-				chain_paddr = ival;
+				mk->chain_paddr = ival;
 				break;
 			case ATTR_CODE:
 				switch(*sval) {
@@ -504,7 +489,7 @@ ifs_parse_attr(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 				}
 				break;
 			case ATTR_IMAGE:
-				parse_addr_space_spec(&image, sval);
+				parse_addr_space_spec(&mk->image, sval);
 				break;
 			case ATTR_KEEPLINKED:
 				attrp->keep_linked = ival;
@@ -517,9 +502,9 @@ ifs_parse_attr(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 				proc_booter_data(sval, 0);
 				break;
 			case ATTR_RAM:
-				split_image = 1;
+				mk->split_image = 1;
 				attrp->uip_flags &= ~PF_W;
-				parse_addr_space_spec(&ram, sval);
+				parse_addr_space_spec(&mk->ram, sval);
 				break;
 			case ATTR_RAW:
 				attrp->raw = ival;
@@ -543,7 +528,7 @@ ifs_parse_attr(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 				if(ival) ival = 3; //Use UCL compression as the default
 				//fall through
 			case ATTR_COMPRESS2:
-				compressed = ival;
+				mk->compressed = ival;
 				break;
 			case ATTR_PAGE_ALIGN:
 				attrp->page_align = ival;
@@ -564,7 +549,7 @@ ifs_parse_attr(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 			case ATTR_PHYS_ALIGN:
 				attrp->phys_align = ival;
 				if ( attrp->phys_align && strstr( sval, ",group" ) ) {
-					attrp->phys_align_group = ++align_group_id;
+					attrp->phys_align_group = ++mk->align_group_id;
 				} else {
 					attrp->phys_align_group = 0;
 				}
@@ -630,16 +615,16 @@ ffs_parse_attr(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 		if(!parse_common_attr(tokenv[i], attrp) ) {
 			switch(decode_attr(1, ffs_attr_table, tokenv[i], &ival, &sval)) {
 			case ATTR_BLOCK_SIZE:
-				block_size = getsize(sval, &sval);
+				mk->block_size = getsize(sval, &sval);
 				break;
 			case ATTR_SPARE_BLOCKS:
-				spare_blocks = ival;
+				mk->spare_blocks = ival;
 				break;
 			case ATTR_MAX_SIZE:
-				image.maxsize = getsize(sval, &sval);
+				mk->image.maxsize = getsize(sval, &sval);
 				break;
 			case ATTR_MIN_SIZE:
-				image.minsize = getsize(sval, &sval);
+				mk->image.minsize = getsize(sval, &sval);
 				break;
 			}
 		}
@@ -679,13 +664,13 @@ etfs_parse_attr(int tokenc, char *tokenv[], struct attr_file_entry *attrp) {
 		if(!parse_common_attr(tokenv[i], attrp) ) {
 			switch(decode_attr(1, etfs_attr_table, tokenv[i], &ival, &sval)) {
 			case ATTR_ETFS_NUM_BLOCKS:
-				num_blocks = getsize(sval, &sval);
+				mk->num_blocks = getsize(sval, &sval);
 				break;
 			case ATTR_ETFS_BLOCK_SIZE:
-				block_size = getsize(sval, &sval);
+				mk->block_size = getsize(sval, &sval);
 				break;
 			case ATTR_ETFS_CLUSTER_SIZE:
-				cluster_size = getsize(sval, &sval);
+				mk->cluster_size = getsize(sval, &sval);
 				break;
 			}
 		}
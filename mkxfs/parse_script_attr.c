@@ -108,7 +108,7 @@ void parse_script_attr(int tokenc, char *tokenv[], struct attr_script_entry *att
 			}
 			break;
 		case ATTR_EXTSCHED_APS:
-			ext_sched = SCRIPT_SCHED_EXT_APS;
+			mk->ext_sched = SCRIPT_SCHED_EXT_APS;
 			if((ival = aps_lookup(sval)) != -1) {
 				attrp->flags |= SCRIPT_FLAGS_EXTSCHED;
 				attrp->extsched.aps.id = ival;
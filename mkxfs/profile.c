@@ -0,0 +1,350 @@
+/*
+ * $QNXLicenseC:
+ * Copyright 2007, QNX Software Systems. All Rights Reserved.
+ *
+ * You must obtain a written license from and pay applicable license fees to QNX
+ * Software Systems before you may reproduce, modify or distribute this software,
+ * or any work that includes all or part of this software.   Free development
+ * licenses are available for evaluation and non-commercial purposes.  For more
+ * information visit http://licensing.qnx.com or email licensing@qnx.com.
+ *
+ * This file may contain contributions from others.  Please review this entire
+ * file for other proprietary rights or license notices, as well as the QNX
+ * Development Suite License Guide at http://licensing.qnx.com/license-guide/
+ * for other information.
+ * $
+ */
+
+
+
+//
+// Build phase profiler (the --profile option).
+//
+// Each phase accumulates wall and CPU time plus the bytes going in and
+// out of it. Phases nest (filters run while the buildfile is parsed,
+// compression happens while the image is written) and every phase
+// reports its inclusive time. CPU time includes child processes, so
+// filter programs are charged to the phase that ran them. Files copied
+// into the image and compression blocks are recorded individually. The
+// report is written as JSON when the build finishes.
+//
+// The same hooks feed the --trace output: whole-build phases, files
+// copied into the image and filter runs become trace spans.
+//
+
+#include <lib/compat.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "struct.h"
+#include "libifs/ifs_trace.h"
+
+#define PROF_REPORT_VERSION	1
+
+struct prof_phase {
+	const char			*name;
+	int					trace;		// emit a trace span per call
+	unsigned			calls;
+	unsigned			depth;
+	double				start_wall;
+	double				start_cpu;
+	double				start_trace;
+	double				wall;
+	double				cpu;
+	unsigned long long	bytes_in;
+	unsigned long long	bytes_out;
+};
+
+struct prof_file {
+	char				*hostpath;
+	char				*targpath;
+	unsigned			size;
+	double				wall;
+	double				write;
+	unsigned long long	bytes_out;
+	double				start_trace;
+};
+
+struct prof_block {
+	unsigned			in;
+	unsigned			out;
+};
+
+char					*profile_name;
+int						 prof_active;
+
+static struct prof_phase	phases[PROF_NUM_PHASES] = {
+	{ "parse_file",		1 },
+	{ "collect_dir",	1 },
+	{ "filter",			0 },
+	{ "classify_file",	0 },
+	{ "locate_files",	1 },
+	{ "write",			1 },
+	{ "compress",		0 },
+	{ "booter_filter",	1 },
+};
+
+static double				start_wall;
+static double				start_cpu;
+
+static struct prof_file		*files;
+static unsigned				 num_files;
+static unsigned				 max_files;
+static struct prof_file		*cur_file;
+static double				 cur_file_start;
+
+static struct prof_block	*blocks;
+static unsigned				 num_blocks_prof;
+static unsigned				 max_blocks;
+
+
+double
+prof_now(void) {
+	struct timespec		ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static double
+prof_cpu(void) {
+	struct timespec		ts;
+	struct rusage		ru;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	getrusage(RUSAGE_CHILDREN, &ru);
+	return ts.tv_sec + ts.tv_nsec / 1e9
+		+ ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+		+ ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+
+static void *
+prof_grow(void *p, unsigned *max, size_t size) {
+	*max = *max ? *max * 2 : 256;
+	p = realloc(p, *max * size);
+	if(p == NULL) {
+		error_exit("No memory for profile information.\n");
+	}
+	return p;
+}
+
+
+//
+// Turn on the hooks. Called once the --profile and --trace options
+// have been seen.
+//
+void
+prof_init(void) {
+	prof_active = 1;
+	start_wall = prof_now();
+	start_cpu = prof_cpu();
+}
+
+
+void
+prof_start(int phase) {
+	struct prof_phase	*pp = &phases[phase];
+
+	if(!prof_active) return;
+	pp->calls++;
+	if(pp->depth++ == 0) {
+		pp->start_wall = prof_now();
+		pp->start_cpu = prof_cpu();
+		if(pp->trace) pp->start_trace = ifs_trace_now();
+	}
+}
+
+
+void
+prof_stop(int phase, unsigned long long bytes_in, unsigned long long bytes_out) {
+	struct prof_phase	*pp = &phases[phase];
+
+	if(!prof_active) return;
+	if(--pp->depth == 0) {
+		pp->wall += prof_now() - pp->start_wall;
+		pp->cpu += prof_cpu() - pp->start_cpu;
+		if(pp->trace) {
+			ifs_trace_span("phase", pp->name, pp->start_trace, NULL, bytes_in, bytes_out);
+		}
+	}
+	pp->bytes_in += bytes_in;
+	pp->bytes_out += bytes_out;
+}
+
+
+//
+// Size of a host file for byte counts, 0 if it can't be found.
+//
+unsigned long long
+prof_size(const char *path) {
+	struct stat		sbuf;
+
+	if(!prof_active || stat(path, &sbuf) != 0) return 0;
+	return sbuf.st_size;
+}
+
+
+void
+prof_file_start(struct file_entry *fip) {
+	if(!prof_active) return;
+	if(num_files >= max_files) {
+		files = prof_grow(files, &max_files, sizeof(*files));
+	}
+	cur_file = &files[num_files++];
+	memset(cur_file, 0, sizeof(*cur_file));
+	cur_file->hostpath = fip->hostpath;
+	cur_file->targpath = fip->targpath;
+	cur_file_start = prof_now();
+	cur_file->start_trace = ifs_trace_now();
+}
+
+
+void
+prof_file_stop(struct file_entry *fip) {
+	if(!prof_active || cur_file == NULL) return;
+	cur_file->size = fip->size;
+	cur_file->wall = prof_now() - cur_file_start;
+	phases[PROF_WRITE].bytes_in += fip->size;
+	ifs_trace_span("file", fip->targpath, cur_file->start_trace, fip->hostpath,
+					fip->size, cur_file->bytes_out);
+	cur_file = NULL;
+}
+
+
+//
+// Account for 'nbytes' of image written in 'secs' seconds. Only bytes
+// that reach the output count towards the write phase; bytes handed
+// to the compressor are counted by the compress phase.
+//
+void
+prof_written(double secs, unsigned nbytes, int to_output) {
+	if(to_output) {
+		phases[PROF_WRITE].bytes_out += nbytes;
+	}
+	if(cur_file != NULL) {
+		cur_file->write += secs;
+		cur_file->bytes_out += nbytes;
+	}
+}
+
+
+//
+// Record a compression block that was started at 'start' (from
+// ifs_trace_now()).
+//
+void
+prof_block(double start, unsigned in, unsigned out) {
+	if(!prof_active) return;
+	ifs_trace_span("compress", "block", start, NULL, in, out);
+	if(num_blocks_prof >= max_blocks) {
+		blocks = prof_grow(blocks, &max_blocks, sizeof(*blocks));
+	}
+	blocks[num_blocks_prof].in = in;
+	blocks[num_blocks_prof].out = out;
+	num_blocks_prof++;
+}
+
+
+static void
+json_string(FILE *fp, const char *str) {
+	putc('"', fp);
+	for( ; *str != '\0'; ++str) {
+		unsigned char	c = *str;
+
+		if(c == '"' || c == '\\') {
+			fprintf(fp, "\\%c", c);
+		} else if(c < 0x20) {
+			fprintf(fp, "\\u%04x", c);
+		} else {
+			putc(c, fp);
+		}
+	}
+	putc('"', fp);
+}
+
+
+static double
+ratio(unsigned long long in, unsigned long long out) {
+	return in ? (double)out / in : 0.0;
+}
+
+
+void
+prof_report(char *buildfile, char *output) {
+	static const char	*methods[] = { "none", "zlib", "lzo", "ucl" };
+	FILE				*fp;
+	unsigned			i;
+
+	if(profile_name == NULL) return;
+
+	if(strcmp(profile_name, "-") == 0) {
+		fp = stderr;
+	} else if((fp = fopen(profile_name, "w")) == NULL) {
+		error_exit("Unable to open '%s': %s.\n", profile_name, strerror(errno));
+	}
+
+	fprintf(fp, "{\n\t\"version\": %d,\n", PROF_REPORT_VERSION);
+	fprintf(fp, "\t\"buildfile\": ");
+	json_string(fp, buildfile != NULL ? buildfile : "-");
+	fprintf(fp, ",\n\t\"output\": ");
+	json_string(fp, output != NULL ? output : "-");
+	fprintf(fp, ",\n\t\"wall\": %.6f,\n\t\"cpu\": %.6f,\n",
+			prof_now() - start_wall, prof_cpu() - start_cpu);
+
+	fprintf(fp, "\t\"phases\": [\n");
+	for(i = 0; i < PROF_NUM_PHASES; ++i) {
+		struct prof_phase	*pp = &phases[i];
+
+		fprintf(fp, "\t\t{ \"name\": \"%s\", \"calls\": %u, \"wall\": %.6f, \"cpu\": %.6f, "
+					"\"bytes_in\": %llu, \"bytes_out\": %llu }%s\n",
+				pp->name, pp->calls, pp->wall, pp->cpu,
+				pp->bytes_in, pp->bytes_out, (i + 1 < PROF_NUM_PHASES) ? "," : "");
+	}
+	fprintf(fp, "\t],\n");
+
+	fprintf(fp, "\t\"files\": [\n");
+	for(i = 0; i < num_files; ++i) {
+		struct prof_file	*pf = &files[i];
+
+		fprintf(fp, "\t\t{ \"host\": ");
+		json_string(fp, pf->hostpath);
+		fprintf(fp, ", \"target\": ");
+		json_string(fp, pf->targpath);
+		fprintf(fp, ", \"size\": %u, \"bytes_out\": %llu, \"wall\": %.6f, \"read\": %.6f, \"write\": %.6f }%s\n",
+				pf->size, pf->bytes_out, pf->wall,
+				pf->wall > pf->write ? pf->wall - pf->write : 0.0, pf->write,
+				(i + 1 < num_files) ? "," : "");
+	}
+	fprintf(fp, "\t],\n");
+
+	fprintf(fp, "\t\"compression\": {\n\t\t\"method\": \"%s\",\n",
+			(mk->compressed >= 0 && mk->compressed <= 3) ? methods[mk->compressed] : "unknown");
+	fprintf(fp, "\t\t\"ratio\": %.6f,\n",
+			ratio(phases[PROF_COMPRESS].bytes_in, phases[PROF_COMPRESS].bytes_out));
+	fprintf(fp, "\t\t\"blocks\": [");
+	for(i = 0; i < num_blocks_prof; ++i) {
+		fprintf(fp, "%s\n\t\t\t{ \"in\": %u, \"out\": %u, \"ratio\": %.6f }",
+				i ? "," : "", blocks[i].in, blocks[i].out, ratio(blocks[i].in, blocks[i].out));
+	}
+	fprintf(fp, "%s]\n\t}\n}\n", num_blocks_prof ? "\n\t\t" : "");
+
+	if(fp != stderr && fclose(fp) != 0) {
+		error_exit("Error writing '%s': %s.\n", profile_name, strerror(errno));
+	}
+
+	free(files);
+	free(blocks);
+	files = NULL;
+	blocks = NULL;
+	num_files = max_files = 0;
+	num_blocks_prof = max_blocks = 0;
+}
+
+__SRCVERSION("profile.c $Rev$");
@@ -34,6 +34,9 @@
 #include _NTO_HDR_(sys/image.h)
 
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <setjmp.h>
+#include "libifs/ifs_cksum.h"
 
 #if defined(__QNX__)     ||	\
 	defined(__SOLARIS__) ||	\
@@ -67,9 +70,23 @@ struct tree_entry {
 	struct tree_entry		*child;
 	struct file_entry		*fip;		// Will be NULL if there is no info
 	unsigned				 flags;		// For the exclusive use of the filesystem module
+	struct tree_entry		*hash_next;	// For the exclusive use of make_tree()
+	struct tree_entry		*last_child;// For the exclusive use of make_tree()
 	char					 name[1];	// Variable length field
 } ;
 
+struct arena {
+	struct arena_block		*head;
+	size_t					 total;
+};
+
+struct strtab {
+	struct arena			*arena;
+	struct strtab_entry		**bucket;
+	unsigned				 mask;
+	unsigned				 count;
+};
+
 #define STACK_GROW  10
 struct inode_stack {
 	int					count;
@@ -119,6 +136,7 @@ struct file_entry {
 	char					*linker;
 	struct keep_section		*sect;
 	uint32_t				host_file_crc;
+	char					*filter_input;	// host file the filter was run on
 };
 
 struct tmpfile_entry {
@@ -245,6 +263,125 @@ struct token_state {
 	char				buf[TOKENLEN];
 };
 
+struct input_buffer {
+	char			*data;
+	unsigned		len;
+};
+
+struct aps_partition {
+	char			name[SCRIPT_APS_PARTITION_NAME_LENGTH + 1];
+	int				budget;
+};
+
+#define GLOBENVC		100
+
+// A host path the parse looked at (model_cache_dep()).
+struct mc_dep {
+	struct mc_dep	*next;
+	char			*path;
+	int				present;
+	struct stat		sbuf;
+};
+
+//
+// Everything one image build works on: the options it was started
+// with, the buildfile parse state, the file list and the layout and
+// output state of the image being written. The build routines find it
+// through 'mk', which the library entry points in build.c point at the
+// build they were called for. Process-wide facilities (the filter
+// cache, --profile and --trace) are shared by all builds.
+//
+struct mkxfs_build {
+	// Options and the file system type.
+	int							 verbose;
+	FILE						*debug_fp;
+	int							 no_time;
+	int							 new_style_bootstrap;
+	char						*symfile_suffix;
+	char						*option_lines;
+	void						(*parse_file_init)(struct attr_file_entry *attrp);
+	void						(*parse_file_attr)(int tokenc, char *tokenv[], struct attr_file_entry *attrp);
+	int							(*need_seekable)(struct file_entry *list);
+	unsigned					(*make_fsys)(FILE *dst_fp, struct file_entry *list, char *mountpoint, char *destname);
+
+	// Buildfile parsing.
+	struct token_state			*token;
+	char						*globenvv[GLOBENVC];
+	int							 globenvc;
+	char						*boot_attr_buf;
+	struct input_buffer			 input_file;
+	struct input_buffer			 input_script;
+	struct input_buffer			 input_boot;
+	unsigned					 line_num;
+	FILE						*script_fp;
+	struct attr_file_entry		 file_attr;
+	struct attr_file_list		*attr_file_list;
+	struct attr_script_entry	 script_attr;
+	struct attr_script_list		*attr_script_list;
+	struct inode_stack			 inode_list;
+	int							 have_startup;
+	int							 ext_sched;
+	struct aps_partition		 globapsv[SCRIPT_APS_MAX_PARTITIONS];
+	int							 globapsc;
+	int							 align_group_id;
+
+	// The files going into the image.
+	struct file_entry			*file_list;
+	struct file_entry			*file_list_end;
+	struct tmpfile_entry		*tmpfile_list;
+	struct tree_entry			**tree_hash;
+	unsigned					 tree_hash_mask;
+	unsigned					 tree_hash_count;
+
+	// File system attributes and layout.
+	int							 target_endian;
+	int							 block_size;
+	int							 chain_paddr;
+	int							 compressed;
+	int							 split_image;
+	struct addr_space			 image;
+	struct addr_space			 ram;
+	char						*mountpoint;
+	int							 cluster_size;
+	int							 num_blocks;
+	int							 spare_blocks;
+	struct attr_booter_entry	 booter;
+	struct addr_space			 default_image;
+	struct addr_space			 default_ram;
+
+	// Image output.
+	struct soname_entry			*soname_head;
+	struct name_list			*section_list;
+	char						 copybuf[4096];
+	struct ifs_cksum			 image_cksum;
+	unsigned					 image_offset;		// uncompressed image offset
+	unsigned					 cimage_offset;		// compressed image offset
+	unsigned					 ram_offset;
+	void						*compress_fp;
+	char						*compress_name;		// compressed data spilled to disk
+	char						*compress_mem;		// compressed data held in memory
+	size_t						 compress_mem_len;
+	size_t						 compress_len;
+	char						*lastcd;
+
+	// Build model memory and the buildfile cache.
+	struct arena				 model_arena;
+	struct strtab				 model_strings;
+	char						*cache_name;
+	uint8_t						 fingerprint[32];	// SHA-256
+	struct arena				 dep_arena;
+	struct strtab				 dep_names;
+	struct mc_dep				*dep_list;
+	int							 track_deps;		// record dependencies even without a cache
+	int							 written;			// mkxfs_write() has been called
+
+	// Error return to the library entry point.
+	jmp_buf						 error_jmp;
+	int							 error_catch;
+	mode_t						 caller_umask;		// files the user keeps are made with this
+	char						 error[1024];
+};
+
 //
 // Proto's
 //
@@ -269,6 +406,8 @@ int aps_lookup(char *aps);
 
 void parse_addr_space_spec(struct addr_space *, char *);
 void parse_file(FILE *src_fp);
+void parse_one_file(char *s);
+void set_target_name(struct file_entry *fip);
 void parse_file_name(int tokenc, char *tokenv[], struct attr_file_entry *attrp);
 struct file_entry *add_file(struct file_entry **list, char *host, char *target, struct attr_file_entry *attrp, struct stat *);
 void collect_dir(char *host, char *target, struct attr_file_entry *attrp, int callindex);
@@ -316,6 +455,51 @@ void print_tree(struct tree_entry *trp, int level);
 int crc32_fn(char* filename, uint32_t *crc32val);
 int crc32_fd(int fd, uint32_t *crc32val);
 
+void *arena_alloc(struct arena *ap, size_t size);
+char *arena_strdup(struct arena *ap, const char *str);
+void arena_release(struct arena *ap);
+char *strtab_intern(struct strtab *tp, const char *str);
+char *strtab_lookup(struct strtab *tp, const char *str);
+char *strtab_intern_len(struct strtab *tp, const char *str, size_t len);
+void strtab_release(struct strtab *tp);
+void *model_alloc(size_t size);
+char *model_intern(const char *str);
+void model_release(void);
+
+void model_cache_open(char *buildfile, int argc, char *argv[], int first_arg);
+void model_cache_dep(const char *path);
+int  model_cache_load(void);
+void model_cache_save(void);
+void model_cache_close(void);
+
+char *filter_cache_file(char *host, char *filter);
+int filter_program(const char *filter, char *path, size_t size);
+void filter_cache_set_limit(char *str);
+void filter_cache_trim(void);
+void filter_cache_report(FILE *fp);
+
+enum {
+	PROF_PARSE,
+	PROF_COLLECT_DIR,
+	PROF_FILTER,
+	PROF_CLASSIFY,
+	PROF_LOCATE,
+	PROF_WRITE,
+	PROF_COMPRESS,
+	PROF_BOOTER_FILTER,
+	PROF_NUM_PHASES
+};
+void prof_init(void);
+double prof_now(void);
+void prof_start(int phase);
+void prof_stop(int phase, unsigned long long bytes_in, unsigned long long bytes_out);
+unsigned long long prof_size(const char *path);
+void prof_file_start(struct file_entry *fip);
+void prof_file_stop(struct file_entry *fip);
+void prof_written(double secs, unsigned nbytes, int to_output);
+void prof_block(double start, unsigned in, unsigned out);
+void prof_report(char *buildfile, char *output);
+
 #if defined (__WIN32__) || defined(__NT__)
 void fixenviron(char *line, int size);
 #endif
@@ -323,29 +507,11 @@ void fixenviron(char *line, int size);
 //
 // Some global vars shared between files.
 //
-extern int	 target_endian;
+extern struct mkxfs_build *mk;
 extern int	 host_endian;
-extern struct addr_space image;
-extern struct addr_space ram;
-extern struct addr_space default_image;
-extern struct addr_space default_ram;
-extern int   block_size;
-extern int   cluster_size;
-extern int   num_blocks;
-extern int   spare_blocks;
-extern int	 chain_paddr;
-extern int	 compressed;
-extern int	 verbose;
-extern int	 split_image;
-extern FILE	*debug_fp;
-extern struct attr_booter_entry booter;
-extern struct token_state *token;
-extern char	*boot_attr_buf;
-extern char *mountpoint;
-extern int ext_sched;
-extern int no_time; /* no timestamps - declared in mkxfs.c */
-extern int new_style_bootstrap;
-extern char *symfile_suffix;
+extern char *cache_dir;
+extern char *profile_name;
+extern int prof_active;
 
 #define RUP(n, pagesize)	(((n) + ((pagesize)-1)) & ~((pagesize)-1))
 #define RDN(n, pagesize)	((n) & ~((pagesize)-1))